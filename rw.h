@@ -23,4 +23,6 @@
 #include "src/gl/rwgl3.h"
 #include "src/gl/rwgl3shader.h"
 #include "src/gl/rwgl3plg.h"
-#include "src/3ds/rw3ds.h"
\ No newline at end of file
+#include "src/3ds/rw3ds.h"
+#include "src/soft/rwsoft.h"
+#include "src/soft/rwsoftplg.h"
\ No newline at end of file
@@ -51,6 +51,7 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 {
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
+	assert(!meshh->index32);	// only 16 bit indices here
 	geo->instData = header;
 	header->platform = PLATFORM_3DS;
 
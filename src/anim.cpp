@@ -101,6 +101,41 @@ Animation::getNumNodes(void)
 	return n;
 }
 
+// Make the animation relative to the first key frame of each node
+// so it can be used as an additive layer.
+bool32
+Animation::makeDelta(void)
+{
+	int32 i, sz, numNodes;
+	int32 *nodes;
+	uint8 *start;
+	AnimInterpolatorInfo *interpInfo = this->interpInfo;
+
+	if(interpInfo->mulRecipCB == nil){
+		RWERROR((ERR_GENERAL, "interpolator can't make delta animations"));
+		return 0;
+	}
+	sz = interpInfo->animKeyFrameSize;
+	numNodes = this->getNumNodes();
+	nodes = rwNewT(int32, this->numFrames, MEMDUR_FUNCTION | ID_ANIMANIMATION);
+	start = rwNewT(uint8, numNodes*sz, MEMDUR_FUNCTION | ID_ANIMANIMATION);
+	memcpy(start, this->keyframes, numNodes*sz);
+	for(i = 0; i < this->numFrames; i++){
+		KeyFrameHeader *f = this->getAnimFrame(i);
+		// the first frame of every node is in order,
+		// for the others we have to follow the prev chain
+		if(i < numNodes)
+			nodes[i] = i;
+		else
+			nodes[i] = nodes[((uint8*)f->prev - (uint8*)this->keyframes)/sz];
+		interpInfo->mulRecipCB(f, start + nodes[i]*sz, this->customData);
+	}
+	interpInfo->mulRecipCB(nil, nil, this->customData);
+	rwFree(start);
+	rwFree(nodes);
+	return 1;
+}
+
 Animation*
 Animation::streamRead(Stream *stream)
 {
@@ -206,6 +241,11 @@ AnimInterpolator::create(int32 numNodes, int32 maxFrameSize)
 	interp->currentInterpKeyFrameSize = maxFrameSize;
 	interp->currentAnimKeyFrameSize = -1;
 	interp->numNodes = numNodes;;
+	interp->applyCB = nil;
+	interp->blendCB = nil;
+	interp->interpCB = nil;
+	interp->addCB = nil;
+	interp->mulRecipCB = nil;
 
 	return interp;
 }
@@ -236,6 +276,7 @@ AnimInterpolator::setCurrentAnim(Animation *anim)
 	this->blendCB = interpInfo->blendCB;
 	this->interpCB = interpInfo->interpCB;
 	this->addCB = interpInfo->addCB;
+	this->mulRecipCB = interpInfo->mulRecipCB;
 	for(i = 0; i < numNodes; i++){
 		InterpFrameHeader *intf;
 		KeyFrameHeader *kf1, *kf2;
@@ -252,6 +293,13 @@ AnimInterpolator::setCurrentAnim(Animation *anim)
 	return 1;
 }
 
+void
+AnimInterpolator::setCurrentTime(float32 t)
+{
+	this->setCurrentAnim(this->currentAnim);
+	this->addTime(t);
+}
+
 void
 AnimInterpolator::addTime(float32 t)
 {
@@ -290,4 +338,72 @@ AnimInterpolator::addTime(float32 t)
 	}
 }
 
+// Prepare this interpolator to receive a combination of in1 and in2.
+// It doesn't need an animation of its own for this.
+bool32
+AnimInterpolator::setupCombine(AnimInterpolator *in1, AnimInterpolator *in2)
+{
+	if(in1->numNodes != this->numNodes || in2->numNodes != this->numNodes){
+		RWERROR((ERR_GENERAL, "number of nodes doesn't match"));
+		return 0;
+	}
+	if(in1->currentInterpKeyFrameSize != in2->currentInterpKeyFrameSize ||
+	   in1->applyCB != in2->applyCB){
+		RWERROR((ERR_GENERAL, "incompatible interpolators"));
+		return 0;
+	}
+	int32 maxkf = this->maxInterpKeyFrameSize;
+	if(sizeof(void*) > 4)	// see above in create()
+		maxkf += 16;
+	if(in1->currentInterpKeyFrameSize > maxkf){
+		RWERROR((ERR_GENERAL, "interpolation frame too big"));
+		return 0;
+	}
+	this->currentInterpKeyFrameSize = in1->currentInterpKeyFrameSize;
+	this->currentAnimKeyFrameSize = in1->currentAnimKeyFrameSize;
+	this->applyCB = in1->applyCB;
+	this->blendCB = in1->blendCB;
+	this->interpCB = in1->interpCB;
+	this->addCB = in1->addCB;
+	this->mulRecipCB = in1->mulRecipCB;
+	return 1;
+}
+
+// out = in1 + (in2 - in1)*alpha*mask[node]
+// out may be the same as in1 or in2
+bool32
+AnimInterpolator::blend(AnimInterpolator *in1, AnimInterpolator *in2,
+                        float32 alpha, const float32 *mask)
+{
+	int32 i;
+	if(!this->setupCombine(in1, in2))
+		return 0;
+	if(this->blendCB == nil){
+		RWERROR((ERR_GENERAL, "interpolator can't blend"));
+		return 0;
+	}
+	for(i = 0; i < this->numNodes; i++)
+		this->blendCB(this->getInterpFrame(i),
+		              in1->getInterpFrame(i), in2->getInterpFrame(i),
+		              mask ? alpha*mask[i] : alpha);
+	return 1;
+}
+
+// in2 is expected to come from a delta animation (Animation::makeDelta)
+bool32
+AnimInterpolator::addTogether(AnimInterpolator *in1, AnimInterpolator *in2)
+{
+	int32 i;
+	if(!this->setupCombine(in1, in2))
+		return 0;
+	if(this->addCB == nil){
+		RWERROR((ERR_GENERAL, "interpolator can't add"));
+		return 0;
+	}
+	for(i = 0; i < this->numNodes; i++)
+		this->addCB(this->getInterpFrame(i),
+		            in1->getInterpFrame(i), in2->getInterpFrame(i));
+	return 1;
+}
+
 }
@@ -35,6 +35,8 @@ int32 build = 0xFFFF;
 	int32 platform = PLATFORM_D3D9;
 #elif RW_3DS
 	int32 platform = PLATFORM_3DS;
+#elif RW_SOFT
+	int32 platform = PLATFORM_SOFT;
 #else
 	int32 platform = PLATFORM_NULL;
 #endif
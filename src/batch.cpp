@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_STATICBATCH
+
+/*
+ * Static batching merges atomics whose frames never move into few
+ * large geometries so they can be drawn with one world matrix and
+ * one mesh per material. Vertices are transformed into the space of
+ * the batch frame. The sources of every batched geometry are kept
+ * so picking can map a triangle back to the original atomic.
+ *
+ * Batching is meant to be done offline, the result is streamed
+ * like any other clump.
+ */
+
+namespace rw {
+
+StaticBatchGlobals staticBatchGlobals;
+
+enum {
+	FORMATFLAGS = Geometry::TEXTURED | Geometry::TEXTURED2 | Geometry::PRELIT |
+		Geometry::NORMALS | Geometry::LIGHT | Geometry::MODULATE
+};
+
+bool32
+StaticBatch::canBatch(Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	if(geo == nil || atomic->getFrame() == nil)
+		return 0;
+	if(geo->flags & Geometry::NATIVE || geo->numMorphTargets != 1 ||
+	   geo->numTriangles == 0)
+		return 0;
+	if(Geometry::getPluginOffset(ID_SKIN) >= 0 && Skin::get(geo))
+		return 0;
+	return 1;
+}
+
+bool32
+StaticBatch::isCompatible(Atomic *a1, Atomic *a2)
+{
+	Geometry *g1 = a1->geometry;
+	Geometry *g2 = a2->geometry;
+	if((g1->flags & FORMATFLAGS) != (g2->flags & FORMATFLAGS) ||
+	   g1->numTexCoordSets != g2->numTexCoordSets)
+		return 0;
+	if(a1->pipeline != a2->pipeline || a1->renderCB != a2->renderCB)
+		return 0;
+	if(Atomic::getPluginOffset(ID_MATFX) >= 0 &&
+	   MatFX::getEffects(a1) != MatFX::getEffects(a2))
+		return 0;
+	return 1;
+}
+
+static bool32
+isSameMaterial(Material *m1, Material *m2)
+{
+	if(m1 == m2)
+		return 1;
+	if(m1->texture != m2->texture || m1->pipeline != m2->pipeline ||
+	   memcmp(&m1->color, &m2->color, sizeof(RGBA)) != 0 ||
+	   m1->surfaceProps.ambient != m2->surfaceProps.ambient ||
+	   m1->surfaceProps.specular != m2->surfaceProps.specular ||
+	   m1->surfaceProps.diffuse != m2->surfaceProps.diffuse)
+		return 0;
+	// we can't compare plugin data in general,
+	// but effects are the one that matters
+	if(Material::getPluginOffset(ID_MATFX) >= 0 &&
+	   (MatFX::getEffects(m1) || MatFX::getEffects(m2)))
+		return 0;
+	return 1;
+}
+
+static int32
+findMaterial(MaterialList *matlist, Material *mat)
+{
+	int32 i;
+	for(i = 0; i < matlist->numMaterials; i++)
+		if(isSameMaterial(matlist->materials[i], mat))
+			return i;
+	return matlist->appendMaterial(mat);
+}
+
+Geometry*
+StaticBatch::merge(Atomic **atomics, int32 *ids, int32 numAtomics, Frame *frame)
+{
+	Geometry *geo, *src;
+	StaticBatch *sb;
+	BatchSource *bs;
+	Matrix inv, xform;
+	V3d *verts, *norms;
+	Triangle32 tri, stri;
+	int32 *matmap;
+	int32 numVertices, numTriangles, maxMaterials;
+	int32 i, j, v, t;
+	uint32 flags;
+	bool32 flip;
+
+	if(numAtomics <= 0)
+		return nil;
+	numVertices = 0;
+	numTriangles = 0;
+	maxMaterials = 0;
+	for(i = 0; i < numAtomics; i++){
+		src = atomics[i]->geometry;
+		assert(canBatch(atomics[i]));
+		assert(isCompatible(atomics[0], atomics[i]));
+		numVertices += src->numVertices;
+		numTriangles += src->numTriangles;
+		if(src->matList.numMaterials > maxMaterials)
+			maxMaterials = src->matList.numMaterials;
+	}
+
+	src = atomics[0]->geometry;
+	flags = (src->flags & FORMATFLAGS) | Geometry::POSITIONS;
+	geo = Geometry::create(numVertices, numTriangles,
+		flags | src->numTexCoordSets<<16);
+	if(geo == nil)
+		return nil;
+	sb = rwNewT(StaticBatch, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	sb->numSources = numAtomics;
+	sb->sources = rwNewT(BatchSource, numAtomics, MEMDUR_EVENT | ID_GEOMETRY);
+	matmap = rwNewT(int32, maxMaterials, MEMDUR_FUNCTION | ID_GEOMETRY);
+
+	if(frame)
+		Matrix::invert(&inv, frame->getLTM());
+	else
+		inv.setIdentity();
+	verts = geo->morphTargets[0].vertices;
+	norms = geo->morphTargets[0].normals;
+	v = 0;
+	t = 0;
+	for(i = 0; i < numAtomics; i++){
+		src = atomics[i]->geometry;
+		Matrix::mult(&xform, atomics[i]->getFrame()->getLTM(), &inv);
+
+		bs = &sb->sources[i];
+		bs->id = ids ? ids[i] : i;
+		bs->firstVertex = v;
+		bs->numVertices = src->numVertices;
+		bs->firstTriangle = t;
+		bs->numTriangles = src->numTriangles;
+
+		V3d::transformPoints(&verts[v], src->morphTargets[0].vertices,
+			src->numVertices, &xform);
+		if(flags & Geometry::NORMALS){
+			V3d::transformVectors(&norms[v], src->morphTargets[0].normals,
+				src->numVertices, &xform);
+			// renormalize in case of scaling
+			for(j = v; j < v+src->numVertices; j++)
+				if(length(norms[j]) > 0.0f)
+					norms[j] = normalize(norms[j]);
+		}
+		if(flags & Geometry::PRELIT)
+			memcpy(&geo->colors[v], src->colors,
+			       src->numVertices*sizeof(RGBA));
+		for(j = 0; j < src->numTexCoordSets; j++)
+			memcpy(&geo->texCoords[j][v], src->texCoords[j],
+			       src->numVertices*sizeof(TexCoords));
+
+		for(j = 0; j < src->matList.numMaterials; j++)
+			matmap[j] = findMaterial(&geo->matList, src->matList.materials[j]);
+
+		// mirroring transforms flip the winding
+		flip = dot(cross(xform.right, xform.up), xform.at) < 0.0f;
+		for(j = 0; j < src->numTriangles; j++){
+			stri = src->getTriangle(j);
+			tri.v[0] = stri.v[0] + v;
+			tri.v[1] = stri.v[flip ? 2 : 1] + v;
+			tri.v[2] = stri.v[flip ? 1 : 2] + v;
+			tri.matId = matmap[stri.matId];
+			geo->setTriangle(t+j, tri);
+		}
+
+		v += src->numVertices;
+		t += src->numTriangles;
+	}
+	rwFree(matmap);
+
+	geo->calculateBoundingSphere();
+	geo->buildMeshes();
+	StaticBatch::set(geo, sb);
+	return geo;
+}
+
+int32
+StaticBatch::build(Clump *clump, Atomic **atomics, int32 numAtomics, Frame *frame, int32 maxVertices)
+{
+	Atomic **members;
+	Atomic *batch, *a;
+	Geometry *geo;
+	int32 *ids;
+	uint8 *done;
+	int32 numMembers, numVertices, numBatches;
+	int32 i, j;
+
+	if(frame == nil)
+		frame = clump->getFrame();
+	if(frame == nil){
+		RWERROR((ERR_GENERAL, "static batch needs a frame"));
+		return 0;
+	}
+	done = rwNewT(uint8, numAtomics, MEMDUR_FUNCTION | ID_GEOMETRY);
+	members = rwNewT(Atomic*, numAtomics, MEMDUR_FUNCTION | ID_GEOMETRY);
+	ids = rwNewT(int32, numAtomics, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numAtomics; i++)
+		done[i] = !canBatch(atomics[i]);
+
+	numBatches = 0;
+	for(i = 0; i < numAtomics; i++){
+		if(done[i])
+			continue;
+		// Gather compatible atomics in order until the batch is full.
+		// An atomic that is too big on its own still gets a batch.
+		numMembers = 0;
+		numVertices = 0;
+		for(j = i; j < numAtomics; j++){
+			if(done[j] || !isCompatible(atomics[i], atomics[j]))
+				continue;
+			if(numMembers > 0 && maxVertices > 0 &&
+			   numVertices + atomics[j]->geometry->numVertices > maxVertices)
+				continue;
+			members[numMembers] = atomics[j];
+			ids[numMembers] = j;
+			numMembers++;
+			numVertices += atomics[j]->geometry->numVertices;
+			done[j] = 1;
+		}
+
+		geo = merge(members, ids, numMembers, frame);
+		if(geo == nil)
+			continue;
+		batch = members[0]->clone();
+		batch->setGeometry(geo, 0);
+		geo->destroy();
+		batch->setFrame(frame);
+		clump->addAtomic(batch);
+
+		for(j = 0; j < numMembers; j++){
+			a = members[j];
+			if(a->clump)
+				a->clump->removeAtomic(a);
+			if(a->world)
+				a->world->removeAtomic(a);
+			a->destroy();
+		}
+		numBatches++;
+	}
+
+	rwFree(done);
+	rwFree(members);
+	rwFree(ids);
+	return numBatches;
+}
+
+int32
+StaticBatch::findSource(const Geometry *geo, int32 triangle, int32 *srcTriangle)
+{
+	StaticBatch *sb = StaticBatch::get(geo);
+	BatchSource *bs;
+	int32 lo, hi, mid;
+
+	if(sb == nil)
+		return -1;
+	// sources are sorted by first triangle
+	lo = 0;
+	hi = sb->numSources-1;
+	while(lo <= hi){
+		mid = (lo+hi)/2;
+		bs = &sb->sources[mid];
+		if(triangle < bs->firstTriangle)
+			hi = mid-1;
+		else if(triangle >= bs->firstTriangle+bs->numTriangles)
+			lo = mid+1;
+		else{
+			if(srcTriangle)
+				*srcTriangle = triangle - bs->firstTriangle;
+			return bs->id;
+		}
+	}
+	return -1;
+}
+
+void
+StaticBatch::destroy(Geometry *geo)
+{
+	StaticBatch *sb = StaticBatch::get(geo);
+	if(sb){
+		rwFree(sb->sources);
+		rwFree(sb);
+		StaticBatch::set(geo, nil);
+	}
+}
+
+static void*
+createStaticBatch(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(StaticBatch*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyStaticBatch(void *object, int32, int32)
+{
+	StaticBatch::destroy((Geometry*)object);
+	return object;
+}
+
+static void*
+copyStaticBatch(void *dst, void *src, int32 offset, int32)
+{
+	StaticBatch *srcsb = *PLUGINOFFSET(StaticBatch*, src, offset);
+	StaticBatch *dstsb;
+	if(srcsb == nil)
+		return dst;
+	dstsb = rwNewT(StaticBatch, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	dstsb->numSources = srcsb->numSources;
+	dstsb->sources = rwNewT(BatchSource, srcsb->numSources, MEMDUR_EVENT | ID_GEOMETRY);
+	memcpy(dstsb->sources, srcsb->sources, srcsb->numSources*sizeof(BatchSource));
+	*PLUGINOFFSET(StaticBatch*, dst, offset) = dstsb;
+	return dst;
+}
+
+static Stream*
+readStaticBatch(Stream *stream, int32 len, void *object, int32 offset, int32)
+{
+	StaticBatch *sb;
+	int32 n = stream->readI32();
+	if(len != 4 + n*(int32)sizeof(BatchSource)){
+		RWERROR((ERR_GENERAL, "bad static batch chunk size"));
+		return nil;
+	}
+	sb = rwNewT(StaticBatch, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	sb->numSources = n;
+	sb->sources = rwNewT(BatchSource, n, MEMDUR_EVENT | ID_GEOMETRY);
+	stream->read32(sb->sources, n*sizeof(BatchSource));
+	*PLUGINOFFSET(StaticBatch*, object, offset) = sb;
+	return stream;
+}
+
+static Stream*
+writeStaticBatch(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	StaticBatch *sb = *PLUGINOFFSET(StaticBatch*, object, offset);
+	stream->writeI32(sb->numSources);
+	stream->write32(sb->sources, sb->numSources*sizeof(BatchSource));
+	return stream;
+}
+
+static int32
+getSizeStaticBatch(void *object, int32 offset, int32)
+{
+	StaticBatch *sb = *PLUGINOFFSET(StaticBatch*, object, offset);
+	if(sb == nil)
+		return -1;
+	return 4 + sb->numSources*sizeof(BatchSource);
+}
+
+void
+registerStaticBatchPlugin(void)
+{
+	staticBatchGlobals.geoOffset =
+		Geometry::registerPlugin(sizeof(StaticBatch*), ID_STATICBATCH,
+		                         createStaticBatch, destroyStaticBatch, copyStaticBatch);
+	Geometry::registerPluginStream(ID_STATICBATCH,
+	                               readStaticBatch, writeStaticBatch, getSizeStaticBatch);
+}
+
+}
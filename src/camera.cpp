@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "rwbase.h"
@@ -9,10 +10,19 @@
 #include "rwobjects.h"
 #include "rwengine.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
 #define PLUGIN_ID ID_CAMERA
 
 namespace rw {
 
+bool32 batchFrustumCulling;
+
 int32 Camera::numAllocated;
 
 PluginList Camera::s_plglist(sizeof(Camera));
@@ -439,6 +449,146 @@ Camera::frustumTestSphere(const Sphere *s) const
 	return res;
 }
 
+int32
+Camera::frustumTestBox(const BBox *box) const
+{
+	int32 res = BOXINSIDE;
+	const FrustumPlane *p = this->frustumPlanes;
+	V3d vmin, vmax;
+	for(int32 i = 0; i < 6; i++){
+		// vmax is the corner furthest along the normal, vmin the opposite one
+		vmax.x = p->closestX ? box->sup.x : box->inf.x;
+		vmax.y = p->closestY ? box->sup.y : box->inf.y;
+		vmax.z = p->closestZ ? box->sup.z : box->inf.z;
+		vmin.x = p->closestX ? box->inf.x : box->sup.x;
+		vmin.y = p->closestY ? box->inf.y : box->sup.y;
+		vmin.z = p->closestZ ? box->inf.z : box->sup.z;
+		if(dot(p->plane.normal, vmin) > p->plane.distance)
+			return BOXOUTSIDE;
+		if(dot(p->plane.normal, vmax) > p->plane.distance)
+			res = BOXBOUNDARY;
+		p++;
+	}
+	return res;
+}
+
+// Spheres are tested four at a time against all planes without early outs,
+// a sphere is outside if its distance to any plane is larger than its radius.
+int32
+Camera::frustumTestSpheres(const float32 *x, const float32 *y, const float32 *z,
+	const float32 *radius, int32 n, uint32 *visible, int32 *indices) const
+{
+	const FrustumPlane *p = this->frustumPlanes;
+	int32 i, j, k, numVisible;
+	uint32 bits;
+	float32 dist;
+
+	memset(visible, 0, (n+31)/32*sizeof(uint32));
+	numVisible = 0;
+	i = 0;
+#if defined(RW_SSE2)
+	__m128 nx[6], ny[6], nz[6], nd[6];
+	for(j = 0; j < 6; j++){
+		nx[j] = _mm_set1_ps(p[j].plane.normal.x);
+		ny[j] = _mm_set1_ps(p[j].plane.normal.y);
+		nz[j] = _mm_set1_ps(p[j].plane.normal.z);
+		nd[j] = _mm_set1_ps(p[j].plane.distance);
+	}
+	for(; i+4 <= n; i += 4){
+		__m128 vx = _mm_loadu_ps(x+i);
+		__m128 vy = _mm_loadu_ps(y+i);
+		__m128 vz = _mm_loadu_ps(z+i);
+		__m128 vr = _mm_loadu_ps(radius+i);
+		__m128 out = _mm_setzero_ps();
+		for(j = 0; j < 6; j++){
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[j], vx),
+				_mm_mul_ps(ny[j], vy)), _mm_mul_ps(nz[j], vz));
+			out = _mm_or_ps(out, _mm_cmpgt_ps(_mm_sub_ps(d, nd[j]), vr));
+		}
+		bits = ~_mm_movemask_ps(out) & 0xF;
+#elif defined(RW_NEON)
+	float32x4_t nx[6], ny[6], nz[6], nd[6];
+	for(j = 0; j < 6; j++){
+		nx[j] = vdupq_n_f32(p[j].plane.normal.x);
+		ny[j] = vdupq_n_f32(p[j].plane.normal.y);
+		nz[j] = vdupq_n_f32(p[j].plane.normal.z);
+		nd[j] = vdupq_n_f32(p[j].plane.distance);
+	}
+	for(; i+4 <= n; i += 4){
+		float32x4_t vx = vld1q_f32(x+i);
+		float32x4_t vy = vld1q_f32(y+i);
+		float32x4_t vz = vld1q_f32(z+i);
+		float32x4_t vr = vld1q_f32(radius+i);
+		uint32x4_t out = vdupq_n_u32(0);
+		for(j = 0; j < 6; j++){
+			float32x4_t d = vmulq_f32(nx[j], vx);
+			d = vmlaq_f32(d, ny[j], vy);
+			d = vmlaq_f32(d, nz[j], vz);
+			out = vorrq_u32(out, vcgtq_f32(vsubq_f32(d, nd[j]), vr));
+		}
+		bits = ~(vgetq_lane_u32(out, 0) & 1 |
+		         (vgetq_lane_u32(out, 1) & 2) |
+		         (vgetq_lane_u32(out, 2) & 4) |
+		         (vgetq_lane_u32(out, 3) & 8)) & 0xF;
+#endif
+#if defined(RW_SSE2) || defined(RW_NEON)
+		// i is a multiple of 4, so the bits stay in one word
+		if(bits == 0)
+			continue;
+		visible[i>>5] |= bits << (i&31);
+		for(k = 0; k < 4; k++)
+			if(bits & (1<<k)){
+				if(indices)
+					indices[numVisible] = i+k;
+				numVisible++;
+			}
+	}
+#endif
+	for(; i < n; i++){
+		for(j = 0; j < 6; j++){
+			dist = p[j].plane.normal.x*x[i] + p[j].plane.normal.y*y[i] +
+				p[j].plane.normal.z*z[i] - p[j].plane.distance;
+			if(dist > radius[i])
+				break;
+		}
+		if(j < 6)
+			continue;
+		visible[i>>5] |= 1u << (i&31);
+		if(indices)
+			indices[numVisible] = i;
+		numVisible++;
+	}
+	return numVisible;
+}
+
+int32
+Camera::cullAtomics(Atomic **atomics, int32 n) const
+{
+	enum { CHUNK = 256 };
+	float32 x[CHUNK], y[CHUNK], z[CHUNK], r[CHUNK];
+	uint32 visible[CHUNK/32];
+	int32 indices[CHUNK];
+	Sphere *s;
+	int32 i, j, m, numVisible;
+
+	numVisible = 0;
+	for(i = 0; i < n; i += CHUNK){
+		m = n-i < CHUNK ? n-i : CHUNK;
+		for(j = 0; j < m; j++){
+			s = atomics[i+j]->getWorldBoundingSphere();
+			x[j] = s->center.x;
+			y[j] = s->center.y;
+			z[j] = s->center.z;
+			r[j] = s->radius;
+		}
+		m = this->frustumTestSpheres(x, y, z, r, m, visible, indices);
+		// indices are increasing so this never overwrites unread atomics
+		for(j = 0; j < m; j++)
+			atomics[numVisible++] = atomics[i+indices[j]];
+	}
+	return numVisible;
+}
+
 struct CameraChunkData
 {
 	V2d viewWindow;
@@ -13,6 +13,7 @@
 #include "d3d/rwd3d.h"
 #include "gl/rwgl3.h"
 #include "3ds/rw3ds.h"
+#include "soft/rwsoft.h"
 
 
 #define PLUGIN_ID 1000	// TODO: find a better ID
@@ -101,12 +101,16 @@ Clump::addAtomic(Atomic *a)
 	assert(a->clump == nil);
 	a->clump = this;
 	this->atomics.append(&a->inClump);
+	if(this->world && a->world == nil)
+		this->world->addAtomic(a);
 }
 
 void
 Clump::removeAtomic(Atomic *a)
 {
 	assert(a->clump == this);
+	if(this->world && a->world == this->world)
+		this->world->removeAtomic(a);
 	a->inClump.remove();
 	a->clump = nil;
 }
@@ -117,12 +121,16 @@ Clump::addLight(Light *l)
 	assert(l->clump == nil);
 	l->clump = this;
 	this->lights.append(&l->inClump);
+	if(this->world && l->world == nil)
+		this->world->addLight(l);
 }
 
 void
 Clump::removeLight(Light *l)
 {
 	assert(l->clump == this);
+	if(this->world && l->world == this->world)
+		this->world->removeLight(l);
 	l->inClump.remove();
 	l->clump = nil;
 }
@@ -133,12 +141,16 @@ Clump::addCamera(Camera *c)
 	assert(c->clump == nil);
 	c->clump = this;
 	this->cameras.append(&c->inClump);
+	if(this->world && c->world == nil)
+		this->world->addCamera(c);
 }
 
 void
 Clump::removeCamera(Camera *c)
 {
 	assert(c->clump == this);
+	if(this->world && c->world == this->world)
+		this->world->removeCamera(c);
 	c->inClump.remove();
 	c->clump = nil;
 }
@@ -378,25 +390,84 @@ Clump::streamGetSize(void)
 	return size;
 }
 
+// Instance all atomics ahead of rendering, e.g. after loading
+void
+Clump::instanceAtomics(void)
+{
+	Atomic **atomics;
+	int32 n;
+
+	n = this->countAtomics();
+	if(n == 0)
+		return;
+	atomics = rwNewT(Atomic*, n, MEMDUR_FUNCTION | ID_CLUMP);
+	n = 0;
+	FORLIST(lnk, this->atomics)
+		atomics[n++] = Atomic::fromClump(lnk);
+	Atomic::instanceAtomics(atomics, n);
+	rwFree(atomics);
+}
+
 void
 Clump::render(void)
 {
+	enum { CHUNK = 256 };
+	Atomic *atomics[CHUNK];
+	Camera *cam;
 	Atomic *a;
+	int32 i, n;
+
+	cam = (Camera*)engine->currentCamera;
+	if(!batchFrustumCulling || cam == nil){
+		FORLIST(lnk, this->atomics){
+			a = Atomic::fromClump(lnk);
+			if(a->object.object.flags & Atomic::RENDER)
+				a->render();
+		}
+		return;
+	}
+
+	n = 0;
 	FORLIST(lnk, this->atomics){
 		a = Atomic::fromClump(lnk);
 		if(a->object.object.flags & Atomic::RENDER)
-			a->render();
+			atomics[n++] = a;
+		if(n == CHUNK){
+			n = cam->cullAtomics(atomics, n);
+			for(i = 0; i < n; i++)
+				atomics[i]->render();
+			n = 0;
+		}
 	}
+	n = cam->cullAtomics(atomics, n);
+	for(i = 0; i < n; i++)
+		atomics[i]->render();
 }
 
 //
 // Atomic
 //
 
+// Lerping center and radius between the spheres of the two
+// targets gives a sphere that contains all lerped vertices.
+static void
+interpolateSphere(Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	Interpolator *ip = &atomic->interpolator;
+	if(geo == nil || geo->numMorphTargets < 2)
+		return;
+	Sphere *s1 = &geo->morphTargets[ip->startMorphTarget].boundingSphere;
+	Sphere *s2 = &geo->morphTargets[ip->endMorphTarget].boundingSphere;
+	float32 t = ip->getValue();
+	atomic->boundingSphere.center = lerp(s1->center, s2->center, t);
+	atomic->boundingSphere.radius = s1->radius + (s2->radius - s1->radius)*t;
+}
+
 static void
 atomicSync(ObjectWithFrame *obj)
 {
-	// TODO: interpolate
+	interpolateSphere((Atomic*)obj);
 	obj->object.privateFlags |= Atomic::WORLDBOUNDDIRTY;
 }
 
@@ -406,6 +477,9 @@ worldAtomicSync(ObjectWithFrame *obj)
 {
 	Atomic *atomic = (Atomic*)obj;
 	atomic->originalSync(obj);
+	atomic->lightStamp = 0;
+	if(atomic->world)
+		atomic->world->updateAtomic(atomic);
 }
 
 Atomic*
@@ -431,10 +505,16 @@ Atomic::create(void)
 	atomic->pipeline = nil;
 	atomic->renderCB = Atomic::defaultRenderCB;
 	atomic->object.object.flags = Atomic::COLLISIONTEST | Atomic::RENDER;
-	// TODO: interpolator
+	atomic->interpolator.init();
 
 	// World extension
 	atomic->world = nil;
+	atomic->sector = nil;
+	atomic->inSector.init();
+	atomic->cachedLights = nil;
+	atomic->numCachedLights = 0;
+	atomic->cachedLightSpace = 0;
+	atomic->lightStamp = 0;
 	atomic->originalSync = atomic->object.syncCB;
 	atomic->object.syncCB = worldAtomicSync;
 
@@ -454,6 +534,7 @@ Atomic::clone()
 		atomic->setGeometry(this->geometry, 0);
 	atomic->renderCB = this->renderCB;
 	atomic->pipeline = this->pipeline;
+	atomic->interpolator = this->interpolator;
 
 	// World extension doesn't add to world
 
@@ -470,6 +551,7 @@ Atomic::destroy(void)
 	assert(this->clump == nil);
 	assert(this->world == nil);
 	this->setFrame(nil);
+	rwFree(this->cachedLights);
 	rwFree(this);
 	numAllocated--;
 }
@@ -491,11 +573,22 @@ Atomic::setGeometry(Geometry *geo, uint32 flags)
 	}
 }
 
+void
+Atomic::addMorphTime(float32 t)
+{
+	if(this->geometry == nil)
+		return;
+	this->interpolator.addTime(t, this->geometry->numMorphTargets);
+	// have the sync interpolate the bounding sphere
+	if(this->geometry->numMorphTargets > 1 && this->getFrame())
+		this->getFrame()->updateObjects();
+}
+
 Sphere*
 Atomic::getWorldBoundingSphere(void)
 {
 	Sphere *s = &this->worldBoundingSphere;
-	// TODO: if we ever support morphing, check interpolation
+	// interpolation is synced with the frame, see addMorphTime
 	if(!this->getFrame()->dirty() &&
 	   (this->object.object.privateFlags & WORLDBOUNDDIRTY) == 0)
 		return s;
@@ -621,6 +714,85 @@ Atomic::uninstance(void)
 	this->geometry->flags &= ~Geometry::NATIVE;
 }
 
+static int
+cmpGeometry(const void *a, const void *b)
+{
+	Geometry *ga = (*(Atomic**)a)->geometry;
+	Geometry *gb = (*(Atomic**)b)->geometry;
+	return ga < gb ? -1 : ga > gb ? 1 : 0;
+}
+
+static void
+prepareInstanceJob(void *data, int32 i)
+{
+	Atomic *a = ((Atomic**)data)[i];
+	ObjPipeline *pipe = a->getPipeline();
+	pipe->impl.prepareInstance(pipe, a);
+}
+
+// Do the CPU side of instancing many atomics for rendering so their
+// first draw doesn't have to. The work is split up with Engine::jobfuncs.
+// Unlike instance() this doesn't make the geometries native.
+// The jobs allocate the instance data, so the memory functions
+// must be thread safe if the jobs run in parallel.
+// Pipelines that can't split instancing are left to uploadInstances.
+void
+Atomic::prepareInstances(Atomic **atomics, int32 num)
+{
+	Atomic **jobs;
+	Atomic *a;
+	int32 i, n;
+
+	if(num <= 0)
+		return;
+	jobs = rwNewT(Atomic*, num, MEMDUR_FUNCTION | ID_ATOMIC);
+	n = 0;
+	for(i = 0; i < num; i++){
+		a = atomics[i];
+		if(a->geometry == nil || a->geometry->flags & Geometry::NATIVE)
+			continue;
+		if(a->getPipeline()->impl.prepareInstance)
+			jobs[n++] = a;
+	}
+	// a geometry shared by several atomics is only instanced once
+	qsort(jobs, n, sizeof(Atomic*), cmpGeometry);
+	num = n;
+	n = 0;
+	for(i = 0; i < num; i++)
+		if(n == 0 || jobs[i]->geometry != jobs[n-1]->geometry)
+			jobs[n++] = jobs[i];
+	Engine::jobfuncs.parallelFor(prepareInstanceJob, jobs, n);
+	rwFree(jobs);
+}
+
+// Finish instancing on the render thread. Prepared atomics get their
+// device buffers, the others are instanced completely here.
+void
+Atomic::uploadInstances(Atomic **atomics, int32 num)
+{
+	ObjPipeline *pipe;
+	Atomic *a;
+	int32 i;
+
+	for(i = 0; i < num; i++){
+		a = atomics[i];
+		if(a->geometry == nil)
+			continue;
+		pipe = a->getPipeline();
+		if(pipe->impl.uploadInstance)
+			pipe->impl.uploadInstance(pipe, a);
+		else if(pipe->impl.prepareInstance == nil)
+			pipe->instance(a);
+	}
+}
+
+void
+Atomic::instanceAtomics(Atomic **atomics, int32 num)
+{
+	prepareInstances(atomics, num);
+	uploadInstances(atomics, num);
+}
+
 void
 Atomic::defaultRenderCB(Atomic *atomic)
 {
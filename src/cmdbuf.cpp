@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwrender.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#include "ps2/rwps2.h"
+#include "d3d/rwd3d.h"
+#include "gl/rwgl3.h"
+#include "3ds/rw3ds.h"
+#include "soft/rwsoft.h"
+
+#define PLUGIN_ID ID_DRIVER
+
+/*
+ * Commands are packed back to back, each one a Command header followed
+ * by a fixed argument struct and then its variable sized data.
+ * Sizes are rounded up to 8 bytes to keep pointers in the
+ * arguments aligned.
+ */
+
+namespace rw {
+
+#ifdef RWDEVICE
+typedef RWDEVICE::Im2DVertex CmdIm2DVertex;
+typedef RWDEVICE::Im3DVertex CmdIm3DVertex;
+#else
+typedef null::Im2DVertex CmdIm2DVertex;
+typedef null::Im3DVertex CmdIm3DVertex;
+#endif
+
+struct CmdCamera { Camera *cam; };
+struct CmdClear { Camera *cam; RGBA col; uint32 mode; };
+struct CmdShowRaster { Raster *raster; uint32 flags; };
+struct CmdRenderState { void *value; int32 state; };
+struct CmdIm2D { int32 primType; int32 numVertices; int32 numIndices; };
+struct CmdIm3DTransform { Matrix world; int32 numVertices; uint32 flags; bool32 hasWorld; };
+struct CmdIm3D { int32 primType; int32 numIndices; };
+struct CmdAtomic { Atomic *atomic; };
+struct CmdCall { void (*func)(void *data); };
+
+#define ALIGN8(n) (((n) + 7) & ~7)
+#define ARGS(cmd, T) ((T*)((CommandBuffer::Command*)(cmd) + 1))
+#define EXTRA(cmd, T) ((uint8*)(ARGS(cmd, T) + 1))
+
+CommandBuffer*
+CommandBuffer::create(uint32 space)
+{
+	CommandBuffer *cb = rwNewT(CommandBuffer, 1, MEMDUR_EVENT | ID_DRIVER);
+	cb->space = ALIGN8(space);
+	cb->data = cb->space ? rwNewT(uint8, cb->space, MEMDUR_EVENT | ID_DRIVER) : nil;
+	cb->size = 0;
+	cb->numCommands = 0;
+	return cb;
+}
+
+void
+CommandBuffer::destroy(void)
+{
+	rwFree(this->data);
+	rwFree(this);
+}
+
+void
+CommandBuffer::reset(void)
+{
+	this->size = 0;
+	this->numCommands = 0;
+}
+
+// Returns the arguments of a new command, followed by extraSize bytes.
+// Everything but the extra data is cleared so recordings compare equal.
+void*
+CommandBuffer::alloc(uint32 op, uint32 argSize, uint32 extraSize)
+{
+	Command *cmd;
+	uint32 size = ALIGN8(sizeof(Command) + argSize + extraSize);
+	if(this->size + size > this->space){
+		this->space *= 2;
+		if(this->space < this->size + size)
+			this->space = this->size + size;
+		this->data = rwResizeT(uint8, this->data, this->space, MEMDUR_EVENT | ID_DRIVER);
+	}
+	cmd = (Command*)(this->data + this->size);
+	memset((uint8*)cmd + size - 8, 0, 8);	// padding
+	cmd->op = op;
+	cmd->size = size;
+	memset(cmd+1, 0, argSize);
+	this->size += size;
+	this->numCommands++;
+	return cmd + 1;
+}
+
+void
+CommandBuffer::beginUpdate(Camera *cam)
+{
+	CmdCamera *args = (CmdCamera*)this->alloc(BEGINUPDATE, sizeof(CmdCamera), 0);
+	args->cam = cam;
+}
+
+void
+CommandBuffer::endUpdate(Camera *cam)
+{
+	CmdCamera *args = (CmdCamera*)this->alloc(ENDUPDATE, sizeof(CmdCamera), 0);
+	args->cam = cam;
+}
+
+void
+CommandBuffer::clearCamera(Camera *cam, RGBA *col, uint32 mode)
+{
+	CmdClear *args = (CmdClear*)this->alloc(CLEARCAMERA, sizeof(CmdClear), 0);
+	args->cam = cam;
+	args->col = *col;
+	args->mode = mode;
+}
+
+void
+CommandBuffer::showRaster(Raster *raster, uint32 flags)
+{
+	CmdShowRaster *args = (CmdShowRaster*)this->alloc(SHOWRASTER, sizeof(CmdShowRaster), 0);
+	args->raster = raster;
+	args->flags = flags;
+}
+
+void
+CommandBuffer::setRenderState(int32 state, uint32 value)
+{
+	this->setRenderStatePtr(state, (void*)(uintptr)value);
+}
+
+void
+CommandBuffer::setRenderStatePtr(int32 state, void *value)
+{
+	CmdRenderState *args = (CmdRenderState*)this->alloc(SETRENDERSTATE, sizeof(CmdRenderState), 0);
+	args->state = state;
+	args->value = value;
+}
+
+void
+CommandBuffer::im2DRenderLine(void *vertices, int32, int32 vert1, int32 vert2)
+{
+	CmdIm2DVertex verts[2];
+	verts[0] = ((CmdIm2DVertex*)vertices)[vert1];
+	verts[1] = ((CmdIm2DVertex*)vertices)[vert2];
+	this->im2DRenderPrimitive(PRIMTYPELINELIST, verts, 2);
+}
+
+void
+CommandBuffer::im2DRenderTriangle(void *vertices, int32, int32 vert1, int32 vert2, int32 vert3)
+{
+	CmdIm2DVertex verts[3];
+	verts[0] = ((CmdIm2DVertex*)vertices)[vert1];
+	verts[1] = ((CmdIm2DVertex*)vertices)[vert2];
+	verts[2] = ((CmdIm2DVertex*)vertices)[vert3];
+	this->im2DRenderPrimitive(PRIMTYPETRILIST, verts, 3);
+}
+
+void
+CommandBuffer::im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices)
+{
+	uint32 vsize = numVertices*sizeof(CmdIm2DVertex);
+	CmdIm2D *args = (CmdIm2D*)this->alloc(IM2DPRIMITIVE, sizeof(CmdIm2D), vsize);
+	args->primType = primType;
+	args->numVertices = numVertices;
+	args->numIndices = 0;
+	memcpy(args+1, vertices, vsize);
+}
+
+void
+CommandBuffer::im2DRenderIndexedPrimitive(PrimitiveType primType, void *vertices, int32 numVertices, void *indices, int32 numIndices)
+{
+	uint32 vsize = numVertices*sizeof(CmdIm2DVertex);
+	uint32 isize = numIndices*sizeof(uint16);
+	CmdIm2D *args = (CmdIm2D*)this->alloc(IM2DINDEXEDPRIMITIVE, sizeof(CmdIm2D), vsize + isize);
+	args->primType = primType;
+	args->numVertices = numVertices;
+	args->numIndices = numIndices;
+	memcpy(args+1, vertices, vsize);
+	memcpy((uint8*)(args+1) + vsize, indices, isize);
+}
+
+void
+CommandBuffer::im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
+{
+	uint32 vsize = numVertices*sizeof(CmdIm3DVertex);
+	CmdIm3DTransform *args = (CmdIm3DTransform*)this->alloc(IM3DTRANSFORM, sizeof(CmdIm3DTransform), vsize);
+	if(world){
+		args->world = *world;
+		args->hasWorld = 1;
+	}
+	args->numVertices = numVertices;
+	args->flags = flags;
+	memcpy(args+1, vertices, vsize);
+}
+
+void
+CommandBuffer::im3DRenderPrimitive(PrimitiveType primType)
+{
+	CmdIm3D *args = (CmdIm3D*)this->alloc(IM3DPRIMITIVE, sizeof(CmdIm3D), 0);
+	args->primType = primType;
+	args->numIndices = 0;
+}
+
+void
+CommandBuffer::im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices)
+{
+	uint32 isize = numIndices*sizeof(uint16);
+	CmdIm3D *args = (CmdIm3D*)this->alloc(IM3DINDEXEDPRIMITIVE, sizeof(CmdIm3D), isize);
+	args->primType = primType;
+	args->numIndices = numIndices;
+	memcpy(args+1, indices, isize);
+}
+
+void
+CommandBuffer::im3DEnd(void)
+{
+	this->alloc(IM3DEND, 0, 0);
+}
+
+void
+CommandBuffer::renderAtomic(Atomic *atomic)
+{
+	CmdAtomic *args = (CmdAtomic*)this->alloc(RENDERATOMIC, sizeof(CmdAtomic), 0);
+	args->atomic = atomic;
+}
+
+void
+CommandBuffer::call(void (*func)(void *data), void *data, uint32 size)
+{
+	CmdCall *args = (CmdCall*)this->alloc(CALLFUNC, sizeof(CmdCall), size);
+	args->func = func;
+	if(size)
+		memcpy(args+1, data, size);
+}
+
+void
+CommandBuffer::execute(void)
+{
+	Device *dev = &engine->device;
+	Command *cmd;
+
+	for(cmd = this->first(); cmd; cmd = this->next(cmd)){
+		switch(cmd->op){
+		// through the camera to make it current
+		case BEGINUPDATE:
+			ARGS(cmd, CmdCamera)->cam->beginUpdate();
+			break;
+		case ENDUPDATE:
+			ARGS(cmd, CmdCamera)->cam->endUpdate();
+			break;
+		case CLEARCAMERA: {
+			CmdClear *args = ARGS(cmd, CmdClear);
+			dev->clearCamera(args->cam, &args->col, args->mode);
+			break;
+		}
+		case SHOWRASTER: {
+			CmdShowRaster *args = ARGS(cmd, CmdShowRaster);
+			dev->showRaster(args->raster, args->flags);
+			break;
+		}
+		case SETRENDERSTATE: {
+			CmdRenderState *args = ARGS(cmd, CmdRenderState);
+			dev->setRenderState(args->state, args->value);
+			break;
+		}
+		case IM2DPRIMITIVE: {
+			CmdIm2D *args = ARGS(cmd, CmdIm2D);
+			dev->im2DRenderPrimitive((PrimitiveType)args->primType,
+				EXTRA(cmd, CmdIm2D), args->numVertices);
+			break;
+		}
+		case IM2DINDEXEDPRIMITIVE: {
+			CmdIm2D *args = ARGS(cmd, CmdIm2D);
+			uint8 *verts = EXTRA(cmd, CmdIm2D);
+			dev->im2DRenderIndexedPrimitive((PrimitiveType)args->primType,
+				verts, args->numVertices,
+				verts + args->numVertices*sizeof(CmdIm2DVertex), args->numIndices);
+			break;
+		}
+		case IM3DTRANSFORM: {
+			CmdIm3DTransform *args = ARGS(cmd, CmdIm3DTransform);
+			dev->im3DTransform(EXTRA(cmd, CmdIm3DTransform), args->numVertices,
+				args->hasWorld ? &args->world : nil, args->flags);
+			break;
+		}
+		case IM3DPRIMITIVE:
+			dev->im3DRenderPrimitive((PrimitiveType)ARGS(cmd, CmdIm3D)->primType);
+			break;
+		case IM3DINDEXEDPRIMITIVE: {
+			CmdIm3D *args = ARGS(cmd, CmdIm3D);
+			dev->im3DRenderIndexedPrimitive((PrimitiveType)args->primType,
+				EXTRA(cmd, CmdIm3D), args->numIndices);
+			break;
+		}
+		case IM3DEND:
+			dev->im3DEnd();
+			break;
+		case RENDERATOMIC:
+			ARGS(cmd, CmdAtomic)->atomic->render();
+			break;
+		case CALLFUNC:
+			ARGS(cmd, CmdCall)->func(EXTRA(cmd, CmdCall));
+			break;
+		default:
+			assert(0 && "unknown command");
+			return;
+		}
+	}
+}
+
+}
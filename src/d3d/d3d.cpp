@@ -82,22 +82,25 @@ calculateTextureSize(uint32 width, uint32 height, uint32 depth, uint32 format)
 }
 
 int vertFormatMap[] = {
-	-1, VERT_FLOAT2, VERT_FLOAT3, VERT_FLOAT4, VERT_ARGB, VERT_RGBA /* blend indices */
+	-1, VERT_FLOAT2, VERT_FLOAT3, VERT_FLOAT4, VERT_ARGB, VERT_RGBA /* blend indices */,
+	-1, -1, VERT_UBYTE4N
 };
 
 void*
-createIndexBuffer(uint32 length, bool dynamic)
+createIndexBuffer(uint32 length, bool dynamic, bool index32)
 {
 #ifdef RW_D3D9
 	IDirect3DIndexBuffer9 *ibuf;
+	D3DFORMAT fmt = index32 ? D3DFMT_INDEX32 : D3DFMT_INDEX16;
 	if(dynamic)
-		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY|D3DUSAGE_DYNAMIC, D3DFMT_INDEX16, D3DPOOL_DEFAULT, &ibuf, 0);
+		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY|D3DUSAGE_DYNAMIC, fmt, D3DPOOL_DEFAULT, &ibuf, 0);
 	else
-		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_MANAGED, &ibuf, 0);
+		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY, fmt, D3DPOOL_MANAGED, &ibuf, 0);
 	if(ibuf)
 		d3d9Globals.numIndexBuffers++;
 	return ibuf;
 #else
+	(void)index32;
 	return rwNewT(uint8, length, MEMDUR_EVENT | ID_DRIVER);
 #endif
 }
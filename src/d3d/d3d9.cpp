@@ -178,6 +178,7 @@ readNativeData(Stream *stream, int32, void *object, int32, int32)
 	header->vertexDeclaration = nil; p += 4;
 	header->totalNumIndex = *(uint32*)p; p += 4;
 	header->totalNumVertex = *(uint32*)p; p += 4;
+	header->index32 = 0;
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
 	InstanceData *inst = header->inst;
@@ -321,6 +322,9 @@ getSizeNativeData(void *object, int32, int32)
 	   geometry->instData->platform != PLATFORM_D3D9)
 		return 0;
 	InstanceDataHeader *header = (InstanceDataHeader*)geometry->instData;
+	// RW's native format only knows 16 bit indices
+	if(header->index32)
+		return 0;
 	int32 size = 12 + 4 + 4 + 64 + header->numMeshes*36;
 	uint32 numElt = getDeclaration(header->vertexDeclaration, nil);
 	size += 4 + numElt*8;
@@ -357,15 +361,29 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->totalNumIndex = meshh->totalIndices;
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
-	header->indexBuffer = createIndexBuffer(header->totalNumIndex*2, false);
-
-	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
+	// Indices are relative to baseIndex, so only meshes that
+	// span more than 0x10000 vertices need a 32 bit index buffer.
 	InstanceData *inst = header->inst;
 	Mesh *mesh = meshh->getMeshes();
-	uint32 startindex = 0;
+	header->index32 = 0;
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
+		findMinVertAndNumVertices(meshh, mesh,
 		                          &inst->minVert, (int32*)&inst->numVertices);
+		if(inst->numVertices > 0x10000)
+			header->index32 = 1;
+		mesh++;
+		inst++;
+	}
+
+	header->indexBuffer = createIndexBuffer(header->totalNumIndex*(header->index32 ? 4 : 2),
+		false, !!header->index32);
+
+	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
+	uint32 *indices32 = (uint32*)indices;
+	inst = header->inst;
+	mesh = meshh->getMeshes();
+	uint32 startindex = 0;
+	for(uint32 i = 0; i < header->numMeshes; i++){
 		inst->numIndex = mesh->numIndices;
 		inst->material = mesh->material;
 		inst->vertexAlpha = 0;
@@ -373,11 +391,14 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 		inst->baseIndex = inst->minVert;
 		inst->startIndex = startindex;
 		inst->numPrimitives = header->primType == D3DPT_TRIANGLESTRIP ? inst->numIndex-2 : inst->numIndex/3;
-		if(inst->minVert == 0)
+		if(header->index32)
+			for(uint32 j = 0; j < inst->numIndex; j++)
+				indices32[inst->startIndex+j] = meshh->getIndex(mesh, j) - inst->minVert;
+		else if(inst->minVert == 0 && !meshh->index32)
 			memcpy(&indices[inst->startIndex], mesh->indices, inst->numIndex*2);
 		else
 			for(uint32 j = 0; j < inst->numIndex; j++)
-				indices[inst->startIndex+j] = mesh->indices[j] - inst->minVert;
+				indices[inst->startIndex+j] = meshh->getIndex(mesh, j) - inst->minVert;
 		startindex += inst->numIndex;
 		mesh++;
 		inst++;
@@ -432,15 +453,20 @@ uninstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	geo->allocateMeshes(geo->meshHeader->numMeshes, geo->meshHeader->totalIndices, 0);
 
 	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
+	MeshHeader *meshh = geo->meshHeader;
 	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
+	uint32 *indices32 = (uint32*)indices;
 	InstanceData *inst = header->inst;
-	Mesh *mesh = geo->meshHeader->getMeshes();
+	Mesh *mesh = meshh->getMeshes();
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		if(inst->minVert == 0)
+		if(header->index32)
+			for(uint32 j = 0; j < inst->numIndex; j++)
+				meshh->setIndex(mesh, j, indices32[inst->startIndex+j] + inst->minVert);
+		else if(inst->minVert == 0 && !meshh->index32)
 			memcpy(mesh->indices, &indices[inst->startIndex], inst->numIndex*2);
 		else
 			for(uint32 j = 0; j < inst->numIndex; j++)
-				mesh->indices[j] = indices[inst->startIndex+j] + inst->minVert;
+				meshh->setIndex(mesh, j, indices[inst->startIndex+j] + inst->minVert);
 		mesh++;
 		inst++;
 	}
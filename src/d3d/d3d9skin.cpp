@@ -101,12 +101,12 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 		dcl[i].stream = 0;
 		dcl[i].offset = stride;
-		dcl[i].type = D3DDECLTYPE_FLOAT4;
+		dcl[i].type = D3DDECLTYPE_UBYTE4N;
 		dcl[i].method = D3DDECLMETHOD_DEFAULT;
 		dcl[i].usage = D3DDECLUSAGE_BLENDWEIGHT;
 		dcl[i].usageIndex = 0;
 		i++;
-		stride += 16;
+		stride += 4;
 
 		dcl[i].stream = 0;
 		dcl[i].offset = stride;
@@ -204,8 +204,8 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_BLENDWEIGHT || dcl[i].usageIndex != 0; i++)
 			;
-		instV4d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			(V4d*)skin->weights,
+		instSkinWeights(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
+			skin->weights,
 			header->totalNumVertex,
 			header->vertexStream[dcl[i].stream].stride);
 	}
@@ -229,60 +229,11 @@ enum
 	VSLOC_boneMatrices = VSLOC_afterLights
 };
 
-static float skinMatrices[64*16];
-
 void
 uploadSkinMatrices(Atomic *a)
 {
-	int i;
 	Skin *skin = Skin::get(a->geometry);
-	float *m = skinMatrices;
-	HAnimHierarchy *hier = Skin::getHierarchy(a);
-
-	if(hier){
-		Matrix *invMats = (Matrix*)skin->inverseMatrices;
-		Matrix tmp, tmp2;
-
-		assert(skin->numBones == hier->numNodes);
-		if(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES){
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &invMats[i], &hier->matrices[i]);
-				RawMatrix::transpose((RawMatrix*)m, (RawMatrix*)&tmp);
-				m += 12;
-			}
-		}else{
-			Matrix invAtmMat;
-			Matrix::invert(&invAtmMat, a->getFrame()->getLTM());
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
-				Matrix::mult(&tmp2, &invMats[i], &tmp);
-				RawMatrix::transpose((RawMatrix*)m, (RawMatrix*)&tmp2);
-				m += 12;
-			}
-		}
-	}else{
-		for(i = 0; i < skin->numBones; i++){
-			m[0] = 1.0f;
-			m[1] = 0.0f;
-			m[2] = 0.0f;
-			m[3] = 0.0f;
-
-			m[4] = 0.0f;
-			m[5] = 1.0f;
-			m[6] = 0.0f;
-			m[7] = 0.0f;
-
-			m[8] = 0.0f;
-			m[9] = 0.0f;
-			m[10] = 1.0f;
-			m[11] = 0.0f;
-
-			m += 12;
-		}
-	}
-	d3ddevice->SetVertexShaderConstantF(VSLOC_boneMatrices, skinMatrices, skin->numBones*3);
+	d3ddevice->SetVertexShaderConstantF(VSLOC_boneMatrices, Skin::getPalette(a), skin->numBones*3);
 }
 
 void
@@ -47,6 +47,7 @@ struct InstanceDataHeader : rw::InstanceDataHeader
 	void   *vertexDeclaration;
 	uint32  totalNumIndex;
 	uint32  totalNumVertex;
+	bool32  index32;	// librw extension, D3DFMT_INDEX32 index buffer
 
 	InstanceData *inst;
 };
@@ -204,6 +204,7 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 		return;
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
+	assert(!meshh->index32);	// only 16 bit indices here
 	geo->instData = header;
 	header->platform = PLATFORM_XBOX;
 
@@ -18,6 +18,7 @@
 #include "gl/rwgl3.h"
 #include "gl/rwwdgl.h"
 #include "3ds/rw3ds.h"
+#include "soft/rwsoft.h"
 
 #define PLUGIN_ID 0
 
@@ -39,6 +40,14 @@ PluginList Driver::s_plglist[NUM_PLATFORMS];
 
 const char *allocLocation;
 
+static void
+parallelFor_serial(void (*job)(void *data, int32 i), void *data, int32 n)
+{
+	for(int32 i = 0; i < n; i++)
+		job(data, i);
+}
+JobFunctions Engine::jobfuncs = { parallelFor_serial };
+
 void *malloc_h(size_t sz, uint32 hint) { if(sz == 0) return nil; return malloc(sz); }
 void *realloc_h(void *p, size_t sz, uint32 hint) { return realloc(p, sz); }
 
@@ -238,6 +247,7 @@ Engine::init(MemoryFunctions *memfuncs)
 	wdgl::registerPlatformPlugins();
 	gl3::registerPlatformPlugins();
 	c3d::registerPlatformPlugins();
+	soft::registerPlatformPlugins();
 
 	Engine::state = Initialized;
 	return 1;
@@ -274,6 +284,8 @@ Engine::open(EngineOpenParams *p)
 	engine->device = d3d::renderdevice;
 #elif RW_3DS
 	engine->device = c3d::renderdevice;
+#elif RW_SOFT
+	engine->device = soft::renderdevice;
 #else
 	engine->device = null::renderdevice;
 #endif
@@ -456,25 +468,36 @@ Engine::setMultiSamplingLevels(uint32 levels)
 
 namespace null {
 
-void beginUpdate(Camera*) { }
-void endUpdate(Camera*) { }
-void clearCamera(Camera*,RGBA*,uint32) { }
-void showRaster(Raster*,uint32) { }
+static CommandBuffer *recorder;
 
-void   setRenderState(int32, void*) { }
+void recordCommands(CommandBuffer *cb) { recorder = cb; }
+
+void beginUpdate(Camera *cam) { if(recorder) recorder->beginUpdate(cam); }
+void endUpdate(Camera *cam) { if(recorder) recorder->endUpdate(cam); }
+void clearCamera(Camera *cam, RGBA *col, uint32 mode) { if(recorder) recorder->clearCamera(cam, col, mode); }
+void showRaster(Raster *raster, uint32 flags) { if(recorder) recorder->showRaster(raster, flags); }
+
+void   setRenderState(int32 state, void *value) { if(recorder) recorder->setRenderStatePtr(state, value); }
 void  *getRenderState(int32) { return 0; }
 
 bool32 rasterRenderFast(Raster *raster, int32 x, int32 y) { return 0; }
 
-void im2DRenderLine(void*, int32, int32, int32) { }
-void im2DRenderTriangle(void*, int32, int32, int32, int32) { }
-void im2DRenderPrimitive(PrimitiveType, void*, int32) { }
-void im2DRenderIndexedPrimitive(PrimitiveType, void*, int32, void*, int32) { }
-
-void im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags) { }
-void im3DRenderPrimitive(PrimitiveType primType) { }
-void im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices) { }
-void im3DEnd(void) { }
+void im2DRenderLine(void *vertices, int32 numVertices, int32 vert1, int32 vert2) {
+	if(recorder) recorder->im2DRenderLine(vertices, numVertices, vert1, vert2); }
+void im2DRenderTriangle(void *vertices, int32 numVertices, int32 vert1, int32 vert2, int32 vert3) {
+	if(recorder) recorder->im2DRenderTriangle(vertices, numVertices, vert1, vert2, vert3); }
+void im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices) {
+	if(recorder) recorder->im2DRenderPrimitive(primType, vertices, numVertices); }
+void im2DRenderIndexedPrimitive(PrimitiveType primType, void *vertices, int32 numVertices, void *indices, int32 numIndices) {
+	if(recorder) recorder->im2DRenderIndexedPrimitive(primType, vertices, numVertices, indices, numIndices); }
+
+void im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags) {
+	if(recorder) recorder->im3DTransform(vertices, numVertices, world, flags); }
+void im3DRenderPrimitive(PrimitiveType primType) {
+	if(recorder) recorder->im3DRenderPrimitive(primType); }
+void im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices) {
+	if(recorder) recorder->im3DRenderIndexedPrimitive(primType, indices, numIndices); }
+void im3DEnd(void) { if(recorder) recorder->im3DEnd(); }
 
 Raster*
 rasterCreate(Raster*)
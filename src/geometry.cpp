@@ -34,13 +34,14 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 	}
 	numAllocated++;
 	geo->object.init(Geometry::ID, 0);
-	geo->flags = flags & 0xFF00FFFF;
+	geo->flags = flags & 0xFF00FFFF & ~INDEX32;
 	geo->numTexCoordSets = (flags & 0xFF0000) >> 16;
 	if(geo->numTexCoordSets == 0)
 		geo->numTexCoordSets = (geo->flags & TEXTURED)  ? 1 :
 		                       (geo->flags & TEXTURED2) ? 2 : 0;
 	geo->numTriangles = numTris;
 	geo->numVertices = numVerts;
+	geo->index32 = (flags & INDEX32) || geo->needsIndex32();
 
 	geo->colors = nil;
 	for(int32 i = 0; i < 8; i++)
@@ -50,14 +51,14 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 	// will hold the first address (even when there are no triangles)
 	// so we can free easily.
 	if(!(geo->flags & NATIVE)){
-		int32 sz = geo->numTriangles*sizeof(Triangle);
+		int32 sz = geo->numTriangles*geo->getTriangleSize();
 		if(geo->flags & PRELIT)
 			sz += geo->numVertices*sizeof(RGBA);
 		sz += geo->numTexCoordSets*geo->numVertices*sizeof(TexCoords);
 
 		uint8 *data = (uint8*)rwNew(sz, MEMDUR_EVENT | ID_GEOMETRY);
 		geo->triangles = (Triangle*)data;
-		data += geo->numTriangles*sizeof(Triangle);
+		data += geo->numTriangles*geo->getTriangleSize();
 		if(geo->flags & PRELIT && geo->numVertices){
 			geo->colors = (RGBA*)data;
 			data += geo->numVertices*sizeof(RGBA);
@@ -70,7 +71,7 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 
 		// init triangles
 		for(int32 i = 0; i < geo->numTriangles; i++)
-			geo->triangles[i].matId = 0xFFFF;
+			geo->setTriMatId(i, 0xFFFF);
 	}
 	geo->numMorphTargets = 0;
 	geo->morphTargets = nil;
@@ -159,12 +160,22 @@ Geometry::streamRead(Stream *stream)
 			stream->read32(geo->texCoords[i],
 				    2*geo->numVertices*4);
 		for(int32 i = 0; i < geo->numTriangles; i++){
-			uint32 tribuf[2];
-			stream->read32(tribuf, 8);
-			geo->triangles[i].v[0]  = tribuf[0] >> 16;
-			geo->triangles[i].v[1]  = tribuf[0];
-			geo->triangles[i].v[2]  = tribuf[1] >> 16;
-			geo->triangles[i].matId = tribuf[1];
+			uint32 tribuf[4];
+			Triangle32 t;
+			if(buf.flags & INDEX32){
+				stream->read32(tribuf, 16);
+				t.v[0]  = tribuf[0];
+				t.v[1]  = tribuf[1];
+				t.v[2]  = tribuf[2];
+				t.matId = tribuf[3];
+			}else{
+				stream->read32(tribuf, 8);
+				t.v[0]  = tribuf[0] >> 16;
+				t.v[1]  = tribuf[0] & 0xFFFF;
+				t.v[2]  = tribuf[1] >> 16;
+				t.matId = tribuf[1];
+			}
+			geo->setTriangle(i, t);
 		}
 	}
 
@@ -211,7 +222,7 @@ geoStructSize(Geometry *geo)
 			size += 4*geo->numVertices;
 		for(int32 i = 0; i < geo->numTexCoordSets; i++)
 			size += 2*geo->numVertices*4;
-		size += 4*geo->numTriangles*2;
+		size += 4*geo->numTriangles*(geo->index32 ? 4 : 2);
 	}
 	for(int32 i = 0; i < geo->numMorphTargets; i++){
 		MorphTarget *m = &geo->morphTargets[i];
@@ -236,6 +247,9 @@ Geometry::streamWrite(Stream *stream)
 	writeChunkHeader(stream, ID_STRUCT, geoStructSize(this));
 
 	buf.flags = this->flags | this->numTexCoordSets << 16;
+	// RW packs two indices into a word, this needs a wider layout
+	if(this->index32 && !(this->flags & NATIVE))
+		buf.flags |= INDEX32;
 	buf.numTriangles = this->numTriangles;
 	buf.numVertices = this->numVertices;
 	buf.numMorphTargets = this->numMorphTargets;
@@ -250,12 +264,19 @@ Geometry::streamWrite(Stream *stream)
 			stream->write32(this->texCoords[i],
 				    2*this->numVertices*4);
 		for(int32 i = 0; i < this->numTriangles; i++){
-			uint32 tribuf[2];
-			tribuf[0] = this->triangles[i].v[0] << 16 |
-			            this->triangles[i].v[1];
-			tribuf[1] = this->triangles[i].v[2] << 16 |
-			            this->triangles[i].matId;
-			stream->write32(tribuf, 8);
+			uint32 tribuf[4];
+			Triangle32 t = this->getTriangle(i);
+			if(this->index32){
+				tribuf[0] = t.v[0];
+				tribuf[1] = t.v[1];
+				tribuf[2] = t.v[2];
+				tribuf[3] = t.matId;
+				stream->write32(tribuf, 16);
+			}else{
+				tribuf[0] = t.v[0] << 16 | t.v[1];
+				tribuf[1] = t.v[2] << 16 | t.matId;
+				stream->write32(tribuf, 8);
+			}
 		}
 	}
 
@@ -370,22 +391,49 @@ Geometry::hasColoredMaterial(void)
 	return 0;
 }
 
+Triangle32
+Geometry::getTriangle(int32 i) const
+{
+	if(this->index32)
+		return this->triangles32[i];
+	Triangle32 t;
+	t.v[0] = this->triangles[i].v[0];
+	t.v[1] = this->triangles[i].v[1];
+	t.v[2] = this->triangles[i].v[2];
+	t.matId = this->triangles[i].matId;
+	return t;
+}
+
+void
+Geometry::setTriangle(int32 i, const Triangle32 &t)
+{
+	if(this->index32){
+		this->triangles32[i] = t;
+		return;
+	}
+	this->triangles[i].v[0] = t.v[0];
+	this->triangles[i].v[1] = t.v[1];
+	this->triangles[i].v[2] = t.v[2];
+	this->triangles[i].matId = t.matId;
+}
+
 // Force allocate data, even when native flag is set
 void
 Geometry::allocateData(void)
 {
 	// Geometry data
 	// Pretty much copy pasted from ::create above
-	int32 sz = this->numTriangles*sizeof(Triangle);
+	this->index32 = this->index32 || this->needsIndex32();
+	int32 sz = this->numTriangles*this->getTriangleSize();
 	if(this->flags & PRELIT)
 		sz += this->numVertices*sizeof(RGBA);
 	sz += this->numTexCoordSets*this->numVertices*sizeof(TexCoords);
 
 	uint8 *data = (uint8*)rwNew(sz, MEMDUR_EVENT | ID_GEOMETRY);
 	this->triangles = (Triangle*)data;
-	data += this->numTriangles*sizeof(Triangle);
+	data += this->numTriangles*this->getTriangleSize();
 	for(int32 i = 0; i < this->numTriangles; i++)
-		this->triangles[i].matId = 0xFFFF;
+		this->setTriMatId(i, 0xFFFF);
 	if(this->flags & PRELIT){
 		this->colors = (RGBA*)data;
 		data += this->numVertices*sizeof(RGBA);
@@ -422,11 +470,12 @@ Geometry::allocateData(void)
 }
 
 static int
-isDegenerate(uint16 *idx)
+isDegenerate(MeshHeader *header, Mesh *m, uint32 j)
 {
-	return idx[0] == idx[1] ||
-	       idx[0] == idx[2] ||
-	       idx[1] == idx[2];
+	uint32 a = header->getIndex(m, j);
+	uint32 b = header->getIndex(m, j+1);
+	uint32 c = header->getIndex(m, j+2);
+	return a == b || a == c || b == c;
 }
 
 // This functions assumes there is enough space allocated
@@ -451,7 +500,7 @@ Geometry::generateTriangles(int8 *adc)
 		if(header->flags == MeshHeader::TRISTRIP){
 			for(uint32 j = 0; j < m->numIndices-2; j++){
 				if(!(adc && adcbits[j+2]) &&
-				   !isDegenerate(&m->indices[j]))
+				   !isDegenerate(header, m, j))
 					this->numTriangles++;
 			}
 		}else
@@ -460,7 +509,8 @@ Geometry::generateTriangles(int8 *adc)
 		m++;
 	}
 
-	Triangle *tri = this->triangles;
+	Triangle32 tri;
+	int32 n = 0;
 	m = header->getMeshes();
 	adcbits = adc;
 	for(uint32 i = 0; i < header->numMeshes; i++){
@@ -473,21 +523,21 @@ Geometry::generateTriangles(int8 *adc)
 		if(header->flags == MeshHeader::TRISTRIP)
 			for(uint32 j = 0; j < m->numIndices-2; j++){
 				if((adc && adcbits[j+2]) ||
-				   isDegenerate(&m->indices[j]))
+				   isDegenerate(header, m, j))
 					continue;
-				tri->v[0] = m->indices[j+0];
-				tri->v[1] = m->indices[j+1 + (j%2)];
-				tri->v[2] = m->indices[j+2 - (j%2)];
-				tri->matId = matid;
-				tri++;
+				tri.v[0] = header->getIndex(m, j+0);
+				tri.v[1] = header->getIndex(m, j+1 + (j%2));
+				tri.v[2] = header->getIndex(m, j+2 - (j%2));
+				tri.matId = matid;
+				this->setTriangle(n++, tri);
 			}
 		else
 			for(uint32 j = 0; j < m->numIndices-2; j+=3){
-				tri->v[0] = m->indices[j+0];
-				tri->v[1] = m->indices[j+1];
-				tri->v[2] = m->indices[j+2];
-				tri->matId = matid;
-				tri++;
+				tri.v[0] = header->getIndex(m, j+0);
+				tri.v[1] = header->getIndex(m, j+1);
+				tri.v[2] = header->getIndex(m, j+2);
+				tri.matId = matid;
+				this->setTriangle(n++, tri);
 			}
 		adcbits += m->numIndices;
 		m++;
@@ -513,7 +563,7 @@ dumpMesh(Mesh *m)
 void
 Geometry::buildMeshes(void)
 {
-	Triangle *tri;
+	Triangle32 tri;
 	Mesh *mesh;
 
 	if(this->flags & Geometry::NATIVE){
@@ -530,14 +580,13 @@ Geometry::buildMeshes(void)
 		memset(numIndices, 0, numMeshes*sizeof(int32));
 
 		// count indices per mesh
-		tri = this->triangles;
 		for(int32 i = 0; i < this->numTriangles; i++){
-			assert(tri->matId < numMeshes);
-			numIndices[tri->matId] += 3;
-			tri++;
+			tri = this->getTriangle(i);
+			assert(tri.matId < numMeshes);
+			numIndices[tri.matId] += 3;
 		}
 		// setup meshes
-		this->allocateMeshes(numMeshes, this->numTriangles*3, 0);
+		this->allocateMeshes(numMeshes, this->numTriangles*3, 0, this->index32);
 		mesh = this->meshHeader->getMeshes();
 		for(int32 i = 0; i < numMeshes; i++){
 			mesh[i].material = this->matList.materials[i];
@@ -549,14 +598,13 @@ Geometry::buildMeshes(void)
 		// now fill in the indices
 		for(int32 i = 0; i < numMeshes; i++)
 			mesh[i].numIndices = 0;
-		tri = this->triangles;
+		MeshHeader *mh = this->meshHeader;
 		for(int32 i = 0; i < this->numTriangles; i++){
-			uint32 idx = mesh[tri->matId].numIndices;
-			mesh[tri->matId].indices[idx++] = tri->v[0];
-			mesh[tri->matId].indices[idx++] = tri->v[1];
-			mesh[tri->matId].indices[idx++] = tri->v[2];
-			mesh[tri->matId].numIndices = idx;
-			tri++;
+			tri = this->getTriangle(i);
+			Mesh *m = &mesh[tri.matId];
+			mh->setIndex(m, m->numIndices++, tri.v[0]);
+			mh->setIndex(m, m->numIndices++, tri.v[1]);
+			mh->setIndex(m, m->numIndices++, tri.v[2]);
 		}
 	}else
 		this->buildTristrips();
@@ -569,8 +617,9 @@ void
 Geometry::correctTristripWinding(void)
 {
 	MeshHeader *header = this->meshHeader;
+	// only needed for PS2 style strips, which are always 16 bit
 	if(this->flags & NATIVE || header == nil ||
-	   header->flags != MeshHeader::TRISTRIP)
+	   header->flags != MeshHeader::TRISTRIP || header->index32)
 		return;
 	this->meshHeader = nil;
 	// Allocate no indices, we realloc later
@@ -655,7 +704,7 @@ Geometry::removeUnusedMaterials(void)
 
 	/* Build new meshes */
 	this->meshHeader = nil;
-	MeshHeader *newmh = this->allocateMeshes(numMaterials, mh->totalIndices, 0);
+	MeshHeader *newmh = this->allocateMeshes(numMaterials, mh->totalIndices, 0, mh->index32);
 	newmh->flags = mh->flags;
 	Mesh *newm = newmh->getMeshes();
 	for(uint32 i = 0; i < mh->numMeshes; i++){
@@ -672,14 +721,14 @@ Geometry::removeUnusedMaterials(void)
 		if(m[i].numIndices <= 0)
 			continue;
 		memcpy(newm->indices, m[i].indices,
-		       m[i].numIndices*sizeof(*m[i].indices));
+		       m[i].numIndices*mh->getIndexSize());
 		newm++;
 	}
 	rwFree(mh);
 
 	/* Remap triangle material IDs */
 	for(int32 i = 0; i < this->numTriangles; i++)
-		this->triangles[i].matId = map[this->triangles[i].matId];
+		this->setTriMatId(i, map[this->getTriangle(i).matId]);
 	rwFree(map);
 }
 
@@ -19,6 +19,7 @@
 #include "gl/rwwdgl.h"
 #include "gl/rwgl3.h"
 #include "3ds/rw3ds.h"
+#include "soft/rwsoft.h"
 
 #define PLUGIN_ID 2
 
@@ -30,18 +31,20 @@ static uint16 nextSerialNum = 1;
 
 // Allocate a mesh header, meshes and optionally indices.
 // If existing meshes already exist, retain their information.
+// Indices are 32 bit if asked for or if the geometry has too many vertices for 16.
 MeshHeader*
-Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
+Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices, bool32 index32)
 {
 	uint32 sz;
 	MeshHeader *mh;
 	Mesh *m;
-	uint16 *indices;
+	uint8 *indices;
 	int32 oldNumMeshes;
 	int32 i;
+	index32 = index32 || this->needsIndex32();
 	sz = sizeof(MeshHeader) + numMeshes*sizeof(Mesh);
 	if(!noIndices)
-		sz += numIndices*sizeof(uint16);
+		sz += numIndices*(index32 ? sizeof(uint32) : sizeof(uint16));
 	if(this->meshHeader){
 		oldNumMeshes = this->meshHeader->numMeshes;
 		mh = (MeshHeader*)rwResize(this->meshHeader, sz, MEMDUR_EVENT | ID_GEOMETRY);
@@ -55,8 +58,9 @@ Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
 	mh->numMeshes = numMeshes;
 	mh->serialNum = nextSerialNum++;
 	mh->totalIndices = numIndices;
+	mh->index32 = index32;
 	m = mh->getMeshes();
-	indices = (uint16*)&m[numMeshes];
+	indices = (uint8*)&m[numMeshes];
 	for(i = 0; i < mh->numMeshes; i++){
 		// keep these
 		if(i >= oldNumMeshes){
@@ -67,8 +71,8 @@ Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
 		if(noIndices)
 			m->indices = nil;
 		else{
-			m->indices = indices;
-			indices += m->numIndices;
+			m->indices = (uint16*)indices;
+			indices += m->numIndices*mh->getIndexSize();
 		}
 		m++;
 	}
@@ -79,16 +83,16 @@ void
 MeshHeader::setupIndices(void)
 {
 	int32 i;
-	uint16 *indices;
+	uint8 *indices;
 	Mesh *m;
 	m = this->getMeshes();
-	indices = m->indices;
+	indices = (uint8*)m->indices;
 	// return if native
 	if(indices == nil)
 		return;
 	for(i = 0; i < this->numMeshes; i++){
-		m->indices = indices;
-		indices += m->numIndices;
+		m->indices = (uint16*)indices;
+		indices += m->numIndices*this->getIndexSize();
 		m++;
 	}
 }
@@ -115,15 +119,21 @@ readMesh(Stream *stream, int32 len, void *object, int32, int32)
 	Mesh *mesh;
 	int32 indbuf[256];
 	uint16 *indices;
+	bool32 index32;
 	Geometry *geo = (Geometry*)object;
 
 	stream->read32(&mhs, sizeof(MeshHeaderStream));
+	// Indices are always 32 bit in the stream, the flag says how wide
+	// they are in memory. Files from other tools may have too many
+	// vertices without it, allocateMeshes catches that.
+	index32 = !!(mhs.flags & MeshHeader::INDEX32);
+	mhs.flags &= ~MeshHeader::INDEX32;
 	// Have to do this dance for War Drum's meshes
 	bool32 hasData = len > int32(sizeof(MeshHeaderStream)+mhs.numMeshes*sizeof(MeshStream));
 	assert(geo->meshHeader == nil);
 	geo->meshHeader = nil;
 	mh = geo->allocateMeshes(mhs.numMeshes, mhs.totalIndices, 
-		geo->flags & Geometry::NATIVE && !hasData);
+		geo->flags & Geometry::NATIVE && !hasData, index32);
 	mh->flags = mhs.flags;
 
 	mesh = mh->getMeshes();
@@ -142,15 +152,20 @@ readMesh(Stream *stream, int32 len, void *object, int32, int32)
 			}
 		}else{
 			mesh->indices = indices;
-			indices += mesh->numIndices;
-			uint16 *ind = mesh->indices;
-			int32 numIndices = mesh->numIndices;
-			for(; numIndices > 0; numIndices -= 256){
-				int32 n = numIndices < 256 ? numIndices : 256;
-				stream->read32(indbuf, n*4);
-				for(int32 j = 0; j < n; j++)
-					ind[j] = indbuf[j];
-				ind += n;
+			if(mh->index32){
+				indices += mesh->numIndices*2;	// in uint16 units
+				stream->read32(mesh->indices32, mesh->numIndices*4);
+			}else{
+				indices += mesh->numIndices;
+				uint16 *ind = mesh->indices;
+				int32 numIndices = mesh->numIndices;
+				for(; numIndices > 0; numIndices -= 256){
+					int32 n = numIndices < 256 ? numIndices : 256;
+					stream->read32(indbuf, n*4);
+					for(int32 j = 0; j < n; j++)
+						ind[j] = indbuf[j];
+					ind += n;
+				}
 			}
 		}
 		mesh++;
@@ -166,6 +181,8 @@ writeMesh(Stream *stream, int32, void *object, int32, int32)
 	int32 indbuf[256];
 	Geometry *geo = (Geometry*)object;
 	mhs.flags = geo->meshHeader->flags;
+	if(geo->meshHeader->index32)
+		mhs.flags |= MeshHeader::INDEX32;
 	mhs.numMeshes = geo->meshHeader->numMeshes;
 	mhs.totalIndices = geo->meshHeader->totalIndices;
 	stream->write32(&mhs, sizeof(MeshHeaderStream));
@@ -179,7 +196,9 @@ writeMesh(Stream *stream, int32, void *object, int32, int32)
 			if(geo->instData->platform == PLATFORM_WDGL)
 				stream->write16(mesh->indices,
 				            mesh->numIndices*2);
-		}else{
+		}else if(geo->meshHeader->index32)
+			stream->write32(mesh->indices32, mesh->numIndices*4);
+		else{
 			uint16 *ind = mesh->indices;
 			int32 numIndices = mesh->numIndices;
 			for(; numIndices > 0; numIndices -= 256){
@@ -254,6 +273,8 @@ destroyNativeData(void *object, int32 offset, int32 size)
 		return gl3::destroyNativeData(object, offset, size);
 	if(geometry->instData->platform == PLATFORM_3DS)
 		return c3d::destroyNativeData(object, offset, size);
+	if(geometry->instData->platform == PLATFORM_SOFT)
+		return soft::destroyNativeData(object, offset, size);
 	return object;
 }
 
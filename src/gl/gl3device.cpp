@@ -135,6 +135,8 @@ int32 u_lightColor;
 
 int32 u_matColor;
 int32 u_surfProps;
+int32 u_posScale;
+int32 u_posOffset;
 
 Shader *defaultShader, *defaultShader_noAT;
 Shader *defaultShader_fullLight, *defaultShader_fullLight_noAT;
@@ -1822,6 +1824,8 @@ initOpenGL(void)
 #endif
 	u_matColor = registerUniform("u_matColor", UNIFORM_VEC4);
 	u_surfProps = registerUniform("u_surfProps", UNIFORM_VEC4);
+	u_posScale = registerUniform("u_posScale", UNIFORM_VEC4);
+	u_posOffset = registerUniform("u_posOffset", UNIFORM_VEC4);
 
 	// for im2d
 	registerUniform("u_xform", UNIFORM_VEC4);
@@ -16,6 +16,8 @@
 namespace rw {
 namespace gl3 {
 
+bool32 compactVertices;
+
 // TODO: make some of these things platform-independent
 
 #ifdef RW_OPENGL
@@ -36,6 +38,7 @@ freeInstanceData(Geometry *geometry)
 	rwFree(header->indexBuffer);
 	rwFree(header->vertexBuffer);
 	rwFree(header->attribDesc);
+	rwFree(header->morphVertices);
 	rwFree(header->inst);
 	rwFree(header);
 }
@@ -60,48 +63,115 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->primType = meshh->flags == 1 ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
 	header->totalNumVertex = geo->numVertices;
 	header->totalNumIndex = meshh->totalIndices;
+	header->posScale.x = header->posScale.y = header->posScale.z = 1.0f;
+	header->posScale.w = 0.0f;
+	header->posOffset.x = header->posOffset.y = header->posOffset.z = 0.0f;
+	header->posOffset.w = 0.0f;
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
-	header->indexBuffer = rwNewT(uint16, header->totalNumIndex, MEMDUR_EVENT | ID_GEOMETRY);
+	// Meshes choose their index width, only those that reference vertices
+	// past 0xFFFF need 32 bits. Leave room for aligning 32 bit meshes.
+	header->indexBuffer = rwNewT(uint8, header->totalNumIndex*meshh->getIndexSize() + 2*header->numMeshes,
+		MEMDUR_EVENT | ID_GEOMETRY);
 	InstanceData *inst = header->inst;
 	Mesh *mesh = meshh->getMeshes();
 	uint32 offset = 0;
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
+		findMinVertAndNumVertices(meshh, mesh,
 		                          &inst->minVert, &inst->numVertices);
 		assert(inst->minVert != 0xFFFFFFFF);
 		inst->numIndex = mesh->numIndices;
 		inst->material = mesh->material;
 		inst->vertexAlpha = 0;
 		inst->program = 0;
-		inst->offset = offset;
-		memcpy((uint8*)header->indexBuffer + inst->offset,
-		       mesh->indices, inst->numIndex*2);
-		offset += inst->numIndex*2;
+		if(inst->minVert + inst->numVertices > 0x10000){
+			inst->indexType = GL_UNSIGNED_INT;
+			offset = (offset+3) & ~3;
+			inst->offset = offset;
+			memcpy(header->indexBuffer + inst->offset,
+			       mesh->indices32, inst->numIndex*4);
+			offset += inst->numIndex*4;
+		}else{
+			inst->indexType = GL_UNSIGNED_SHORT;
+			inst->offset = offset;
+			if(meshh->index32){
+				uint16 *dst = (uint16*)(header->indexBuffer + inst->offset);
+				for(uint32 j = 0; j < inst->numIndex; j++)
+					dst[j] = mesh->indices32[j];
+			}else
+				memcpy(header->indexBuffer + inst->offset,
+				       mesh->indices, inst->numIndex*2);
+			offset += inst->numIndex*2;
+		}
 		mesh++;
 		inst++;
 	}
 
 	header->vertexBuffer = nil;
+	header->vertexBufferSize = 0;
 	header->numAttribs = 0;
 	header->attribDesc = nil;
+	header->morphStreamSize = 0;
+	header->morphStart = -1;
+	header->morphEnd = -1;
+	header->morphValue = 0.0f;
+	header->morphVertices = nil;
+	header->indexBufferSize = offset;
+	header->needsUpload = 0;
+	header->vsBits = 0;
 	header->ibo = 0;
 	header->vbo = 0;
-
 #ifdef RW_GL_USE_VAOS
-	glGenVertexArrays(1, &header->vao);
-	glBindVertexArray(header->vao);
+	header->vao = 0;
 #endif
-	glGenBuffers(1, &header->ibo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->totalNumIndex*2,
-			header->indexBuffer, GL_STATIC_DRAW);
 
 	return header;
 }
 
+// Create the GL objects of an instanced geometry and fill them
+// with the buffers the instance callback packed.
 static void
-instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+uploadInstanceData(InstanceDataHeader *header)
+{
+	// Older instanceCBs create and fill the vbo themselves
+	// and leave the size at 0, their data is already there.
+	bool32 uploaded = header->vbo != 0 && header->vertexBufferSize == 0;
+
+	if(header->ibo == 0){
+#ifdef RW_GL_USE_VAOS
+		glGenVertexArrays(1, &header->vao);
+		glBindVertexArray(header->vao);
+#endif
+		glGenBuffers(1, &header->ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->indexBufferSize,
+				header->indexBuffer, GL_STATIC_DRAW);
+	}
+	if(header->vbo == 0)
+		glGenBuffers(1, &header->vbo);
+
+#ifdef RW_GL_USE_VAOS
+	glBindVertexArray(header->vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
+#endif
+	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+	if(!uploaded){
+		// the instanceCB didn't fill in the size
+		assert(header->vertexBufferSize != 0);
+		glBufferData(GL_ARRAY_BUFFER, header->vertexBufferSize, header->vertexBuffer,
+		             header->morphStreamSize ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+	}
+#ifdef RW_GL_USE_VAOS
+	setAttribPointers(header->attribDesc, header->numAttribs);
+	glBindVertexArray(0);
+#endif
+	header->needsUpload = 0;
+}
+
+// The CPU half of instancing, it makes no GL calls
+// so Atomic::prepareInstances can run it in a job.
+static void
+prepareInstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 {
 	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
 	Geometry *geo = atomic->geometry;
@@ -110,7 +180,33 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 		return;
 
 	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
-	if(geo->instData){
+	if(header){
+		assert(header->platform == PLATFORM_GL3);
+		// freeing the old instance deletes GL objects, leave it to upload
+		if(header->serialNumber != geo->meshHeader->serialNum)
+			return;
+		if(geo->lockedSinceInst){
+			pipe->instanceCB(geo, header, 1);
+			header->needsUpload = 1;
+		}
+	}else{
+		header = instanceMesh(rwpipe, geo);
+		pipe->instanceCB(geo, header, 0);
+		header->needsUpload = 1;
+	}
+
+	geo->lockedSinceInst = 0;
+}
+
+static void
+uploadInstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	if(geo->flags & Geometry::NATIVE)
+		return;
+
+	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
+	if(header){
 		// Already have instanced data, so check if we have to reinstance
 		assert(header->platform == PLATFORM_GL3);
 		if(header->serialNumber != geo->meshHeader->serialNum){
@@ -119,14 +215,57 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 		}
 	}
 
-	// no instance or complete reinstance
-	if(geo->instData == nil){
-		geo->instData = instanceMesh(rwpipe, geo);
-		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 0);
-	}else if(geo->lockedSinceInst)
-		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
+	// does nothing if the geometry was prepared already
+	prepareInstance(rwpipe, atomic);
+	header = (InstanceDataHeader*)geo->instData;
+	if(header->needsUpload)
+		uploadInstanceData(header);
+}
 
-	geo->lockedSinceInst = 0;
+static void
+instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	uploadInstance(rwpipe, atomic);
+}
+
+// Blend the morph targets selected by the atomic's interpolator
+// and reinstance only the dynamic block of positions and normals.
+static void
+morphInstance(Atomic *atomic, InstanceDataHeader *header)
+{
+	Geometry *geo = atomic->geometry;
+	Interpolator *ip = &atomic->interpolator;
+	float32 t = ip->getValue();
+	if(header->morphStart == ip->startMorphTarget &&
+	   header->morphEnd == ip->endMorphTarget &&
+	   header->morphValue == t)
+		return;
+	header->morphStart = ip->startMorphTarget;
+	header->morphEnd = ip->endMorphTarget;
+	header->morphValue = t;
+
+	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	int32 n = header->totalNumVertex;
+	if(header->morphVertices == nil)
+		header->morphVertices = rwNewT(V3d, hasNormals ? 2*n : n, MEMDUR_EVENT | ID_GEOMETRY);
+	V3d *normals = hasNormals ? header->morphVertices + n : nil;
+	geo->interpolateMorphTargets(header->morphVertices, normals,
+		ip->startMorphTarget, ip->endMorphTarget, t);
+
+	AttribDesc *a;
+	for(a = header->attribDesc; a->index != ATTRIB_POS; a++)
+		;
+	instV3d(VERT_FLOAT3, header->vertexBuffer + a->offset,
+		header->morphVertices, n, a->stride);
+	if(hasNormals){
+		for(a = header->attribDesc; a->index != ATTRIB_NORMAL; a++)
+			;
+		instV3d(VERT_FLOAT3, header->vertexBuffer + a->offset,
+			normals, n, a->stride);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, header->morphStreamSize, header->vertexBuffer);
 }
 
 static void
@@ -143,10 +282,42 @@ render(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	pipe->instance(atomic);
 	assert(geo->instData != nil);
 	assert(geo->instData->platform == PLATFORM_GL3);
+	if(((InstanceDataHeader*)geo->instData)->morphStreamSize)
+		morphInstance(atomic, (InstanceDataHeader*)geo->instData);
 	if(pipe->renderCB)
 		pipe->renderCB(atomic, (InstanceDataHeader*)geo->instData);
 }
 
+static void
+renderMesh(rw::ObjPipeline *rwpipe, Atomic *atomic, int32 mesh, bool32 sameAtomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	InstanceDataHeader *header;
+	if(!sameAtomic){
+		pipe->instance(atomic);
+		assert(geo->instData != nil);
+		assert(geo->instData->platform == PLATFORM_GL3);
+		if(((InstanceDataHeader*)geo->instData)->morphStreamSize)
+			morphInstance(atomic, (InstanceDataHeader*)geo->instData);
+	}
+	header = (InstanceDataHeader*)geo->instData;
+	assert(mesh >= 0 && (uint32)mesh < header->numMeshes);
+	pipe->renderMeshCB(atomic, header, &header->inst[mesh], sameAtomic);
+}
+
+static bool32
+meshVertexAlpha(rw::ObjPipeline *rwpipe, Atomic *atomic, int32 mesh)
+{
+	InstanceDataHeader *header;
+	rwpipe->instance(atomic);
+	header = (InstanceDataHeader*)atomic->geometry->instData;
+	if(header == nil || header->platform != PLATFORM_GL3 ||
+	   (uint32)mesh >= header->numMeshes)
+		return 0;
+	return header->inst[mesh].vertexAlpha;
+}
+
 void
 ObjPipeline::init(void)
 {
@@ -154,9 +325,13 @@ ObjPipeline::init(void)
 	this->impl.instance = gl3::instance;
 	this->impl.uninstance = gl3::uninstance;
 	this->impl.render = gl3::render;
+	this->impl.meshVertexAlpha = gl3::meshVertexAlpha;
+	this->impl.prepareInstance = gl3::prepareInstance;
+	this->impl.uploadInstance = gl3::uploadInstance;
 	this->instanceCB = nil;
 	this->uninstanceCB = nil;
 	this->renderCB = nil;
+	this->renderMeshCB = nil;
 }
 
 ObjPipeline*
@@ -167,6 +342,31 @@ ObjPipeline::create(void)
 	return pipe;
 }
 
+// Instance positions in the format the attribute was set up with
+// and update the dequantization range of the header.
+void
+instPositions(Geometry *geo, InstanceDataHeader *header, AttribDesc *a)
+{
+	V3d *src = geo->morphTargets[0].vertices;
+	V3d scale, offset;
+	if(a->type == GL_FLOAT){
+		scale.set(1.0f, 1.0f, 1.0f);
+		offset.set(0.0f, 0.0f, 0.0f);
+		instV3d(VERT_FLOAT3, header->vertexBuffer + a->offset,
+			src, header->totalNumVertex, a->stride);
+	}else{
+		findV3dRange(src, header->totalNumVertex, &scale, &offset);
+		instV3dRange(VERT_NORMSHORT4, header->vertexBuffer + a->offset,
+			src, header->totalNumVertex, a->stride, &scale, &offset);
+	}
+	header->posScale.x = scale.x;
+	header->posScale.y = scale.y;
+	header->posScale.z = scale.z;
+	header->posOffset.x = offset.x;
+	header->posOffset.y = offset.y;
+	header->posOffset.z = offset.z;
+}
+
 void
 defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 {
@@ -174,6 +374,9 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 	bool isPrelit = !!(geo->flags & Geometry::PRELIT);
 	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	bool isMorphed = geo->numMorphTargets > 1;
+	// morph targets are blended on the CPU, keep them as floats
+	bool compact = compactVertices && !isMorphed;
 
 	if(!reinstance){
 		AttribDesc tmpAttribs[12];
@@ -187,22 +390,37 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 		// Positions
 		a->index = ATTRIB_POS;
-		a->size = 3;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
-		a->offset = stride;
-		stride += 12;
-		a++;
-
-		// Normals
-		// TODO: compress
-		if(hasNormals){
-			a->index = ATTRIB_NORMAL;
+		if(compact){
+			a->size = 4;
+			a->type = GL_SHORT;
+			a->normalized = GL_TRUE;
+			a->offset = stride;
+			stride += 8;
+		}else{
 			a->size = 3;
 			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
 			stride += 12;
+		}
+		a++;
+
+		// Normals
+		if(hasNormals){
+			a->index = ATTRIB_NORMAL;
+			if(compact){
+				a->size = 4;
+				a->type = GL_INT_2_10_10_10_REV;
+				a->normalized = GL_TRUE;
+				a->offset = stride;
+				stride += 4;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				a->offset = stride;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -221,16 +439,34 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			if(compact){
+				a->type = GL_HALF_FLOAT;
+				stride += 4;
+			}else{
+				a->type = GL_FLOAT;
+				stride += 8;
+			}
 			a++;
 		}
 
 		header->numAttribs = a - tmpAttribs;
-		for(a = tmpAttribs; a != &tmpAttribs[header->numAttribs]; a++)
-			a->stride = stride;
+		header->vertexBufferSize = header->totalNumVertex*stride;
+		if(isMorphed){
+			// move positions and normals into their own block
+			uint32 dynStride = hasNormals ? 24 : 12;
+			header->morphStreamSize = header->totalNumVertex*dynStride;
+			for(a = tmpAttribs; a != &tmpAttribs[header->numAttribs]; a++)
+				if(a->index == ATTRIB_POS || a->index == ATTRIB_NORMAL)
+					a->stride = dynStride;
+				else{
+					a->stride = stride - dynStride;
+					a->offset += header->morphStreamSize - dynStride;
+				}
+		}else
+			for(a = tmpAttribs; a != &tmpAttribs[header->numAttribs]; a++)
+				a->stride = stride;
 		header->attribDesc = rwNewT(AttribDesc, header->numAttribs, MEMDUR_EVENT | ID_GEOMETRY);
 		memcpy(header->attribDesc, tmpAttribs,
 		       header->numAttribs*sizeof(AttribDesc));
@@ -239,8 +475,6 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		// Allocate vertex buffer
 		//
 		header->vertexBuffer = rwNewT(uint8, header->totalNumVertex*stride, MEMDUR_EVENT | ID_GEOMETRY);
-		assert(header->vbo == 0);
-		glGenBuffers(1, &header->vbo);
 	}
 
 	attribs = header->attribDesc;
@@ -255,16 +489,15 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		instPositions(geo, header, a);
 	}
 
 	// Normals
 	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
+		instV3d(a->type == GL_FLOAT ? VERT_FLOAT3 : VERT_NORM1010102,
+			verts + a->offset,
 			geo->morphTargets[0].normals,
 			header->totalNumVertex, a->stride);
 	}
@@ -290,23 +523,15 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
 			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
 				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
+			instTexCoords(a->type == GL_FLOAT ? VERT_FLOAT2 : VERT_HALF2,
+				verts + a->offset,
 				geo->texCoords[n],
 				header->totalNumVertex, a->stride);
 		}
 	}
 
-#ifdef RW_GL_USE_VAOS
-	glBindVertexArray(header->vao);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-#endif
-	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
-#ifdef RW_GL_USE_VAOS
-	setAttribPointers(header->attribDesc, header->numAttribs);
-	glBindVertexArray(0);
-#endif
+	// buffer holds the base shape now, blend again on the next render
+	header->morphStart = -1;
 }
 
 void
@@ -322,6 +547,8 @@ makeDefaultPipeline(void)
 	pipe->instanceCB = defaultInstanceCB;
 	pipe->uninstanceCB = defaultUninstanceCB;
 	pipe->renderCB = defaultRenderCB;
+	pipe->renderMeshCB = defaultRenderMeshCB;
+	pipe->impl.renderMesh = gl3::renderMesh;
 	return pipe;
 }
 
@@ -25,7 +25,7 @@ drawInst_simple(InstanceDataHeader *header, InstanceData *inst)
 {
 	flushCache();
 	glDrawElements(header->primType, inst->numIndex,
-	               GL_UNSIGNED_SHORT, (void*)(uintptr)inst->offset);
+	               inst->indexType, (void*)(uintptr)inst->offset);
 }
 
 // Emulate PS2 GS alpha test FB_ONLY case: failed alpha writes to frame- but not to depth buffer
@@ -100,6 +100,8 @@ setupVertexInput(InstanceDataHeader *header)
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
 	setAttribPointers(header->attribDesc, header->numAttribs);
 #endif
+	setUniform(u_posScale, &header->posScale);
+	setUniform(u_posOffset, &header->posOffset);
 }
 
 void
@@ -144,11 +146,35 @@ lightingCB(void)
 }
 
 
+static void
+defaultRenderMesh(InstanceDataHeader *header, InstanceData *inst, uint32 flags, int32 vsBits)
+{
+	Material *m = inst->material;
+
+	setMaterial(flags, m->color, m->surfaceProps);
+
+	setTexture(0, m->texture);
+
+	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+	if((vsBits & VSLIGHT_MASK) == 0){
+		if(getAlphaTest())
+			defaultShader->use();
+		else
+			defaultShader_noAT->use();
+	}else{
+		if(getAlphaTest())
+			defaultShader_fullLight->use();
+		else
+			defaultShader_fullLight_noAT->use();
+	}
+
+	drawInst(header, inst);
+}
+
 void
 defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
 {
-	Material *m;
-
 	uint32 flags = atomic->geometry->flags;
 	setWorldMatrix(atomic->getFrame()->getLTM());
 	int32 vsBits = lightingCB(atomic);
@@ -159,32 +185,24 @@ defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
 	int32 n = header->numMeshes;
 
 	while(n--){
-		m = inst->material;
-
-		setMaterial(flags, m->color, m->surfaceProps);
-
-		setTexture(0, m->texture);
-
-		rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
-
-		if((vsBits & VSLIGHT_MASK) == 0){
-			if(getAlphaTest())
-				defaultShader->use();
-			else
-				defaultShader_noAT->use();
-		}else{
-			if(getAlphaTest())
-				defaultShader_fullLight->use();
-			else
-				defaultShader_fullLight_noAT->use();
-		}
-
-		drawInst(header, inst);
+		defaultRenderMesh(header, inst, flags, vsBits);
 		inst++;
 	}
 	teardownVertexInput(header);
 }
 
+void
+defaultRenderMeshCB(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic)
+{
+	if(!sameAtomic){
+		setWorldMatrix(atomic->getFrame()->getLTM());
+		header->vsBits = lightingCB(atomic);
+	}
+	setupVertexInput(header);
+	defaultRenderMesh(header, inst, atomic->geometry->flags, header->vsBits);
+	teardownVertexInput(header);
+}
+
 
 }
 }
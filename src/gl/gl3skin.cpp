@@ -19,6 +19,8 @@
 
 #include "rwgl3impl.h"
 
+#define PLUGIN_ID ID_SKIN
+
 namespace rw {
 namespace gl3 {
 
@@ -26,7 +28,48 @@ namespace gl3 {
 
 static Shader *skinShader, *skinShader_noAT;
 static Shader *skinShader_fullLight, *skinShader_fullLight_noAT;
+static Shader *skinShaderDQ, *skinShaderDQ_noAT;
+static Shader *skinShaderDQ_fullLight, *skinShaderDQ_fullLight_noAT;
 static int32 u_boneMatrices;
+static int32 u_boneDualQuats;
+
+// size of the palette in the shaders
+#define MAXBONES 64
+
+static bool32
+hasMeshPalettes(Skin *skin, Geometry *geo)
+{
+	return skin->meshPalettes && skin->numMeshes == (int32)geo->meshHeader->numMeshes;
+}
+
+// Bone indices relative to the palette of the mesh a vertex is used in.
+// Skin::splitGeometry makes sure this is the same for all meshes.
+static uint8*
+splitSkinIndices(Geometry *geo, Skin *skin)
+{
+	int32 i, j, k, n;
+	uint8 bones[256];
+	uint8 slots[256];
+	uint8 *indices;
+	uint32 v;
+	Mesh *m;
+
+	indices = rwNewT(uint8, geo->numVertices*4, MEMDUR_FUNCTION | ID_SKIN);
+	memcpy(indices, skin->indices, geo->numVertices*4);
+	m = geo->meshHeader->getMeshes();
+	for(i = 0; i < geo->meshHeader->numMeshes; i++){
+		n = skin->getSplitBones(i, bones);
+		memset(slots, 0, sizeof(slots));
+		for(j = 0; j < n; j++)
+			slots[bones[j]] = j;
+		for(j = 0; j < (int32)m[i].numIndices; j++){
+			v = geo->meshHeader->getIndex(&m[i], j);
+			for(k = 0; k < 4; k++)
+				indices[v*4+k] = slots[skin->indices[v*4+k]];
+		}
+	}
+	return indices;
+}
 
 void
 skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
@@ -48,22 +91,37 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 		// Positions
 		a->index = ATTRIB_POS;
-		a->size = 3;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
-		a->offset = stride;
-		stride += 12;
-		a++;
-
-		// Normals
-		// TODO: compress
-		if(hasNormals){
-			a->index = ATTRIB_NORMAL;
+		if(compactVertices){
+			a->size = 4;
+			a->type = GL_SHORT;
+			a->normalized = GL_TRUE;
+			a->offset = stride;
+			stride += 8;
+		}else{
 			a->size = 3;
 			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
 			stride += 12;
+		}
+		a++;
+
+		// Normals
+		if(hasNormals){
+			a->index = ATTRIB_NORMAL;
+			if(compactVertices){
+				a->size = 4;
+				a->type = GL_INT_2_10_10_10_REV;
+				a->normalized = GL_TRUE;
+				a->offset = stride;
+				stride += 4;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				a->offset = stride;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -82,20 +140,25 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			if(compactVertices){
+				a->type = GL_HALF_FLOAT;
+				stride += 4;
+			}else{
+				a->type = GL_FLOAT;
+				stride += 8;
+			}
 			a++;
 		}
 
 		// Weights
 		a->index = ATTRIB_WEIGHTS;
 		a->size = 4;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
+		a->type = GL_UNSIGNED_BYTE;
+		a->normalized = GL_TRUE;
 		a->offset = stride;
-		stride += 16;
+		stride += 4;
 		a++;
 
 		// Indices
@@ -108,6 +171,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		a++;
 
 		header->numAttribs = a - tmpAttribs;
+		header->vertexBufferSize = header->totalNumVertex*stride;
 		for(a = tmpAttribs; a != &tmpAttribs[header->numAttribs]; a++)
 			a->stride = stride;
 		header->attribDesc = rwNewT(AttribDesc, header->numAttribs, MEMDUR_EVENT | ID_GEOMETRY);
@@ -118,8 +182,6 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		// Allocate vertex buffer
 		//
 		header->vertexBuffer = rwNewT(uint8, header->totalNumVertex*stride, MEMDUR_EVENT | ID_GEOMETRY);
-		assert(header->vbo == 0);
-		glGenBuffers(1, &header->vbo);
 	}
 
 	Skin *skin = Skin::get(geo);
@@ -135,16 +197,15 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		instPositions(geo, header, a);
 	}
 
 	// Normals
 	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
+		instV3d(a->type == GL_FLOAT ? VERT_FLOAT3 : VERT_NORM1010102,
+			verts + a->offset,
 			geo->morphTargets[0].normals,
 			header->totalNumVertex, a->stride);
 	}
@@ -163,7 +224,8 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
 			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
 				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
+			instTexCoords(a->type == GL_FLOAT ? VERT_FLOAT2 : VERT_HALF2,
+				verts + a->offset,
 				geo->texCoords[n],
 				header->totalNumVertex, a->stride);
 		}
@@ -173,9 +235,8 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance){
 		for(a = attribs; a->index != ATTRIB_WEIGHTS; a++)
 			;
-		float *w = skin->weights;
-		instV4d(VERT_FLOAT4, verts + a->offset,
-			(V4d*)w,
+		instSkinWeights(VERT_UBYTE4N, verts + a->offset,
+			skin->weights,
 			header->totalNumVertex, a->stride);
 	}
 
@@ -183,23 +244,21 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance){
 		for(a = attribs; a->index != ATTRIB_INDICES; a++)
 			;
+		uint8 *indices = skin->indices;
+		// split skins index into the palette of their mesh
+		if(hasMeshPalettes(skin, geo)){
+			if(skin->boneLimit > MAXBONES)
+				RWERROR((ERR_GENERAL, "skin bone limit too high, only 64 bones are supported"));
+			indices = splitSkinIndices(geo, skin);
+		}else if(skin->numBones > MAXBONES)
+			RWERROR((ERR_GENERAL, "skin has too many bones, only 64 are supported"));
 		// not really colors of course but what the heck
 		instColor(VERT_RGBA, verts + a->offset,
-			  (RGBA*)skin->indices,
+			  (RGBA*)indices,
 			  header->totalNumVertex, a->stride);
+		if(indices != skin->indices)
+			rwFree(indices);
 	}
-
-#ifdef RW_GL_USE_VAOS
-	glBindVertexArray(header->vao);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-#endif
-	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
-#ifdef RW_GL_USE_VAOS
-	setAttribPointers(header->attribDesc, header->numAttribs);
-	glBindVertexArray(0);
-#endif
 }
 
 void
@@ -208,44 +267,42 @@ skinUninstanceCB(Geometry *geo, InstanceDataHeader *header)
 	assert(0 && "can't uninstance");
 }
 
-static float skinMatrices[64*16];
+// 3x4 per bone
+static float skinMatrices[MAXBONES*12];
 
 void
 uploadSkinMatrices(Atomic *a)
 {
-	int i;
 	Skin *skin = Skin::get(a->geometry);
-	Matrix *m = (Matrix*)skinMatrices;
-	HAnimHierarchy *hier = Skin::getHierarchy(a);
-
-	if(hier){
-		Matrix *invMats = (Matrix*)skin->inverseMatrices;
-		Matrix tmp;
-
-		assert(skin->numBones == hier->numNodes);
-		if(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES){
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(m, &invMats[i], &hier->matrices[i]);
-				m++;
-			}
-		}else{
-			Matrix invAtmMat;
-			Matrix::invert(&invAtmMat, a->getFrame()->getLTM());
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
-				Matrix::mult(m, &invMats[i], &tmp);
-				m++;
-			}
-		}
+	int32 n = skin->numBones < MAXBONES ? skin->numBones : MAXBONES;
+	memcpy(skinMatrices, Skin::getPalette(a), n*12*sizeof(float));
+	setUniform(u_boneMatrices, skinMatrices);
+}
+
+// mesh is -1 for the whole palette
+static void
+uploadSkinPalette(Atomic *a, bool32 dualQuat, int32 mesh)
+{
+	int32 i, n, sz;
+	uint8 bones[256];
+	Skin *skin = Skin::get(a->geometry);
+	float32 *palette;
+
+	// dual quaternions only need 8 floats per bone
+	sz = dualQuat ? 8 : 12;
+	palette = dualQuat ? Skin::getDualQuatPalette(a) : Skin::getPalette(a);
+	// bones past the limit are dropped, instancing complained already
+	if(mesh < 0){
+		n = skin->numBones < MAXBONES ? skin->numBones : MAXBONES;
+		memcpy(skinMatrices, palette, n*sz*sizeof(float));
 	}else{
-		for(i = 0; i < skin->numBones; i++){
-			m->setIdentity();
-			m++;
-		}
+		n = skin->getSplitBones(mesh, bones);
+		if(n > MAXBONES)
+			n = MAXBONES;
+		for(i = 0; i < n; i++)
+			memcpy(&skinMatrices[i*sz], &palette[bones[i]*sz], sz*sizeof(float));
 	}
-	setUniform(u_boneMatrices, skinMatrices);
+	setUniform(dualQuat ? u_boneDualQuats : u_boneMatrices, skinMatrices);
 }
 
 void
@@ -261,19 +318,37 @@ skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
 
 	InstanceData *inst = header->inst;
 	int32 n = header->numMeshes;
+	bool32 split = hasMeshPalettes(Skin::get(atomic->geometry), atomic->geometry);
+	bool32 dualQuat = Skin::getDualQuat(atomic);
 
-	uploadSkinMatrices(atomic);
+	if(!split)
+		uploadSkinPalette(atomic, dualQuat, -1);
 
 	while(n--){
 		m = inst->material;
 
+		if(split)
+			uploadSkinPalette(atomic, dualQuat, inst - header->inst);
+
 		setMaterial(flags, m->color, m->surfaceProps);
 
 		setTexture(0, m->texture);
 
 		rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
 
-		if((vsBits & VSLIGHT_MASK) == 0){
+		if(dualQuat){
+			if((vsBits & VSLIGHT_MASK) == 0){
+				if(getAlphaTest())
+					skinShaderDQ->use();
+				else
+					skinShaderDQ_noAT->use();
+			}else{
+				if(getAlphaTest())
+					skinShaderDQ_fullLight->use();
+				else
+					skinShaderDQ_fullLight_noAT->use();
+			}
+		}else if((vsBits & VSLIGHT_MASK) == 0){
 			if(getAlphaTest())
 				skinShader->use();
 			else
@@ -300,6 +375,8 @@ skinOpen(void *o, int32, int32)
 #include "shaders/skin_gl.inc"
 	const char *vs[] = { shaderDecl, header_vert_src, skin_vert_src, nil };
 	const char *vs_fullLight[] = { shaderDecl, "#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n", header_vert_src, skin_vert_src, nil };
+	const char *vsDQ[] = { shaderDecl, "#define DUALQUAT\n", header_vert_src, skin_vert_src, nil };
+	const char *vsDQ_fullLight[] = { shaderDecl, "#define DUALQUAT\n#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n", header_vert_src, skin_vert_src, nil };
 	const char *fs[] = { shaderDecl, header_frag_src, simple_frag_src, nil };
 	const char *fs_noAT[] = { shaderDecl, "#define NO_ALPHATEST\n", header_frag_src, simple_frag_src, nil };
 
@@ -313,6 +390,16 @@ skinOpen(void *o, int32, int32)
 	skinShader_fullLight_noAT = Shader::create(vs_fullLight, fs_noAT);
 	assert(skinShader_fullLight_noAT);
 
+	skinShaderDQ = Shader::create(vsDQ, fs);
+	assert(skinShaderDQ);
+	skinShaderDQ_noAT = Shader::create(vsDQ, fs_noAT);
+	assert(skinShaderDQ_noAT);
+
+	skinShaderDQ_fullLight = Shader::create(vsDQ_fullLight, fs);
+	assert(skinShaderDQ_fullLight);
+	skinShaderDQ_fullLight_noAT = Shader::create(vsDQ_fullLight, fs_noAT);
+	assert(skinShaderDQ_fullLight_noAT);
+
 	return o;
 }
 
@@ -330,6 +417,14 @@ skinClose(void *o, int32, int32)
 	skinShader_fullLight = nil;
 	skinShader_fullLight_noAT->destroy();
 	skinShader_fullLight_noAT = nil;
+	skinShaderDQ->destroy();
+	skinShaderDQ = nil;
+	skinShaderDQ_noAT->destroy();
+	skinShaderDQ_noAT = nil;
+	skinShaderDQ_fullLight->destroy();
+	skinShaderDQ_fullLight = nil;
+	skinShaderDQ_fullLight_noAT->destroy();
+	skinShaderDQ_fullLight_noAT = nil;
 
 	return o;
 }
@@ -337,7 +432,8 @@ skinClose(void *o, int32, int32)
 void
 initSkin(void)
 {
-	u_boneMatrices = registerUniform("u_boneMatrices", UNIFORM_MAT4, 64);
+	u_boneMatrices = registerUniform("u_boneMatrices", UNIFORM_VEC4, MAXBONES*3);
+	u_boneDualQuats = registerUniform("u_boneDualQuats", UNIFORM_VEC4, MAXBONES*2);
 
 	Driver::registerPlugin(PLATFORM_GL3, 0, ID_SKIN,
 	                       skinOpen, skinClose);
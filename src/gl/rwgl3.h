@@ -60,6 +60,12 @@ enum AttribIndices
 // default uniform indices
 extern int32 u_matColor;
 extern int32 u_surfProps;
+extern int32 u_posScale;
+extern int32 u_posOffset;
+
+// Instance new geometry with 16 bit positions relative to the bounding box,
+// 10:10:10:2 normals and half float texture coordinates.
+extern bool32 compactVertices;
 
 struct InstanceData
 {
@@ -70,19 +76,38 @@ struct InstanceData
 	bool32    vertexAlpha;
 	uint32    program;
 	uint32    offset;
+	uint32    indexType;	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 };
 
 struct InstanceDataHeader : rw::InstanceDataHeader
 {
 	uint32      serialNumber;
 	uint32      numMeshes;
-	uint16     *indexBuffer;
+	uint8      *indexBuffer;	// 16 and 32 bit indices, see InstanceData
 	uint32      primType;
 	uint8      *vertexBuffer;
 	int32       numAttribs;
 	AttribDesc *attribDesc;
 	uint32      totalNumIndex;
 	uint32      totalNumVertex;
+	// dequantization of compact positions, identity otherwise
+	V4d         posScale;
+	V4d         posOffset;
+	uint32      vertexBufferSize;
+	// Morphing geometry keeps positions and normals in a dynamic block at
+	// the start of the vertex buffer, they are reinstanced from the
+	// blended morph targets when the atomic's interpolator changes.
+	uint32      morphStreamSize;
+	int32       morphStart, morphEnd;
+	float32     morphValue;
+	V3d        *morphVertices;
+
+	uint32      indexBufferSize;
+	// vertex data was (re)instanced but not yet given to GL
+	bool32      needsUpload;
+	// lighting of the atomic last drawn by renderMeshCB,
+	// still valid for the following meshes of the same atomic
+	int32       vsBits;
 
 	uint32      ibo;
 	uint32      vbo;		// or 2?
@@ -221,14 +246,24 @@ public:
 	void init(void);
 	static ObjPipeline *create(void);
 
+	// Packs header->vertexBuffer and sets header->vertexBufferSize,
+	// uploadInstanceData does the glBufferData later.
+	// It may run in a job on another thread (Atomic::prepareInstances),
+	// so no GL calls, and the memory functions must be thread safe.
+	// Older callbacks that create and fill header->vbo themselves and
+	// leave the size at 0 still work, but not with prepareInstances.
 	void (*instanceCB)(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
 	void (*uninstanceCB)(Geometry *geo, InstanceDataHeader *header);
 	void (*renderCB)(Atomic *atomic, InstanceDataHeader *header);
+	// optional, draws one mesh for render queues
+	void (*renderMeshCB)(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic);
 };
 
 void defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+void instPositions(Geometry *geo, InstanceDataHeader *header, AttribDesc *a);
 void defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header);
 void defaultRenderCB(Atomic *atomic, InstanceDataHeader *header);
+void defaultRenderMeshCB(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic);
 int32 lightingCB(Atomic *atomic);
 int32 lightingCB(void);
 
@@ -7,7 +7,7 @@ VSOUT float v_fog;
 void
 main(void)
 {
-	vec4 Vertex = u_world * vec4(in_pos, 1.0);
+	vec4 Vertex = u_world * vec4(DecodePos(in_pos), 1.0);
 	gl_Position = u_proj * u_view * Vertex;
 	vec3 Normal = mat3(u_world) * in_normal;
 
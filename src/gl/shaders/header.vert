@@ -73,6 +73,12 @@ uniform vec4 u_lightColor[MAX_LIGHTS];
 uniform vec4 u_matColor;
 uniform vec4 u_surfProps;	// amb, spec, diff, extra
 
+// compact vertices store positions relative to the bounding box
+uniform vec4 u_posScale;
+uniform vec4 u_posOffset;
+
+#define DecodePos(p) ((p)*u_posScale.xyz + u_posOffset.xyz)
+
 #define surfAmbient (u_surfProps.x)
 #define surfSpecular (u_surfProps.y)
 #define surfDiffuse (u_surfProps.z)
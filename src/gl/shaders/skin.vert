@@ -1,4 +1,10 @@
-uniform mat4 u_boneMatrices[64];
+#ifdef DUALQUAT
+// real and dual part per bone
+uniform vec4 u_boneDualQuats[128];
+#else
+// 3x4 matrices, one row per vec4
+uniform vec4 u_boneMatrices[192];
+#endif
 
 VSIN(ATTRIB_POS)	vec3 in_pos;
 
@@ -9,12 +15,38 @@ VSOUT float v_fog;
 void
 main(void)
 {
+	vec3 InPos = DecodePos(in_pos);
 	vec3 SkinVertex = vec3(0.0, 0.0, 0.0);
 	vec3 SkinNormal = vec3(0.0, 0.0, 0.0);
+#ifdef DUALQUAT
+	vec4 Real = vec4(0.0, 0.0, 0.0, 0.0);
+	vec4 Dual = vec4(0.0, 0.0, 0.0, 0.0);
+	vec4 Real0 = u_boneDualQuats[int(in_indices[0])*2];
 	for(int i = 0; i < 4; i++){
-		SkinVertex += (u_boneMatrices[int(in_indices[i])] * vec4(in_pos, 1.0)).xyz * in_weights[i];
-		SkinNormal += (mat3(u_boneMatrices[int(in_indices[i])]) * in_normal) * in_weights[i];
+		int j = int(in_indices[i])*2;
+		// keep all rotations in the same hemisphere
+		float w = dot(Real0, u_boneDualQuats[j]) < 0.0 ? -in_weights[i] : in_weights[i];
+		Real += u_boneDualQuats[j]*w;
+		Dual += u_boneDualQuats[j+1]*w;
 	}
+	float len = length(Real);
+	Real /= len;
+	Dual /= len;
+	SkinVertex = InPos + 2.0*cross(Real.xyz, cross(Real.xyz, InPos) + Real.w*InPos) +
+		2.0*(Real.w*Dual.xyz - Dual.w*Real.xyz + cross(Real.xyz, Dual.xyz));
+	SkinNormal = in_normal + 2.0*cross(Real.xyz, cross(Real.xyz, in_normal) + Real.w*in_normal);
+#else
+	vec4 Pos = vec4(InPos, 1.0);
+	for(int i = 0; i < 4; i++){
+		int j = int(in_indices[i])*3;
+		SkinVertex += vec3(dot(u_boneMatrices[j], Pos),
+		                   dot(u_boneMatrices[j+1], Pos),
+		                   dot(u_boneMatrices[j+2], Pos)) * in_weights[i];
+		SkinNormal += vec3(dot(u_boneMatrices[j].xyz, in_normal),
+		                   dot(u_boneMatrices[j+1].xyz, in_normal),
+		                   dot(u_boneMatrices[j+2].xyz, in_normal)) * in_weights[i];
+	}
+#endif
 
 	vec4 Vertex = u_world * vec4(SkinVertex, 1.0);
 	gl_Position = u_proj * u_view * Vertex;
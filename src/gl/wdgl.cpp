@@ -83,6 +83,7 @@ uploadGeo(Geometry *geo)
 {
 	InstanceDataHeader *inst = (InstanceDataHeader*)geo->instData;
 	MeshHeader *meshHeader = geo->meshHeader;
+	assert(!meshHeader->index32);	// only 16 bit indices here
 
 	glGenBuffers(1, &inst->vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, inst->vbo);
@@ -19,6 +19,10 @@
 #include "gl/rwwdgl.h"
 #include "gl/rwgl3.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+
 #define PLUGIN_ID ID_HANIM
 
 namespace rw {
@@ -41,6 +45,7 @@ HAnimHierarchy::create(int32 numNodes, int32 *nodeFlags, int32 *nodeIDs,
 	hier->flags = flags;
 	hier->parentFrame = nil;
 	hier->parentHierarchy = hier;
+	hier->generation = nextGeneration();
 	if(hier->flags & NOMATRICES){
 		hier->matrices = nil;
 		hier->matricesUnaligned = nil;
@@ -131,6 +136,27 @@ HAnimHierarchy::getIndex(Frame *f)
 	return -1;
 }
 
+// Set weight in mask for node idx and all nodes below it
+void
+HAnimHierarchy::makeMask(float32 *mask, int32 idx, float32 weight)
+{
+	int32 i, depth;
+	int32 flags;
+	depth = 0;
+	for(i = idx; i < this->numNodes; i++){
+		mask[i] = weight;
+		flags = this->nodeInfo[i].flags;
+		// a push on the first node refers to its siblings
+		if(i != idx && flags & PUSH)
+			depth++;
+		if(flags & POP){
+			if(depth == 0)
+				break;
+			depth--;
+		}
+	}
+}
+
 HAnimHierarchy*
 HAnimHierarchy::get(Frame *f)
 {
@@ -191,6 +217,145 @@ HAnimHierarchy::updateMatrices(void)
 		node++;
 		curMat++;
 	}
+	this->generation = nextGeneration();
+}
+
+// Unique over all hierarchies so caches can't mix them up
+uint32
+HAnimHierarchy::nextGeneration(void)
+{
+	static uint32 generation;
+	return ++generation;
+}
+
+//
+// Batched update
+//
+
+struct HAnimBatchEntry
+{
+	HAnimHierarchy *hier;
+	float32 delta;
+	Matrix root;
+};
+
+// All hierarchies in a group have the same node layout
+struct HAnimBatchGroup
+{
+	HAnimBatchEntry *entries;
+	int32 numEntries;
+	int32 *parents;
+};
+
+// hierarchies per job
+#define BATCHCHUNK 8
+
+static int
+cmpTopology(const void *a, const void *b)
+{
+	HAnimHierarchy *ha = ((HAnimBatchEntry*)a)->hier;
+	HAnimHierarchy *hb = ((HAnimBatchEntry*)b)->hier;
+	if(ha->numNodes != hb->numNodes)
+		return ha->numNodes - hb->numNodes;
+	for(int32 i = 0; i < ha->numNodes; i++)
+		if(ha->nodeInfo[i].flags != hb->nodeInfo[i].flags)
+			return ha->nodeInfo[i].flags - hb->nodeInfo[i].flags;
+	return 0;
+}
+
+// Resolve the push/pop stack of updateMatrices into a parent index per node.
+// -1 is the root matrix.
+static void
+makeParentIndices(int32 *parents, HAnimNodeInfo *nodes, int32 numNodes)
+{
+	int32 *sp, stack[64];
+	int32 i, parent;
+
+	sp = stack;
+	parent = -1;
+	*sp++ = parent;
+	for(i = 0; i < numNodes; i++){
+		parents[i] = parent;
+		if(nodes[i].flags & HAnimHierarchy::PUSH)
+			*sp++ = parent;
+		parent = i;
+		if(nodes[i].flags & HAnimHierarchy::POP)
+			parent = *--sp;
+		assert(sp >= stack);
+		assert(sp <= &stack[64]);
+	}
+}
+
+static void
+updateBatchJob(void *data, int32 n)
+{
+	HAnimBatchGroup *grp = (HAnimBatchGroup*)data;
+	HAnimBatchEntry *e;
+	AnimInterpolator *anim;
+	Matrix animMat;
+	Matrix *mats;
+	int32 i, j, end;
+
+	end = (n+1)*BATCHCHUNK;
+	if(end > grp->numEntries)
+		end = grp->numEntries;
+	for(j = n*BATCHCHUNK; j < end; j++){
+		e = &grp->entries[j];
+		anim = e->hier->interpolator;
+		anim->addTime(e->delta);
+		mats = e->hier->matrices;
+		for(i = 0; i < e->hier->numNodes; i++){
+			anim->applyCB(&animMat, anim->getInterpFrame(i));
+			Matrix::mult(&mats[i], &animMat,
+			             grp->parents[i] < 0 ? &e->root : &mats[grp->parents[i]]);
+		}
+	}
+}
+
+// Advance the animations of many hierarchies and update their matrices.
+// Hierarchies with the same node layout are processed together
+// and the work is split up with Engine::jobfuncs.
+// deltas may be nil to only update the matrices.
+void
+HAnimHierarchy::updateBatch(HAnimHierarchy **hierarchies, float32 *deltas, int32 num)
+{
+	HAnimBatchEntry *entries;
+	HAnimBatchGroup grp;
+	HAnimHierarchy *hier;
+	Frame *frm, *parfrm;
+	int32 i, j;
+
+	if(num <= 0)
+		return;
+	entries = rwNewT(HAnimBatchEntry, num, MEMDUR_FUNCTION | ID_HANIM);
+	for(i = 0; i < num; i++){
+		hier = hierarchies[i];
+		entries[i].hier = hier;
+		entries[i].delta = deltas ? deltas[i] : 0.0f;
+		hier->generation = nextGeneration();
+		// getLTM may have to sync frames, so don't do this in the jobs
+		frm = hier->parentFrame;
+		if(frm && (parfrm = frm->getParent()) && !(hier->flags&LOCALSPACEMATRICES))
+			entries[i].root = *parfrm->getLTM();
+		else
+			entries[i].root.setIdentity();
+	}
+	qsort(entries, num, sizeof(HAnimBatchEntry), cmpTopology);
+
+	for(i = 0; i < num; i = j){
+		for(j = i+1; j < num; j++)
+			if(cmpTopology(&entries[i], &entries[j]) != 0)
+				break;
+		hier = entries[i].hier;
+		grp.entries = &entries[i];
+		grp.numEntries = j - i;
+		grp.parents = rwNewT(int32, hier->numNodes, MEMDUR_FUNCTION | ID_HANIM);
+		makeParentIndices(grp.parents, hier->nodeInfo, hier->numNodes);
+		Engine::jobfuncs.parallelFor(updateBatchJob, &grp,
+			(grp.numEntries + BATCHCHUNK-1)/BATCHCHUNK);
+		rwFree(grp.parents);
+	}
+	rwFree(entries);
 }
 
 HAnimData*
@@ -345,9 +510,222 @@ hAnimFrameGetSize(Animation *anim)
 	return anim->numFrames*(4 + 4*4 + 3*4 + 4);
 }
 
-//void hanimBlendCB(void *out, void *in1, void *in2, float32 a);
-//void hanimAddCB(void *out, void *in1, void *in2);
-//void hanimMulRecipCB(void *frame, void *start);
+//
+// Compressed key frames
+//
+
+// Quaternions are stored as the three smallest components,
+// the index of the largest one is in the top bits of c[0] and c[1].
+static void
+compressQuat(uint16 *c, const Quat &q)
+{
+	float32 v[4] = { q.x, q.y, q.z, q.w };
+	int32 i, j, largest;
+	float32 s, f;
+
+	largest = 0;
+	for(i = 1; i < 4; i++)
+		if(fabsf(v[i]) > fabsf(v[largest]))
+			largest = i;
+	// q and -q are the same rotation, the largest component is always positive
+	s = v[largest] < 0.0f ? -1.0f : 1.0f;
+	for(i = 0, j = 0; i < 4; i++){
+		if(i == largest)
+			continue;
+		// other components are in [-1/sqrt(2), 1/sqrt(2)]
+		f = (s*v[i]*1.41421356f + 1.0f)*0.5f;
+		f = fminf(fmaxf(f, 0.0f), 1.0f);
+		c[j] = (uint16)(f*32767.0f + 0.5f);
+		if(j < 2)
+			c[j] |= ((largest>>j)&1) << 15;
+		j++;
+	}
+}
+
+static Quat
+decompressQuat(const uint16 *c)
+{
+	float32 v[4];
+	int32 i, j, largest;
+	float32 sum;
+
+	largest = c[0]>>15 | (c[1]>>15)<<1;
+	sum = 0.0f;
+	for(i = 0, j = 0; i < 4; i++){
+		if(i == largest)
+			continue;
+		v[i] = ((c[j]&0x7FFF)/32767.0f*2.0f - 1.0f)*0.70710678f;
+		sum += v[i]*v[i];
+		j++;
+	}
+	v[largest] = sqrtf(fmaxf(1.0f - sum, 0.0f));
+	return makeQuat(v[3], v[0], v[1], v[2]);
+}
+
+static void
+compressTrans(uint16 *c, const V3d &t, HAnimCompressedCustomData *cust)
+{
+	float32 f[3];
+	f[0] = cust->scalar.x == 0.0f ? 0.0f : (t.x - cust->offset.x)/cust->scalar.x;
+	f[1] = cust->scalar.y == 0.0f ? 0.0f : (t.y - cust->offset.y)/cust->scalar.y;
+	f[2] = cust->scalar.z == 0.0f ? 0.0f : (t.z - cust->offset.z)/cust->scalar.z;
+	for(int32 i = 0; i < 3; i++)
+		c[i] = (uint16)(fminf(fmaxf(f[i], 0.0f), 1.0f)*65535.0f + 0.5f);
+}
+
+static V3d
+decompressTrans(const uint16 *c, HAnimCompressedCustomData *cust)
+{
+	return makeV3d(cust->offset.x + c[0]/65535.0f*cust->scalar.x,
+	               cust->offset.y + c[1]/65535.0f*cust->scalar.y,
+	               cust->offset.z + c[2]/65535.0f*cust->scalar.z);
+}
+
+static void
+hAnimCompressedFrameRead(Stream *stream, Animation *anim)
+{
+	HAnimCompressedKeyFrame *frames = (HAnimCompressedKeyFrame*)anim->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)anim->customData;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		frames[i].time = stream->readF32();
+		stream->read16(frames[i].q, 3*2);
+		stream->read16(frames[i].t, 3*2);
+		int32 prev = stream->readI32()/0x14;
+		frames[i].prev = &frames[prev];
+	}
+	stream->read32(&cust->offset, 3*4);
+	stream->read32(&cust->scalar, 3*4);
+}
+
+static void
+hAnimCompressedFrameWrite(Stream *stream, Animation *anim)
+{
+	HAnimCompressedKeyFrame *frames = (HAnimCompressedKeyFrame*)anim->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)anim->customData;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->writeF32(frames[i].time);
+		stream->write16(frames[i].q, 3*2);
+		stream->write16(frames[i].t, 3*2);
+		stream->writeI32((frames[i].prev - frames)*0x14);
+	}
+	stream->write32(&cust->offset, 3*4);
+	stream->write32(&cust->scalar, 3*4);
+}
+
+static uint32
+hAnimCompressedFrameGetSize(Animation *anim)
+{
+	return anim->numFrames*(4 + 3*2 + 3*2 + 4) + 2*3*4;
+}
+
+static void
+hanimCompressedInterpCB(void *vout, void *vin1, void *vin2, float32 t, void *custom)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimCompressedKeyFrame *in1 = (HAnimCompressedKeyFrame*)vin1;
+	HAnimCompressedKeyFrame *in2 = (HAnimCompressedKeyFrame*)vin2;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)custom;
+	assert(t >= in1->time && t <= in2->time);
+	float32 a = (t - in1->time)/(in2->time - in1->time);
+	out->t = lerp(decompressTrans(in1->t, cust), decompressTrans(in2->t, cust), a);
+	out->q = slerp(decompressQuat(in1->q), decompressQuat(in2->q), a);
+}
+
+// Delta translations can span twice the range of the animation,
+// they're kept at half the precision in a range widened at the end.
+static void
+hanimCompressedMulRecipCB(void *vframe, void *vstart, void *custom)
+{
+	HAnimCompressedKeyFrame *frame = (HAnimCompressedKeyFrame*)vframe;
+	HAnimCompressedKeyFrame *start = (HAnimCompressedKeyFrame*)vstart;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)custom;
+	int32 d;
+	if(frame == nil){
+		cust->offset = neg(cust->scalar);
+		cust->scalar = scale(cust->scalar, 2.0f);
+		return;
+	}
+	compressQuat(frame->q, mult(conj(decompressQuat(start->q)), decompressQuat(frame->q)));
+	for(int32 i = 0; i < 3; i++){
+		// (t - start + 65535)/2 decodes exactly in the widened range,
+		// halve it rounding ties to even so there's no bias
+		d = (int32)frame->t[i] - start->t[i] + 0xFFFF;
+		frame->t[i] = (uint16)((d >> 1) + (d & (d >> 1) & 1));
+	}
+}
+
+Animation*
+compressHAnimAnimation(Animation *anim)
+{
+	int32 i;
+	Animation *canim;
+	HAnimKeyFrame *frames;
+	HAnimCompressedKeyFrame *cframes;
+	HAnimCompressedCustomData *cust;
+	V3d min, max;
+
+	if(anim->interpInfo->id != 1){
+		RWERROR((ERR_GENERAL, "not an uncompressed HAnim animation"));
+		return nil;
+	}
+	canim = Animation::create(AnimInterpolatorInfo::find(HAnimCompressedKeyFrame::INTERPID), anim->numFrames,
+	                          anim->flags, anim->duration);
+	if(canim == nil)
+		return nil;
+	frames = (HAnimKeyFrame*)anim->keyframes;
+	cframes = (HAnimCompressedKeyFrame*)canim->keyframes;
+	cust = (HAnimCompressedCustomData*)canim->customData;
+
+	// translations are quantized in the range of the whole animation
+	min = max = anim->numFrames > 0 ? frames[0].t : makeV3d(0.0f, 0.0f, 0.0f);
+	for(i = 1; i < anim->numFrames; i++){
+		min.x = fminf(min.x, frames[i].t.x);
+		min.y = fminf(min.y, frames[i].t.y);
+		min.z = fminf(min.z, frames[i].t.z);
+		max.x = fmaxf(max.x, frames[i].t.x);
+		max.y = fmaxf(max.y, frames[i].t.y);
+		max.z = fmaxf(max.z, frames[i].t.z);
+	}
+	cust->offset = min;
+	cust->scalar = sub(max, min);
+
+	for(i = 0; i < anim->numFrames; i++){
+		cframes[i].prev = &cframes[frames[i].prev - frames];
+		cframes[i].time = frames[i].time;
+		compressQuat(cframes[i].q, frames[i].q);
+		compressTrans(cframes[i].t, frames[i].t, cust);
+	}
+	return canim;
+}
+
+Animation*
+decompressHAnimAnimation(Animation *canim)
+{
+	int32 i;
+	Animation *anim;
+	HAnimKeyFrame *frames;
+	HAnimCompressedKeyFrame *cframes;
+	HAnimCompressedCustomData *cust;
+
+	if(canim->interpInfo->id != HAnimCompressedKeyFrame::INTERPID){
+		RWERROR((ERR_GENERAL, "not a compressed HAnim animation"));
+		return nil;
+	}
+	anim = Animation::create(AnimInterpolatorInfo::find(1), canim->numFrames,
+	                         canim->flags, canim->duration);
+	if(anim == nil)
+		return nil;
+	frames = (HAnimKeyFrame*)anim->keyframes;
+	cframes = (HAnimCompressedKeyFrame*)canim->keyframes;
+	cust = (HAnimCompressedCustomData*)canim->customData;
+	for(i = 0; i < canim->numFrames; i++){
+		frames[i].prev = &frames[cframes[i].prev - cframes];
+		frames[i].time = cframes[i].time;
+		frames[i].q = decompressQuat(cframes[i].q);
+		frames[i].t = decompressTrans(cframes[i].t, cust);
+	}
+	return anim;
+}
 
 static void
 hanimApplyCB(void *result, void *frame)
@@ -370,6 +748,146 @@ assert(t >= in1->time && t <= in2->time);
 	out->q = slerp(in1->q, in2->q, a);
 }
 
+// normalized lerp that takes the shorter way around
+static Quat
+nlerp(const Quat &q1, const Quat &q2, float32 a)
+{
+	if(dot(q1, q2) < 0.0f)
+		return normalize(lerp(q1, negate(q2), a));
+	return normalize(lerp(q1, q2, a));
+}
+
+static void
+hanimBlendCB(void *vout, void *vin1, void *vin2, float32 a)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimInterpFrame *in1 = (HAnimInterpFrame*)vin1;
+	HAnimInterpFrame *in2 = (HAnimInterpFrame*)vin2;
+	out->q = nlerp(in1->q, in2->q, a);
+	out->t = lerp(in1->t, in2->t, a);
+}
+
+static void
+hanimAddCB(void *vout, void *vin1, void *vin2)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimInterpFrame *in1 = (HAnimInterpFrame*)vin1;
+	HAnimInterpFrame *in2 = (HAnimInterpFrame*)vin2;
+	out->q = mult(in1->q, in2->q);
+	out->t = add(in1->t, in2->t);
+}
+
+static void
+hanimMulRecipCB(void *vframe, void *vstart, void*)
+{
+	HAnimKeyFrame *frame = (HAnimKeyFrame*)vframe;
+	HAnimKeyFrame *start = (HAnimKeyFrame*)vstart;
+	if(frame == nil)
+		return;
+	frame->q = mult(conj(start->q), frame->q);
+	frame->t = sub(frame->t, start->t);
+}
+
+#ifdef RW_SSE2
+static inline __m128
+dot4(__m128 a, __m128 b)
+{
+	__m128 m = _mm_mul_ps(a, b);
+	m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2,3,0,1)));
+	return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,0,3,2)));
+}
+#endif
+
+// Same as hanimBlendCB but for all nodes at once
+static void
+blendFrames(AnimInterpolator *out, AnimInterpolator *in1, AnimInterpolator *in2,
+            float32 alpha, const float32 *mask)
+{
+	int32 i;
+	float32 a;
+	HAnimInterpFrame *fo, *f1, *f2;
+	for(i = 0; i < out->numNodes; i++){
+		fo = (HAnimInterpFrame*)out->getInterpFrame(i);
+		f1 = (HAnimInterpFrame*)in1->getInterpFrame(i);
+		f2 = (HAnimInterpFrame*)in2->getInterpFrame(i);
+		a = mask ? alpha*mask[i] : alpha;
+		if(a == 0.0f){
+			// masked out, nothing to blend
+			if(fo != f1){
+				fo->q = f1->q;
+				fo->t = f1->t;
+			}
+			continue;
+		}
+#ifdef RW_SSE2
+		__m128 q1 = _mm_loadu_ps(&f1->q.x);
+		__m128 q2 = _mm_loadu_ps(&f2->q.x);
+		// take the shorter way around
+		__m128 neg = _mm_cmplt_ps(dot4(q1, q2), _mm_setzero_ps());
+		q2 = _mm_xor_ps(q2, _mm_and_ps(neg, _mm_set1_ps(-0.0f)));
+		__m128 q = _mm_add_ps(q1, _mm_mul_ps(_mm_set1_ps(a), _mm_sub_ps(q2, q1)));
+		q = _mm_div_ps(q, _mm_sqrt_ps(dot4(q, q)));
+		_mm_storeu_ps(&fo->q.x, q);
+#else
+		fo->q = nlerp(f1->q, f2->q, a);
+#endif
+		fo->t = lerp(f1->t, f2->t, a);
+	}
+}
+
+// Cross-fade from in1 to in2. Blending happens on the interpolated frames,
+// so updateMatrices only has to be called on this hierarchy afterwards.
+bool32
+HAnimHierarchy::blend(HAnimHierarchy *in1, HAnimHierarchy *in2,
+                      float32 alpha, const float32 *mask)
+{
+	AnimInterpolator *out = this->interpolator;
+	if(in1->interpolator->applyCB != hanimApplyCB)
+		return out->blend(in1->interpolator, in2->interpolator, alpha, mask);
+	if(!out->setupCombine(in1->interpolator, in2->interpolator))
+		return 0;
+	blendFrames(out, in1->interpolator, in2->interpolator, alpha, mask);
+	return 1;
+}
+
+// Add a layer from a delta animation (Animation::makeDelta) in in2 on top of in1.
+bool32
+HAnimHierarchy::addTogether(HAnimHierarchy *in1, HAnimHierarchy *in2,
+                            float32 weight, const float32 *mask)
+{
+	int32 i;
+	float32 a;
+	Quat dq;
+	V3d dt;
+	HAnimInterpFrame *fo, *f1, *f2;
+	static Quat identity = { 0.0f, 0.0f, 0.0f, 1.0f };
+	AnimInterpolator *out = this->interpolator;
+
+	if(in1->interpolator->applyCB != hanimApplyCB){
+		if(weight == 1.0f && mask == nil)
+			return out->addTogether(in1->interpolator, in2->interpolator);
+		RWERROR((ERR_GENERAL, "interpolator can't add weighted"));
+		return 0;
+	}
+	if(!out->setupCombine(in1->interpolator, in2->interpolator))
+		return 0;
+	for(i = 0; i < out->numNodes; i++){
+		fo = (HAnimInterpFrame*)out->getInterpFrame(i);
+		f1 = (HAnimInterpFrame*)in1->interpolator->getInterpFrame(i);
+		f2 = (HAnimInterpFrame*)in2->interpolator->getInterpFrame(i);
+		a = mask ? weight*mask[i] : weight;
+		dq = f2->q;
+		dt = f2->t;
+		if(a != 1.0f){
+			dq = nlerp(identity, dq, a);
+			dt = scale(dt, a);
+		}
+		fo->q = mult(f1->q, dq);
+		fo->t = add(f1->t, dt);
+	}
+	return 1;
+}
+
 static void*
 hanimOpen(void *object, int32 offset, int32 size)
 {
@@ -379,14 +897,30 @@ hanimOpen(void *object, int32 offset, int32 size)
 	info->animKeyFrameSize = sizeof(HAnimKeyFrame);
 	info->customDataSize = 0;
 	info->applyCB = hanimApplyCB;
-	info->blendCB = nil;
+	info->blendCB = hanimBlendCB;
 	info->interpCB = hanimInterpCB;
-	info->addCB = nil;
-	info->mulRecipCB = nil;
+	info->addCB = hanimAddCB;
+	info->mulRecipCB = hanimMulRecipCB;
 	info->streamRead = hAnimFrameRead;
 	info->streamWrite = hAnimFrameWrite;
 	info->streamGetSize = hAnimFrameGetSize;
 	AnimInterpolatorInfo::registerInterp(info);
+
+	// same interpolated frames, so everything but interpolation is shared
+	info = rwNewT(AnimInterpolatorInfo, 1, MEMDUR_GLOBAL | ID_HANIM);
+	info->id = HAnimCompressedKeyFrame::INTERPID;
+	info->interpKeyFrameSize = sizeof(HAnimInterpFrame);
+	info->animKeyFrameSize = sizeof(HAnimCompressedKeyFrame);
+	info->customDataSize = sizeof(HAnimCompressedCustomData);
+	info->applyCB = hanimApplyCB;
+	info->blendCB = hanimBlendCB;
+	info->interpCB = hanimCompressedInterpCB;
+	info->addCB = hanimAddCB;
+	info->mulRecipCB = hanimCompressedMulRecipCB;
+	info->streamRead = hAnimCompressedFrameRead;
+	info->streamWrite = hAnimCompressedFrameWrite;
+	info->streamGetSize = hAnimCompressedFrameGetSize;
+	AnimInterpolatorInfo::registerInterp(info);
 	return object;
 }
 
@@ -394,6 +928,7 @@ static void*
 hanimClose(void *object, int32 offset, int32 size)
 {
 	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(1));
+	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(HAnimCompressedKeyFrame::INTERPID));
 	return object;
 }
 
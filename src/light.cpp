@@ -27,6 +27,8 @@ worldLightSync(ObjectWithFrame *obj)
 {
 	Light *light = (Light*)obj;
 	light->originalSync(obj);
+	if(light->world && light->getType() >= Light::POINT)
+		light->world->updateLight(light);
 }
 
 Light*
@@ -56,6 +58,8 @@ Light::create(int32 type)
 
 	// world extension
 	light->world = nil;
+	light->sector = nil;
+	light->inSector.init();
 	light->originalSync = light->object.syncCB;
 	light->object.syncCB = worldLightSync;
 
@@ -74,6 +78,14 @@ Light::destroy(void)
 	numAllocated--;
 }
 
+void
+Light::setRadius(float32 radius)
+{
+	this->radius = radius;
+	if(this->world && this->getType() >= Light::POINT)
+		this->world->updateLight(this);
+}
+
 void
 Light::setAngle(float32 angle)
 {
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_LODATOMIC
+
+namespace rw {
+
+LODAtomicGlobals lodAtomicGlobals;
+
+LODAtomic*
+LODAtomic::get(Atomic *a)
+{
+	return PLUGINOFFSET(LODAtomic, a, lodAtomicGlobals.atomicOffset);
+}
+
+static void*
+createLODAtomic(void *object, int32 offset, int32)
+{
+	LODAtomic *lod = PLUGINOFFSET(LODAtomic, object, offset);
+	memset(lod, 0, sizeof(LODAtomic));
+	return object;
+}
+
+static void*
+destroyLODAtomic(void *object, int32 offset, int32)
+{
+	LODAtomic *lod = PLUGINOFFSET(LODAtomic, object, offset);
+	LODAtomic *baselod;
+	Atomic *a = (Atomic*)object;
+	int32 i;
+
+	// unlink from the set
+	if(lod->base == a){
+		for(i = 1; i < lod->numLods; i++)
+			if(lod->lods[i])
+				LODAtomic::get(lod->lods[i])->base = nil;
+	}else if(lod->base){
+		baselod = LODAtomic::get(lod->base);
+		for(i = 0; i < baselod->numLods; i++)
+			if(baselod->lods[i] == a)
+				baselod->lods[i] = nil;
+	}
+	return object;
+}
+
+static void*
+copyLODAtomic(void *dst, void *, int32 offset, int32)
+{
+	// A clone is not part of any set
+	createLODAtomic(dst, offset, 0);
+	return dst;
+}
+
+bool32
+LODAtomic::setLOD(Atomic *base, int32 level, Atomic *lod, float32 range)
+{
+	LODAtomic *baselod = LODAtomic::get(base);
+	if(level < 0 || level >= MAXLOD){
+		RWERROR((ERR_GENERAL, "LOD level out of range"));
+		return 0;
+	}
+	baselod->base = base;
+	baselod->lods[0] = base;
+	baselod->lods[level] = lod;
+	baselod->ranges[level] = range;
+	if(level >= baselod->numLods)
+		baselod->numLods = level+1;
+	if(lod)
+		LODAtomic::get(lod)->base = base;
+	return 1;
+}
+
+/* Generate numLods-1 simplified levels of the base atomic and add them
+ * to the clump. ratios[i] is the fraction of triangles level i keeps,
+ * ranges[i] the camera distance up to which it is used.
+ * ratios[0] and ranges[0] belong to the base atomic.
+ * Returns the number of levels in the set. */
+int32
+LODAtomic::generate(Clump *clump, Atomic *base, float32 *ratios, float32 *ranges, int32 numLods)
+{
+	Atomic *a;
+	Geometry *geo;
+	int32 i;
+
+	if(numLods > MAXLOD)
+		numLods = MAXLOD;
+	if(base->geometry == nil || numLods < 1)
+		return 0;
+	LODAtomic::setLOD(base, 0, base, ranges[0]);
+	for(i = 1; i < numLods; i++){
+		geo = base->geometry->simplify(ratios[i]);
+		if(geo == nil)
+			break;
+		// the clone has the same pipeline and plugin data
+		a = base->clone();
+		a->setGeometry(geo, 0);
+		geo->destroy();
+		a->setFrame(base->getFrame());
+		a->setFlags(a->getFlags() & ~Atomic::RENDER);
+		clump->addAtomic(a);
+		LODAtomic::setLOD(base, i, a, ranges[i]);
+	}
+	return LODAtomic::get(base)->numLods;
+}
+
+/* Pick the level of every set in the clump by the distance from the
+ * camera to the base atomic's bounding sphere. Beyond the last range
+ * the last level stays. */
+void
+LODAtomic::select(Clump *clump, Camera *cam)
+{
+	Atomic *a;
+	LODAtomic *lod;
+	Sphere *s;
+	V3d campos;
+	float32 dist;
+	int32 i, level;
+
+	campos = cam->getFrame()->getLTM()->pos;
+	FORLIST(lnk, clump->atomics){
+		a = Atomic::fromClump(lnk);
+		lod = LODAtomic::get(a);
+		if(lod->base != a || lod->numLods == 0)
+			continue;
+		s = a->getWorldBoundingSphere();
+		dist = length(sub(s->center, campos)) - s->radius;
+		for(level = 0; level < lod->numLods-1; level++)
+			if(dist < lod->ranges[level])
+				break;
+		lod->currentLod = level;
+		for(i = 0; i < lod->numLods; i++){
+			if(lod->lods[i] == nil)
+				continue;
+			if(i == level)
+				lod->lods[i]->setFlags(lod->lods[i]->getFlags() | Atomic::RENDER);
+			else
+				lod->lods[i]->setFlags(lod->lods[i]->getFlags() & ~Atomic::RENDER);
+		}
+	}
+}
+
+void
+registerLODAtomicPlugin(void)
+{
+	lodAtomicGlobals.atomicOffset =
+		Atomic::registerPlugin(sizeof(LODAtomic), ID_LODATOMIC,
+		                       createLODAtomic, destroyLODAtomic, copyLODAtomic);
+}
+
+}
@@ -21,6 +21,8 @@
 #include "gl/rwgl3plg.h"
 #include "3ds/rw3ds.h"
 #include "3ds/rw3dsplg.h"
+#include "soft/rwsoft.h"
+#include "soft/rwsoftplg.h"
 
 #define PLUGIN_ID ID_MATFX
 
@@ -622,6 +624,7 @@ registerMatFXPlugin(void)
 	wdgl::initMatFX();
 	gl3::initMatFX();
 	c3d::initMatFX();
+	soft::initMatFX();
 
 	matFXGlobals.atomicOffset =
 	Atomic::registerPlugin(sizeof(int32), ID_MATFX,
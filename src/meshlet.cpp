@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_MESHLETS
+
+/*
+ * Meshlets partition the triangles of every mesh into small clusters.
+ * The triangles of a cluster are made contiguous in the mesh's index
+ * list so a visible cluster can be drawn as one index range.
+ * Every cluster has a bounding sphere and a normal cone for culling.
+ */
+
+namespace rw {
+
+MeshletGlobals meshletGlobals;
+
+struct MeshletBuilder
+{
+	uint32 *indices;
+	int32 numTris;
+	int32 *vertTris;	// triangles by vertex
+	int32 *vertFirst;
+	uint8 *emitted;
+	int32 *inCluster;	// stamp of the cluster the vertex is in
+	int32 cluster;
+	int32 clusterVerts[256];
+	int32 numClusterVerts;
+};
+
+static int32
+newVerts(MeshletBuilder *mb, int32 t)
+{
+	int32 n = 0;
+	for(int32 j = 0; j < 3; j++)
+		if(mb->inCluster[mb->indices[t*3+j]] != mb->cluster &&
+		   (j == 0 || mb->indices[t*3+j] != mb->indices[t*3]) &&
+		   (j < 2 || mb->indices[t*3+2] != mb->indices[t*3+1]))
+			n++;
+	return n;
+}
+
+static void
+addTriangle(MeshletBuilder *mb, int32 t)
+{
+	int32 v;
+	mb->emitted[t] = 1;
+	for(int32 j = 0; j < 3; j++){
+		v = mb->indices[t*3+j];
+		if(mb->inCluster[v] != mb->cluster){
+			mb->inCluster[v] = mb->cluster;
+			mb->clusterVerts[mb->numClusterVerts++] = v;
+		}
+	}
+}
+
+// Adjacent triangle that adds the fewest new vertices
+static int32
+findNextTriangle(MeshletBuilder *mb, int32 maxVerts)
+{
+	int32 i, k, t, n, v;
+	int32 best, bestNew;
+
+	best = -1;
+	bestNew = 4;
+	for(i = 0; i < mb->numClusterVerts; i++){
+		v = mb->clusterVerts[i];
+		for(k = mb->vertFirst[v]; k < mb->vertFirst[v+1]; k++){
+			t = mb->vertTris[k];
+			if(mb->emitted[t])
+				continue;
+			n = newVerts(mb, t);
+			if(mb->numClusterVerts + n > maxVerts)
+				continue;
+			if(n < bestNew || (n == bestNew && t < best)){
+				best = t;
+				bestNew = n;
+			}
+		}
+	}
+	return best;
+}
+
+static void
+calculateBounds(Meshlet *ml, uint32 *indices, V3d *verts)
+{
+	V3d min, max, p, n, axis;
+	V3d *normals;
+	float32 r, d, mindot, len;
+	int32 i, numTris;
+
+	numTris = ml->numTriangles;
+	min = max = verts[indices[0]];
+	for(i = 0; i < numTris*3; i++){
+		p = verts[indices[i]];
+		if(p.x < min.x) min.x = p.x;
+		if(p.y < min.y) min.y = p.y;
+		if(p.z < min.z) min.z = p.z;
+		if(p.x > max.x) max.x = p.x;
+		if(p.y > max.y) max.y = p.y;
+		if(p.z > max.z) max.z = p.z;
+	}
+	ml->bound.center = scale(add(min, max), 0.5f);
+	r = 0.0f;
+	for(i = 0; i < numTris*3; i++){
+		d = length(sub(verts[indices[i]], ml->bound.center));
+		if(d > r) r = d;
+	}
+	ml->bound.radius = r;
+
+	// normal cone
+	normals = rwNewT(V3d, numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	axis = makeV3d(0.0f, 0.0f, 0.0f);
+	for(i = 0; i < numTris; i++){
+		n = cross(sub(verts[indices[i*3+1]], verts[indices[i*3]]),
+		          sub(verts[indices[i*3+2]], verts[indices[i*3]]));
+		len = length(n);
+		normals[i] = len > 0.0f ? scale(n, 1.0f/len) : n;
+		axis = add(axis, normals[i]);
+	}
+	len = length(axis);
+	mindot = 1.0f;
+	if(len > 0.0f){
+		axis = scale(axis, 1.0f/len);
+		for(i = 0; i < numTris; i++){
+			d = dot(axis, normals[i]);
+			// degenerate triangles don't face anywhere
+			if(normals[i].x == 0.0f && normals[i].y == 0.0f && normals[i].z == 0.0f)
+				continue;
+			if(d < mindot) mindot = d;
+		}
+	}else
+		mindot = -1.0f;
+	rwFree(normals);
+	ml->coneAxis = axis;
+	// sine of the cone's half angle, 1.0 never culls
+	ml->coneCutoff = mindot <= 0.0f ? 1.0f : sqrtf(1.0f - mindot*mindot);
+}
+
+static void
+buildMeshMeshlets(Geometry *geo, Mesh *mesh, int32 meshIndex,
+	int32 maxVerts, int32 maxTris, Meshlet **meshlets, int32 *numMeshlets, int32 *space)
+{
+	MeshHeader *header = geo->meshHeader;
+	MeshletBuilder mb;
+	Meshlet *ml;
+	uint32 *out;
+	int32 i, j, v, t, n, start, first;
+	int32 numVerts = geo->numVertices;
+
+	mb.numTris = mesh->numIndices/3;
+	if(mb.numTris == 0)
+		return;
+	mb.indices = rwNewT(uint32, mb.numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < mb.numTris*3; i++)
+		mb.indices[i] = header->getIndex(mesh, i);
+	mb.vertFirst = rwNewT(int32, numVerts+1, MEMDUR_FUNCTION | ID_GEOMETRY);
+	mb.vertTris = rwNewT(int32, mb.numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	mb.emitted = rwNewT(uint8, mb.numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	mb.inCluster = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	out = rwNewT(uint32, mb.numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(mb.emitted, 0, mb.numTris);
+	memset(mb.vertFirst, 0, (numVerts+1)*sizeof(int32));
+	for(i = 0; i < numVerts; i++)
+		mb.inCluster[i] = -1;
+
+	// vertex -> triangle adjacency
+	for(i = 0; i < mb.numTris*3; i++)
+		mb.vertFirst[mb.indices[i]+1]++;
+	for(i = 0; i < numVerts; i++)
+		mb.vertFirst[i+1] += mb.vertFirst[i];
+	for(i = 0; i < mb.numTris*3; i++){
+		v = mb.indices[i];
+		mb.vertTris[mb.vertFirst[v]++] = i/3;
+	}
+	for(i = numVerts; i > 0; i--)
+		mb.vertFirst[i] = mb.vertFirst[i-1];
+	mb.vertFirst[0] = 0;
+
+	// Grow clusters over shared vertices,
+	// start a new one at the first free triangle.
+	mb.cluster = -1;
+	start = 0;
+	n = 0;
+	first = *numMeshlets;
+	while(n < mb.numTris){
+		while(mb.emitted[start])
+			start++;
+		if(*numMeshlets >= *space){
+			*space = *space*2 + 16;
+			*meshlets = rwResizeT(Meshlet, *meshlets, *space, MEMDUR_EVENT | ID_GEOMETRY);
+		}
+		ml = &(*meshlets)[(*numMeshlets)++];
+		ml->mesh = meshIndex;
+		ml->firstIndex = n*3;
+		ml->numTriangles = 0;
+		mb.cluster++;
+		mb.numClusterVerts = 0;
+		t = start;
+		do{
+			addTriangle(&mb, t);
+			for(j = 0; j < 3; j++)
+				out[n*3+j] = mb.indices[t*3+j];
+			n++;
+			ml->numTriangles++;
+			if(ml->numTriangles >= maxTris)
+				break;
+			t = findNextTriangle(&mb, maxVerts);
+		}while(t >= 0);
+		ml->numVertices = mb.numClusterVerts;
+	}
+
+	for(i = first; i < *numMeshlets; i++)
+		calculateBounds(&(*meshlets)[i], &out[(*meshlets)[i].firstIndex],
+			geo->morphTargets[0].vertices);
+
+	for(i = 0; i < mb.numTris*3; i++)
+		header->setIndex(mesh, i, out[i]);
+	rwFree(out);
+	rwFree(mb.indices);
+	rwFree(mb.inCluster);
+	rwFree(mb.emitted);
+	rwFree(mb.vertTris);
+	rwFree(mb.vertFirst);
+}
+
+Meshlets*
+Meshlets::build(Geometry *geo, int32 maxVertices, int32 maxTriangles)
+{
+	MeshHeader *header = geo->meshHeader;
+	Meshlets *mls;
+	Meshlet *meshlets;
+	Mesh *m;
+	int32 i, numMeshlets, space;
+
+	if(geo->flags & Geometry::NATIVE){
+		RWERROR((ERR_GENERAL, "can't build meshlets of native geometry"));
+		return nil;
+	}
+	if(header == nil || header->flags == MeshHeader::TRISTRIP){
+		RWERROR((ERR_GENERAL, "meshlets need triangle lists"));
+		return nil;
+	}
+	if(maxVertices < 3 || maxVertices > 256 || maxTriangles < 1){
+		RWERROR((ERR_GENERAL, "bad meshlet limits"));
+		return nil;
+	}
+
+	meshlets = nil;
+	numMeshlets = 0;
+	space = 0;
+	m = header->getMeshes();
+	for(i = 0; i < header->numMeshes; i++)
+		buildMeshMeshlets(geo, &m[i], i, maxVertices, maxTriangles,
+			&meshlets, &numMeshlets, &space);
+
+	Meshlets::destroy(geo);
+	mls = rwNewT(Meshlets, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	mls->numMeshlets = numMeshlets;
+	mls->meshlets = meshlets;
+	Meshlets::set(geo, mls);
+	geo->lockedSinceInst |= Geometry::LOCKPOLYGONS;
+	return mls;
+}
+
+void
+Meshlets::destroy(Geometry *geo)
+{
+	Meshlets *mls = Meshlets::get(geo);
+	if(mls){
+		rwFree(mls->meshlets);
+		rwFree(mls);
+		Meshlets::set(geo, nil);
+	}
+}
+
+int32
+Meshlets::cull(Atomic *atomic, Camera *cam, uint8 *visible)
+{
+	Meshlets *mls = Meshlets::get(atomic->geometry);
+	Matrix *ltm;
+	Meshlet *ml;
+	Sphere s;
+	V3d campos, axis, v;
+	float32 scl, d;
+	int32 i, numVisible;
+
+	if(mls == nil)
+		return 0;
+	ltm = atomic->getFrame()->getLTM();
+	campos = cam->getFrame()->getLTM()->pos;
+	// radius has to cover non-uniform scale too
+	scl = length(ltm->right);
+	d = length(ltm->up);
+	if(d > scl) scl = d;
+	d = length(ltm->at);
+	if(d > scl) scl = d;
+
+	numVisible = 0;
+	for(i = 0; i < mls->numMeshlets; i++){
+		ml = &mls->meshlets[i];
+		V3d::transformPoints(&s.center, &ml->bound.center, 1, ltm);
+		s.radius = ml->bound.radius*scl;
+		visible[i] = 0;
+		if(cam->frustumTestSphere(&s) == Camera::SPHEREOUTSIDE)
+			continue;
+		// the whole cluster faces away from the camera
+		if(ml->coneCutoff < 1.0f){
+			V3d::transformVectors(&axis, &ml->coneAxis, 1, ltm);
+			axis = normalize(axis);
+			v = sub(s.center, campos);
+			if(dot(v, axis) >= ml->coneCutoff*length(v) + s.radius)
+				continue;
+		}
+		visible[i] = 1;
+		numVisible++;
+	}
+	return numVisible;
+}
+
+static void*
+createMeshlets(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(Meshlets*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyMeshlets(void *object, int32, int32)
+{
+	Meshlets::destroy((Geometry*)object);
+	return object;
+}
+
+static void*
+copyMeshlets(void *dst, void *src, int32 offset, int32)
+{
+	Meshlets *srcmls = *PLUGINOFFSET(Meshlets*, src, offset);
+	Meshlets *dstmls;
+	if(srcmls == nil)
+		return dst;
+	dstmls = rwNewT(Meshlets, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	dstmls->numMeshlets = srcmls->numMeshlets;
+	dstmls->meshlets = rwNewT(Meshlet, srcmls->numMeshlets, MEMDUR_EVENT | ID_GEOMETRY);
+	memcpy(dstmls->meshlets, srcmls->meshlets, srcmls->numMeshlets*sizeof(Meshlet));
+	*PLUGINOFFSET(Meshlets*, dst, offset) = dstmls;
+	return dst;
+}
+
+static Stream*
+readMeshlets(Stream *stream, int32 len, void *object, int32 offset, int32)
+{
+	Meshlets *mls;
+	int32 n = stream->readI32();
+	if(len != 4 + n*(int32)sizeof(Meshlet)){
+		RWERROR((ERR_GENERAL, "bad meshlet chunk size"));
+		return nil;
+	}
+	mls = rwNewT(Meshlets, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	mls->numMeshlets = n;
+	mls->meshlets = rwNewT(Meshlet, n, MEMDUR_EVENT | ID_GEOMETRY);
+	stream->read32(mls->meshlets, n*sizeof(Meshlet));
+	*PLUGINOFFSET(Meshlets*, object, offset) = mls;
+	return stream;
+}
+
+static Stream*
+writeMeshlets(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	Meshlets *mls = *PLUGINOFFSET(Meshlets*, object, offset);
+	stream->writeI32(mls->numMeshlets);
+	stream->write32(mls->meshlets, mls->numMeshlets*sizeof(Meshlet));
+	return stream;
+}
+
+static int32
+getSizeMeshlets(void *object, int32 offset, int32)
+{
+	Meshlets *mls = *PLUGINOFFSET(Meshlets*, object, offset);
+	if(mls == nil)
+		return -1;
+	return 4 + mls->numMeshlets*sizeof(Meshlet);
+}
+
+void
+registerMeshletPlugin(void)
+{
+	meshletGlobals.geoOffset =
+		Geometry::registerPlugin(sizeof(Meshlets*), ID_MESHLETS,
+		                         createMeshlets, destroyMeshlets, copyMeshlets);
+	Geometry::registerPluginStream(ID_MESHLETS,
+	                               readMeshlets, writeMeshlets, getSizeMeshlets);
+}
+
+}
@@ -0,0 +1,1339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+#include "rwuserdata.h"
+
+#define PLUGIN_ID 2
+
+/*
+ * Vertex cache optimization of triangle list meshes.
+ *
+ * Triangles in each mesh are reordered with Tom Forsyth's
+ * "Linear-Speed Vertex Cache Optimisation" (a simulated LRU cache
+ * and a greedy choice of the best scoring triangle), then vertices
+ * are renumbered in order of first use so fetches are mostly linear.
+ *
+ * Vertex welding merges vertices whose attributes are all the same.
+ */
+
+namespace rw {
+
+#define CACHESIZE 32
+
+static float32
+vertexScore(int32 cachePos, int32 numTris)
+{
+	float32 score;
+
+	// no triangles left, never pick this vertex
+	if(numTris == 0)
+		return -1.0f;
+	score = 0.0f;
+	if(cachePos >= 0){
+		// the last triangle's vertices get a fixed score
+		// so we don't prefer them too much
+		if(cachePos < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cachePos-3)/(float32)(CACHESIZE-3), 1.5f);
+	}
+	// favour vertices with few triangles left to get rid of them
+	score += 2.0f/sqrtf((float32)numTris);
+	return score;
+}
+
+struct CacheVert
+{
+	int32 cachePos;
+	int32 numActive;	// triangles not yet emitted
+	int32 firstTri;		// into the adjacency list
+	float32 score;
+};
+
+static void
+optimizeMeshTriangles(MeshHeader *header, Mesh *m, CacheVert *verts, int32 numVertices)
+{
+	int32 numTris = m->numIndices/3;
+	int32 i, j, k, n, t, best;
+	uint32 v;
+	float32 bestScore;
+	uint32 *in, *out;
+	int32 *adj;
+	float32 *triScore;
+	uint8 *emitted;
+	uint32 cache[CACHESIZE+3];
+	uint32 newCache[CACHESIZE+3];
+	int32 cacheSize, newSize;
+
+	if(numTris < 2)
+		return;
+	in = rwNewT(uint32, numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numTris*3; i++)
+		in[i] = header->getIndex(m, i);
+
+	// build vertex -> triangle adjacency
+	for(i = 0; i < numVertices; i++){
+		verts[i].cachePos = -1;
+		verts[i].numActive = 0;
+	}
+	for(i = 0; i < numTris*3; i++)
+		verts[in[i]].numActive++;
+	n = 0;
+	for(i = 0; i < numVertices; i++){
+		verts[i].firstTri = n;
+		n += verts[i].numActive;
+		verts[i].score = vertexScore(-1, verts[i].numActive);
+		verts[i].numActive = 0;
+	}
+	adj = rwNewT(int32, numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numTris*3; i++){
+		v = in[i];
+		adj[verts[v].firstTri + verts[v].numActive++] = i/3;
+	}
+
+	triScore = rwNewT(float32, numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	emitted = rwNewT(uint8, numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	out = rwNewT(uint32, numTris*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(emitted, 0, numTris);
+	for(i = 0; i < numTris; i++)
+		triScore[i] = verts[in[i*3+0]].score +
+		              verts[in[i*3+1]].score +
+		              verts[in[i*3+2]].score;
+
+	cacheSize = 0;
+	best = -1;
+	for(n = 0; n < numTris; n++){
+		// nothing in the cache is connected to anything, do a full search
+		if(best < 0){
+			bestScore = -1.0f;
+			for(i = 0; i < numTris; i++)
+				if(!emitted[i] && triScore[i] > bestScore){
+					bestScore = triScore[i];
+					best = i;
+				}
+		}
+		assert(best >= 0);
+
+		t = best;
+		emitted[t] = 1;
+		newSize = 0;
+		for(j = 0; j < 3; j++){
+			v = in[t*3+j];
+			out[n*3+j] = v;
+			// remove triangle from active list
+			int32 *tris = &adj[verts[v].firstTri];
+			for(k = 0; k < verts[v].numActive; k++)
+				if(tris[k] == t){
+					tris[k] = tris[--verts[v].numActive];
+					break;
+				}
+			// degenerate triangles may reference a vertex twice
+			for(k = 0; k < newSize; k++)
+				if(newCache[k] == v)
+					break;
+			if(k == newSize)
+				newCache[newSize++] = v;
+		}
+		// move the rest of the old cache back
+		for(i = 0; i < cacheSize; i++){
+			v = cache[i];
+			for(k = 0; k < 3; k++)
+				if(in[t*3+k] == v)
+					break;
+			if(k == 3)
+				newCache[newSize++] = v;
+		}
+
+		// update scores of everything that was or is in the cache
+		for(i = 0; i < newSize; i++){
+			v = newCache[i];
+			verts[v].cachePos = i < CACHESIZE ? i : -1;
+			verts[v].score = vertexScore(verts[v].cachePos, verts[v].numActive);
+		}
+		best = -1;
+		bestScore = -1.0f;
+		for(i = 0; i < newSize; i++){
+			v = newCache[i];
+			int32 *tris = &adj[verts[v].firstTri];
+			for(k = 0; k < verts[v].numActive; k++){
+				t = tris[k];
+				triScore[t] = verts[in[t*3+0]].score +
+				              verts[in[t*3+1]].score +
+				              verts[in[t*3+2]].score;
+				if(triScore[t] > bestScore){
+					bestScore = triScore[t];
+					best = t;
+				}
+			}
+		}
+
+		cacheSize = newSize < CACHESIZE ? newSize : CACHESIZE;
+		memcpy(cache, newCache, cacheSize*sizeof(int32));
+	}
+
+	for(i = 0; i < numTris*3; i++)
+		header->setIndex(m, i, out[i]);
+	rwFree(out);
+	rwFree(in);
+	rwFree(emitted);
+	rwFree(triScore);
+	rwFree(adj);
+}
+
+static void
+permute(void *data, int32 size, int32 *remap, int32 num, uint8 *tmp)
+{
+	uint8 *src = (uint8*)data;
+	for(int32 i = 0; i < num; i++)
+		memcpy(&tmp[remap[i]*size], &src[i*size], size);
+	memcpy(data, tmp, num*size);
+}
+
+static void
+renumberVertices(Geometry *geo)
+{
+	MeshHeader *header = geo->meshHeader;
+	Mesh *m;
+	int32 i, j, n;
+	uint32 k;
+	int32 numVerts = geo->numVertices;
+	int32 *remap;
+	uint8 *tmp;
+	Skin *skin;
+	UserDataExtension *ext;
+	UserDataArray *a;
+
+	remap = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numVerts; i++)
+		remap[i] = -1;
+	// order of first use, unused vertices go to the end
+	n = 0;
+	m = header->getMeshes();
+	for(i = 0; i < header->numMeshes; i++)
+		for(k = 0; k < m[i].numIndices; k++)
+			if(remap[header->getIndex(&m[i], k)] < 0)
+				remap[header->getIndex(&m[i], k)] = n++;
+	for(i = 0; i < numVerts; i++)
+		if(remap[i] < 0)
+			remap[i] = n++;
+
+	for(i = 0; i < header->numMeshes; i++)
+		for(k = 0; k < m[i].numIndices; k++)
+			header->setIndex(&m[i], k, remap[header->getIndex(&m[i], k)]);
+	for(i = 0; i < geo->numTriangles; i++){
+		Triangle32 t = geo->getTriangle(i);
+		for(j = 0; j < 3; j++)
+			t.v[j] = remap[t.v[j]];
+		geo->setTriangle(i, t);
+	}
+
+	// largest vertex attribute is a float4 of skin weights
+	tmp = rwNewT(uint8, numVerts*16, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < geo->numMorphTargets; i++){
+		permute(geo->morphTargets[i].vertices, sizeof(V3d), remap, numVerts, tmp);
+		if(geo->morphTargets[i].normals)
+			permute(geo->morphTargets[i].normals, sizeof(V3d), remap, numVerts, tmp);
+	}
+	if(geo->colors)
+		permute(geo->colors, sizeof(RGBA), remap, numVerts, tmp);
+	for(i = 0; i < geo->numTexCoordSets; i++)
+		permute(geo->texCoords[i], sizeof(TexCoords), remap, numVerts, tmp);
+	skin = skinGlobals.geoOffset ? Skin::get(geo) : nil;
+	if(skin){
+		permute(skin->indices, 4, remap, numVerts, tmp);
+		permute(skin->weights, 4*sizeof(float32), remap, numVerts, tmp);
+	}
+	// user data with one element per vertex
+	ext = userDataGlobals.geometryOffset ? UserDataExtension::get(geo) : nil;
+	if(ext)
+		for(i = 0; i < ext->getCount(); i++){
+			a = ext->get(i);
+			if(a->numElements != numVerts || a->datatype == USERDATANA)
+				continue;
+			permute(a->data, a->datatype == USERDATASTRING ? sizeof(char*) : 4,
+				remap, numVerts, tmp);
+		}
+	rwFree(tmp);
+	rwFree(remap);
+}
+
+void
+Geometry::getVertexCacheStats(VertexCacheStats *stats, int32 cacheSize)
+{
+	MeshHeader *header = this->meshHeader;
+	Mesh *m;
+	int32 i, v, base, misses, numTris, numUsed;
+	uint32 k;
+	int32 *stamp;
+
+	stats->acmr = 0.0f;
+	stats->atvr = 0.0f;
+	if(header == nil || header->flags == MeshHeader::TRISTRIP ||
+	   this->numVertices == 0)
+		return;
+
+	// simulate a FIFO cache: a vertex is still cached if fewer than
+	// cacheSize misses happened since it was loaded
+	stamp = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numVertices; i++)
+		stamp[i] = -1;
+	misses = 0;
+	numTris = 0;
+	m = header->getMeshes();
+	for(i = 0; i < header->numMeshes; i++){
+		// every mesh is a separate draw call
+		base = misses;
+		for(k = 0; k < m[i].numIndices; k++){
+			v = header->getIndex(&m[i], k);
+			if(stamp[v] < base || misses - stamp[v] >= cacheSize)
+				stamp[v] = misses++;
+		}
+		numTris += m[i].numIndices/3;
+	}
+	numUsed = 0;
+	for(i = 0; i < this->numVertices; i++)
+		if(stamp[i] >= 0)
+			numUsed++;
+	rwFree(stamp);
+
+	if(numTris)
+		stats->acmr = (float32)misses/numTris;
+	if(numUsed)
+		stats->atvr = (float32)misses/numUsed;
+}
+
+bool32
+Geometry::optimizeVertexCache(VertexCacheStats *before, VertexCacheStats *after)
+{
+	MeshHeader *header = this->meshHeader;
+	CacheVert *verts;
+	Mesh *m;
+	int32 i, j;
+
+	if(this->flags & Geometry::NATIVE){
+		RWERROR((ERR_GENERAL, "can't optimize native geometry"));
+		return 0;
+	}
+	if(header == nil || header->flags == MeshHeader::TRISTRIP){
+		RWERROR((ERR_GENERAL, "can only optimize triangle lists"));
+		return 0;
+	}
+	if(before)
+		this->getVertexCacheStats(before);
+
+	verts = rwNewT(CacheVert, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	m = header->getMeshes();
+	for(i = 0; i < header->numMeshes; i++)
+		optimizeMeshTriangles(header, &m[i], verts, this->numVertices);
+	rwFree(verts);
+
+	// keep triangles in mesh order so buildMeshes gives the same result
+	if((uint32)this->numTriangles*3 == header->totalIndices){
+		Triangle32 tri;
+		int32 n = 0;
+		for(i = 0; i < header->numMeshes; i++){
+			int32 matid = this->matList.findIndex(m[i].material);
+			for(j = 0; j+2 < (int32)m[i].numIndices; j += 3){
+				tri.v[0] = header->getIndex(&m[i], j+0);
+				tri.v[1] = header->getIndex(&m[i], j+1);
+				tri.v[2] = header->getIndex(&m[i], j+2);
+				tri.matId = matid;
+				this->setTriangle(n++, tri);
+			}
+		}
+	}
+
+	renumberVertices(this);
+	this->lockedSinceInst |= LOCKALL;
+
+	if(after)
+		this->getVertexCacheStats(after);
+	return 1;
+}
+
+
+/*
+ * Welding
+ */
+
+struct WeldData
+{
+	Geometry *geo;
+	Skin *skin;
+	UserDataArray *userData[16];	// per-vertex arrays
+	int32 numUserData;
+	float32 eps;
+	float32 invEps;
+};
+
+static uint32
+quantizeBits(float32 f)
+{
+	uint32 u;
+	if(f == 0.0f)	// -0.0
+		return 0;
+	memcpy(&u, &f, 4);
+	return u;
+}
+
+// Cell of an epsilon sized grid, clamped so the conversion can't overflow.
+// Far out coordinates end up in the same cell, which only costs time.
+static int32
+cellCoord(WeldData *wd, float32 f)
+{
+	f = floorf(f*wd->invEps);
+	if(f > 1.0e9f) f = 1.0e9f;
+	if(f < -1.0e9f) f = -1.0e9f;
+	return (int32)f;
+}
+
+static uint32
+hashCombine(uint32 h, uint32 v)
+{
+	return (h ^ v)*0x01000193u;
+}
+
+static uint32
+hashEdge(int32 a, int32 b)
+{
+	return (a*0x9E3779B1u) ^ (b*0x85EBCA77u);
+}
+
+static uint32
+hashCell(int32 x, int32 y, int32 z)
+{
+	uint32 h = 0x811C9DC5u;
+	h = hashCombine(h, x);
+	h = hashCombine(h, y);
+	h = hashCombine(h, z);
+	return h;
+}
+
+// Only used without epsilon, with it vertices are hashed by position cell
+static uint32
+hashVertex(WeldData *wd, int32 v)
+{
+	Geometry *geo = wd->geo;
+	MorphTarget *mt;
+	UserDataArray *a;
+	int32 i;
+	uint32 h = 0x811C9DC5u;
+	uint32 u;
+	char *s;
+
+	for(i = 0; i < geo->numMorphTargets; i++){
+		mt = &geo->morphTargets[i];
+		h = hashCombine(h, quantizeBits(mt->vertices[v].x));
+		h = hashCombine(h, quantizeBits(mt->vertices[v].y));
+		h = hashCombine(h, quantizeBits(mt->vertices[v].z));
+		if(mt->normals){
+			h = hashCombine(h, quantizeBits(mt->normals[v].x));
+			h = hashCombine(h, quantizeBits(mt->normals[v].y));
+			h = hashCombine(h, quantizeBits(mt->normals[v].z));
+		}
+	}
+	if(geo->colors){
+		memcpy(&u, &geo->colors[v], 4);
+		h = hashCombine(h, u);
+	}
+	for(i = 0; i < geo->numTexCoordSets; i++){
+		h = hashCombine(h, quantizeBits(geo->texCoords[i][v].u));
+		h = hashCombine(h, quantizeBits(geo->texCoords[i][v].v));
+	}
+	if(wd->skin){
+		memcpy(&u, &wd->skin->indices[v*4], 4);
+		h = hashCombine(h, u);
+		for(i = 0; i < 4; i++)
+			h = hashCombine(h, quantizeBits(wd->skin->weights[v*4+i]));
+	}
+	for(i = 0; i < wd->numUserData; i++){
+		a = wd->userData[i];
+		switch(a->datatype){
+		case USERDATAINT:
+			h = hashCombine(h, a->getInt(v));
+			break;
+		case USERDATAFLOAT:
+			h = hashCombine(h, quantizeBits(a->getFloat(v)));
+			break;
+		case USERDATASTRING:
+			for(s = a->getString(v); s && *s; s++)
+				h = hashCombine(h, *s);
+			break;
+		}
+	}
+	return h;
+}
+
+static bool32
+equalFloat(WeldData *wd, float32 a, float32 b)
+{
+	if(wd->invEps > 0.0f)
+		return fabsf(a - b) <= wd->eps;
+	return quantizeBits(a) == quantizeBits(b);
+}
+
+static bool32
+equalV3d(WeldData *wd, V3d *a, V3d *b)
+{
+	return equalFloat(wd, a->x, b->x) &&
+		equalFloat(wd, a->y, b->y) &&
+		equalFloat(wd, a->z, b->z);
+}
+
+static bool32
+equalVertex(WeldData *wd, int32 v1, int32 v2)
+{
+	Geometry *geo = wd->geo;
+	MorphTarget *mt;
+	UserDataArray *a;
+	int32 i;
+	char *s1, *s2;
+
+	for(i = 0; i < geo->numMorphTargets; i++){
+		mt = &geo->morphTargets[i];
+		if(!equalV3d(wd, &mt->vertices[v1], &mt->vertices[v2]))
+			return 0;
+		if(mt->normals && !equalV3d(wd, &mt->normals[v1], &mt->normals[v2]))
+			return 0;
+	}
+	if(geo->colors &&
+	   !equal(geo->colors[v1], geo->colors[v2]))
+		return 0;
+	for(i = 0; i < geo->numTexCoordSets; i++)
+		if(!equalFloat(wd, geo->texCoords[i][v1].u, geo->texCoords[i][v2].u) ||
+		   !equalFloat(wd, geo->texCoords[i][v1].v, geo->texCoords[i][v2].v))
+			return 0;
+	if(wd->skin){
+		if(memcmp(&wd->skin->indices[v1*4], &wd->skin->indices[v2*4], 4) != 0)
+			return 0;
+		for(i = 0; i < 4; i++)
+			if(!equalFloat(wd, wd->skin->weights[v1*4+i], wd->skin->weights[v2*4+i]))
+				return 0;
+	}
+	for(i = 0; i < wd->numUserData; i++){
+		a = wd->userData[i];
+		switch(a->datatype){
+		case USERDATAINT:
+			if(a->getInt(v1) != a->getInt(v2))
+				return 0;
+			break;
+		case USERDATAFLOAT:
+			if(!equalFloat(wd, a->getFloat(v1), a->getFloat(v2)))
+				return 0;
+			break;
+		case USERDATASTRING:
+			s1 = a->getString(v1);
+			s2 = a->getString(v2);
+			if(s1 != s2 && (s1 == nil || s2 == nil || strcmp(s1, s2) != 0))
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+// With epsilon, vertices within reach can be in any of the neighbouring
+// cells, so all of them are searched. Returns the index of the kept vertex.
+static int32
+findNearVertex(WeldData *wd, int32 v, int32 *heads, int32 *next, int32 *orig, int32 hashSize)
+{
+	V3d *p = &wd->geo->morphTargets[0].vertices[v];
+	int32 x, y, z, j;
+	int32 cx = cellCoord(wd, p->x);
+	int32 cy = cellCoord(wd, p->y);
+	int32 cz = cellCoord(wd, p->z);
+	for(z = cz-1; z <= cz+1; z++)
+	for(y = cy-1; y <= cy+1; y++)
+	for(x = cx-1; x <= cx+1; x++)
+		for(j = heads[hashCell(x, y, z) & (hashSize-1)]; j >= 0; j = next[j])
+			if(equalVertex(wd, orig[j], v))
+				return j;
+	return -1;
+}
+
+// Drop the triangles welding collapsed, from the mesh lists too.
+// Strips keep theirs, they're harmless and stitch the strip together.
+static void
+removeDegenerates(Geometry *geo)
+{
+	MeshHeader *header;
+	Mesh *m;
+	Triangle32 t;
+	uint32 a, b, c, j, k;
+	int32 i, n;
+
+	n = 0;
+	for(i = 0; i < geo->numTriangles; i++){
+		t = geo->getTriangle(i);
+		if(t.v[0] == t.v[1] || t.v[1] == t.v[2] || t.v[0] == t.v[2])
+			continue;
+		geo->setTriangle(n++, t);
+	}
+	geo->numTriangles = n;
+
+	header = geo->meshHeader;
+	if(header == nil || header->flags == MeshHeader::TRISTRIP)
+		return;
+	m = header->getMeshes();
+	header->totalIndices = 0;
+	for(i = 0; i < (int32)header->numMeshes; i++){
+		k = 0;
+		for(j = 0; j+2 < m[i].numIndices; j += 3){
+			a = header->getIndex(&m[i], j);
+			b = header->getIndex(&m[i], j+1);
+			c = header->getIndex(&m[i], j+2);
+			if(a == b || b == c || a == c)
+				continue;
+			header->setIndex(&m[i], k++, a);
+			header->setIndex(&m[i], k++, b);
+			header->setIndex(&m[i], k++, c);
+		}
+		m[i].numIndices = k;
+		header->totalIndices += k;
+	}
+	// index counts changed, instance everything again
+	header->serialNum++;
+}
+
+// Move element orig[i] to i, orig[i] >= i so this works in place
+static void
+compact(void *data, int32 size, int32 *orig, int32 num)
+{
+	uint8 *p = (uint8*)data;
+	for(int32 i = 0; i < num; i++)
+		if(orig[i] != i)
+			memcpy(&p[i*size], &p[orig[i]*size], size);
+}
+
+int32
+Geometry::weldVertices(float32 epsilon)
+{
+	WeldData wd;
+	UserDataExtension *ext;
+	UserDataArray *a;
+	MeshHeader *header;
+	Mesh *m;
+	int32 *remap, *orig, *heads, *next;
+	int32 i, j, k, n, hashSize;
+	uint32 l;
+	uint32 h;
+	char **strings;
+
+	if(this->flags & Geometry::NATIVE){
+		RWERROR((ERR_GENERAL, "can't weld native geometry"));
+		return 0;
+	}
+	if(this->numVertices == 0)
+		return 0;
+
+	wd.geo = this;
+	wd.skin = skinGlobals.geoOffset ? Skin::get(this) : nil;
+	wd.eps = epsilon;
+	wd.invEps = epsilon > 0.0f ? 1.0f/epsilon : 0.0f;
+	// Arrays with one element per vertex are vertex data,
+	// they have to match and are compacted like everything else.
+	wd.numUserData = 0;
+	ext = userDataGlobals.geometryOffset ? UserDataExtension::get(this) : nil;
+	if(ext)
+		for(i = 0; i < ext->getCount(); i++){
+			a = ext->get(i);
+			if(a->numElements != this->numVertices ||
+			   a->datatype == USERDATANA)
+				continue;
+			if(wd.numUserData == nelem(wd.userData)){
+				RWERROR((ERR_GENERAL, "too many user data arrays"));
+				return 0;
+			}
+			wd.userData[wd.numUserData++] = a;
+		}
+
+	hashSize = 16;
+	while(hashSize < this->numVertices*2)
+		hashSize *= 2;
+	heads = rwNewT(int32, hashSize, MEMDUR_FUNCTION | ID_GEOMETRY);
+	next = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	remap = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	orig = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < hashSize; i++)
+		heads[i] = -1;
+
+	// the first of equal vertices stays, in original order
+	n = 0;
+	for(i = 0; i < this->numVertices; i++){
+		if(wd.invEps > 0.0f){
+			V3d *p = &this->morphTargets[0].vertices[i];
+			h = hashCell(cellCoord(&wd, p->x), cellCoord(&wd, p->y),
+				cellCoord(&wd, p->z)) & (hashSize-1);
+			j = findNearVertex(&wd, i, heads, next, orig, hashSize);
+		}else{
+			h = hashVertex(&wd, i) & (hashSize-1);
+			for(j = heads[h]; j >= 0; j = next[j])
+				if(equalVertex(&wd, orig[j], i))
+					break;
+		}
+		if(j >= 0){
+			remap[i] = j;
+			continue;
+		}
+		orig[n] = i;
+		next[n] = heads[h];
+		heads[h] = n;
+		remap[i] = n++;
+	}
+	rwFree(next);
+	rwFree(heads);
+
+	if(n == this->numVertices){
+		rwFree(orig);
+		rwFree(remap);
+		return 0;
+	}
+
+	// Indices
+	for(i = 0; i < this->numTriangles; i++){
+		Triangle32 t = this->getTriangle(i);
+		for(k = 0; k < 3; k++)
+			t.v[k] = remap[t.v[k]];
+		this->setTriangle(i, t);
+	}
+	header = this->meshHeader;
+	if(header){
+		m = header->getMeshes();
+		for(i = 0; i < header->numMeshes; i++)
+			for(l = 0; l < m[i].numIndices; l++)
+				header->setIndex(&m[i], l, remap[header->getIndex(&m[i], l)]);
+	}
+	removeDegenerates(this);
+
+	// Vertex data, the storage isn't shrunk
+	for(i = 0; i < this->numMorphTargets; i++){
+		compact(this->morphTargets[i].vertices, sizeof(V3d), orig, n);
+		if(this->morphTargets[i].normals)
+			compact(this->morphTargets[i].normals, sizeof(V3d), orig, n);
+	}
+	if(this->colors)
+		compact(this->colors, sizeof(RGBA), orig, n);
+	for(i = 0; i < this->numTexCoordSets; i++)
+		compact(this->texCoords[i], sizeof(TexCoords), orig, n);
+	if(wd.skin){
+		compact(wd.skin->indices, 4, orig, n);
+		compact(wd.skin->weights, 4*sizeof(float32), orig, n);
+	}
+	for(i = 0; i < wd.numUserData; i++){
+		a = wd.userData[i];
+		if(a->datatype == USERDATASTRING){
+			// free strings that are dropped
+			strings = (char**)a->data;
+			for(j = 0; j < this->numVertices; j++)
+				if(orig[remap[j]] != j)
+					rwFree(strings[j]);
+			compact(a->data, sizeof(char*), orig, n);
+		}else
+			compact(a->data, 4, orig, n);
+		a->numElements = n;
+	}
+
+	k = this->numVertices - n;
+	this->numVertices = n;
+	this->lockedSinceInst |= LOCKALL;
+	rwFree(orig);
+	rwFree(remap);
+	return k;
+}
+
+
+/*
+ * Simplification
+ *
+ * Garland-Heckbert quadric error metric with half edge collapses,
+ * so surviving vertices keep all their attributes (UVs, colours,
+ * skin weights) unchanged. Vertices on material borders and open
+ * boundaries are never moved. UV or normal seams (more than one vertex
+ * at a position) are collapsed together with their twins on the other
+ * side, so a seam can only get shorter along itself and never tears.
+ */
+
+// More vertices than this at one position are left alone
+#define MAXSEAMVERTS 16
+
+struct Quadric
+{
+	float32 a2, ab, ac, ad;
+	float32 b2, bc, bd;
+	float32 c2, cd;
+	float32 d2;
+};
+
+static void
+addPlane(Quadric *q, V3d n, float32 d, float32 w)
+{
+	q->a2 += w*n.x*n.x; q->ab += w*n.x*n.y; q->ac += w*n.x*n.z; q->ad += w*n.x*d;
+	q->b2 += w*n.y*n.y; q->bc += w*n.y*n.z; q->bd += w*n.y*d;
+	q->c2 += w*n.z*n.z; q->cd += w*n.z*d;
+	q->d2 += w*d*d;
+}
+
+static void
+addQuadric(Quadric *q, Quadric *r)
+{
+	float32 *a = (float32*)q;
+	float32 *b = (float32*)r;
+	for(int32 i = 0; i < 10; i++)
+		a[i] += b[i];
+}
+
+static float32
+quadricError(Quadric *q, Quadric *r, V3d p)
+{
+	Quadric s = *q;
+	addQuadric(&s, r);
+	float32 e = s.a2*p.x*p.x + 2.0f*s.ab*p.x*p.y + 2.0f*s.ac*p.x*p.z + 2.0f*s.ad*p.x +
+		s.b2*p.y*p.y + 2.0f*s.bc*p.y*p.z + 2.0f*s.bd*p.y +
+		s.c2*p.z*p.z + 2.0f*s.cd*p.z +
+		s.d2;
+	return e < 0.0f ? 0.0f : e;
+}
+
+struct Collapse
+{
+	float32 cost;
+	int32 u, v;	// move u onto v
+	uint32 stamp;
+};
+
+struct SimplifyData
+{
+	Geometry *geo;
+	V3d *pos;
+	Quadric *quadrics;
+	Triangle32 *tris;	// working copy
+	uint8 *deadTri;
+	int32 *firstCorner;	// per vertex list of tri*3+k
+	int32 *nextCorner;
+	int32 *lastCorner;
+	int32 *sameNext;	// ring of vertices at the same position
+	uint8 *locked;
+	uint8 *removed;
+	uint32 *stamp;
+	Collapse *heap;
+	int32 heapSize;
+	int32 heapSpace;
+};
+
+static void
+heapPush(SimplifyData *sd, Collapse *c)
+{
+	int32 i, p;
+	if(sd->heapSize >= sd->heapSpace){
+		sd->heapSpace = sd->heapSpace*2 + 64;
+		sd->heap = rwResizeT(Collapse, sd->heap, sd->heapSpace, MEMDUR_FUNCTION | ID_GEOMETRY);
+	}
+	i = sd->heapSize++;
+	while(i > 0){
+		p = (i-1)/2;
+		if(sd->heap[p].cost <= c->cost)
+			break;
+		sd->heap[i] = sd->heap[p];
+		i = p;
+	}
+	sd->heap[i] = *c;
+}
+
+static void
+heapPop(SimplifyData *sd, Collapse *c)
+{
+	int32 i, k;
+	Collapse last;
+	*c = sd->heap[0];
+	last = sd->heap[--sd->heapSize];
+	i = 0;
+	for(;;){
+		k = i*2+1;
+		if(k >= sd->heapSize)
+			break;
+		if(k+1 < sd->heapSize && sd->heap[k+1].cost < sd->heap[k].cost)
+			k++;
+		if(last.cost <= sd->heap[k].cost)
+			break;
+		sd->heap[i] = sd->heap[k];
+		i = k;
+	}
+	sd->heap[i] = last;
+}
+
+// Find the cheapest neighbour to collapse u onto and queue it
+static float32
+collapseCost(SimplifyData *sd, int32 u, int32 v)
+{
+	Quadric qu, qv;
+	int32 w;
+
+	// the error of the whole position, all attribute splits together
+	memset(&qu, 0, sizeof(qu));
+	memset(&qv, 0, sizeof(qv));
+	w = u;
+	do{
+		addQuadric(&qu, &sd->quadrics[w]);
+		w = sd->sameNext[w];
+	}while(w != u);
+	w = v;
+	do{
+		addQuadric(&qv, &sd->quadrics[w]);
+		w = sd->sameNext[w];
+	}while(w != v);
+	return quadricError(&qu, &qv, sd->pos[v]);
+}
+
+static void
+queueVertex(SimplifyData *sd, int32 u)
+{
+	Collapse c;
+	Triangle32 *t;
+	int32 k, j, v;
+	float32 cost;
+
+	sd->stamp[u]++;
+	if(sd->locked[u] || sd->removed[u])
+		return;
+	c.cost = -1.0f;
+	for(k = sd->firstCorner[u]; k >= 0; k = sd->nextCorner[k]){
+		if(sd->deadTri[k/3])
+			continue;
+		t = &sd->tris[k/3];
+		for(j = 1; j < 3; j++){
+			v = t->v[(k%3 + j) % 3];
+			cost = collapseCost(sd, u, v);
+			if(c.cost < 0.0f || cost < c.cost){
+				c.cost = cost;
+				c.v = v;
+			}
+		}
+	}
+	if(c.cost < 0.0f)
+		return;
+	c.u = u;
+	c.stamp = sd->stamp[u];
+	heapPush(sd, &c);
+}
+
+static V3d
+triNormal(V3d a, V3d b, V3d c)
+{
+	return cross(sub(b, a), sub(c, a));
+}
+
+// Would moving u onto v flip or squash a triangle?
+static bool32
+collapseFlips(SimplifyData *sd, uint32 u, uint32 v)
+{
+	Triangle32 *t;
+	V3d p[3], n0, n1;
+	int32 k, j;
+	bool32 hasV;
+
+	for(k = sd->firstCorner[u]; k >= 0; k = sd->nextCorner[k]){
+		if(sd->deadTri[k/3])
+			continue;
+		t = &sd->tris[k/3];
+		hasV = 0;
+		for(j = 0; j < 3; j++){
+			if(t->v[j] == v)
+				hasV = 1;
+			p[j] = sd->pos[t->v[j]];
+		}
+		// this one goes away
+		if(hasV)
+			continue;
+		n0 = triNormal(p[0], p[1], p[2]);
+		p[k%3] = sd->pos[v];
+		n1 = triNormal(p[0], p[1], p[2]);
+		if(dot(n0, n1) <= 0.2f*length(n0)*length(n1))
+			return 1;
+	}
+	return 0;
+}
+
+static void
+doCollapse(SimplifyData *sd, uint32 u, uint32 v, int32 *numTris)
+{
+	Triangle32 *t;
+	int32 k, j, w;
+	bool32 hasV;
+
+	for(k = sd->firstCorner[u]; k >= 0; k = sd->nextCorner[k]){
+		if(sd->deadTri[k/3])
+			continue;
+		t = &sd->tris[k/3];
+		hasV = 0;
+		for(j = 0; j < 3; j++)
+			if(t->v[j] == v)
+				hasV = 1;
+		if(hasV){
+			sd->deadTri[k/3] = 1;
+			(*numTris)--;
+		}else
+			t->v[k%3] = v;
+	}
+	// u's corners now belong to v
+	if(sd->firstCorner[u] >= 0){
+		if(sd->firstCorner[v] < 0)
+			sd->firstCorner[v] = sd->firstCorner[u];
+		else
+			sd->nextCorner[sd->lastCorner[v]] = sd->firstCorner[u];
+		sd->lastCorner[v] = sd->lastCorner[u];
+	}
+	sd->firstCorner[u] = -1;
+	sd->removed[u] = 1;
+	addQuadric(&sd->quadrics[v], &sd->quadrics[u]);
+
+	// costs around v changed
+	queueVertex(sd, v);
+	for(k = sd->firstCorner[v]; k >= 0; k = sd->nextCorner[k]){
+		if(sd->deadTri[k/3])
+			continue;
+		t = &sd->tris[k/3];
+		for(j = 1; j < 3; j++){
+			w = t->v[(k%3 + j) % 3];
+			queueVertex(sd, w);
+		}
+	}
+}
+
+static void
+lockPosition(SimplifyData *sd, int32 v)
+{
+	int32 w = v;
+	do{
+		sd->locked[w] = 1;
+		w = sd->sameNext[w];
+	}while(w != v);
+}
+
+static void
+findLockedVertices(SimplifyData *sd)
+{
+	Geometry *geo = sd->geo;
+	Triangle32 *t;
+	int32 numVerts = geo->numVertices;
+	int32 i, j, k, a, b, n, hashSize;
+	uint32 h;
+	int32 *heads, *next, *matOf, *rep;
+	bool32 found;
+
+	memset(sd->locked, 0, numVerts);
+
+	// Link up vertices at the same position, rep is the first of them.
+	// Everything below works on positions so seams don't count as borders.
+	hashSize = 16;
+	while(hashSize < numVerts*2)
+		hashSize *= 2;
+	heads = rwNewT(int32, hashSize, MEMDUR_FUNCTION | ID_GEOMETRY);
+	next = rwNewT(int32, numVerts > geo->numTriangles*3 ? numVerts : geo->numTriangles*3,
+		MEMDUR_FUNCTION | ID_GEOMETRY);
+	rep = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < hashSize; i++)
+		heads[i] = -1;
+	for(i = 0; i < numVerts; i++){
+		h = (quantizeBits(sd->pos[i].x)*0x9E3779B1u ^
+		     quantizeBits(sd->pos[i].y)*0x85EBCA77u ^
+		     quantizeBits(sd->pos[i].z)*0xC2B2AE3Du) & (hashSize-1);
+		for(j = heads[h]; j >= 0; j = next[j])
+			if(equal(sd->pos[i], sd->pos[j]))
+				break;
+		if(j >= 0){
+			rep[i] = rep[j];
+			sd->sameNext[i] = sd->sameNext[rep[i]];
+			sd->sameNext[rep[i]] = i;
+			continue;
+		}
+		rep[i] = i;
+		sd->sameNext[i] = i;
+		next[i] = heads[h];
+		heads[h] = i;
+	}
+	for(i = 0; i < numVerts; i++)
+		if(rep[i] == i){
+			n = 0;
+			j = i;
+			do{
+				n++;
+				j = sd->sameNext[j];
+			}while(j != i);
+			if(n > MAXSEAMVERTS)
+				lockPosition(sd, i);
+		}
+
+	// vertices shared by materials
+	matOf = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numVerts; i++)
+		matOf[i] = -1;
+	for(i = 0; i < geo->numTriangles; i++){
+		t = &sd->tris[i];
+		for(j = 0; j < 3; j++){
+			a = rep[t->v[j]];
+			if(matOf[a] >= 0 && matOf[a] != t->matId)
+				lockPosition(sd, a);
+			matOf[a] = t->matId;
+		}
+	}
+	rwFree(matOf);
+
+	// open boundary edges have no opposite half edge
+	for(i = 0; i < hashSize; i++)
+		heads[i] = -1;
+	for(i = 0; i < geo->numTriangles*3; i++){
+		t = &sd->tris[i/3];
+		h = hashEdge(rep[t->v[i%3]], rep[t->v[(i+1)%3]]) & (hashSize-1);
+		next[i] = heads[h];
+		heads[h] = i;
+	}
+	for(i = 0; i < geo->numTriangles*3; i++){
+		t = &sd->tris[i/3];
+		a = rep[t->v[(i+1)%3]];
+		b = rep[t->v[i%3]];
+		h = hashEdge(a, b) & (hashSize-1);
+		found = 0;
+		for(k = heads[h]; k >= 0; k = next[k]){
+			t = &sd->tris[k/3];
+			if(rep[t->v[k%3]] == a && rep[t->v[(k+1)%3]] == b){
+				found = 1;
+				break;
+			}
+		}
+		if(!found){
+			lockPosition(sd, a);
+			lockPosition(sd, b);
+		}
+	}
+	rwFree(rep);
+	rwFree(next);
+	rwFree(heads);
+}
+
+// Every vertex at u's position has to move onto its neighbour at v's
+// position. Seam vertices only have one on the seam, so they can
+// only move along it. Returns the number of pairs, 0 if not possible.
+static int32
+findSeamPairs(SimplifyData *sd, int32 u, int32 v, int32 *us, int32 *vs)
+{
+	Triangle32 *t;
+	int32 n, w, k, j, x, found;
+
+	n = 0;
+	w = u;
+	do{
+		found = -1;
+		if(w == u)
+			found = v;
+		else for(k = sd->firstCorner[w]; k >= 0 && found < 0; k = sd->nextCorner[k]){
+			if(sd->deadTri[k/3])
+				continue;
+			t = &sd->tris[k/3];
+			for(j = 1; j < 3; j++){
+				x = t->v[(k%3 + j) % 3];
+				if(equal(sd->pos[x], sd->pos[v])){
+					found = x;
+					break;
+				}
+			}
+		}
+		if(found >= 0){
+			us[n] = w;
+			vs[n] = found;
+			n++;
+		}else if(sd->firstCorner[w] >= 0)
+			return 0;	// part of the mesh but can't follow
+		w = sd->sameNext[w];
+	}while(w != u);
+	return n;
+}
+
+
+Geometry*
+Geometry::simplify(float32 ratio)
+{
+	SimplifyData sd;
+	Collapse c;
+	Triangle32 *t;
+	Geometry *geo;
+	Skin *skin, *newskin;
+	int32 *remap;
+	int32 i, j, k, numTris, target, numVerts, numPairs, dst;
+	int32 us[MAXSEAMVERTS], vs[MAXSEAMVERTS];
+	V3d n;
+	float32 len;
+
+	if(this->flags & Geometry::NATIVE){
+		RWERROR((ERR_GENERAL, "can't simplify native geometry"));
+		return nil;
+	}
+	if(this->numTriangles == 0 || this->numVertices == 0){
+		RWERROR((ERR_GENERAL, "can't simplify empty geometry"));
+		return nil;
+	}
+	target = (int32)(this->numTriangles*ratio);
+	if(target < 1)
+		target = 1;
+
+	numVerts = this->numVertices;
+	sd.geo = this;
+	sd.pos = this->morphTargets[0].vertices;
+	sd.quadrics = rwNewT(Quadric, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.tris = rwNewT(Triangle32, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.deadTri = rwNewT(uint8, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.firstCorner = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.lastCorner = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.sameNext = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.nextCorner = rwNewT(int32, this->numTriangles*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.locked = rwNewT(uint8, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.removed = rwNewT(uint8, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.stamp = rwNewT(uint32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sd.heap = nil;
+	sd.heapSize = 0;
+	sd.heapSpace = 0;
+	for(i = 0; i < this->numTriangles; i++)
+		sd.tris[i] = this->getTriangle(i);
+	memset(sd.deadTri, 0, this->numTriangles);
+	memset(sd.quadrics, 0, numVerts*sizeof(Quadric));
+	memset(sd.removed, 0, numVerts);
+	memset(sd.stamp, 0, numVerts*sizeof(uint32));
+	for(i = 0; i < numVerts; i++){
+		sd.firstCorner[i] = -1;
+		sd.lastCorner[i] = -1;
+	}
+
+	findLockedVertices(&sd);
+
+	// area weighted plane quadrics and corner lists
+	numTris = 0;
+	for(i = 0; i < this->numTriangles; i++){
+		t = &sd.tris[i];
+		if(t->v[0] == t->v[1] || t->v[0] == t->v[2] || t->v[1] == t->v[2]){
+			sd.deadTri[i] = 1;
+			continue;
+		}
+		numTris++;
+		n = triNormal(sd.pos[t->v[0]], sd.pos[t->v[1]], sd.pos[t->v[2]]);
+		len = length(n);
+		if(len > 0.0f){
+			n = scale(n, 1.0f/len);
+			for(j = 0; j < 3; j++)
+				addPlane(&sd.quadrics[t->v[j]], n,
+					-dot(n, sd.pos[t->v[0]]), len*0.5f);
+		}
+		for(j = 0; j < 3; j++){
+			k = i*3 + j;
+			sd.nextCorner[k] = -1;
+			if(sd.firstCorner[t->v[j]] < 0)
+				sd.firstCorner[t->v[j]] = k;
+			else
+				sd.nextCorner[sd.lastCorner[t->v[j]]] = k;
+			sd.lastCorner[t->v[j]] = k;
+		}
+	}
+
+	for(i = 0; i < numVerts; i++)
+		queueVertex(&sd, i);
+	while(numTris > target && sd.heapSize > 0){
+		heapPop(&sd, &c);
+		if(c.stamp != sd.stamp[c.u] || sd.removed[c.u] || sd.removed[c.v])
+			continue;
+		// u is stuck until one of its neighbours changes
+		numPairs = findSeamPairs(&sd, c.u, c.v, us, vs);
+		for(i = 0; i < numPairs; i++)
+			if(sd.removed[vs[i]] || collapseFlips(&sd, us[i], vs[i]))
+				break;
+		if(numPairs == 0 || i < numPairs)
+			continue;
+		for(i = 0; i < numPairs; i++)
+			doCollapse(&sd, us[i], vs[i], &numTris);
+	}
+
+	// Build the new geometry from what is left
+	remap = rwNewT(int32, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < numVerts; i++)
+		remap[i] = -1;
+	k = 0;
+	for(i = 0; i < this->numTriangles; i++)
+		if(!sd.deadTri[i])
+			for(j = 0; j < 3; j++)
+				if(remap[sd.tris[i].v[j]] < 0)
+					remap[sd.tris[i].v[j]] = 0;
+	for(i = 0; i < numVerts; i++)
+		if(remap[i] == 0)
+			remap[i] = k++;
+
+	geo = Geometry::create(k, numTris,
+		(this->flags & ~(NATIVE|NATIVEINSTANCE)) | this->numTexCoordSets<<16);
+	geo->addMorphTargets(this->numMorphTargets-1);
+	for(i = 0; i < this->matList.numMaterials; i++)
+		geo->matList.appendMaterial(this->matList.materials[i]);
+	dst = 0;
+	for(i = 0; i < this->numTriangles; i++)
+		if(!sd.deadTri[i]){
+			t = &sd.tris[i];
+			for(j = 0; j < 3; j++)
+				t->v[j] = remap[t->v[j]];
+			geo->setTriangle(dst++, *t);
+		}
+	skin = skinGlobals.geoOffset ? Skin::get(this) : nil;
+	newskin = nil;
+	if(skin){
+		newskin = rwNewT(Skin, 1, MEMDUR_EVENT | ID_SKIN);
+		newskin->init(skin->numBones, skin->numUsedBones, k);
+		memcpy(newskin->inverseMatrices, skin->inverseMatrices, skin->numBones*64);
+		newskin->legacyType = skin->legacyType;
+		Skin::set(geo, newskin);
+	}
+	for(i = 0; i < numVerts; i++){
+		if(remap[i] < 0)
+			continue;
+		k = remap[i];
+		for(j = 0; j < this->numMorphTargets; j++){
+			geo->morphTargets[j].vertices[k] = this->morphTargets[j].vertices[i];
+			if(this->flags & NORMALS)
+				geo->morphTargets[j].normals[k] = this->morphTargets[j].normals[i];
+		}
+		if(this->colors)
+			geo->colors[k] = this->colors[i];
+		for(j = 0; j < this->numTexCoordSets; j++)
+			geo->texCoords[j][k] = this->texCoords[j][i];
+		if(newskin){
+			memcpy(&newskin->indices[k*4], &skin->indices[i*4], 4);
+			memcpy(&newskin->weights[k*4], &skin->weights[i*4], 4*sizeof(float32));
+		}
+	}
+	if(newskin){
+		newskin->findNumWeights(geo->numVertices);
+		newskin->findUsedBones(geo->numVertices);
+	}
+	geo->calculateBoundingSphere();
+	geo->buildMeshes();
+
+	rwFree(remap);
+	rwFree(sd.heap);
+	rwFree(sd.stamp);
+	rwFree(sd.removed);
+	rwFree(sd.locked);
+	rwFree(sd.sameNext);
+	rwFree(sd.nextCorner);
+	rwFree(sd.lastCorner);
+	rwFree(sd.firstCorner);
+	rwFree(sd.deadTri);
+	rwFree(sd.tris);
+	rwFree(sd.quadrics);
+	return geo;
+}
+
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+
+#define PLUGIN_ID 2
+
+/*
+ * Morph target animation.
+ *
+ * Each atomic has an interpolator that blends between two of its
+ * geometry's morph targets. The pipelines blend the targets into a
+ * dynamic stream of positions and normals when the interpolator
+ * changes and only reinstance those.
+ */
+
+namespace rw {
+
+// dst = a + (b-a)*t over n floats
+static void
+lerpFloats(float32 *dst, const float32 *a, const float32 *b, float32 t, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	__m128 vt = _mm_set1_ps(t);
+	for(; i+4 <= n; i += 4){
+		__m128 va = _mm_loadu_ps(a+i);
+		__m128 vb = _mm_loadu_ps(b+i);
+		_mm_storeu_ps(dst+i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+	}
+#endif
+	for(; i < n; i++)
+		dst[i] = a[i] + (b[i]-a[i])*t;
+}
+
+// dst += src*w over n floats
+static void
+accumFloats(float32 *dst, const float32 *src, float32 w, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	__m128 vw = _mm_set1_ps(w);
+	for(; i+4 <= n; i += 4){
+		__m128 d = _mm_loadu_ps(dst+i);
+		_mm_storeu_ps(dst+i, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src+i), vw)));
+	}
+#endif
+	for(; i < n; i++)
+		dst[i] += src[i]*w;
+}
+
+// Blended normals get shorter where the targets disagree,
+// lighting expects unit length
+static void
+normalizeNormals(V3d *normals, int32 n)
+{
+	float32 len;
+	for(int32 i = 0; i < n; i++){
+		len = length(normals[i]);
+		if(len > 0.0f)
+			normals[i] = scale(normals[i], 1.0f/len);
+	}
+}
+
+void
+Geometry::interpolateMorphTargets(V3d *vertices, V3d *normals, int32 start, int32 end, float32 t)
+{
+	assert(start >= 0 && start < this->numMorphTargets);
+	assert(end >= 0 && end < this->numMorphTargets);
+	MorphTarget *m1 = &this->morphTargets[start];
+	MorphTarget *m2 = &this->morphTargets[end];
+	if(vertices && m1->vertices)
+		lerpFloats((float32*)vertices, (float32*)m1->vertices,
+			(float32*)m2->vertices, t, this->numVertices*3);
+	if(normals && m1->normals){
+		lerpFloats((float32*)normals, (float32*)m1->normals,
+			(float32*)m2->normals, t, this->numVertices*3);
+		normalizeNormals(normals, this->numVertices);
+	}
+}
+
+void
+Geometry::blendMorphTargets(V3d *vertices, V3d *normals, const float32 *weights)
+{
+	if(vertices)
+		memset(vertices, 0, this->numVertices*sizeof(V3d));
+	if(normals)
+		memset(normals, 0, this->numVertices*sizeof(V3d));
+	for(int32 i = 0; i < this->numMorphTargets; i++){
+		if(weights[i] == 0.0f)
+			continue;
+		MorphTarget *m = &this->morphTargets[i];
+		if(vertices && m->vertices)
+			accumFloats((float32*)vertices, (float32*)m->vertices,
+				weights[i], this->numVertices*3);
+		if(normals && m->normals)
+			accumFloats((float32*)normals, (float32*)m->normals,
+				weights[i], this->numVertices*3);
+	}
+	if(normals)
+		normalizeNormals(normals, this->numVertices);
+}
+
+void
+Interpolator::init(void)
+{
+	this->startMorphTarget = 0;
+	this->endMorphTarget = 0;
+	this->time = 1.0f;
+	this->recipTime = 1.0f;
+	this->position = 0.0f;
+}
+
+void
+Interpolator::setTargets(int32 start, int32 end, float32 time)
+{
+	this->startMorphTarget = start;
+	this->endMorphTarget = end;
+	this->time = time;
+	this->recipTime = time > 0.0f ? 1.0f/time : 0.0f;
+	this->position = 0.0f;
+}
+
+// Advance the interpolation, on overflow continue with the
+// next pair of morph targets, wrapping around at the end.
+void
+Interpolator::addTime(float32 t, int32 numMorphTargets)
+{
+	if(this->time <= 0.0f || numMorphTargets < 1)
+		return;
+	this->position += t;
+	while(this->position > this->time){
+		this->position -= this->time;
+		this->startMorphTarget = this->endMorphTarget;
+		this->endMorphTarget = (this->endMorphTarget+1) % numMorphTargets;
+	}
+}
+
+}
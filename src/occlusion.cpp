@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
+#define PLUGIN_ID 0
+
+/*
+ * Occluders are transformed to camera space, clipped against the near
+ * plane and set up as edge and depth plane equations in pixel space.
+ * The screen is split into bands of BANDHEIGHT rows that are rasterized
+ * as parallel jobs. Bands write disjoint pixels and only ever take
+ * the maximum nearness, so the result does not depend on scheduling.
+ * Pixels are sampled at their centers, four at a time with SIMD.
+ *
+ * Level n+1 of the pyramid holds the minimum (farthest) of 2x2 texels
+ * of level n. A box is hidden if its nearest point is farther than
+ * every texel under its screen rectangle on a level where that
+ * rectangle is at most 4x4 texels.
+ */
+
+namespace rw {
+
+#define CLEARDEPTH (-FLT_MAX)
+
+// nearness: greater is closer and linear in screen space
+static float32
+getNearness(Camera *cam, float32 z)
+{
+	if(cam->projection == Camera::PERSPECTIVE)
+		return 1.0f/z;
+	return -z;
+}
+
+OcclusionBuffer*
+OcclusionBuffer::create(int32 width, int32 height)
+{
+	OcclusionBuffer *ob;
+	int32 i, w, h, size;
+
+	ob = rwNewT(OcclusionBuffer, 1, MEMDUR_EVENT);
+	if(ob == nil){
+		RWERROR((ERR_ALLOC, sizeof(OcclusionBuffer)));
+		return nil;
+	}
+	if(width < 4) width = 4;
+	if(height < 1) height = 1;
+	width = (width+3) & ~3;
+	ob->width = width;
+	ob->height = height;
+
+	w = width;
+	h = height;
+	size = 0;
+	for(i = 0; i < MAXLEVELS; i++){
+		ob->levelWidth[i] = w;
+		ob->levelHeight[i] = h;
+		size += w*h;
+		if(w == 1 && h == 1)
+			break;
+		w = w > 1 ? (w+1)/2 : 1;
+		h = h > 1 ? (h+1)/2 : 1;
+	}
+	ob->numLevels = i < MAXLEVELS ? i+1 : MAXLEVELS;
+	ob->levels[0] = rwNewT(float32, size, MEMDUR_EVENT);
+	for(i = 1; i < ob->numLevels; i++)
+		ob->levels[i] = ob->levels[i-1] + ob->levelWidth[i-1]*ob->levelHeight[i-1];
+
+	ob->space = 256;
+	ob->triangles = rwNewT(OccluderTriangle, ob->space, MEMDUR_EVENT);
+	ob->numTriangles = 0;
+	ob->camera = nil;
+	memset(&ob->stats, 0, sizeof(OcclusionStats));
+	return ob;
+}
+
+void
+OcclusionBuffer::destroy(void)
+{
+	rwFree(this->levels[0]);
+	rwFree(this->triangles);
+	rwFree(this);
+}
+
+void
+OcclusionBuffer::begin(Camera *cam)
+{
+	this->camera = cam;
+	this->numTriangles = 0;
+	memset(&this->stats, 0, sizeof(OcclusionStats));
+}
+
+void
+OcclusionBuffer::addOccluder(Atomic *atomic)
+{
+	if(atomic->geometry == nil)
+		return;
+	this->stats.numOccluders++;
+	this->addGeometry(atomic->geometry, atomic->getFrame()->getLTM());
+}
+
+static void
+setupTriangle(OcclusionBuffer *ob, V3d *v)
+{
+	Camera *cam = ob->camera;
+	OccluderTriangle *t;
+	float32 x[3], y[3], n[3];
+	float32 area, tmp, dx, dy;
+	float32 minx, maxx, miny, maxy;
+	int32 i, j;
+
+	for(i = 0; i < 3; i++){
+		if(cam->projection == Camera::PERSPECTIVE){
+			x[i] = v[i].x/v[i].z * ob->width;
+			y[i] = v[i].y/v[i].z * ob->height;
+		}else{
+			x[i] = v[i].x * ob->width;
+			y[i] = v[i].y * ob->height;
+		}
+		n[i] = getNearness(cam, v[i].z);
+	}
+
+	area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+	if(area > -1.0e-6f && area < 1.0e-6f)
+		return;
+	// occluders are rendered double sided, make the winding positive
+	if(area < 0.0f){
+		tmp = x[1]; x[1] = x[2]; x[2] = tmp;
+		tmp = y[1]; y[1] = y[2]; y[2] = tmp;
+		tmp = n[1]; n[1] = n[2]; n[2] = tmp;
+		area = -area;
+	}
+
+	minx = maxx = x[0];
+	miny = maxy = y[0];
+	for(i = 1; i < 3; i++){
+		if(x[i] < minx) minx = x[i];
+		if(x[i] > maxx) maxx = x[i];
+		if(y[i] < miny) miny = y[i];
+		if(y[i] > maxy) maxy = y[i];
+	}
+	// pixels whose centers can be covered
+	if(maxx < 0.5f || maxy < 0.5f ||
+	   minx > ob->width-0.5f || miny > ob->height-0.5f)
+		return;
+
+	if(ob->numTriangles >= ob->space){
+		ob->space *= 2;
+		ob->triangles = rwResizeT(OccluderTriangle, ob->triangles, ob->space, MEMDUR_EVENT);
+	}
+	t = &ob->triangles[ob->numTriangles++];
+	t->x0 = minx < 0.5f ? 0 : (int32)ceilf(minx - 0.5f);
+	t->y0 = miny < 0.5f ? 0 : (int32)ceilf(miny - 0.5f);
+	t->x1 = maxx > ob->width-0.5f ? ob->width-1 : (int32)floorf(maxx - 0.5f);
+	t->y1 = maxy > ob->height-0.5f ? ob->height-1 : (int32)floorf(maxy - 0.5f);
+
+	for(i = 0; i < 3; i++){
+		j = i == 2 ? 0 : i+1;
+		t->edge[i][0] = y[i] - y[j];
+		t->edge[i][1] = x[j] - x[i];
+		t->edge[i][2] = -(t->edge[i][0]*x[i] + t->edge[i][1]*y[i]);
+	}
+	dx = ((n[1]-n[0])*(y[2]-y[0]) - (n[2]-n[0])*(y[1]-y[0]))/area;
+	dy = ((n[2]-n[0])*(x[1]-x[0]) - (n[1]-n[0])*(x[2]-x[0]))/area;
+	t->depth[0] = dx;
+	t->depth[1] = dy;
+	t->depth[2] = n[0] - dx*x[0] - dy*y[0];
+}
+
+// Clips against the near plane and adds one or two triangles
+static void
+clipTriangle(OcclusionBuffer *ob, V3d *v)
+{
+	float32 nearz = ob->camera->nearPlane;
+	V3d out[4], tri[3];
+	int32 i, j, n;
+	float32 t;
+
+	if(v[0].z >= nearz && v[1].z >= nearz && v[2].z >= nearz){
+		setupTriangle(ob, v);
+		return;
+	}
+	if(v[0].z < nearz && v[1].z < nearz && v[2].z < nearz)
+		return;
+
+	n = 0;
+	for(i = 0; i < 3; i++){
+		j = i == 2 ? 0 : i+1;
+		if(v[i].z >= nearz)
+			out[n++] = v[i];
+		if((v[i].z >= nearz) != (v[j].z >= nearz)){
+			t = (nearz - v[i].z)/(v[j].z - v[i].z);
+			out[n] = add(v[i], scale(sub(v[j], v[i]), t));
+			out[n].z = nearz;
+			n++;
+		}
+	}
+	for(i = 2; i < n; i++){
+		tri[0] = out[0];
+		tri[1] = out[i-1];
+		tri[2] = out[i];
+		setupTriangle(ob, tri);
+	}
+}
+
+void
+OcclusionBuffer::addGeometry(Geometry *geo, Matrix *ltm)
+{
+	Matrix m;
+	V3d *verts;
+	V3d v[3];
+	Triangle32 tri;
+	int32 i;
+
+	if(this->camera == nil || geo->numTriangles == 0 ||
+	   geo->numMorphTargets == 0 || geo->morphTargets[0].vertices == nil)
+		return;
+	Matrix::mult(&m, ltm, &this->camera->viewMatrix);
+	verts = geo->morphTargets[0].vertices;
+	for(i = 0; i < geo->numTriangles; i++){
+		tri = geo->getTriangle(i);
+		V3d::transformPoints(&v[0], &verts[tri.v[0]], 1, &m);
+		V3d::transformPoints(&v[1], &verts[tri.v[1]], 1, &m);
+		V3d::transformPoints(&v[2], &verts[tri.v[2]], 1, &m);
+		clipTriangle(this, v);
+	}
+}
+
+static void
+rasterizeRows(OcclusionBuffer *ob, OccluderTriangle *t, int32 y0, int32 y1)
+{
+	float32 row[3], fy;
+	float32 *dst;
+	int32 x, y, x0;
+
+	x0 = t->x0 & ~3;
+	for(y = y0; y <= y1; y++){
+		fy = y + 0.5f;
+		row[0] = t->edge[0][1]*fy + t->edge[0][2];
+		row[1] = t->edge[1][1]*fy + t->edge[1][2];
+		row[2] = t->edge[2][1]*fy + t->edge[2][2];
+		dst = &ob->levels[0][y*ob->width];
+		x = x0;
+#if defined(RW_SSE2)
+		{
+			__m128 a0 = _mm_set1_ps(t->edge[0][0]);
+			__m128 a1 = _mm_set1_ps(t->edge[1][0]);
+			__m128 a2 = _mm_set1_ps(t->edge[2][0]);
+			__m128 r0 = _mm_set1_ps(row[0]);
+			__m128 r1 = _mm_set1_ps(row[1]);
+			__m128 r2 = _mm_set1_ps(row[2]);
+			__m128 da = _mm_set1_ps(t->depth[0]);
+			__m128 dr = _mm_set1_ps(t->depth[1]*fy + t->depth[2]);
+			__m128 zero = _mm_setzero_ps();
+			for(; x <= t->x1; x += 4){
+				__m128 fx = _mm_setr_ps(x+0.5f, x+1.5f, x+2.5f, x+3.5f);
+				__m128 in = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, fx), r0), zero);
+				in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, fx), r1), zero));
+				in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, fx), r2), zero));
+				if(_mm_movemask_ps(in) == 0)
+					continue;
+				__m128 d = _mm_add_ps(_mm_mul_ps(da, fx), dr);
+				__m128 old = _mm_loadu_ps(&dst[x]);
+				d = _mm_max_ps(old, d);
+				_mm_storeu_ps(&dst[x], _mm_or_ps(_mm_and_ps(in, d), _mm_andnot_ps(in, old)));
+			}
+		}
+#elif defined(RW_NEON)
+		{
+			float32x4_t a0 = vdupq_n_f32(t->edge[0][0]);
+			float32x4_t a1 = vdupq_n_f32(t->edge[1][0]);
+			float32x4_t a2 = vdupq_n_f32(t->edge[2][0]);
+			float32x4_t r0 = vdupq_n_f32(row[0]);
+			float32x4_t r1 = vdupq_n_f32(row[1]);
+			float32x4_t r2 = vdupq_n_f32(row[2]);
+			float32x4_t da = vdupq_n_f32(t->depth[0]);
+			float32x4_t dr = vdupq_n_f32(t->depth[1]*fy + t->depth[2]);
+			float32x4_t zero = vdupq_n_f32(0.0f);
+			float32 xs[4];
+			for(; x <= t->x1; x += 4){
+				xs[0] = x+0.5f; xs[1] = x+1.5f; xs[2] = x+2.5f; xs[3] = x+3.5f;
+				float32x4_t fx = vld1q_f32(xs);
+				uint32x4_t in = vcgeq_f32(vaddq_f32(vmulq_f32(a0, fx), r0), zero);
+				in = vandq_u32(in, vcgeq_f32(vaddq_f32(vmulq_f32(a1, fx), r1), zero));
+				in = vandq_u32(in, vcgeq_f32(vaddq_f32(vmulq_f32(a2, fx), r2), zero));
+				float32x4_t old = vld1q_f32(&dst[x]);
+				float32x4_t d = vmaxq_f32(old, vaddq_f32(vmulq_f32(da, fx), dr));
+				vst1q_f32(&dst[x], vbslq_f32(in, d, old));
+			}
+		}
+#else
+		{
+			float32 fx, d, dr;
+			dr = t->depth[1]*fy + t->depth[2];
+			for(; x <= t->x1; x++){
+				fx = x + 0.5f;
+				if(t->edge[0][0]*fx + row[0] >= 0.0f &&
+				   t->edge[1][0]*fx + row[1] >= 0.0f &&
+				   t->edge[2][0]*fx + row[2] >= 0.0f){
+					d = t->depth[0]*fx + dr;
+					if(d > dst[x])
+						dst[x] = d;
+				}
+			}
+		}
+#endif
+	}
+}
+
+static void
+rasterizeBandJob(void *data, int32 band)
+{
+	OcclusionBuffer *ob = (OcclusionBuffer*)data;
+	OccluderTriangle *t;
+	float32 *dst;
+	int32 i, y0, y1;
+
+	y0 = band*OcclusionBuffer::BANDHEIGHT;
+	y1 = y0 + OcclusionBuffer::BANDHEIGHT-1;
+	if(y1 >= ob->height)
+		y1 = ob->height-1;
+	dst = &ob->levels[0][y0*ob->width];
+	for(i = 0; i < (y1-y0+1)*ob->width; i++)
+		dst[i] = CLEARDEPTH;
+
+	for(i = 0; i < ob->numTriangles; i++){
+		t = &ob->triangles[i];
+		if(t->y1 < y0 || t->y0 > y1)
+			continue;
+		rasterizeRows(ob, t, t->y0 > y0 ? t->y0 : y0, t->y1 < y1 ? t->y1 : y1);
+	}
+}
+
+static void
+buildLevel(OcclusionBuffer *ob, int32 l)
+{
+	float32 *src, *dst, d;
+	int32 x, y, sw, sh, sx, sy;
+
+	src = ob->levels[l-1];
+	dst = ob->levels[l];
+	sw = ob->levelWidth[l-1];
+	sh = ob->levelHeight[l-1];
+	for(y = 0; y < ob->levelHeight[l]; y++)
+		for(x = 0; x < ob->levelWidth[l]; x++){
+			sx = 2*x;
+			sy = 2*y;
+			d = src[sy*sw + sx];
+			if(sx+1 < sw && src[sy*sw + sx+1] < d)
+				d = src[sy*sw + sx+1];
+			if(sy+1 < sh){
+				if(src[(sy+1)*sw + sx] < d)
+					d = src[(sy+1)*sw + sx];
+				if(sx+1 < sw && src[(sy+1)*sw + sx+1] < d)
+					d = src[(sy+1)*sw + sx+1];
+			}
+			dst[y*ob->levelWidth[l] + x] = d;
+		}
+}
+
+void
+OcclusionBuffer::end(void)
+{
+	int32 l;
+
+	this->stats.numTriangles = this->numTriangles;
+	Engine::jobfuncs.parallelFor(rasterizeBandJob, this,
+		(this->height + BANDHEIGHT-1)/BANDHEIGHT);
+	for(l = 1; l < this->numLevels; l++)
+		buildLevel(this, l);
+}
+
+bool32
+OcclusionBuffer::testBox(const BBox *box)
+{
+	Camera *cam = this->camera;
+	V3d c[8];
+	float32 minx, maxx, miny, maxy, minz, sx, sy;
+	float32 nearest, *level;
+	int32 i, l, x, y, x0, y0, x1, y1;
+
+	if(cam == nil || this->numTriangles == 0)
+		return 1;
+	this->stats.numTested++;
+
+	for(i = 0; i < 8; i++){
+		c[i].x = i & 1 ? box->sup.x : box->inf.x;
+		c[i].y = i & 2 ? box->sup.y : box->inf.y;
+		c[i].z = i & 4 ? box->sup.z : box->inf.z;
+	}
+	V3d::transformPoints(c, c, 8, &cam->viewMatrix);
+
+	minx = miny = FLT_MAX;
+	maxx = maxy = -FLT_MAX;
+	minz = FLT_MAX;
+	for(i = 0; i < 8; i++){
+		// crosses the near plane, can't be projected
+		if(c[i].z < cam->nearPlane)
+			return 1;
+		if(cam->projection == Camera::PERSPECTIVE){
+			sx = c[i].x/c[i].z * this->width;
+			sy = c[i].y/c[i].z * this->height;
+		}else{
+			sx = c[i].x * this->width;
+			sy = c[i].y * this->height;
+		}
+		if(sx < minx) minx = sx;
+		if(sx > maxx) maxx = sx;
+		if(sy < miny) miny = sy;
+		if(sy > maxy) maxy = sy;
+		if(c[i].z < minz) minz = c[i].z;
+	}
+	// off screen, leave that to frustum culling
+	if(maxx < 0.0f || maxy < 0.0f || minx >= this->width || miny >= this->height)
+		return 1;
+	x0 = minx < 0.0f ? 0 : (int32)minx;
+	y0 = miny < 0.0f ? 0 : (int32)miny;
+	x1 = maxx >= this->width ? this->width-1 : (int32)maxx;
+	y1 = maxy >= this->height ? this->height-1 : (int32)maxy;
+	nearest = getNearness(cam, minz);
+
+	for(l = 0; l < this->numLevels-1; l++)
+		if((x1>>l) - (x0>>l) < 4 && (y1>>l) - (y0>>l) < 4)
+			break;
+	level = this->levels[l];
+	for(y = y0>>l; y <= y1>>l; y++)
+		for(x = x0>>l; x <= x1>>l; x++)
+			if(level[y*this->levelWidth[l] + x] <= nearest)
+				return 1;
+	this->stats.numOccluded++;
+	return 0;
+}
+
+bool32
+OcclusionBuffer::testAtomic(Atomic *atomic)
+{
+	Sphere *s;
+	BBox box;
+
+	if(this->camera == nil || this->numTriangles == 0)
+		return 1;
+	s = atomic->getWorldBoundingSphere();
+	box.inf.x = s->center.x - s->radius;
+	box.inf.y = s->center.y - s->radius;
+	box.inf.z = s->center.z - s->radius;
+	box.sup.x = s->center.x + s->radius;
+	box.sup.y = s->center.y + s->radius;
+	box.sup.z = s->center.z + s->radius;
+	return this->testBox(&box);
+}
+
+int32
+OcclusionBuffer::cullAtomics(Atomic **atomics, int32 n)
+{
+	int32 i, numVisible;
+
+	numVisible = 0;
+	for(i = 0; i < n; i++)
+		if(this->testAtomic(atomics[i]))
+			atomics[numVisible++] = atomics[i];
+	return numVisible;
+}
+
+}
@@ -9,6 +9,10 @@
 #include "rwobjects.h"
 #include "rwengine.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+
 #define COLOR_ARGB(a,r,g,b) \
     ((uint32)((((a)&0xff)<<24)|(((r)&0xff)<<16)|(((g)&0xff)<<8)|((b)&0xff)))
 
@@ -23,6 +27,10 @@ ObjPipeline::init(uint32 platform)
 	this->impl.instance = nothing;
 	this->impl.uninstance = nothing;
 	this->impl.render = nothing;
+	this->impl.renderMesh = nil;
+	this->impl.meshVertexAlpha = nil;
+	this->impl.prepareInstance = nil;
+	this->impl.uploadInstance = nil;
 }
 
 ObjPipeline*
@@ -65,6 +73,38 @@ findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, i
 		*numVertices = num;
 }
 
+void
+findMinVertAndNumVertices(uint32 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
+{
+	uint32 min = 0xFFFFFFFF;
+	uint32 max = 0;
+	while(numIndices--){
+		if(*indices < min)
+			min = *indices;
+		if(*indices > max)
+			max = *indices;
+		indices++;
+	}
+	uint32 num = max - min + 1;
+	if(min > max){
+		min = 0;
+		num = 0;
+	}
+	if(minVert)
+		*minVert = min;
+	if(numVertices)
+		*numVertices = num;
+}
+
+void
+findMinVertAndNumVertices(MeshHeader *header, Mesh *mesh, uint32 *minVert, int32 *numVertices)
+{
+	if(header->index32)
+		findMinVertAndNumVertices(mesh->indices32, mesh->numIndices, minVert, numVertices);
+	else
+		findMinVertAndNumVertices(mesh->indices, mesh->numIndices, minVert, numVertices);
+}
+
 void
 instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride)
 {
@@ -78,10 +118,104 @@ instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride)
 		assert(0 && "unsupported instV4d type");
 }
 
+#ifndef RW_SSE2
+static int32
+roundToInt(float32 f)
+{
+	return (int32)(f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+
+static int32
+clampNorm(float32 f, float32 max)
+{
+	f *= max;
+	if(f > max) f = max;
+	if(f < -max) f = -max;
+	return roundToInt(f);
+}
+#endif
+
+// float to half with round to nearest even, overflow goes to infinity
+static uint16
+floatToHalf(float32 f)
+{
+	uint32 u, sign;
+	uint16 h;
+	memcpy(&u, &f, 4);
+	sign = u & 0x80000000;
+	u ^= sign;
+	if(u >= (127+16)<<23)
+		h = u > 0x7F800000 ? 0x7E00 : 0x7C00;	// NaN or infinity
+	else if(u < 113<<23){
+		// denormal, let the FPU do the rounding
+		float32 magic, t;
+		uint32 m = ((127-15)+(23-10)+1)<<23;
+		memcpy(&magic, &m, 4);
+		memcpy(&t, &u, 4);
+		t += magic;
+		memcpy(&u, &t, 4);
+		h = u - m;
+	}else{
+		u = u - ((127-15)<<23) + 0xFFF + ((u>>13)&1);
+		h = u>>13;
+	}
+	return h | (sign>>16);
+}
+
+static float32
+halfToFloat(uint16 h)
+{
+	uint32 u = (h & 0x7FFF) << 13;
+	uint32 exp = u & (0x7C00<<13);
+	float32 f;
+	u += (127-15)<<23;
+	if(exp == 0x7C00<<13)
+		u += (128-16)<<23;	// NaN or infinity
+	else if(exp == 0){
+		// denormal, renormalize
+		float32 magic;
+		uint32 m = 113<<23;
+		memcpy(&magic, &m, 4);
+		u += 1<<23;
+		memcpy(&f, &u, 4);
+		f -= magic;
+		memcpy(&u, &f, 4);
+	}
+	u |= (h & 0x8000) << 16;
+	memcpy(&f, &u, 4);
+	return f;
+}
+
 void
 instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
 {
-	if(type == VERT_FLOAT3)
+	if(type == VERT_NORMSHORT4){
+		V3d scale = { 1.0f, 1.0f, 1.0f };
+		V3d offset = { 0.0f, 0.0f, 0.0f };
+		instV3dRange(type, dst, src, numVertices, stride, &scale, &offset);
+	}else if(type == VERT_NORM1010102){
+#ifdef RW_SSE2
+		__m128 max = _mm_set1_ps(511.0f);
+		__m128 min = _mm_set1_ps(-511.0f);
+		int32 n[4];
+		for(uint32 i = 0; i < numVertices; i++){
+			__m128 v = _mm_setr_ps(src->x, src->y, src->z, 0.0f);
+			v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, max), min), max);
+			_mm_storeu_si128((__m128i*)n, _mm_cvtps_epi32(v));
+			*(uint32*)dst = (n[0] & 0x3FF) | (n[1] & 0x3FF) << 10 | (n[2] & 0x3FF) << 20;
+			dst += stride;
+			src++;
+		}
+#else
+		for(uint32 i = 0; i < numVertices; i++){
+			*(uint32*)dst = (clampNorm(src->x, 511.0f) & 0x3FF) |
+				(clampNorm(src->y, 511.0f) & 0x3FF) << 10 |
+				(clampNorm(src->z, 511.0f) & 0x3FF) << 20;
+			dst += stride;
+			src++;
+		}
+#endif
+	}else if(type == VERT_FLOAT3)
 		for(uint32 i = 0; i < numVertices; i++){
 			memcpy(dst, src, 12);
 			dst += stride;
@@ -115,7 +249,24 @@ instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
 void
 uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 {
-	if(type == VERT_FLOAT3)
+	if(type == VERT_NORMSHORT4){
+		V3d scale = { 1.0f, 1.0f, 1.0f };
+		V3d offset = { 0.0f, 0.0f, 0.0f };
+		uninstV3dRange(type, dst, src, numVertices, stride, &scale, &offset);
+	}else if(type == VERT_NORM1010102)
+		for(uint32 i = 0; i < numVertices; i++){
+			uint32 n = *(uint32*)src;
+			// shift up and back down to sign extend
+			float32 x = (int32)(n << 22) >> 22;
+			float32 y = (int32)(n << 12) >> 22;
+			float32 z = (int32)(n << 2) >> 22;
+			dst->x = x < -511.0f ? -1.0f : x/511.0f;
+			dst->y = y < -511.0f ? -1.0f : y/511.0f;
+			dst->z = z < -511.0f ? -1.0f : z/511.0f;
+			src += stride;
+			dst++;
+		}
+	else if(type == VERT_FLOAT3)
 		for(uint32 i = 0; i < numVertices; i++){
 			memcpy(dst, src, 12);
 			src += stride;
@@ -143,27 +294,113 @@ uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 }
 
 void
-instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
+findV3dRange(V3d *src, uint32 numVertices, V3d *scale, V3d *offset)
+{
+	V3d min, max;
+	if(numVertices == 0){
+		scale->set(1.0f, 1.0f, 1.0f);
+		offset->set(0.0f, 0.0f, 0.0f);
+		return;
+	}
+	min = max = src[0];
+	for(uint32 i = 1; i < numVertices; i++){
+		if(src[i].x < min.x) min.x = src[i].x;
+		if(src[i].y < min.y) min.y = src[i].y;
+		if(src[i].z < min.z) min.z = src[i].z;
+		if(src[i].x > max.x) max.x = src[i].x;
+		if(src[i].y > max.y) max.y = src[i].y;
+		if(src[i].z > max.z) max.z = src[i].z;
+	}
+	offset->set((min.x+max.x)*0.5f, (min.y+max.y)*0.5f, (min.z+max.z)*0.5f);
+	scale->set((max.x-min.x)*0.5f, (max.y-min.y)*0.5f, (max.z-min.z)*0.5f);
+	// flat extents would give a division by zero
+	if(scale->x == 0.0f) scale->x = 1.0f;
+	if(scale->y == 0.0f) scale->y = 1.0f;
+	if(scale->z == 0.0f) scale->z = 1.0f;
+}
+
+void
+instV3dRange(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride, V3d *scale, V3d *offset)
 {
-	assert(type == VERT_FLOAT2);
+	assert(type == VERT_NORMSHORT4);
+#ifdef RW_SSE2
+	__m128 off = _mm_setr_ps(offset->x, offset->y, offset->z, 0.0f);
+	__m128 s = _mm_setr_ps(32767.0f/scale->x, 32767.0f/scale->y, 32767.0f/scale->z, 0.0f);
+	for(uint32 i = 0; i < numVertices; i++){
+		__m128 v = _mm_setr_ps(src->x, src->y, src->z, 0.0f);
+		__m128i n = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(v, off), s));
+		// saturating pack takes care of the range
+		_mm_storel_epi64((__m128i*)dst, _mm_packs_epi32(n, n));
+		dst += stride;
+		src++;
+	}
+#else
+	V3d s = { 1.0f/scale->x, 1.0f/scale->y, 1.0f/scale->z };
 	for(uint32 i = 0; i < numVertices; i++){
-		memcpy(dst, src, 8);
+		((int16*)dst)[0] = clampNorm((src->x - offset->x)*s.x, 32767.0f);
+		((int16*)dst)[1] = clampNorm((src->y - offset->y)*s.y, 32767.0f);
+		((int16*)dst)[2] = clampNorm((src->z - offset->z)*s.z, 32767.0f);
+		((int16*)dst)[3] = 0;
 		dst += stride;
 		src++;
 	}
+#endif
 }
 
 void
-uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
+uninstV3dRange(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride, V3d *scale, V3d *offset)
 {
-	assert(type == VERT_FLOAT2);
+	assert(type == VERT_NORMSHORT4);
+	V3d s = { scale->x/32767.0f, scale->y/32767.0f, scale->z/32767.0f };
 	for(uint32 i = 0; i < numVertices; i++){
-		memcpy(dst, src, 8);
+		dst->x = ((int16*)src)[0]*s.x + offset->x;
+		dst->y = ((int16*)src)[1]*s.y + offset->y;
+		dst->z = ((int16*)src)[2]*s.z + offset->z;
 		src += stride;
 		dst++;
 	}
 }
 
+void
+instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
+{
+	if(type == VERT_HALF2)
+		for(uint32 i = 0; i < numVertices; i++){
+			((uint16*)dst)[0] = floatToHalf(src->u);
+			((uint16*)dst)[1] = floatToHalf(src->v);
+			dst += stride;
+			src++;
+		}
+	else{
+		assert(type == VERT_FLOAT2);
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 8);
+			dst += stride;
+			src++;
+		}
+	}
+}
+
+void
+uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	if(type == VERT_HALF2)
+		for(uint32 i = 0; i < numVertices; i++){
+			dst->u = halfToFloat(((uint16*)src)[0]);
+			dst->v = halfToFloat(((uint16*)src)[1]);
+			src += stride;
+			dst++;
+		}
+	else{
+		assert(type == VERT_FLOAT2);
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 8);
+			src += stride;
+			dst++;
+		}
+	}
+}
+
 bool32
 instColor(int type, uint8 *dst, RGBA *src, uint32 numVertices, uint32 stride)
 {
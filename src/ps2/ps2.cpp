@@ -812,6 +812,7 @@ objInstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	geo->instData = header;
 	header->platform = PLATFORM_PS2;
 	assert(geo->meshHeader != nil);
+	assert(!geo->meshHeader->index32);	// only 16 bit indices here
 	header->numMeshes = geo->meshHeader->numMeshes;
 	header->instanceMeshes = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 	for(uint32 i = 0; i < header->numMeshes; i++){
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#define PLUGIN_ID 0
+
+/*
+ * The render queue sorts meshes by a 64 bit key before handing them
+ * to their pipelines, so meshes sharing state are drawn together.
+ * The state part of the key is 31 bits:
+ *	pipeline:7 shader:4 raster:16 blend:4
+ * Pipelines and rasters are hashed, a collision only costs a state change.
+ *
+ * Opaque:      0 | state:31 | depth:32
+ * Translucent: 1 | ~depth:32 | state:31
+ *
+ * Depth is the view space depth of the atomic's bounding sphere,
+ * positive floats sort correctly as integers.
+ */
+
+namespace rw {
+
+enum {
+	BLEND_MATERIAL = 1,
+	BLEND_RASTER = 2,
+	BLEND_VERTEX = 4,
+
+	SHADER_LIGHT = 1,
+	SHADER_PRELIT = 2,
+	SHADER_MODULATE = 4,
+	SHADER_TEXTURED = 8
+};
+
+static uint32
+hashPointer(void *p, int32 bits)
+{
+	uint32 h = (uint32)((uintptr)p >> 4);
+	h *= 2654435761u;
+	return h >> (32 - bits);
+}
+
+static uint32
+getStateBits(uint64 key)
+{
+	if(key >> 63)
+		return (uint32)key & 0x7FFFFFFF;
+	return (uint32)(key >> 32) & 0x7FFFFFFF;
+}
+
+static Raster*
+getRaster(Material *m)
+{
+	return m && m->texture ? m->texture->raster : nil;
+}
+
+static uint32
+getBlendBits(ObjPipeline *pipe, Atomic *atomic, Material *m, int32 mesh)
+{
+	Raster *r;
+	uint32 blend = 0;
+	if(m == nil)
+		return 0;
+	if(m->color.alpha != 0xFF)
+		blend |= BLEND_MATERIAL;
+	r = getRaster(m);
+	if(r && Raster::formatHasAlpha(r->format))
+		blend |= BLEND_RASTER;
+	if(pipe->impl.meshVertexAlpha &&
+	   pipe->impl.meshVertexAlpha(pipe, atomic, mesh < 0 ? 0 : mesh))
+		blend |= BLEND_VERTEX;
+	return blend;
+}
+
+static uint64
+makeKey(ObjPipeline *pipe, Atomic *atomic, Material *m, int32 mesh, float32 depth)
+{
+	uint32 flags = atomic->geometry->flags;
+	uint32 shader, blend, state, idepth;
+
+	shader = 0;
+	if(flags & Geometry::LIGHT) shader |= SHADER_LIGHT;
+	if(flags & Geometry::PRELIT) shader |= SHADER_PRELIT;
+	if(flags & Geometry::MODULATE) shader |= SHADER_MODULATE;
+	if(getRaster(m)) shader |= SHADER_TEXTURED;
+	blend = getBlendBits(pipe, atomic, m, mesh);
+
+	state = hashPointer(pipe, 7)<<24 | shader<<20 |
+		hashPointer(getRaster(m), 16)<<4 | blend;
+	if(depth < 0.0f)
+		depth = 0.0f;
+	memcpy(&idepth, &depth, 4);
+
+	if(blend)
+		return (uint64)1<<63 | (uint64)(~idepth)<<31 | state;
+	return (uint64)state<<32 | idepth;
+}
+
+static void
+calculateStats(RenderQueueStats *stats, RenderItem *items, int32 numItems)
+{
+	RenderItem *it, *prev;
+	int32 i;
+
+	memset(stats, 0, sizeof(RenderQueueStats));
+	stats->numItems = numItems;
+	prev = nil;
+	for(i = 0; i < numItems; i++){
+		it = &items[i];
+		if(it->key >> 63)
+			stats->numTranslucent++;
+		if(prev == nil || it->atomic != prev->atomic || it->mesh < 0)
+			stats->atomicChanges++;
+		if(prev == nil || it->pipeline != prev->pipeline)
+			stats->pipelineChanges++;
+		if(prev == nil || (getStateBits(it->key)>>20 & 0xF) != (getStateBits(prev->key)>>20 & 0xF))
+			stats->shaderChanges++;
+		if(prev == nil || getRaster(it->material) != getRaster(prev->material))
+			stats->rasterChanges++;
+		if(prev == nil || (getStateBits(it->key) & 0xF) != (getStateBits(prev->key) & 0xF))
+			stats->blendChanges++;
+		prev = it;
+	}
+}
+
+RenderQueue*
+RenderQueue::create(int32 space)
+{
+	RenderQueue *q = rwNewT(RenderQueue, 1, MEMDUR_EVENT);
+	if(q == nil){
+		RWERROR((ERR_ALLOC, sizeof(RenderQueue)));
+		return nil;
+	}
+	if(space < 16)
+		space = 16;
+	q->items = rwNewT(RenderItem, space, MEMDUR_EVENT);
+	q->sortBuffer = rwNewT(RenderItem, space, MEMDUR_EVENT);
+	q->numItems = 0;
+	q->space = space;
+	q->camera = nil;
+	q->occlusion = nil;
+	memset(&q->unsortedStats, 0, sizeof(RenderQueueStats));
+	memset(&q->stats, 0, sizeof(RenderQueueStats));
+	return q;
+}
+
+void
+RenderQueue::destroy(void)
+{
+	rwFree(this->items);
+	rwFree(this->sortBuffer);
+	rwFree(this);
+}
+
+void
+RenderQueue::begin(Camera *cam)
+{
+	this->camera = cam;
+	this->numItems = 0;
+}
+
+static RenderItem*
+newItem(RenderQueue *q)
+{
+	if(q->numItems >= q->space){
+		q->space *= 2;
+		q->items = rwResizeT(RenderItem, q->items, q->space, MEMDUR_EVENT);
+		q->sortBuffer = rwResizeT(RenderItem, q->sortBuffer, q->space, MEMDUR_EVENT);
+	}
+	return &q->items[q->numItems++];
+}
+
+void
+RenderQueue::addAtomic(Atomic *atomic)
+{
+	ObjPipeline *pipe;
+	Geometry *geo;
+	MeshHeader *mh;
+	Mesh *m;
+	RenderItem *it;
+	Sphere *s;
+	Matrix *camltm;
+	float32 depth;
+	int32 i;
+
+	geo = atomic->geometry;
+	if(geo == nil)
+		return;
+	if(this->occlusion && !this->occlusion->testAtomic(atomic))
+		return;
+	pipe = atomic->getPipeline();
+	mh = geo->meshHeader;
+
+	depth = 0.0f;
+	if(this->camera){
+		s = atomic->getWorldBoundingSphere();
+		camltm = this->camera->getFrame()->getLTM();
+		depth = dot(sub(s->center, camltm->pos), camltm->at);
+	}
+
+	// custom render callbacks and pipelines that
+	// can't draw single meshes get one item
+	if(atomic->renderCB != Atomic::defaultRenderCB ||
+	   pipe->impl.renderMesh == nil ||
+	   mh == nil || mh->numMeshes == 0){
+		it = newItem(this);
+		it->atomic = atomic;
+		it->pipeline = pipe;
+		it->material = mh && mh->numMeshes ? mh->getMeshes()->material : nil;
+		it->mesh = -1;
+		it->key = makeKey(pipe, atomic, it->material, -1, depth);
+		return;
+	}
+
+	m = mh->getMeshes();
+	for(i = 0; i < mh->numMeshes; i++){
+		if(m[i].numIndices == 0)
+			continue;
+		it = newItem(this);
+		it->atomic = atomic;
+		it->pipeline = pipe;
+		it->material = m[i].material;
+		it->mesh = i;
+		it->key = makeKey(pipe, atomic, it->material, i, depth);
+	}
+}
+
+void
+RenderQueue::addClump(Clump *clump)
+{
+	Atomic *a;
+	FORLIST(lnk, clump->atomics){
+		a = Atomic::fromClump(lnk);
+		if(a->object.object.flags & Atomic::RENDER)
+			this->addAtomic(a);
+	}
+}
+
+static Atomic*
+addAtomicCB(Atomic *atomic, void *data)
+{
+	if(atomic->object.object.flags & Atomic::RENDER)
+		((RenderQueue*)data)->addAtomic(atomic);
+	return atomic;
+}
+
+void
+RenderQueue::addWorld(World *world)
+{
+	if(this->camera == nil){
+		FORLIST(lnk, world->clumps)
+			this->addClump(Clump::fromWorld(lnk));
+		return;
+	}
+	world->forAllVisibleAtomics(this->camera, addAtomicCB, this);
+}
+
+// LSD radix sort on the 64 bit key, bytes that are
+// the same in all keys are skipped
+void
+RenderQueue::sort(void)
+{
+	uint32 counts[8][256];
+	RenderItem *src, *dst, *tmp;
+	uint32 offsets[256];
+	uint32 sum, b;
+	int32 i, pass, n;
+
+	n = this->numItems;
+	calculateStats(&this->unsortedStats, this->items, n);
+	if(n < 2)
+		return;
+
+	memset(counts, 0, sizeof(counts));
+	for(i = 0; i < n; i++)
+		for(pass = 0; pass < 8; pass++)
+			counts[pass][(this->items[i].key >> pass*8) & 0xFF]++;
+
+	src = this->items;
+	dst = this->sortBuffer;
+	for(pass = 0; pass < 8; pass++){
+		if(counts[pass][(src[0].key >> pass*8) & 0xFF] == (uint32)n)
+			continue;
+		sum = 0;
+		for(b = 0; b < 256; b++){
+			offsets[b] = sum;
+			sum += counts[pass][b];
+		}
+		for(i = 0; i < n; i++)
+			dst[offsets[(src[i].key >> pass*8) & 0xFF]++] = src[i];
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	// the result has to end up in items
+	if(src != this->items){
+		this->sortBuffer = this->items;
+		this->items = src;
+	}
+}
+
+void
+RenderQueue::submit(void)
+{
+	RenderItem *it;
+	Atomic *last;
+	int32 i;
+
+	last = nil;
+	for(i = 0; i < this->numItems; i++){
+		it = &this->items[i];
+		if(it->mesh < 0){
+			it->atomic->render();
+			last = nil;
+		}else{
+			it->pipeline->impl.renderMesh(it->pipeline, it->atomic,
+				it->mesh, it->atomic == last);
+			last = it->atomic;
+		}
+	}
+	calculateStats(&this->stats, this->items, this->numItems);
+}
+
+}
@@ -29,7 +29,9 @@ struct AnimInterpolatorInfo
 	typedef void (*InterpCB)(void *out, void *in1, void *in2, float32 t,
 	                         void *custom);
 	typedef void (*AddCB)(void *out, void *in1, void *in2);
-	typedef void (*MulRecipCB)(void *frame, void *start);
+	// Called once more with nil frames after all frames are done,
+	// so the custom data can be adjusted for the delta.
+	typedef void (*MulRecipCB)(void *frame, void *start, void *custom);
 
 	int32      id;
 	int32      interpKeyFrameSize;
@@ -63,6 +65,7 @@ struct Animation
 	                         int32 flags, float duration);
 	void destroy(void);
 	int32 getNumNodes(void);
+	bool32 makeDelta(void);
 	KeyFrameHeader *getAnimFrame(int32 n){
 		return (KeyFrameHeader*)((uint8*)this->keyframes +
 		                         n*this->interpInfo->animKeyFrameSize);
@@ -83,18 +86,26 @@ struct AnimInterpolator
 	int32      currentInterpKeyFrameSize;
 	int32      currentAnimKeyFrameSize;
 	int32      numNodes;
-	// TODO some callbacks, parent/sub
+	// TODO: parent/sub
 	// cached from the InterpolatorInfo
 	AnimInterpolatorInfo::ApplyCB    applyCB;
 	AnimInterpolatorInfo::BlendCB    blendCB;
 	AnimInterpolatorInfo::InterpCB   interpCB;
 	AnimInterpolatorInfo::AddCB      addCB;
+	AnimInterpolatorInfo::MulRecipCB mulRecipCB;
 	// after this interpolated frames
 
 	static AnimInterpolator *create(int32 numNodes, int32 maxKeyFrameSize);
 	void destroy(void);
 	bool32 setCurrentAnim(Animation *anim);
+	void setCurrentTime(float32 t);
 	void addTime(float32 t);
+	// Combine the interpolated frames of two interpolators into this one.
+	// mask is an optional weight per node that scales alpha.
+	bool32 blend(AnimInterpolator *in1, AnimInterpolator *in2,
+	             float32 alpha, const float32 *mask = nil);
+	bool32 addTogether(AnimInterpolator *in1, AnimInterpolator *in2);
+	bool32 setupCombine(AnimInterpolator *in1, AnimInterpolator *in2);
 	void *getFrames(void){ return this+1;}
 	InterpFrameHeader *getInterpFrame(int32 n){
 		return (InterpFrameHeader*)((uint8*)getFrames() +
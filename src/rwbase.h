@@ -44,6 +44,17 @@
 #define RWDEVICE c3d
 #endif
 
+#ifdef RW_SOFT
+#define RWDEVICE soft
+#endif
+
+// vectorized code paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RW_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RW_NEON
+#endif
+
 namespace rw {
 
 #ifdef RW_PS2
@@ -544,6 +555,7 @@ enum Platform
 	PLATFORM_WDGL = 11,	// WarDrum OpenGL
 	PLATFORM_GL3  = 12,	// my GL3 implementation
 	PLATFORM_3DS  = 13,
+	PLATFORM_SOFT = 14,	// software rasterizer
 
 	NUM_PLATFORMS,
 
@@ -562,7 +574,9 @@ enum VendorID
 	// Used for rasters (platform-specific)
 	VEND_RASTER         = 10,
 	// Used for driver/device allocation tags
-	VEND_DRIVER         = 11
+	VEND_DRIVER         = 11,
+	// librw's own plugins
+	VEND_LIBRW          = 12
 };
 
 // TODO: modules (VEND_CRITERIONINT)
@@ -609,6 +623,11 @@ enum PluginID
 	ID_NATIVEDATA    = MAKEPLUGINID(VEND_CRITERIONWORLD, 0x10),
 	ID_VERTEXFMT     = MAKEPLUGINID(VEND_CRITERIONWORLD, 0x11),
 
+	// librw
+	ID_MESHLETS      = MAKEPLUGINID(VEND_LIBRW, 0x01),
+	ID_STATICBATCH   = MAKEPLUGINID(VEND_LIBRW, 0x02),
+	ID_LODATOMIC     = MAKEPLUGINID(VEND_LIBRW, 0x03),
+
 	// custom native raster
 	ID_RASTERGL      = MAKEPLUGINID(VEND_RASTER, PLATFORM_GL),
 	ID_RASTERPS2     = MAKEPLUGINID(VEND_RASTER, PLATFORM_PS2),
@@ -618,6 +637,7 @@ enum PluginID
 	ID_RASTERWDGL    = MAKEPLUGINID(VEND_RASTER, PLATFORM_WDGL),
 	ID_RASTERGL3     = MAKEPLUGINID(VEND_RASTER, PLATFORM_GL3),
 	ID_RASTERC3D     = MAKEPLUGINID(VEND_RASTER, PLATFORM_3DS),
+	ID_RASTERSOFT    = MAKEPLUGINID(VEND_RASTER, PLATFORM_SOFT),
 
 	// anything driver/device related (only as allocation tag)
 	ID_DRIVER        = MAKEPLUGINID(VEND_DRIVER, 0)
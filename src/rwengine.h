@@ -42,6 +42,7 @@ struct Camera;
 struct Image;
 struct Texture;
 struct Raster;
+struct Atomic;
 class ObjPipeline;
 
 // This is for the render device, we only have one
@@ -132,6 +133,16 @@ struct FileFunctions
 	int (*rwfeof)(void *fp);
 };
 
+// Lets the application spread work over its own threads.
+// The default just runs everything on the calling thread.
+struct JobFunctions
+{
+	// Call job(data, i) for every i in [0, n), return when all are done.
+	// Jobs must not change shared engine state and only allocate
+	// memory where the caller says so (Atomic::prepareInstances).
+	void (*parallelFor)(void (*job)(void *data, int32 i), void *data, int32 n);
+};
+
 struct SubSystemInfo
 {
 	char name[80];
@@ -175,6 +186,7 @@ struct Engine
 
 	// These must always be available
 	static MemoryFunctions memfuncs;
+	static JobFunctions jobfuncs;
 	static State state;
 
 	static bool32 init(MemoryFunctions *memfuncs = nil);
@@ -235,6 +247,77 @@ extern MemoryFunctions defaultMemfuncs;
 extern MemoryFunctions managedMemfuncs;
 void printleaks(void);	// when using managed mem funcs
 
+// Device commands recorded into one linear buffer and executed later,
+// e.g. recorded on worker threads and replayed in order on the render
+// thread. Vertices, indices and matrices are copied, objects only by
+// pointer so they have to live until the buffer has been executed.
+// Recording touches nothing but the buffer, which allocates through
+// Engine::memfuncs only when it has to grow.
+struct CommandBuffer
+{
+	enum Op {
+		BEGINUPDATE = 1,
+		ENDUPDATE,
+		CLEARCAMERA,
+		SHOWRASTER,
+		SETRENDERSTATE,
+		IM2DPRIMITIVE,
+		IM2DINDEXEDPRIMITIVE,
+		IM3DTRANSFORM,
+		IM3DPRIMITIVE,
+		IM3DINDEXEDPRIMITIVE,
+		IM3DEND,
+		RENDERATOMIC,
+		CALLFUNC
+	};
+	// every command starts with this, followed by its arguments
+	struct Command {
+		uint32 op;
+		uint32 size;	// including this header
+	};
+
+	uint8 *data;
+	uint32 size;	// bytes recorded
+	uint32 space;
+	int32 numCommands;
+
+	static CommandBuffer *create(uint32 space = 4096);
+	void destroy(void);
+	void reset(void);
+	// Replay all commands on engine->device, must not record into itself
+	void execute(void);
+	Command *first(void) { return this->size ? (Command*)this->data : nil; }
+	Command *next(Command *cmd) {
+		uint8 *p = (uint8*)cmd + cmd->size;
+		return p < this->data + this->size ? (Command*)p : nil; }
+
+	void beginUpdate(Camera *cam);
+	void endUpdate(Camera *cam);
+	void clearCamera(Camera *cam, RGBA *col, uint32 mode);
+	void showRaster(Raster *raster, uint32 flags);
+	void setRenderState(int32 state, uint32 value);
+	void setRenderStatePtr(int32 state, void *value);
+
+	// lines and triangles are recorded as primitives of their vertices
+	void im2DRenderLine(void *vertices, int32 numVertices, int32 vert1, int32 vert2);
+	void im2DRenderTriangle(void *vertices, int32 numVertices, int32 vert1, int32 vert2, int32 vert3);
+	void im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices);
+	void im2DRenderIndexedPrimitive(PrimitiveType primType, void *vertices, int32 numVertices, void *indices, int32 numIndices);
+
+	void im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags);
+	void im3DRenderPrimitive(PrimitiveType primType);
+	void im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices);
+	void im3DEnd(void);
+
+	// Runs the atomic's pipeline when executed
+	void renderAtomic(Atomic *atomic);
+	// Anything else, e.g. backend matrix or uniform updates.
+	// The data is copied, func gets the copy when executed.
+	void call(void (*func)(void *data), void *data, uint32 size);
+
+	void *alloc(uint32 op, uint32 argSize, uint32 extraSize);
+};
+
 namespace null {
 	void beginUpdate(Camera*);
 	void endUpdate(Camera*);
@@ -270,6 +353,25 @@ namespace null {
 	int deviceSystem(DeviceReq req, void *arg0, int32 n);
 
 	extern Device renderdevice;
+
+	// Nothing is drawn but vertices still have a size when recorded
+	struct Im2DVertex
+	{
+		float32 x, y, z, w;
+		uint8   r, g, b, a;
+		float32 u, v;
+	};
+	struct Im3DVertex
+	{
+		V3d     position;
+		V3d     normal;
+		uint8   r, g, b, a;
+		float32 u, v;
+	};
+
+	// Record everything the null device is asked to do into cb,
+	// e.g. to check what a command buffer replays. nil stops recording.
+	void recordCommands(CommandBuffer *cb);
 }
 
 }
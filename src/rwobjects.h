@@ -453,7 +453,10 @@ void registerMaterialRightsPlugin(void);
 
 struct Mesh
 {
-	uint16 *indices;
+	union {
+		uint16 *indices;
+		uint32 *indices32;	// if MeshHeader::index32 is set
+	};
 	uint32 numIndices;
 	Material *material;
 };
@@ -461,22 +464,38 @@ struct Mesh
 struct MeshHeader
 {
 	enum {
-		TRISTRIP = 1
+		TRISTRIP = 1,
+		// librw extension, only used in the stream.
+		// in memory index32 is set instead so flags keeps its meaning
+		INDEX32 = 0x10000
 	};
 	uint32 flags;
 	uint16 numMeshes;
 	uint16 serialNum;
 	uint32 totalIndices;
-	uint32 pad;	// needed for alignment of Meshes
+	bool32 index32;	// uint32 indices, also needed for alignment of Meshes
 	// after this the meshes
 
 	Mesh *getMeshes(void) { return (Mesh*)(this+1); }
 	void setupIndices(void);
 	uint32 guessNumTriangles(void);
+	uint32 getIndexSize(void) const { return this->index32 ? 4 : 2; }
+	uint32 getIndex(const Mesh *m, uint32 i) const {
+		return this->index32 ? m->indices32[i] : m->indices[i]; }
+	void setIndex(Mesh *m, uint32 i, uint32 v) {
+		if(this->index32) m->indices32[i] = v;
+		else m->indices[i] = v; }
 };
 
 struct Geometry;
 
+// Post-transform vertex cache efficiency of a triangle list
+struct VertexCacheStats
+{
+	float32 acmr;	// average cache miss ratio, transformed vertices per triangle
+	float32 atvr;	// average transform to vertex ratio, 1.0 is optimal
+};
+
 struct MorphTarget
 {
 	Geometry *parent;
@@ -498,6 +517,13 @@ struct Triangle
 	uint16 matId;
 };
 
+// librw extension, only for geometries with Geometry::index32 set
+struct Triangle32
+{
+	uint32 v[3];
+	uint16 matId;
+};
+
 struct MaterialList
 {
 	Material **materials;
@@ -520,12 +546,16 @@ struct Geometry
 	Object object;
 	uint32 flags;
 	uint16 lockedSinceInst;
+	uint16 index32;	// triangles32 instead of triangles
 	int32 numTriangles;
 	int32 numVertices;
 	int32 numMorphTargets;
 	int32 numTexCoordSets;
 
-	Triangle *triangles;
+	union {
+		Triangle *triangles;
+		Triangle32 *triangles32;	// if index32 is set
+	};
 	RGBA *colors;
 	TexCoords *texCoords[8];
 
@@ -548,12 +578,30 @@ struct Geometry
 	void calculateBoundingSphere(void);
 	bool32 hasColoredMaterial(void);
 	void allocateData(void);
-	MeshHeader *allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices);
+	MeshHeader *allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices, bool32 index32 = 0);
+	// 16 bit indices can't address all vertices
+	bool32 needsIndex32(void) const { return this->numVertices > 0x10000; }
+	uint32 getTriangleSize(void) const { return this->index32 ? sizeof(Triangle32) : sizeof(Triangle); }
+	// work on either triangle layout
+	Triangle32 getTriangle(int32 i) const;
+	void setTriangle(int32 i, const Triangle32 &t);
+	void setTriMatId(int32 i, uint16 matId) {
+		if(this->index32) this->triangles32[i].matId = matId;
+		else this->triangles[i].matId = matId; }
 	void generateTriangles(int8 *adc = nil);
 	void buildMeshes(void);
 	void buildTristrips(void);	// private, used by buildMeshes
 	void correctTristripWinding(void);
 	void removeUnusedMaterials(void);
+	void getVertexCacheStats(VertexCacheStats *stats, int32 cacheSize = 16);
+	bool32 optimizeVertexCache(VertexCacheStats *before = nil, VertexCacheStats *after = nil);
+	int32 weldVertices(float32 epsilon = 0.0f);
+	Geometry *simplify(float32 ratio);
+	// write morph targets lerped from start to end by t into vertices and normals,
+	// normals are renormalized
+	void interpolateMorphTargets(V3d *vertices, V3d *normals, int32 start, int32 end, float32 t);
+	// weighted sum of all morph targets, one weight per target
+	void blendMorphTargets(V3d *vertices, V3d *normals, const float32 *weights);
 	static Geometry *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -577,7 +625,10 @@ struct Geometry
 		// to prevent rendering when executing a pipeline,
 		// so only instancing will occur.
 		// librw's pipelines are different so it's unused here.
-		NATIVEINSTANCE = 0x02000000
+		NATIVEINSTANCE = 0x02000000,
+		// librw extension: triangles are Triangle32, passed to
+		// create and used in the stream. In memory index32 is set.
+		INDEX32        = 0x80000000
 	};
 
 	enum LockFlags
@@ -607,6 +658,23 @@ void registerNativeDataPlugin(void);
 
 struct Clump;
 struct World;
+struct WorldSector;
+struct Light;
+
+struct Interpolator
+{
+	int32 startMorphTarget;
+	int32 endMorphTarget;
+	float32 time;		// duration of the interpolation
+	float32 recipTime;
+	float32 position;	// current time in [0, time]
+
+	void init(void);
+	void setTargets(int32 start, int32 end, float32 time);
+	void setPosition(float32 position) { this->position = position; }
+	void addTime(float32 t, int32 numMorphTargets);
+	float32 getValue(void) const { return this->position*this->recipTime; }
+};
 
 struct Atomic
 {
@@ -631,8 +699,16 @@ struct Atomic
 	LLLink inClump;
 	ObjPipeline *pipeline;
 	RenderCB renderCB;
+	Interpolator interpolator;
 
 	World *world;
+	WorldSector *sector;	// where it is in the world's octree
+	LLLink inSector;
+	// local lights touching the atomic, valid while lightStamp is not 0
+	Light **cachedLights;
+	int32 numCachedLights;
+	int32 cachedLightSpace;
+	uint32 lightStamp;
 	ObjectWithFrame::Sync originalSync;
 
 	static int32 numAllocated;
@@ -647,11 +723,16 @@ struct Atomic
 	Frame *getFrame(void) const { return (Frame*)this->object.object.parent; }
 	static Atomic *fromClump(LLLink *lnk){
 		return LLLinkGetData(lnk, Atomic, inClump); }
+	static Atomic *fromSector(LLLink *lnk){
+		return LLLinkGetData(lnk, Atomic, inSector); }
 	void setGeometry(Geometry *geo, uint32 flags);
 	Sphere *getWorldBoundingSphere(void);
 	ObjPipeline *getPipeline(void);
 	void instance(void);
 	void uninstance(void);
+	static void prepareInstances(Atomic **atomics, int32 num);
+	static void uploadInstances(Atomic **atomics, int32 num);
+	static void instanceAtomics(Atomic **atomics, int32 num);
 	void render(void) { this->renderCB(this); }
 	void setRenderCB(RenderCB renderCB){
 		this->renderCB = renderCB;
@@ -660,6 +741,7 @@ struct Atomic
 	};
 	void setFlags(uint32 flags) { this->object.object.flags = flags; }
 	uint32 getFlags(void) const { return this->object.object.flags; }
+	void addMorphTime(float32 t);
 	static Atomic *streamReadClump(Stream *stream,
 		FrameList_ *frameList, Geometry **geometryList);
 	bool streamWriteClump(Stream *stream, FrameList_ *frmlst);
@@ -686,6 +768,8 @@ struct Light
 
 	// world extension
 	World *world;
+	WorldSector *sector;	// only local lights are in the octree
+	LLLink inSector;
 	ObjectWithFrame::Sync originalSync;
 
 	static int32 numAllocated;
@@ -698,6 +782,10 @@ struct Light
 		return LLLinkGetData(lnk, Light, inClump); }
 	static Light *fromWorld(LLLink *lnk){
 		return LLLinkGetData(lnk, Light, inWorld); }
+	static Light *fromSector(LLLink *lnk){
+		return LLLinkGetData(lnk, Light, inSector); }
+	// changing radius directly doesn't update the world
+	void setRadius(float32 radius);
 	void setAngle(float32 angle);
 	float32 getAngle(void);
 	void setColor(float32 r, float32 g, float32 b);
@@ -732,6 +820,10 @@ struct FrustumPlane
 	uint8 closestZ;
 };
 
+// Opt-in, Clump::render and World::render test atomics
+// against the current camera with frustumTestSpheres.
+extern bool32 batchFrustumCulling;
+
 struct Camera
 {
 	PLUGINBASE
@@ -740,6 +832,8 @@ struct Camera
 	enum { CLEARIMAGE = 0x1, CLEARZ = 0x2, CLEARSTENCIL = 0x4 };
 	// return value of frustumTestSphere
 	enum { SPHEREOUTSIDE, SPHEREBOUNDARY, SPHEREINSIDE };
+	// return value of frustumTestBox
+	enum { BOXOUTSIDE, BOXBOUNDARY, BOXINSIDE };
 
 	ObjectWithFrame object;
 	void (*beginUpdateCB)(Camera*);
@@ -795,6 +889,15 @@ struct Camera
 	void setViewOffset(const V2d *offset);
 	void setProjection(int32 proj);
 	int32 frustumTestSphere(const Sphere *s) const;
+	int32 frustumTestBox(const BBox *box) const;
+	// Tests n world space spheres given as separate arrays.
+	// Sets bit i of visible ((n+31)/32 words) for every sphere not outside,
+	// writes their indices if indices isn't nil. Returns the number visible.
+	int32 frustumTestSpheres(const float32 *x, const float32 *y, const float32 *z,
+		const float32 *radius, int32 n, uint32 *visible, int32 *indices = nil) const;
+	// Moves the atomics whose world bounding spheres are not outside
+	// to the front of the array and returns their number.
+	int32 cullAtomics(Atomic **atomics, int32 n) const;
 	static Camera *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -838,6 +941,7 @@ struct Clump
 	static Clump *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
+	void instanceAtomics(void);
 	void render(void);
 };
 
@@ -852,18 +956,51 @@ struct WorldLights
 	Light **locals;	// points, (soft)spots
 };
 
+// Node of the world's loose octree.
+// An atomic lives in the deepest sector whose cell contains the center
+// of its bounding sphere and whose half size is at least the radius,
+// so the cell grown by its half size on every side contains the atomic.
+// The root also keeps atomics outside of the world's bounding box.
+// Local lights are kept the same way by their frame's position and radius.
+struct WorldSector
+{
+	V3d center;
+	float32 halfSize;
+	WorldSector *parent;
+	WorldSector *children[8];
+	int32 numChildren;
+	LinkList atomics;
+	LinkList lights;
+
+	void getBounds(BBox *box) const;	// the loose bounds
+};
+
 // A bit of a stub right now
 struct World
 {
 	PLUGINBASE
 	enum { ID = 7 };
+	enum { MAXSECTORDEPTH = 10, LIGHTHISTORY = 64 };
 	Object object;
 	LinkList localLights;	// these have positions (type >= 0x80)
 	LinkList globalLights;	// these do not (type < 0x80)
 	LinkList clumps;
+	WorldSector *rootSector;
+
+	// Every change to a local light gets a new stamp. An atomic's
+	// light list is still valid if it didn't move and none of the
+	// lights that changed since touch it now or before.
+	// Removing lights invalidates all lists.
+	uint32 lightStamp;
+	uint32 lightResetStamp;
+	struct {
+		Light *light;
+		uint32 stamp;
+	} lightHistory[LIGHTHISTORY];
 
 	static int32 numAllocated;
 
+	// the octree covers bbox, a large default cube if nil
 	static World *create(BBox *bbox = nil);	// TODO: should probably make this non-optional
 	void destroy(void);
 	void addLight(Light *light);
@@ -874,11 +1011,120 @@ struct World
 	void removeAtomic(Atomic *atomic);
 	void addClump(Clump *clump);
 	void removeClump(Clump *clump);
+	// moves the atomic to the right sector, called on frame sync
+	void updateAtomic(Atomic *atomic);
+	// same for local lights
+	void updateLight(Light *light);
+	typedef Atomic *(*AtomicCallback)(Atomic *atomic, void *data);
+	// return nil from the callback to stop
+	void forAllAtomicsInBox(const BBox *box, AtomicCallback cb, void *data);
+	void forAllAtomicsInSphere(const Sphere *sphere, AtomicCallback cb, void *data);
+	void forAllVisibleAtomics(Camera *cam, AtomicCallback cb, void *data);
+	// renders the atomics visible to the current camera
 	void render(void);
 	void enumerateLights(Atomic *atomic, WorldLights *lightData);
 	void enumerateLights(WorldLights *lightData);
 };
 
+// Screen space occluder triangle, edge and depth planes in pixels
+struct OccluderTriangle
+{
+	float32 edge[3][3];	// a*x + b*y + c >= 0 inside
+	float32 depth[3];	// nearness as a plane
+	int32 x0, y0, x1, y1;	// pixel bounds, inclusive
+};
+
+struct OcclusionStats
+{
+	int32 numOccluders;
+	int32 numTriangles;	// after near clipping and bounds rejection
+	int32 numTested;
+	int32 numOccluded;
+};
+
+// Software hierarchical Z buffer for occlusion culling.
+// Occluder atomics are rasterized into a small depth buffer,
+// then a min pyramid is built so boxes can be tested
+// against a few texels. Depth is stored as nearness (1/z for
+// perspective cameras), so greater values are closer.
+// Occluders need a geometry with triangles, native geometry is skipped.
+struct OcclusionBuffer
+{
+	enum { MAXLEVELS = 16, BANDHEIGHT = 16 };
+
+	int32 width, height;	// width is rounded up to 4
+	int32 numLevels;
+	int32 levelWidth[MAXLEVELS];
+	int32 levelHeight[MAXLEVELS];
+	float32 *levels[MAXLEVELS];	// 0 is the depth buffer
+	OccluderTriangle *triangles;
+	int32 numTriangles;
+	int32 space;
+	Camera *camera;
+	OcclusionStats stats;
+
+	static OcclusionBuffer *create(int32 width = 256, int32 height = 128);
+	void destroy(void);
+	void begin(Camera *cam);
+	void addOccluder(Atomic *atomic);
+	void addGeometry(Geometry *geo, Matrix *ltm);
+	// rasterizes the occluders and builds the pyramid
+	void end(void);
+	// false if the world space box is hidden
+	bool32 testBox(const BBox *box);
+	bool32 testAtomic(Atomic *atomic);
+	// Moves the atomics that are not hidden to the
+	// front of the array and returns their number.
+	int32 cullAtomics(Atomic **atomics, int32 n);
+};
+
+// One mesh (or a whole atomic) to be drawn by a RenderQueue
+struct RenderItem
+{
+	uint64 key;
+	Atomic *atomic;
+	ObjPipeline *pipeline;
+	Material *material;
+	int32 mesh;	// -1 renders the whole atomic
+};
+
+// State changes between consecutive items
+struct RenderQueueStats
+{
+	int32 numItems;
+	int32 numTranslucent;
+	int32 atomicChanges;
+	int32 pipelineChanges;
+	int32 shaderChanges;
+	int32 rasterChanges;
+	int32 blendChanges;
+};
+
+// Collects draw items and submits them sorted by state.
+// Opaque items are sorted by state and then front to back,
+// translucent ones back to front and then by state.
+// Pipelines without renderMesh get one item for the whole atomic.
+struct RenderQueue
+{
+	RenderItem *items;
+	RenderItem *sortBuffer;
+	int32 numItems;
+	int32 space;
+	Camera *camera;
+	OcclusionBuffer *occlusion;	// optional, tested in addAtomic
+	RenderQueueStats unsortedStats;	// in the order items were added
+	RenderQueueStats stats;		// in submission order
+
+	static RenderQueue *create(int32 space = 256);
+	void destroy(void);
+	void begin(Camera *cam);
+	void addAtomic(Atomic *atomic);
+	void addClump(Clump *clump);
+	void addWorld(World *world);
+	void sort(void);
+	void submit(void);
+};
+
 struct TexDictionary
 {
 	PLUGINBASE
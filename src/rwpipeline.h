@@ -1,6 +1,8 @@
 namespace rw {
 
 struct Atomic;
+struct Mesh;
+struct MeshHeader;
 
 class Pipeline
 {
@@ -29,6 +31,17 @@ public:
 		void (*instance)(ObjPipeline *pipe, Atomic *atomic);
 		void (*uninstance)(ObjPipeline *pipe, Atomic *atomic);
 		void (*render)(ObjPipeline *pipe, Atomic *atomic);
+		// Optional, used by RenderQueue to draw meshes one by one.
+		// sameAtomic means the last mesh drawn was of the same atomic,
+		// so per-object state is still set.
+		void (*renderMesh)(ObjPipeline *pipe, Atomic *atomic, int32 mesh, bool32 sameAtomic);
+		// Optional, whether the instanced mesh has vertex alpha
+		bool32 (*meshVertexAlpha)(ObjPipeline *pipe, Atomic *atomic, int32 mesh);
+		// Optional, instance split in two for Atomic::prepareInstances.
+		// prepareInstance does the CPU work and may run in a job,
+		// uploadInstance creates the device objects on the render thread.
+		void (*prepareInstance)(ObjPipeline *pipe, Atomic *atomic);
+		void (*uploadInstance)(ObjPipeline *pipe, Atomic *atomic);
 	} impl;
 	// just for convenience
 	void instance(Atomic *atomic) { this->impl.instance(this, atomic); }
@@ -37,6 +50,8 @@ public:
 };
 
 void findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices);
+void findMinVertAndNumVertices(uint32 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices);
+void findMinVertAndNumVertices(MeshHeader *header, Mesh *mesh, uint32 *minVert, int32 *numVertices);
 
 // everything xbox, d3d8 and d3d9 may want to use
 enum {
@@ -52,12 +67,20 @@ enum {
 	VERT_ARGB,
 	VERT_RGBA,
 	VERT_COMPNORM,
-	VERT_COMPNORM2
+	VERT_COMPNORM2,
+	VERT_UBYTE4N,
+	VERT_NORMSHORT4,	// normalized xyz + pad, positions are relative to a range
+	VERT_NORM1010102,	// signed normalized 10:10:10:2
+	VERT_HALF2
 };
 
 void instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride);
 void instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride);
 void uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride);
+// Quantized positions are stored as (v - offset)/scale, the range from findV3dRange maps into [-1,1]
+void findV3dRange(V3d *src, uint32 numVertices, V3d *scale, V3d *offset);
+void instV3dRange(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride, V3d *scale, V3d *offset);
+void uninstV3dRange(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride, V3d *scale, V3d *offset);
 void instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride);
 void uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride);
 bool32 instColor(int type, uint8 *dst, RGBA *src, uint32 numVertices, uint32 stride);
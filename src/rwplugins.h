@@ -20,6 +20,26 @@ struct HAnimInterpFrame
 	V3d            t;
 };
 
+// Compressed key frames, librw's own layout.
+// Rotation is smallest-three quantized,
+// translation is quantized to the range of the whole animation.
+// Not RW's compressed frames, which use interpolator id 2.
+struct HAnimCompressedKeyFrame
+{
+	enum { INTERPID = MAKEPLUGINID(VEND_LIBRW, 0x80) };
+
+	HAnimCompressedKeyFrame *prev;
+	float32 time;
+	uint16  q[3];
+	uint16  t[3];
+};
+
+struct HAnimCompressedCustomData
+{
+	V3d offset;
+	V3d scalar;
+};
+
 struct HAnimNodeInfo
 {
 	int32 id;
@@ -32,12 +52,17 @@ struct HAnimHierarchy
 {
 	int32 flags;
 	int32 numNodes;
+	// Skin::getPalette caches on generation, so after writing
+	// these directly set generation = nextGeneration()
+	// or skinned atomics keep rendering the old pose.
 	Matrix *matrices;
 	void  *matricesUnaligned;
 	HAnimNodeInfo *nodeInfo;
 	Frame *parentFrame;
 	HAnimHierarchy *parentHierarchy;	// mostly unused
 	AnimInterpolator *interpolator;
+	// changes whenever the matrices are updated, see above
+	uint32 generation;
 
 	static HAnimHierarchy *create(int32 numNodes, int32 *nodeFlags,
 			int32 *nodeIDs, int32 flags, int32 maxKeySize);
@@ -47,6 +72,14 @@ struct HAnimHierarchy
 	int32 getIndex(int32 id);
 	int32 getIndex(Frame *f);
 	void updateMatrices(void);
+	static void updateBatch(HAnimHierarchy **hierarchies, float32 *deltas, int32 num);
+	// mask is an optional weight per node, see makeMask
+	bool32 blend(HAnimHierarchy *in1, HAnimHierarchy *in2,
+	             float32 alpha, const float32 *mask = nil);
+	bool32 addTogether(HAnimHierarchy *in1, HAnimHierarchy *in2,
+	                   float32 weight = 1.0f, const float32 *mask = nil);
+	void makeMask(float32 *mask, int32 idx, float32 weight);
+	static uint32 nextGeneration(void);
 
 	static HAnimHierarchy *get(Frame *f);
 	static HAnimHierarchy *get(Clump *c){
@@ -78,6 +111,8 @@ struct HAnimData
 extern int32 hAnimOffset;
 extern bool32 hAnimDoStream;
 void registerHAnimPlugin(void);
+Animation *compressHAnimAnimation(Animation *anim);
+Animation *decompressHAnimAnimation(Animation *anim);
 
 
 /*
@@ -190,6 +225,13 @@ struct SkinGlobals
 };
 extern SkinGlobals skinGlobals;
 
+// Skin plugin data of an atomic
+struct SkinAtomic
+{
+	HAnimHierarchy *hierarchy;
+	bool32 dualQuat;	// use dual quaternion skinning
+};
+
 struct Skin
 {
 	int32 numBones;
@@ -214,6 +256,7 @@ struct Skin
 	};
 	int32 boneLimit;
 	int32 numMeshes;
+	bool32 meshPalettes;	// split by splitGeometry, every mesh has its own palette
 	int32 rleSize;
 	int8 *remapIndices;
 	RLEcount *rleCount;
@@ -223,9 +266,37 @@ struct Skin
 	void *platformData; // a place to store platform specific stuff
 	bool32 legacyType;	// old skin attached to atomic, needed for always CB
 
+	// Skinning matrices of the last pose, 3x4 row major per bone
+	struct Palette {
+		float32 *matrices;
+		float32 *dualQuats;	// 8 per bone, real and dual part
+		bool32 dualQuatsValid;
+		HAnimHierarchy *hier;
+		uint32 generation;
+		Matrix ltm;
+	} palette;
+
 	void init(int32 numBones, int32 numUsedBones, int32 numVertices);
 	void findNumWeights(int32 numVertices);
 	void findUsedBones(int32 numVertices);
+	static float32 *getPalette(Atomic *a);
+	static float32 *getDualQuatPalette(Atomic *a);
+	static bool32 splitGeometry(Geometry *geo, int32 boneLimit);
+	int32 getSplitBones(int32 mesh, uint8 *bones);
+
+	// Software skinning of morph target 0 into the atomic's local space.
+	// Destination arrays are indexed like the geometry's vertices.
+	static void skinVertices(Atomic *a, V3d *dstVerts, V3d *dstNormals);
+	void skinVertexRange(const float32 *palette,
+		const V3d *srcVerts, const V3d *srcNormals,
+		V3d *dstVerts, V3d *dstNormals, int32 first, int32 num);
+	// scalar reference for skinVertexRange
+	void skinVertexRangeRef(const float32 *palette,
+		const V3d *srcVerts, const V3d *srcNormals,
+		V3d *dstVerts, V3d *dstNormals, int32 first, int32 num);
+	void skinVertexRangeDualQuat(const float32 *dqPalette,
+		const V3d *srcVerts, const V3d *srcNormals,
+		V3d *dstVerts, V3d *dstNormals, int32 first, int32 num);
 
 	static void setPipeline(Atomic *a, int32 type);
 	static Skin *get(const Geometry *geo){
@@ -235,18 +306,154 @@ struct Skin
 		*PLUGINOFFSET(Skin*, geo, skinGlobals.geoOffset) = skin;
 	}
 	static void setHierarchy(Atomic *atomic, HAnimHierarchy *hier){
-		*PLUGINOFFSET(HAnimHierarchy*, atomic,
-		              skinGlobals.atomicOffset) = hier;
+		PLUGINOFFSET(SkinAtomic, atomic,
+		             skinGlobals.atomicOffset)->hierarchy = hier;
 	}
 	static HAnimHierarchy *getHierarchy(const Atomic *atomic){
-		return *PLUGINOFFSET(HAnimHierarchy*, atomic,
-		                     skinGlobals.atomicOffset);
+		return PLUGINOFFSET(SkinAtomic, atomic,
+		                    skinGlobals.atomicOffset)->hierarchy;
+	}
+	static void setDualQuat(Atomic *atomic, bool32 enable){
+		PLUGINOFFSET(SkinAtomic, atomic,
+		             skinGlobals.atomicOffset)->dualQuat = enable;
+	}
+	static bool32 getDualQuat(const Atomic *atomic){
+		return PLUGINOFFSET(SkinAtomic, atomic,
+		                    skinGlobals.atomicOffset)->dualQuat;
 	}
 };
 
+// VERT_FLOAT4 or VERT_UBYTE4N, the latter still sums up to one
+void instSkinWeights(int type, uint8 *dst, float32 *weights, uint32 numVertices, uint32 stride);
 Stream *readSkinSplitData(Stream *stream, Skin *skin);
 Stream *writeSkinSplitData(Stream *stream, Skin *skin);
 int32 skinSplitDataSize(Skin *skin);
 void registerSkinPlugin(void);
 
+/*
+ * LOD Atomic
+ */
+
+// Levels of detail are separate atomics in the same clump sharing a frame.
+// The base atomic (level 0) holds the set, select() turns on
+// rendering of exactly one level per set.
+struct LODAtomic
+{
+	enum { MAXLOD = 10 };
+
+	Atomic *lods[MAXLOD];	// only on the base atomic
+	float32 ranges[MAXLOD];	// level i is used up to this camera distance
+	int32 numLods;
+	int32 currentLod;
+	Atomic *base;		// base atomic of the set this one belongs to
+
+	static LODAtomic *get(Atomic *a);
+	static bool32 setLOD(Atomic *base, int32 level, Atomic *lod, float32 range);
+	static int32 generate(Clump *clump, Atomic *base, float32 *ratios, float32 *ranges, int32 numLods);
+	static void select(Clump *clump, Camera *cam);
+	static int32 getCurrentLOD(Atomic *a) { return get(a)->currentLod; }
+};
+
+struct LODAtomicGlobals
+{
+	int32 atomicOffset;
+};
+extern LODAtomicGlobals lodAtomicGlobals;
+void registerLODAtomicPlugin(void);
+
+/*
+ * Meshlets
+ */
+
+// A cluster of triangles, contiguous in its mesh's index list.
+// All fields are 32 bit for streaming.
+struct Meshlet
+{
+	Sphere bound;		// object space
+	V3d coneAxis;		// average facing direction
+	float32 coneCutoff;	// sine of the cone's half angle, 1.0 if it can't be culled
+	int32 mesh;
+	int32 firstIndex;
+	int32 numTriangles;
+	int32 numVertices;
+};
+
+struct MeshletGlobals
+{
+	int32 geoOffset;
+};
+extern MeshletGlobals meshletGlobals;
+
+struct Meshlets
+{
+	int32 numMeshlets;
+	Meshlet *meshlets;
+
+	// Reorders the triangles of every mesh, the geometry has to be a triangle list.
+	static Meshlets *build(Geometry *geo, int32 maxVertices = 64, int32 maxTriangles = 124);
+	static void destroy(Geometry *geo);
+	// Sets visible[i] for every meshlet not outside the frustum or facing away.
+	// The camera's frustum planes have to be up to date.
+	static int32 cull(Atomic *atomic, Camera *cam, uint8 *visible);
+	static Meshlets *get(const Geometry *geo){
+		return *PLUGINOFFSET(Meshlets*, geo, meshletGlobals.geoOffset);
+	}
+	static void set(Geometry *geo, Meshlets *mls){
+		*PLUGINOFFSET(Meshlets*, geo, meshletGlobals.geoOffset) = mls;
+	}
+};
+void registerMeshletPlugin(void);
+
+/*
+ * Static batching
+ */
+
+// Where the vertices and triangles of one source atomic ended up
+// in a batched geometry. All fields are 32 bit for streaming.
+struct BatchSource
+{
+	int32 id;		// index of the atomic in the array passed to build()
+	int32 firstVertex;
+	int32 numVertices;
+	int32 firstTriangle;
+	int32 numTriangles;
+};
+
+struct StaticBatchGlobals
+{
+	int32 geoOffset;
+};
+extern StaticBatchGlobals staticBatchGlobals;
+
+struct StaticBatch
+{
+	int32 numSources;
+	BatchSource *sources;
+
+	// Merges compatible atomics into new atomics attached to frame
+	// (the clump's frame if nil) and adds them to the clump.
+	// The merged atomics are removed and destroyed, all others are left alone.
+	// Returns the number of batched atomics created.
+	// A maxVertices of 0 means no limit, larger batches
+	// get 32 bit triangles and indices.
+	static int32 build(Clump *clump, Atomic **atomics, int32 numAtomics,
+		Frame *frame = nil, int32 maxVertices = 0x10000);
+	// Transforms the atomics into frame's space and merges them
+	// into one triangle list geometry, meshes are merged by material.
+	static Geometry *merge(Atomic **atomics, int32 *ids, int32 numAtomics, Frame *frame);
+	static bool32 canBatch(Atomic *atomic);
+	static bool32 isCompatible(Atomic *a1, Atomic *a2);
+	// Returns the source id of a batched triangle or -1,
+	// optionally the triangle's index in the source geometry.
+	static int32 findSource(const Geometry *geo, int32 triangle, int32 *srcTriangle = nil);
+	static void destroy(Geometry *geo);
+	static StaticBatch *get(const Geometry *geo){
+		return *PLUGINOFFSET(StaticBatch*, geo, staticBatchGlobals.geoOffset);
+	}
+	static void set(Geometry *geo, StaticBatch *sb){
+		*PLUGINOFFSET(StaticBatch*, geo, staticBatchGlobals.geoOffset) = sb;
+	}
+};
+void registerStaticBatchPlugin(void);
+
 }
@@ -20,6 +20,12 @@
 #include "gl/rwgl3.h"
 #include "gl/rwgl3plg.h"
 #include "3ds/rw3dsplg.h"
+#include "soft/rwsoft.h"
+#include "soft/rwsoftplg.h"
+
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
 
 #define PLUGIN_ID ID_SKIN
 
@@ -41,6 +47,8 @@ destroySkin(void *object, int32 offset, int32)
 	if(skin){
 		rwFree(skin->data);
 		rwFree(skin->remapIndices);
+		rwFree(skin->palette.matrices);
+		rwFree(skin->palette.dualQuats);
 //		delete[] skin->platformData;
 	}
 	rwFree(skin);
@@ -323,7 +331,9 @@ skinAlways(void *object, int32, int32)
 static void*
 createSkinAtm(void *object, int32 offset, int32)
 {
-	*PLUGINOFFSET(void*, object, offset) = nil;
+	SkinAtomic *skin = PLUGINOFFSET(SkinAtomic, object, offset);
+	skin->hierarchy = nil;
+	skin->dualQuat = 0;
 	return object;
 }
 
@@ -336,7 +346,7 @@ destroySkinAtm(void *object, int32 offset, int32)
 static void*
 copySkinAtm(void *dst, void *src, int32 offset, int32)
 {
-	*PLUGINOFFSET(void*, dst, offset) = *PLUGINOFFSET(void*, src, offset);
+	*PLUGINOFFSET(SkinAtomic, dst, offset) = *PLUGINOFFSET(SkinAtomic, src, offset);
 	return dst;
 }
 
@@ -375,6 +385,7 @@ registerSkinPlugin(void)
 	wdgl::initSkin();
 	gl3::initSkin();
 	c3d::initSkin();
+	soft::initSkin();
 
 	int32 o;
 	o = Geometry::registerPlugin(sizeof(Skin*), ID_SKIN,
@@ -382,7 +393,7 @@ registerSkinPlugin(void)
 	Geometry::registerPluginStream(ID_SKIN,
 	                               readSkin, writeSkin, getSizeSkin);
 	skinGlobals.geoOffset = o;
-	o = Atomic::registerPlugin(sizeof(HAnimHierarchy*),ID_SKIN,
+	o = Atomic::registerPlugin(sizeof(SkinAtomic),ID_SKIN,
 	                           createSkinAtm, destroySkinAtm, copySkinAtm);
 	skinGlobals.atomicOffset = o;
 	Atomic::registerPluginStream(ID_SKIN, readSkinLegacy, nil, nil);
@@ -426,6 +437,7 @@ Skin::init(int32 numBones, int32 numUsedBones, int32 numVertices)
 
 	this->boneLimit = 0;
 	this->numMeshes = 0;
+	this->meshPalettes = 0;
 	this->rleSize = 0;
 	this->remapIndices = nil;
 	this->rleCount = nil;
@@ -433,6 +445,151 @@ Skin::init(int32 numBones, int32 numUsedBones, int32 numVertices)
 
 	this->platformData = nil;
 	this->legacyType = 0;
+
+	this->palette.matrices = nil;
+	this->palette.dualQuats = nil;
+	this->palette.dualQuatsValid = 0;
+	this->palette.hier = nil;
+	this->palette.generation = 0;
+}
+
+static bool32
+equalMatrix(const Matrix *a, const Matrix *b)
+{
+	return memcmp(&a->right, &b->right, sizeof(V3d)) == 0 &&
+	       memcmp(&a->up, &b->up, sizeof(V3d)) == 0 &&
+	       memcmp(&a->at, &b->at, sizeof(V3d)) == 0 &&
+	       memcmp(&a->pos, &b->pos, sizeof(V3d)) == 0;
+}
+
+// Get the skinning matrices for an atomic. They are only recalculated
+// when the hierarchy or the atomic have moved, so all render passes and
+// atomics sharing the skin use the same palette. Moving the hierarchy is
+// detected through its generation, code that writes the matrices itself
+// has to bump it.
+float32*
+Skin::getPalette(Atomic *a)
+{
+	int32 i;
+	Skin *skin = Skin::get(a->geometry);
+	HAnimHierarchy *hier = Skin::getHierarchy(a);
+	Palette *pal = &skin->palette;
+	float32 *m;
+	Matrix *ltm;
+	Matrix *invMats;
+	Matrix invAtmMat, tmp, tmp2;
+	RawMatrix raw;
+
+	if(pal->matrices == nil){
+		pal->matrices = rwNewT(float32, skin->numBones*12, MEMDUR_EVENT | ID_SKIN);
+		pal->hier = nil;
+	}
+	m = pal->matrices;
+
+	if(hier == nil){
+		for(i = 0; i < skin->numBones; i++){
+			m[0] = 1.0f; m[1] = 0.0f; m[2] = 0.0f; m[3] = 0.0f;
+			m[4] = 0.0f; m[5] = 1.0f; m[6] = 0.0f; m[7] = 0.0f;
+			m[8] = 0.0f; m[9] = 0.0f; m[10] = 1.0f; m[11] = 0.0f;
+			m += 12;
+		}
+		pal->hier = nil;
+		pal->dualQuatsValid = 0;
+		return pal->matrices;
+	}
+
+	assert(skin->numBones == hier->numNodes);
+	ltm = nil;
+	if(!(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES))
+		ltm = a->getFrame()->getLTM();
+	if(pal->hier == hier && pal->generation == hier->generation &&
+	   (ltm == nil || equalMatrix(ltm, &pal->ltm)))
+		return pal->matrices;
+
+	invMats = (Matrix*)skin->inverseMatrices;
+	if(ltm){
+		Matrix::invert(&invAtmMat, ltm);
+		pal->ltm = *ltm;
+	}
+	for(i = 0; i < hier->numNodes; i++){
+		invMats[i].flags = 0;
+		if(ltm){
+			Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
+			Matrix::mult(&tmp2, &invMats[i], &tmp);
+		}else
+			Matrix::mult(&tmp2, &invMats[i], &hier->matrices[i]);
+		RawMatrix::transpose(&raw, (RawMatrix*)&tmp2);
+		memcpy(m, &raw, 12*sizeof(float32));
+		m += 12;
+	}
+	pal->hier = hier;
+	pal->generation = hier->generation;
+	pal->dualQuatsValid = 0;
+	return pal->matrices;
+}
+
+// Convert the matrix palette to unit dual quaternions.
+// Bone matrices are assumed not to have any scaling.
+float32*
+Skin::getDualQuatPalette(Atomic *a)
+{
+	int32 i;
+	Skin *skin = Skin::get(a->geometry);
+	Palette *pal = &skin->palette;
+	float32 *m, *dq;
+	float32 tr, s, x, y, z, w;
+
+	m = Skin::getPalette(a);
+	if(pal->dualQuats == nil){
+		pal->dualQuats = rwNewT(float32, skin->numBones*8, MEMDUR_EVENT | ID_SKIN);
+		pal->dualQuatsValid = 0;
+	}
+	if(pal->dualQuatsValid)
+		return pal->dualQuats;
+
+	dq = pal->dualQuats;
+	for(i = 0; i < skin->numBones; i++){
+		// rows are m[0..2], m[4..6], m[8..10]; translation is column 3
+		tr = m[0] + m[5] + m[10];
+		if(tr > 0.0f){
+			s = sqrtf(tr + 1.0f)*2.0f;
+			w = 0.25f*s;
+			x = (m[9] - m[6])/s;
+			y = (m[2] - m[8])/s;
+			z = (m[4] - m[1])/s;
+		}else if(m[0] > m[5] && m[0] > m[10]){
+			s = sqrtf(1.0f + m[0] - m[5] - m[10])*2.0f;
+			w = (m[9] - m[6])/s;
+			x = 0.25f*s;
+			y = (m[1] + m[4])/s;
+			z = (m[2] + m[8])/s;
+		}else if(m[5] > m[10]){
+			s = sqrtf(1.0f + m[5] - m[0] - m[10])*2.0f;
+			w = (m[2] - m[8])/s;
+			x = (m[1] + m[4])/s;
+			y = 0.25f*s;
+			z = (m[6] + m[9])/s;
+		}else{
+			s = sqrtf(1.0f + m[10] - m[0] - m[5])*2.0f;
+			w = (m[4] - m[1])/s;
+			x = (m[2] + m[8])/s;
+			y = (m[6] + m[9])/s;
+			z = 0.25f*s;
+		}
+		dq[0] = x;
+		dq[1] = y;
+		dq[2] = z;
+		dq[3] = w;
+		// dual = 0.5 * translation * real
+		dq[4] = 0.5f*( m[3]*w + m[7]*z - m[11]*y);
+		dq[5] = 0.5f*(-m[3]*z + m[7]*w + m[11]*x);
+		dq[6] = 0.5f*( m[3]*y - m[7]*x + m[11]*w);
+		dq[7] = -0.5f*(m[3]*x + m[7]*y + m[11]*z);
+		m += 12;
+		dq += 8;
+	}
+	pal->dualQuatsValid = 1;
+	return pal->dualQuats;
 }
 
 
@@ -440,19 +597,34 @@ Skin::init(int32 numBones, int32 numUsedBones, int32 numVertices)
 //static_assert(sizeof(Skin::RLEcount) == 2, "RLEcount size");
 //static_assert(sizeof(Skin::RLE) == 2, "RLE size");
 
+#ifdef RW_SSE2
+// bit i set if weight i is not zero
+static inline int
+weightMask(const float *w)
+{
+	return ~_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(w), _mm_setzero_ps())) & 0xF;
+}
+#else
+static inline int
+weightMask(const float *w)
+{
+	return (w[0] != 0.0f) | (w[1] != 0.0f)<<1 | (w[2] != 0.0f)<<2 | (w[3] != 0.0f)<<3;
+}
+#endif
+
 void
 Skin::findNumWeights(int32 numVertices)
 {
-	this->numWeights = 1;
+	int mask = 0;
 	float *w = this->weights;
-	while(numVertices--){
-		while(w[this->numWeights] != 0.0f){
-			this->numWeights++;
-			if(this->numWeights == 4)
-				return;
-		}
+	// weights are sorted, so the highest non-zero one gives the number
+	while(numVertices-- && mask < 8){
+		mask |= weightMask(w);
 		w += 4;
 	}
+	this->numWeights = mask >= 8 ? 4 :
+	                   mask >= 4 ? 3 :
+	                   mask >= 2 ? 2 : 1;
 }
 
 void
@@ -461,14 +633,15 @@ Skin::findUsedBones(int32 numVertices)
 	uint8 usedTab[256];
 	uint8 *indices = this->indices;
 	float *weights = this->weights;
+	int all = (1<<this->numWeights) - 1;
+	int mask;
 	memset(usedTab, 0, 256);
 	while(numVertices--){
-		for(int32 i = 0; i < this->numWeights; i++){
-			if(weights[i] == 0.0f)
-				continue;	// TODO: this could probably be optimized
-			if(usedTab[indices[i]] == 0)
-				usedTab[indices[i]]++;
-		}
+		mask = weightMask(weights) & all;
+		if(mask & 1) usedTab[indices[0]] = 1;
+		if(mask & 2) usedTab[indices[1]] = 1;
+		if(mask & 4) usedTab[indices[2]] = 1;
+		if(mask & 8) usedTab[indices[3]] = 1;
 		indices += 4;
 		weights += 4;
 	}
@@ -478,6 +651,643 @@ Skin::findUsedBones(int32 numVertices)
 			this->usedBones[this->numUsedBones++] = i;
 }
 
+void
+instSkinWeights(int type, uint8 *dst, float32 *weights, uint32 numVertices, uint32 stride)
+{
+	uint32 i;
+	int32 j, max, sum;
+	int32 q[4];
+	float32 w[4], total;
+	if(type == VERT_FLOAT4)
+		for(i = 0; i < numVertices; i++){
+			memcpy(dst, weights, 16);
+			dst += stride;
+			weights += 4;
+		}
+	else if(type == VERT_UBYTE4N)
+		for(i = 0; i < numVertices; i++){
+			// weights don't always add up to one, normalize first
+			total = 0.0f;
+			for(j = 0; j < 4; j++){
+				w[j] = weights[j] > 0.0f ? weights[j] : 0.0f;
+				total += w[j];
+			}
+			total = total > 0.0f ? 255.0f/total : 0.0f;
+			max = 0;
+			sum = 0;
+			for(j = 0; j < 4; j++){
+				q[j] = (int32)(w[j]*total + 0.5f);
+				q[j] = q[j] > 255 ? 255 : q[j];
+				sum += q[j];
+				if(q[j] > q[max])
+					max = j;
+			}
+			// put the rounding error on the largest weight
+			if(sum != 0){
+				q[max] += 255 - sum;
+				q[max] = q[max] < 0 ? 0 : q[max] > 255 ? 255 : q[max];
+			}
+			for(j = 0; j < 4; j++)
+				dst[j] = q[j];
+			dst += stride;
+			weights += 4;
+		}
+	else
+		assert(0 && "unsupported skin weight type");
+}
+
+//
+// Skin splitting
+//
+
+// Bones used by a split mesh in the order of its palette
+int32
+Skin::getSplitBones(int32 mesh, uint8 *bones)
+{
+	int32 i, j, n;
+	RLEcount *rc = &this->rleCount[mesh];
+	n = 0;
+	for(i = rc->start; i < rc->start+rc->size; i++)
+		for(j = 0; j < this->rle[i].n; j++)
+			bones[n++] = this->remapIndices[this->rle[i].startbone + j];
+	return n;
+}
+
+// Replace all vertex data by the vertices listed in orig
+static void
+remapVertices(Geometry *geo, Skin *skin, int32 *orig, int32 numVerts)
+{
+	int32 i, j, n;
+	int32 numTex = geo->numTexCoordSets;
+	int32 numMT = geo->numMorphTargets;
+	bool32 normals = !!(geo->flags & Geometry::NORMALS);
+	MorphTarget *mt;
+	V3d *verts, *norms, *v;
+	RGBA *colors;
+	TexCoords *tex;
+	uint8 *indices;
+	float32 *weights;
+
+	// allocateData doesn't keep any data, so copy everything first
+	n = numMT*numVerts*(normals ? 2 : 1);
+	verts = rwNewT(V3d, n, MEMDUR_FUNCTION | ID_SKIN);
+	norms = normals ? verts + numMT*numVerts : nil;
+	for(j = 0; j < numMT; j++){
+		mt = &geo->morphTargets[j];
+		for(i = 0; i < numVerts; i++){
+			verts[j*numVerts + i] = mt->vertices[orig[i]];
+			if(normals)
+				norms[j*numVerts + i] = mt->normals[orig[i]];
+		}
+	}
+	colors = nil;
+	if(geo->colors){
+		colors = rwNewT(RGBA, numVerts, MEMDUR_FUNCTION | ID_SKIN);
+		for(i = 0; i < numVerts; i++)
+			colors[i] = geo->colors[orig[i]];
+	}
+	tex = rwNewT(TexCoords, numTex*numVerts, MEMDUR_FUNCTION | ID_SKIN);
+	for(j = 0; j < numTex; j++)
+		for(i = 0; i < numVerts; i++)
+			tex[j*numVerts + i] = geo->texCoords[j][orig[i]];
+	indices = rwNewT(uint8, numVerts*4, MEMDUR_FUNCTION | ID_SKIN);
+	weights = rwNewT(float32, numVerts*4, MEMDUR_FUNCTION | ID_SKIN);
+	for(i = 0; i < numVerts; i++){
+		memcpy(&indices[i*4], &skin->indices[orig[i]*4], 4);
+		memcpy(&weights[i*4], &skin->weights[orig[i]*4], 4*sizeof(float32));
+	}
+
+	// frees colors and tex coords too, triangles are rewritten by the caller
+	rwFree(geo->triangles);
+	geo->numVertices = numVerts;
+	geo->allocateData();
+	for(j = 0; j < numMT; j++){
+		v = geo->morphTargets[j].vertices;
+		memcpy(v, &verts[j*numVerts], numVerts*sizeof(V3d));
+		if(normals){
+			v = geo->morphTargets[j].normals;
+			memcpy(v, &norms[j*numVerts], numVerts*sizeof(V3d));
+		}
+	}
+	if(colors)
+		memcpy(geo->colors, colors, numVerts*sizeof(RGBA));
+	for(j = 0; j < numTex; j++)
+		memcpy(geo->texCoords[j], &tex[j*numVerts], numVerts*sizeof(TexCoords));
+
+	// same for the skin
+	uint8 *olddata = skin->data;
+	float *oldInv = skin->inverseMatrices;
+	uint8 *oldUsed = skin->usedBones;
+	int32 numWeights = skin->numWeights;
+	void *platformData = skin->platformData;
+	bool32 legacyType = skin->legacyType;
+	rwFree(skin->remapIndices);
+	rwFree(skin->palette.matrices);
+	rwFree(skin->palette.dualQuats);
+	skin->init(skin->numBones, skin->numUsedBones, numVerts);
+	memcpy(skin->usedBones, oldUsed, skin->numUsedBones);
+	memcpy(skin->inverseMatrices, oldInv, skin->numBones*64);
+	memcpy(skin->indices, indices, numVerts*4);
+	memcpy(skin->weights, weights, numVerts*4*sizeof(float32));
+	skin->numWeights = numWeights;
+	skin->platformData = platformData;
+	skin->legacyType = legacyType;
+	rwFree(olddata);
+
+	rwFree(verts);
+	rwFree(colors);
+	rwFree(tex);
+	rwFree(indices);
+	rwFree(weights);
+}
+
+// Do all bones of vertex v have the same palette slot in both groups?
+static bool32
+sameSlots(Skin *skin, uint8 *slots1, uint8 *slots2, int32 v)
+{
+	for(int32 k = 0; k < 4; k++){
+		if(skin->weights[v*4 + k] == 0.0f)
+			continue;
+		int32 b = skin->indices[v*4 + k];
+		if(slots1[b] != slots2[b])
+			return 0;
+	}
+	return 1;
+}
+
+// Collect the distinct bones of a triangle
+static int32
+triangleBones(Skin *skin, Triangle32 *tri, uint8 *bones)
+{
+	int32 i, j, k, b, n;
+	n = 0;
+	for(i = 0; i < 3; i++)
+		for(k = 0; k < 4; k++){
+			if(skin->weights[tri->v[i]*4 + k] == 0.0f)
+				continue;
+			b = skin->indices[tri->v[i]*4 + k];
+			for(j = 0; j < n; j++)
+				if(bones[j] == b)
+					break;
+			if(j == n)
+				bones[n++] = b;
+		}
+	return n;
+}
+
+// Split the triangles of a skinned geometry into meshes that use
+// at most boneLimit bones each. Bones are ordered so that every mesh
+// uses few runs of them, which are described by the RLE tables.
+// Vertex bone indices are unchanged, the pipelines map them to palette
+// slots with getSplitBones. Vertices that would need different slots
+// in different meshes are duplicated.
+// NB: per-vertex data of other plugins is not remapped.
+bool32
+Skin::splitGeometry(Geometry *geo, int32 boneLimit)
+{
+	Skin *skin = Skin::get(geo);
+	int32 i, j, k, b, g, t, n, u, v;
+	int32 numTris, numVerts, numBones;
+	int32 numGroups, maxGroups, numInGroup, numNew, numRle, start;
+	int32 *order, *groupFirst, *orig, *owner, *dupNext;
+	uint16 *groupMat;
+	uint8 *groupBits, *bits, *slots;
+	uint8 triBones[12];
+	uint8 remap[256];
+	int32 pos[256];
+	Triangle32 *tris, tri;
+	int8 *data;
+	RLE *rle;
+	Mesh *m;
+	bool32 ret;
+
+	if(skin == nil || geo->flags & Geometry::NATIVE || geo->instData){
+		RWERROR((ERR_GENERAL, "can only split uninstanced skinned geometry"));
+		return 0;
+	}
+	if(boneLimit < 4 || boneLimit > 255){
+		RWERROR((ERR_GENERAL, "invalid bone limit"));
+		return 0;
+	}
+	numTris = geo->numTriangles;
+	numVerts = geo->numVertices;
+	numBones = skin->numBones;
+	if(numTris == 0)
+		return 1;
+
+	ret = 0;
+	slots = nil;
+	orig = nil;
+	tris = nil;
+
+	// sort triangles by material
+	order = rwNewT(int32, numTris, MEMDUR_FUNCTION | ID_SKIN);
+	n = 0;
+	for(j = 0; j < geo->matList.numMaterials; j++)
+		for(i = 0; i < numTris; i++)
+			if(geo->getTriangle(i).matId == j)
+				order[n++] = i;
+	assert(n == numTris);
+
+	// Greedily collect triangles into groups until the bone limit is hit
+	maxGroups = 16;
+	groupFirst = rwNewT(int32, maxGroups+1, MEMDUR_FUNCTION | ID_SKIN);
+	groupMat = rwNewT(uint16, maxGroups, MEMDUR_FUNCTION | ID_SKIN);
+	groupBits = rwNewT(uint8, maxGroups*256, MEMDUR_FUNCTION | ID_SKIN);
+	numGroups = 0;
+	numInGroup = 0;
+	bits = nil;
+	for(t = 0; t < numTris; t++){
+		tri = geo->getTriangle(order[t]);
+		n = triangleBones(skin, &tri, triBones);
+		if(n > boneLimit){
+			RWERROR((ERR_GENERAL, "triangle uses more bones than the limit"));
+			goto out;
+		}
+		if(numGroups > 0 && groupMat[numGroups-1] == tri.matId){
+			numNew = 0;
+			for(i = 0; i < n; i++)
+				if(!bits[triBones[i]])
+					numNew++;
+			if(numInGroup + numNew <= boneLimit)
+				goto add;
+		}
+		// start a new group
+		if(numGroups == maxGroups){
+			maxGroups *= 2;
+			groupFirst = rwResizeT(int32, groupFirst, maxGroups+1, MEMDUR_FUNCTION | ID_SKIN);
+			groupMat = rwResizeT(uint16, groupMat, maxGroups, MEMDUR_FUNCTION | ID_SKIN);
+			groupBits = rwResizeT(uint8, groupBits, maxGroups*256, MEMDUR_FUNCTION | ID_SKIN);
+		}
+		groupFirst[numGroups] = t;
+		groupMat[numGroups] = tri.matId;
+		bits = &groupBits[numGroups*256];
+		memset(bits, 0, 256);
+		numGroups++;
+		numInGroup = 0;
+	add:
+		for(i = 0; i < n; i++)
+			if(!bits[triBones[i]]){
+				bits[triBones[i]] = 1;
+				numInGroup++;
+			}
+	}
+	groupFirst[numGroups] = numTris;
+	if(numGroups > 255){
+		RWERROR((ERR_GENERAL, "too many meshes after split"));
+		goto out;
+	}
+
+	// Order bones by first use so groups get contiguous runs
+	n = 0;
+	for(b = 0; b < 256; b++)
+		pos[b] = -1;
+	for(g = 0; g < numGroups; g++)
+		for(b = 0; b < 256; b++)
+			if(groupBits[g*256 + b] && pos[b] < 0)
+				pos[b] = n++;
+	for(b = 0; b < numBones; b++)
+		if(pos[b] < 0)
+			pos[b] = n++;
+
+	for(b = 0; b < numBones; b++)
+		remap[pos[b]] = b;
+
+	// Count runs and find the palette slot of every bone in each group
+	slots = rwNewT(uint8, numGroups*256, MEMDUR_FUNCTION | ID_SKIN);
+	memset(slots, 0, numGroups*256);
+	numRle = 0;
+	for(g = 0; g < numGroups; g++){
+		bits = &groupBits[g*256];
+		n = 0;
+		for(i = 0; i < numBones; i++){
+			if(!bits[remap[i]])
+				continue;
+			if(i == 0 || !bits[remap[i-1]])
+				numRle++;
+			slots[g*256 + remap[i]] = n++;
+		}
+	}
+	if(numRle > 255){
+		RWERROR((ERR_GENERAL, "too many bone runs after split"));
+		goto out;
+	}
+
+	// Give every group vertices with consistent palette slots
+	n = numVerts + 3*numTris;
+	orig = rwNewT(int32, 3*n, MEMDUR_FUNCTION | ID_SKIN);
+	owner = orig + n;
+	dupNext = owner + n;
+	for(i = 0; i < numVerts; i++){
+		orig[i] = i;
+		owner[i] = -1;
+		dupNext[i] = -1;
+	}
+	tris = rwNewT(Triangle32, numTris, MEMDUR_FUNCTION | ID_SKIN);
+	n = numVerts;
+	for(g = 0; g < numGroups; g++)
+		for(t = groupFirst[g]; t < groupFirst[g+1]; t++){
+			tri = geo->getTriangle(order[t]);
+			tris[t].matId = tri.matId;
+			for(k = 0; k < 3; k++){
+				v = tri.v[k];
+				for(u = v; u >= 0; u = dupNext[u]){
+					if(owner[u] < 0)
+						owner[u] = g;
+					if(sameSlots(skin, &slots[owner[u]*256], &slots[g*256], v))
+						break;
+				}
+				if(u < 0){
+					u = n++;
+					orig[u] = v;
+					owner[u] = g;
+					dupNext[u] = dupNext[v];
+					dupNext[v] = u;
+				}
+				tris[t].v[k] = u;
+			}
+		}
+	if(n > 0x10000){
+		RWERROR((ERR_GENERAL, "too many vertices after split"));
+		goto out;
+	}
+
+	// Nothing can fail anymore, change the geometry
+	if(n != numVerts)
+		remapVertices(geo, skin, orig, n);
+	for(t = 0; t < numTris; t++)
+		geo->setTriangle(t, tris[t]);
+
+	rwFree(skin->remapIndices);
+	data = rwNewT(int8, numBones + 2*(numGroups+numRle), MEMDUR_EVENT | ID_SKIN);
+	skin->boneLimit = boneLimit;
+	skin->numMeshes = numGroups;
+	skin->meshPalettes = 1;
+	skin->rleSize = numRle;
+	skin->remapIndices = data;
+	skin->rleCount = (RLEcount*)(data + numBones);
+	skin->rle = (RLE*)(data + numBones + 2*numGroups);
+	memcpy(skin->remapIndices, remap, numBones);
+	rle = skin->rle;
+	for(g = 0; g < numGroups; g++){
+		bits = &groupBits[g*256];
+		start = rle - skin->rle;
+		for(i = 0; i < numBones; i++){
+			if(!bits[remap[i]])
+				continue;
+			if(i == 0 || !bits[remap[i-1]]){
+				rle->startbone = i;
+				rle->n = 0;
+				rle++;
+			}
+			rle[-1].n++;
+		}
+		skin->rleCount[g].start = start;
+		skin->rleCount[g].size = (rle - skin->rle) - start;
+	}
+
+	// Build one triangle list mesh per group
+	rwFree(geo->meshHeader);
+	geo->meshHeader = nil;
+	geo->flags &= ~Geometry::TRISTRIP;
+	geo->allocateMeshes(numGroups, numTris*3, 0, geo->index32);
+	m = geo->meshHeader->getMeshes();
+	for(g = 0; g < numGroups; g++){
+		m[g].material = geo->matList.materials[groupMat[g]];
+		m[g].numIndices = (groupFirst[g+1] - groupFirst[g])*3;
+	}
+	geo->meshHeader->setupIndices();
+	for(g = 0; g < numGroups; g++)
+		for(t = groupFirst[g], i = 0; t < groupFirst[g+1]; t++){
+			geo->meshHeader->setIndex(&m[g], i++, tris[t].v[0]);
+			geo->meshHeader->setIndex(&m[g], i++, tris[t].v[1]);
+			geo->meshHeader->setIndex(&m[g], i++, tris[t].v[2]);
+		}
+	ret = 1;
+
+out:
+	rwFree(order);
+	rwFree(groupFirst);
+	rwFree(groupMat);
+	rwFree(groupBits);
+	rwFree(slots);
+	rwFree(orig);
+	rwFree(tris);
+	return ret;
+}
+
+//
+// Software skinning
+//
+
+void
+Skin::skinVertexRangeRef(const float32 *palette,
+	const V3d *srcVerts, const V3d *srcNormals,
+	V3d *dstVerts, V3d *dstNormals, int32 first, int32 num)
+{
+	int32 i, j;
+	float32 w;
+	const float32 *m;
+	const V3d *v, *n;
+	V3d vo, no;
+
+	for(i = first; i < first+num; i++){
+		vo = makeV3d(0.0f, 0.0f, 0.0f);
+		no = makeV3d(0.0f, 0.0f, 0.0f);
+		v = &srcVerts[i];
+		n = srcNormals ? &srcNormals[i] : nil;
+		for(j = 0; j < 4; j++){
+			w = this->weights[i*4 + j];
+			if(w == 0.0f)
+				continue;
+			m = &palette[this->indices[i*4 + j]*12];
+			vo.x += (m[0]*v->x + m[1]*v->y + m[2]*v->z + m[3])*w;
+			vo.y += (m[4]*v->x + m[5]*v->y + m[6]*v->z + m[7])*w;
+			vo.z += (m[8]*v->x + m[9]*v->y + m[10]*v->z + m[11])*w;
+			if(n){
+				no.x += (m[0]*n->x + m[1]*n->y + m[2]*n->z)*w;
+				no.y += (m[4]*n->x + m[5]*n->y + m[6]*n->z)*w;
+				no.z += (m[8]*n->x + m[9]*n->y + m[10]*n->z)*w;
+			}
+		}
+		if(dstVerts)
+			dstVerts[i] = vo;
+		if(n && dstNormals)
+			dstNormals[i] = no;
+	}
+}
+
+// Dual quaternion skinning, dqPalette comes from getDualQuatPalette
+void
+Skin::skinVertexRangeDualQuat(const float32 *dqPalette,
+	const V3d *srcVerts, const V3d *srcNormals,
+	V3d *dstVerts, V3d *dstNormals, int32 first, int32 num)
+{
+	int32 i, j, k;
+	float32 w, len;
+	const float32 *dq, *r0;
+	float32 b[8];
+	V3d r, d, v, t;
+
+	for(i = first; i < first+num; i++){
+		for(k = 0; k < 8; k++)
+			b[k] = 0.0f;
+		r0 = &dqPalette[this->indices[i*4]*8];
+		for(j = 0; j < 4; j++){
+			w = this->weights[i*4 + j];
+			if(w == 0.0f)
+				continue;
+			dq = &dqPalette[this->indices[i*4 + j]*8];
+			// keep all rotations in the same hemisphere
+			if(r0[0]*dq[0] + r0[1]*dq[1] + r0[2]*dq[2] + r0[3]*dq[3] < 0.0f)
+				w = -w;
+			for(k = 0; k < 8; k++)
+				b[k] += dq[k]*w;
+		}
+		len = sqrtf(b[0]*b[0] + b[1]*b[1] + b[2]*b[2] + b[3]*b[3]);
+		for(k = 0; k < 8; k++)
+			b[k] /= len;
+		r = makeV3d(b[0], b[1], b[2]);
+		d = makeV3d(b[4], b[5], b[6]);
+		if(dstVerts){
+			v = srcVerts[i];
+			t = add(scale(d, b[3]), sub(cross(r, d), scale(r, b[7])));
+			v = add(v, scale(cross(r, add(cross(r, v), scale(v, b[3]))), 2.0f));
+			dstVerts[i] = add(v, scale(t, 2.0f));
+		}
+		if(srcNormals && dstNormals){
+			v = srcNormals[i];
+			dstNormals[i] = add(v, scale(cross(r, add(cross(r, v), scale(v, b[3]))), 2.0f));
+		}
+	}
+}
+
+#ifdef RW_SSE2
+// Blend the bone matrices of a vertex, then transform once.
+// numWeights is constant at every call so the loops get unrolled.
+static inline void
+skinRangeSSE2(int32 numWeights, const float32 *palette,
+	const uint8 *indices, const float32 *weights,
+	const V3d *srcVerts, const V3d *srcNormals,
+	V3d *dstVerts, V3d *dstNormals, int32 first, int32 num)
+{
+	int32 i, j;
+	const float32 *m;
+	__m128 w, r0, r1, r2, x, y, z, t;
+	float32 out[4];
+
+	for(i = first; i < first+num; i++){
+		const uint8 *idx = &indices[i*4];
+		const float32 *wt = &weights[i*4];
+		w = _mm_set1_ps(wt[0]);
+		m = &palette[idx[0]*12];
+		r0 = _mm_mul_ps(w, _mm_loadu_ps(m));
+		r1 = _mm_mul_ps(w, _mm_loadu_ps(m+4));
+		r2 = _mm_mul_ps(w, _mm_loadu_ps(m+8));
+		for(j = 1; j < numWeights; j++){
+			w = _mm_set1_ps(wt[j]);
+			m = &palette[idx[j]*12];
+			r0 = _mm_add_ps(r0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+			r1 = _mm_add_ps(r1, _mm_mul_ps(w, _mm_loadu_ps(m+4)));
+			r2 = _mm_add_ps(r2, _mm_mul_ps(w, _mm_loadu_ps(m+8)));
+		}
+		// transpose to columns so we can transform with splats
+		t = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(r0, r1, r2, t);
+		if(dstVerts){
+			const V3d *v = &srcVerts[i];
+			x = _mm_mul_ps(r0, _mm_set1_ps(v->x));
+			y = _mm_mul_ps(r1, _mm_set1_ps(v->y));
+			z = _mm_mul_ps(r2, _mm_set1_ps(v->z));
+			_mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, t)));
+			dstVerts[i] = makeV3d(out[0], out[1], out[2]);
+		}
+		if(srcNormals && dstNormals){
+			const V3d *n = &srcNormals[i];
+			x = _mm_mul_ps(r0, _mm_set1_ps(n->x));
+			y = _mm_mul_ps(r1, _mm_set1_ps(n->y));
+			z = _mm_mul_ps(r2, _mm_set1_ps(n->z));
+			_mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(x, y), z));
+			dstNormals[i] = makeV3d(out[0], out[1], out[2]);
+		}
+	}
+}
+#endif
+
+void
+Skin::skinVertexRange(const float32 *palette,
+	const V3d *srcVerts, const V3d *srcNormals,
+	V3d *dstVerts, V3d *dstNormals, int32 first, int32 num)
+{
+#ifdef RW_SSE2
+	switch(this->numWeights){
+#define SKIN(n) skinRangeSSE2(n, palette, this->indices, this->weights, \
+	srcVerts, srcNormals, dstVerts, dstNormals, first, num)
+	case 1: SKIN(1); return;
+	case 2: SKIN(2); return;
+	case 3: SKIN(3); return;
+	case 4: SKIN(4); return;
+#undef SKIN
+	}
+#endif
+	this->skinVertexRangeRef(palette, srcVerts, srcNormals,
+		dstVerts, dstNormals, first, num);
+}
+
+struct SkinJob
+{
+	Skin *skin;
+	float32 *palette;
+	bool32 dualQuat;
+	MorphTarget *mt;
+	V3d *dstVerts;
+	V3d *dstNormals;
+	int32 numVertices;
+};
+
+// vertices per job
+#define SKINCHUNK 1024
+
+static void
+skinJob(void *data, int32 n)
+{
+	SkinJob *job = (SkinJob*)data;
+	int32 first = n*SKINCHUNK;
+	int32 num = job->numVertices - first;
+	if(num > SKINCHUNK)
+		num = SKINCHUNK;
+	if(job->dualQuat)
+		job->skin->skinVertexRangeDualQuat(job->palette,
+			job->mt->vertices, job->mt->normals,
+			job->dstVerts, job->dstNormals, first, num);
+	else
+		job->skin->skinVertexRange(job->palette,
+			job->mt->vertices, job->mt->normals,
+			job->dstVerts, job->dstNormals, first, num);
+}
+
+void
+Skin::skinVertices(Atomic *a, V3d *dstVerts, V3d *dstNormals)
+{
+	SkinJob job;
+	Geometry *geo = a->geometry;
+
+	job.skin = Skin::get(geo);
+	if(job.skin == nil || job.skin->weights == nil){
+		RWERROR((ERR_GENERAL, "geometry has no skin data"));
+		return;
+	}
+	// this may have to sync frames, so do it before starting jobs
+	job.dualQuat = Skin::getDualQuat(a);
+	job.palette = job.dualQuat ? Skin::getDualQuatPalette(a) : Skin::getPalette(a);
+	job.mt = &geo->morphTargets[0];
+	job.dstVerts = dstVerts;
+	job.dstNormals = dstNormals;
+	job.numVertices = geo->numVertices;
+	Engine::jobfuncs.parallelFor(skinJob, &job,
+		(geo->numVertices + SKINCHUNK-1)/SKINCHUNK);
+}
+
 void
 Skin::setPipeline(Atomic *a, int32 type)
 {
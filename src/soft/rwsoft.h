@@ -0,0 +1,182 @@
+namespace rw {
+
+#ifdef RW_SOFT
+struct EngineOpenParams
+{
+	int width, height;	// size of the single video mode
+};
+#endif
+
+namespace soft {
+
+void registerPlatformPlugins(void);
+
+extern Device renderdevice;
+
+// Largest camera raster the rasterizer can address,
+// edge functions are 28.4 fixed point.
+enum { MAXTARGETSIZE = 2048 };
+
+struct InstanceData
+{
+	uint32    numIndex;
+	uint32    minVert;
+	int32     numVertices;
+	uint32    offset;	// into indices
+	Material *material;
+	bool32    vertexAlpha;
+};
+
+// Meshes are instanced as triangle lists into one index array,
+// vertex data is copied from the geometry and stays on the CPU.
+struct InstanceDataHeader : rw::InstanceDataHeader
+{
+	uint32     serialNumber;
+	uint32     numMeshes;
+	int32      numVertices;
+	uint32     totalNumIndex;
+	uint32    *indices;
+	V3d       *positions;
+	V3d       *normals;	// nil if the geometry has none
+	RGBA      *colors;	// nil if not prelit
+	TexCoords *texCoords;	// first set, nil if none
+	uint8     *vertexBuffer;	// holds all of the above
+	// blended positions and normals of morphing geometry
+	int32      morphStart, morphEnd;
+	float32    morphValue;
+	V3d       *morphVertices;
+
+	InstanceData *inst;
+};
+
+#ifdef RW_SOFT
+
+struct Im3DVertex
+{
+	V3d     position;
+	V3d     normal;		// librw extension
+	uint8   r, g, b, a;
+	float32 u, v;
+
+	void setX(float32 x) { this->position.x = x; }
+	void setY(float32 y) { this->position.y = y; }
+	void setZ(float32 z) { this->position.z = z; }
+	void setNormalX(float32 x) { this->normal.x = x; }
+	void setNormalY(float32 y) { this->normal.y = y; }
+	void setNormalZ(float32 z) { this->normal.z = z; }
+	void setColor(uint8 r, uint8 g, uint8 b, uint8 a) {
+		this->r = r; this->g = g; this->b = b; this->a = a; }
+	void setU(float32 u) { this->u = u; }
+	void setV(float32 v) { this->v = v; }
+
+	float getX(void) { return this->position.x; }
+	float getY(void) { return this->position.y; }
+	float getZ(void) { return this->position.z; }
+	float getNormalX(void) { return this->normal.x; }
+	float getNormalY(void) { return this->normal.y; }
+	float getNormalZ(void) { return this->normal.z; }
+	RGBA getColor(void) { return makeRGBA(this->r, this->g, this->b, this->a); }
+	float getU(void) { return this->u; }
+	float getV(void) { return this->v; }
+};
+extern RGBA im3dMaterialColor;
+extern SurfaceProperties im3dSurfaceProps;
+
+struct Im2DVertex
+{
+	float32 x, y, z, w;	// w is camera z
+	uint8   r, g, b, a;
+	float32 u, v;
+
+	void setScreenX(float32 x) { this->x = x; }
+	void setScreenY(float32 y) { this->y = y; }
+	void setScreenZ(float32 z) { this->z = z; }
+	void setCameraZ(float32 z) { this->w = z; }
+	void setRecipCameraZ(float32 recipz) { this->w = 1.0f/recipz; }
+	void setColor(uint8 r, uint8 g, uint8 b, uint8 a) {
+		this->r = r; this->g = g; this->b = b; this->a = a; }
+	void setU(float32 u, float recipz) { this->u = u; }
+	void setV(float32 v, float recipz) { this->v = v; }
+
+	float getScreenX(void) { return this->x; }
+	float getScreenY(void) { return this->y; }
+	float getScreenZ(void) { return this->z; }
+	float getCameraZ(void) { return this->w; }
+	float getRecipCameraZ(void) { return 1.0f/this->w; }
+	RGBA getColor(void) { return makeRGBA(this->r, this->g, this->b, this->a); }
+	float getU(void) { return this->u; }
+	float getV(void) { return this->v; }
+};
+
+// per Object
+void setWorldMatrix(Matrix*);
+void setLights(WorldLights *lightData);
+
+// per Mesh
+void setTexture(int32 n, Texture *tex);
+void setMaterial(const RGBA &color, const SurfaceProperties &surfaceprops);
+inline void setMaterial(uint32 flags, const RGBA &color, const SurfaceProperties &surfaceprops)
+{
+	static RGBA white = { 255, 255, 255, 255 };
+	if(flags & Geometry::MODULATE)
+		setMaterial(color, surfaceprops);
+	else
+		setMaterial(white, surfaceprops);
+}
+
+// Transform and light the vertices of an instance for the meshes
+// drawn after it, positions and normals default to the instanced ones.
+void processVertices(InstanceDataHeader *header, V3d *positions = nil, V3d *normals = nil);
+// Draw one mesh with the current material and render state
+void drawInst(InstanceDataHeader *header, InstanceData *inst);
+
+// Wait for all queued triangles to be rasterized.
+void flush(void);
+
+#endif
+
+class ObjPipeline : public rw::ObjPipeline
+{
+public:
+	void init(void);
+	static ObjPipeline *create(void);
+
+	void (*instanceCB)(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+	void (*uninstanceCB)(Geometry *geo, InstanceDataHeader *header);
+	void (*renderCB)(Atomic *atomic, InstanceDataHeader *header);
+	// optional, draws one mesh for render queues
+	void (*renderMeshCB)(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic);
+};
+
+void defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+void defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header);
+void defaultRenderCB(Atomic *atomic, InstanceDataHeader *header);
+void defaultRenderMeshCB(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic);
+void lightingCB(Atomic *atomic);
+void lightingCB(void);
+
+void *destroyNativeData(void *object, int32, int32);
+
+ObjPipeline *makeDefaultPipeline(void);
+
+// Native Texture and Raster
+
+// Color rasters always hold 32 bit RGBA pixels, top row first,
+// whatever their format. Z-buffers hold float depth in [0, 1].
+struct SoftRaster
+{
+	enum { MAXLEVELS = 16 };
+
+	uint8 *data;	// all levels
+	uint32 levelOffset[MAXLEVELS];
+	int32 numLevels;
+	bool hasAlpha;
+	bool autogenMipmap;
+};
+
+extern int32 nativeRasterOffset;
+void registerNativeRaster(void);
+#define GETSOFTRASTEREXT(raster) PLUGINOFFSET(rw::soft::SoftRaster, raster, rw::soft::nativeRasterOffset)
+
+}
+}
@@ -0,0 +1,143 @@
+namespace rw {
+namespace soft {
+
+#ifdef RW_SOFT
+
+void im2DRenderLine(void *vertices, int32 numVertices,
+  int32 vert1, int32 vert2);
+void im2DRenderTriangle(void *vertices, int32 numVertices,
+  int32 vert1, int32 vert2, int32 vert3);
+void im2DRenderPrimitive(PrimitiveType primType,
+   void *vertices, int32 numVertices);
+void im2DRenderIndexedPrimitive(PrimitiveType primType,
+   void *vertices, int32 numVertices, void *indices, int32 numIndices);
+
+void closeIm3D(void);
+void im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags);
+void im3DRenderPrimitive(PrimitiveType primType);
+void im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices);
+void im3DEnd(void);
+
+// Clip space vertex, inside is -w <= x,y <= w and 0 <= z <= w.
+// Colors are 0-255.
+struct ClipVertex
+{
+	float32 x, y, z, w;
+	float32 r, g, b, a;
+	float32 u, v;
+	float32 fog;	// 1 is no fog
+	uint32 clip;	// outcodes, see getClipCode
+};
+
+enum {
+	CLIPLEFT   = 1,
+	CLIPRIGHT  = 2,
+	CLIPBOTTOM = 4,
+	CLIPTOP    = 8,
+	CLIPNEAR   = 0x10,
+	CLIPFAR    = 0x20
+};
+
+inline uint32
+getClipCode(float32 x, float32 y, float32 z, float32 w)
+{
+	uint32 code = 0;
+	if(x < -w) code |= CLIPLEFT;
+	if(x > w) code |= CLIPRIGHT;
+	if(y < -w) code |= CLIPBOTTOM;
+	if(y > w) code |= CLIPTOP;
+	if(z < 0.0f) code |= CLIPNEAR;
+	if(z > w) code |= CLIPFAR;
+	return code;
+}
+
+// What the rasterizer needs of the render state,
+// a snapshot is taken whenever it changes between draws.
+struct DrawState
+{
+	Raster *texture;
+	uint8 filter;
+	uint8 addressU, addressV;
+	uint8 blend;
+	uint8 srcBlend, destBlend;
+	uint8 zTest, zWrite;
+	uint8 alphaFunc;	// ALPHAALWAYS when alpha test is off
+	uint8 alphaRef;
+	uint8 fog;
+	uint8 cullMode;
+	RGBA fogColor;
+};
+
+enum { MAXLIGHTS = 8 };
+
+struct SoftLight
+{
+	int32 type;	// Light::Type
+	V3d position;
+	V3d direction;
+	RGBAf color;
+	float32 radius;
+	float32 minusCosAngle;
+	float32 hardSpot;	// lower bound of spot falloff
+};
+
+struct SoftGlobals
+{
+	// the one video mode
+	int32 width, height;
+
+	Camera *camera;
+	RawMatrix viewProj;
+	Matrix world;
+	RawMatrix worldViewProj;
+	float32 fogEnd, fogRange;
+
+	// material
+	RGBAf matColor;
+	SurfaceProperties surfProps;
+	float32 colorClamp;	// lower bound of the lit color
+	RawMatrix *texMatrix;	// texture coordinates from world normals if set
+
+	// lights
+	RGBAf ambient;
+	int32 numLights;
+	SoftLight lights[MAXLIGHTS];
+};
+extern SoftGlobals softGlobals;
+
+// softdevice.cpp
+void getDrawState(DrawState *state);
+bool32 getAlphaBlend(void);
+void evictRaster(Raster *raster);
+
+// softdraw.cpp
+void openRasterizer(void);
+void closeRasterizer(void);
+void setRenderTarget(Camera *cam);
+void clearRenderTarget(RGBA *col, uint32 mode);
+void invalidateDrawState(void);
+bool32 isRasterizerBusy(void);
+void drawTriangle(ClipVertex *v0, ClipVertex *v1, ClipVertex *v2);
+void drawLine(ClipVertex *v0, ClipVertex *v1);
+
+// softrender.cpp
+// Transform positions to clip space and sum up the dynamic lights
+// into a cache, the draw functions then finish vertices from it.
+void transformVertices(V3d *positions, V3d *normals, int32 numVertices, bool32 lighting);
+void finishVertices(ClipVertex *out, int32 first, int32 numVertices,
+	RGBA *colors, TexCoords *texCoords);
+void closeRender(void);
+
+#endif
+
+Raster *rasterCreate(Raster *raster);
+uint8 *rasterLock(Raster*, int32 level, int32 lockMode);
+void rasterUnlock(Raster*, int32);
+int32 rasterNumLevels(Raster*);
+bool32 imageFindRasterFormat(Image *img, int32 type,
+	int32 *width, int32 *height, int32 *depth, int32 *format);
+bool32 rasterFromImage(Raster *raster, Image *image);
+Image *rasterToImage(Raster *raster);
+
+}
+}
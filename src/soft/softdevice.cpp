@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#ifdef RW_SOFT
+
+#define PLUGIN_ID 0
+
+namespace rw {
+namespace soft {
+
+SoftGlobals softGlobals;
+
+struct RwRasterStateCache {
+	Raster *raster;
+	Texture::Addressing addressingU;
+	Texture::Addressing addressingV;
+	Texture::FilterMode filter;
+};
+
+// cached RW render states
+struct RwStateCache {
+	bool32 vertexAlpha;
+	bool32 alphaTestEnable;
+	uint32 alphaFunc;
+	uint32 alphaRef;
+	bool32 textureAlpha;
+	bool32 blendEnable;
+	uint32 srcblend, destblend;
+	uint32 zwrite;
+	uint32 ztest;
+	uint32 cullmode;
+	uint32 stencilenable;
+	uint32 stencilpass;
+	uint32 stencilfail;
+	uint32 stencilzfail;
+	uint32 stencilfunc;
+	uint32 stencilref;
+	uint32 stencilmask;
+	uint32 stencilwritemask;
+	uint32 fogEnable;
+	RGBA fogColor;
+
+	// emulation of PS2 GS
+	bool32 gsalpha;
+	uint32 gsalpharef;
+
+	RwRasterStateCache texstage;
+};
+static RwStateCache rwStateCache;
+
+static void
+setAlphaBlend(bool32 enable)
+{
+	if(rwStateCache.blendEnable != enable){
+		rwStateCache.blendEnable = enable;
+		invalidateDrawState();
+	}
+}
+
+bool32
+getAlphaBlend(void)
+{
+	return rwStateCache.blendEnable;
+}
+
+static void
+setAlphaTest(bool32 enable)
+{
+	if(rwStateCache.alphaTestEnable != enable){
+		rwStateCache.alphaTestEnable = enable;
+		invalidateDrawState();
+	}
+}
+
+static void
+setVertexAlpha(bool32 enable)
+{
+	if(rwStateCache.vertexAlpha != enable){
+		if(!rwStateCache.textureAlpha){
+			setAlphaBlend(enable);
+			setAlphaTest(enable);
+		}
+		rwStateCache.vertexAlpha = enable;
+	}
+}
+
+static void
+setRasterStage(Raster *raster)
+{
+	bool32 alpha;
+	if(raster != rwStateCache.texstage.raster){
+		rwStateCache.texstage.raster = raster;
+		invalidateDrawState();
+		if(raster){
+			assert(raster->platform == PLATFORM_SOFT);
+			alpha = GETSOFTRASTEREXT(raster)->hasAlpha;
+		}else
+			alpha = 0;
+
+		if(alpha != rwStateCache.textureAlpha){
+			rwStateCache.textureAlpha = alpha;
+			if(!rwStateCache.vertexAlpha){
+				setAlphaBlend(alpha);
+				setAlphaTest(alpha);
+			}
+		}
+	}
+}
+
+static void
+setFilterMode(int32 filter)
+{
+	if(rwStateCache.texstage.filter != filter){
+		rwStateCache.texstage.filter = (Texture::FilterMode)filter;
+		invalidateDrawState();
+	}
+}
+
+static void
+setAddressU(int32 addressing)
+{
+	if(rwStateCache.texstage.addressingU != addressing){
+		rwStateCache.texstage.addressingU = (Texture::Addressing)addressing;
+		invalidateDrawState();
+	}
+}
+
+static void
+setAddressV(int32 addressing)
+{
+	if(rwStateCache.texstage.addressingV != addressing){
+		rwStateCache.texstage.addressingV = (Texture::Addressing)addressing;
+		invalidateDrawState();
+	}
+}
+
+// Only one texture stage is rasterized
+void
+setTexture(int32 stage, Texture *tex)
+{
+	if(stage != 0)
+		return;
+	if(tex == nil || tex->raster == nil){
+		setRasterStage(nil);
+		return;
+	}
+	setRasterStage(tex->raster);
+	setFilterMode(tex->getFilter());
+	setAddressU(tex->getAddressU());
+	setAddressV(tex->getAddressV());
+}
+
+// Make sure the rasterizer is done with a raster before it changes
+void
+evictRaster(Raster *raster)
+{
+	if(isRasterizerBusy())
+		flush();
+	if(rwStateCache.texstage.raster == raster)
+		setRasterStage(nil);
+}
+
+#define SETSTATE(field, v) \
+	if(rwStateCache.field != (v)){ \
+		rwStateCache.field = (v); \
+		invalidateDrawState(); \
+	}
+
+static void
+setRenderState(int32 state, void *pvalue)
+{
+	uint32 value = (uint32)(uintptr)pvalue;
+	switch(state){
+	case TEXTURERASTER:
+		setRasterStage((Raster*)pvalue);
+		break;
+	case TEXTUREADDRESS:
+		setAddressU(value);
+		setAddressV(value);
+		break;
+	case TEXTUREADDRESSU:
+		setAddressU(value);
+		break;
+	case TEXTUREADDRESSV:
+		setAddressV(value);
+		break;
+	case TEXTUREFILTER:
+		setFilterMode(value);
+		break;
+	case VERTEXALPHA:
+		setVertexAlpha(value);
+		break;
+	case SRCBLEND:
+		SETSTATE(srcblend, value);
+		break;
+	case DESTBLEND:
+		SETSTATE(destblend, value);
+		break;
+	case ZTESTENABLE:
+		SETSTATE(ztest, value);
+		break;
+	case ZWRITEENABLE:
+		SETSTATE(zwrite, value);
+		break;
+	case FOGENABLE:
+		SETSTATE(fogEnable, value);
+		break;
+	case FOGCOLOR:
+		rwStateCache.fogColor.red = value;
+		rwStateCache.fogColor.green = value>>8;
+		rwStateCache.fogColor.blue = value>>16;
+		rwStateCache.fogColor.alpha = value>>24;
+		invalidateDrawState();
+		break;
+	case CULLMODE:
+		SETSTATE(cullmode, value);
+		break;
+
+	// not rasterized, only cached
+	case STENCILENABLE:
+		rwStateCache.stencilenable = value;
+		break;
+	case STENCILFAIL:
+		rwStateCache.stencilfail = value;
+		break;
+	case STENCILZFAIL:
+		rwStateCache.stencilzfail = value;
+		break;
+	case STENCILPASS:
+		rwStateCache.stencilpass = value;
+		break;
+	case STENCILFUNCTION:
+		rwStateCache.stencilfunc = value;
+		break;
+	case STENCILFUNCTIONREF:
+		rwStateCache.stencilref = value;
+		break;
+	case STENCILFUNCTIONMASK:
+		rwStateCache.stencilmask = value;
+		break;
+	case STENCILFUNCTIONWRITEMASK:
+		rwStateCache.stencilwritemask = value;
+		break;
+
+	case ALPHATESTFUNC:
+		SETSTATE(alphaFunc, value);
+		break;
+	case ALPHATESTREF:
+		SETSTATE(alphaRef, value);
+		break;
+	case GSALPHATEST:
+		rwStateCache.gsalpha = value;
+		break;
+	case GSALPHATESTREF:
+		rwStateCache.gsalpharef = value;
+	}
+}
+
+#undef SETSTATE
+
+static void*
+getRenderState(int32 state)
+{
+	uint32 val;
+	switch(state){
+	case TEXTURERASTER:
+		return rwStateCache.texstage.raster;
+	case TEXTUREADDRESS:
+		if(rwStateCache.texstage.addressingU == rwStateCache.texstage.addressingV)
+			val = rwStateCache.texstage.addressingU;
+		else
+			val = 0;	// invalid
+		break;
+	case TEXTUREADDRESSU:
+		val = rwStateCache.texstage.addressingU;
+		break;
+	case TEXTUREADDRESSV:
+		val = rwStateCache.texstage.addressingV;
+		break;
+	case TEXTUREFILTER:
+		val = rwStateCache.texstage.filter;
+		break;
+
+	case VERTEXALPHA:
+		val = rwStateCache.vertexAlpha;
+		break;
+	case SRCBLEND:
+		val = rwStateCache.srcblend;
+		break;
+	case DESTBLEND:
+		val = rwStateCache.destblend;
+		break;
+	case ZTESTENABLE:
+		val = rwStateCache.ztest;
+		break;
+	case ZWRITEENABLE:
+		val = rwStateCache.zwrite;
+		break;
+	case FOGENABLE:
+		val = rwStateCache.fogEnable;
+		break;
+	case FOGCOLOR:
+		val = RWRGBAINT(rwStateCache.fogColor.red, rwStateCache.fogColor.green,
+			rwStateCache.fogColor.blue, rwStateCache.fogColor.alpha);
+		break;
+	case CULLMODE:
+		val = rwStateCache.cullmode;
+		break;
+
+	case STENCILENABLE:
+		val = rwStateCache.stencilenable;
+		break;
+	case STENCILFAIL:
+		val = rwStateCache.stencilfail;
+		break;
+	case STENCILZFAIL:
+		val = rwStateCache.stencilzfail;
+		break;
+	case STENCILPASS:
+		val = rwStateCache.stencilpass;
+		break;
+	case STENCILFUNCTION:
+		val = rwStateCache.stencilfunc;
+		break;
+	case STENCILFUNCTIONREF:
+		val = rwStateCache.stencilref;
+		break;
+	case STENCILFUNCTIONMASK:
+		val = rwStateCache.stencilmask;
+		break;
+	case STENCILFUNCTIONWRITEMASK:
+		val = rwStateCache.stencilwritemask;
+		break;
+
+	case ALPHATESTFUNC:
+		val = rwStateCache.alphaFunc;
+		break;
+	case ALPHATESTREF:
+		val = rwStateCache.alphaRef;
+		break;
+	case GSALPHATEST:
+		val = rwStateCache.gsalpha;
+		break;
+	case GSALPHATESTREF:
+		val = rwStateCache.gsalpharef;
+		break;
+	default:
+		val = 0;
+	}
+	return (void*)(uintptr)val;
+}
+
+static void
+resetRenderState(void)
+{
+	rwStateCache.alphaFunc = ALPHAGREATEREQUAL;
+	rwStateCache.alphaRef = 10;
+	rwStateCache.fogEnable = 0;
+	rwStateCache.fogColor = makeRGBA(255, 255, 255, 255);
+	rwStateCache.gsalpha = 0;
+	rwStateCache.gsalpharef = 128;
+
+	rwStateCache.vertexAlpha = 0;
+	rwStateCache.textureAlpha = 0;
+	rwStateCache.alphaTestEnable = 0;
+	rwStateCache.blendEnable = 0;
+	rwStateCache.srcblend = BLENDSRCALPHA;
+	rwStateCache.destblend = BLENDINVSRCALPHA;
+	rwStateCache.zwrite = 1;
+	rwStateCache.ztest = 1;
+	rwStateCache.cullmode = CULLNONE;
+
+	rwStateCache.stencilenable = 0;
+	rwStateCache.stencilfail = STENCILKEEP;
+	rwStateCache.stencilzfail = STENCILKEEP;
+	rwStateCache.stencilpass = STENCILKEEP;
+	rwStateCache.stencilfunc = STENCILALWAYS;
+	rwStateCache.stencilref = 0;
+	rwStateCache.stencilmask = 0xFFFFFFFF;
+	rwStateCache.stencilwritemask = 0xFFFFFFFF;
+
+	rwStateCache.texstage.raster = nil;
+	rwStateCache.texstage.filter = Texture::NEAREST;
+	rwStateCache.texstage.addressingU = Texture::WRAP;
+	rwStateCache.texstage.addressingV = Texture::WRAP;
+	invalidateDrawState();
+}
+
+void
+getDrawState(DrawState *state)
+{
+	Raster *raster = rwStateCache.texstage.raster;
+	// rasters without pixels sample as white
+	state->texture = raster && GETSOFTRASTEREXT(raster)->data ? raster : nil;
+	state->filter = rwStateCache.texstage.filter;
+	state->addressU = rwStateCache.texstage.addressingU;
+	state->addressV = rwStateCache.texstage.addressingV;
+	state->blend = rwStateCache.blendEnable;
+	state->srcBlend = rwStateCache.srcblend;
+	state->destBlend = rwStateCache.destblend;
+	state->zTest = rwStateCache.ztest;
+	state->zWrite = rwStateCache.zwrite;
+	state->alphaFunc = rwStateCache.alphaTestEnable ? rwStateCache.alphaFunc : (uint32)ALPHAALWAYS;
+	state->alphaRef = rwStateCache.alphaRef;
+	state->fog = rwStateCache.fogEnable;
+	state->cullMode = rwStateCache.cullmode;
+	state->fogColor = rwStateCache.fogColor;
+}
+
+void
+setWorldMatrix(Matrix *mat)
+{
+	RawMatrix world;
+	softGlobals.world = *mat;
+	convMatrix(&world, mat);
+	RawMatrix::mult(&softGlobals.worldViewProj, &world, &softGlobals.viewProj);
+}
+
+void
+setLights(WorldLights *lightData)
+{
+	int i, n;
+	Light *l;
+	SoftLight *sl;
+
+	softGlobals.ambient = lightData->ambient;
+
+	n = 0;
+	for(i = 0; i < lightData->numDirectionals && n < MAXLIGHTS; i++){
+		l = lightData->directionals[i];
+		sl = &softGlobals.lights[n++];
+		sl->type = Light::DIRECTIONAL;
+		sl->color = l->color;
+		sl->direction = l->getFrame()->getLTM()->at;
+	}
+
+	for(i = 0; i < lightData->numLocals && n < MAXLIGHTS; i++){
+		l = lightData->locals[i];
+		switch(l->getType()){
+		case Light::POINT:
+			sl = &softGlobals.lights[n++];
+			sl->type = Light::POINT;
+			sl->color = l->color;
+			sl->radius = l->radius;
+			sl->position = l->getFrame()->getLTM()->pos;
+			break;
+		case Light::SPOT:
+		case Light::SOFTSPOT:
+			sl = &softGlobals.lights[n++];
+			sl->type = Light::SPOT;
+			sl->color = l->color;
+			sl->radius = l->radius;
+			sl->minusCosAngle = l->minusCosAngle;
+			sl->position = l->getFrame()->getLTM()->pos;
+			sl->direction = l->getFrame()->getLTM()->at;
+			// lower bound of falloff
+			sl->hardSpot = l->getType() == Light::SOFTSPOT ? 0.0f : 1.0f;
+			break;
+		}
+	}
+	softGlobals.numLights = n;
+}
+
+void
+setMaterial(const RGBA &color, const SurfaceProperties &surfaceprops)
+{
+	convColor(&softGlobals.matColor, &color);
+	softGlobals.surfProps = surfaceprops;
+}
+
+static void
+beginUpdate(Camera *cam)
+{
+	float view[16], proj[16];
+	// View Matrix
+	Matrix inv;
+	Matrix::invert(&inv, cam->getFrame()->getLTM());
+	// Since we're looking into positive Z,
+	// flip X to ge a left handed view space.
+	view[0]  = -inv.right.x;
+	view[1]  =  inv.right.y;
+	view[2]  =  inv.right.z;
+	view[3]  =  0.0f;
+	view[4]  = -inv.up.x;
+	view[5]  =  inv.up.y;
+	view[6]  =  inv.up.z;
+	view[7]  =  0.0f;
+	view[8]  =  -inv.at.x;
+	view[9]  =   inv.at.y;
+	view[10] =  inv.at.z;
+	view[11] =  0.0f;
+	view[12] = -inv.pos.x;
+	view[13] =  inv.pos.y;
+	view[14] =  inv.pos.z;
+	view[15] =  1.0f;
+	memcpy(&cam->devView, &view, sizeof(RawMatrix));
+
+	// Projection Matrix, z is mapped to [0, w] like in D3D
+	float32 invwx = 1.0f/cam->viewWindow.x;
+	float32 invwy = 1.0f/cam->viewWindow.y;
+	float32 invz = 1.0f/(cam->farPlane-cam->nearPlane);
+
+	proj[0] = invwx;
+	proj[1] = 0.0f;
+	proj[2] = 0.0f;
+	proj[3] = 0.0f;
+
+	proj[4] = 0.0f;
+	proj[5] = invwy;
+	proj[6] = 0.0f;
+	proj[7] = 0.0f;
+
+	proj[8] = cam->viewOffset.x*invwx;
+	proj[9] = cam->viewOffset.y*invwy;
+	proj[12] = -proj[8];
+	proj[13] = -proj[9];
+	if(cam->projection == Camera::PERSPECTIVE){
+		proj[10] = cam->farPlane*invz;
+		proj[11] = 1.0f;
+
+		proj[14] = -cam->nearPlane*cam->farPlane*invz;
+		proj[15] = 0.0f;
+	}else{
+		proj[10] = invz;
+		proj[11] = 0.0f;
+
+		proj[14] = -cam->nearPlane*invz;
+		proj[15] = 1.0f;
+	}
+	memcpy(&cam->devProj, &proj, sizeof(RawMatrix));
+	RawMatrix::mult(&softGlobals.viewProj, &cam->devView, &cam->devProj);
+	softGlobals.worldViewProj = softGlobals.viewProj;
+
+	softGlobals.fogEnd = cam->farPlane;
+	if(cam->fogPlane != cam->farPlane)
+		softGlobals.fogRange = 1.0f/(cam->fogPlane - cam->farPlane);
+	else
+		softGlobals.fogRange = 0.0f;
+
+	softGlobals.camera = cam;
+	setRenderTarget(cam);
+}
+
+static void
+endUpdate(Camera *cam)
+{
+	softGlobals.camera = nil;
+	// flushes, nothing is drawn outside of an update
+	setRenderTarget(nil);
+}
+
+static void
+clearCamera(Camera *cam, RGBA *col, uint32 mode)
+{
+	setRenderTarget(cam);
+	clearRenderTarget(col, mode);
+	setRenderTarget(softGlobals.camera);
+}
+
+static void
+showRaster(Raster *raster, uint32 flags)
+{
+	// Nothing to present, the image is in the camera raster
+	flush();
+}
+
+static bool32
+rasterRenderFast(Raster *raster, int32 x, int32 y)
+{
+	Raster *src = raster;
+	Raster *dst = Raster::getCurrentContext();
+	SoftRaster *natsrc, *natdst;
+	uint8 *sp, *dp;
+	int32 w, h, i;
+
+	if(src->type != Raster::CAMERA && src->type != Raster::CAMERATEXTURE)
+		return 0;
+	if(dst->type == Raster::ZBUFFER)
+		return 0;
+	natsrc = GETSOFTRASTEREXT(src->parent);
+	natdst = GETSOFTRASTEREXT(dst->parent);
+	if(natsrc->data == nil || natdst->data == nil)
+		return 0;
+	flush();
+
+	w = src->width;
+	h = src->height;
+	if(x < 0 || y < 0)
+		return 0;
+	if(x + w > dst->width) w = dst->width - x;
+	if(y + h > dst->height) h = dst->height - y;
+	sp = natsrc->data + src->offsetY*src->parent->originalStride + src->offsetX*4;
+	dp = natdst->data + (dst->offsetY+y)*dst->parent->originalStride + (dst->offsetX+x)*4;
+	for(i = 0; i < h; i++){
+		memcpy(dp, sp, w*4);
+		sp += src->parent->originalStride;
+		dp += dst->parent->originalStride;
+	}
+	if(natdst->autogenMipmap)
+		dst->parent->unlock(0);
+	return 1;
+}
+
+static int
+openSoft(EngineOpenParams *openparams)
+{
+	softGlobals.width = 640;
+	softGlobals.height = 480;
+	if(openparams){
+		if(openparams->width > 0)
+			softGlobals.width = openparams->width;
+		if(openparams->height > 0)
+			softGlobals.height = openparams->height;
+	}
+	if(softGlobals.width > MAXTARGETSIZE)
+		softGlobals.width = MAXTARGETSIZE;
+	if(softGlobals.height > MAXTARGETSIZE)
+		softGlobals.height = MAXTARGETSIZE;
+	return 1;
+}
+
+static int
+initSoft(void)
+{
+	openRasterizer();
+	resetRenderState();
+	softGlobals.texMatrix = nil;
+	softGlobals.colorClamp = 0.0f;
+	return 1;
+}
+
+static int
+termSoft(void)
+{
+	closeIm3D();
+	closeRender();
+	closeRasterizer();
+	return 1;
+}
+
+static int
+deviceSystem(DeviceReq req, void *arg, int32 n)
+{
+	VideoMode *rwmode;
+
+	switch(req){
+	case DEVICEOPEN:
+		return openSoft((EngineOpenParams*)arg);
+	case DEVICECLOSE:
+		return 1;
+
+	case DEVICEINIT:
+		return initSoft();
+	case DEVICETERM:
+		return termSoft();
+
+	case DEVICEFINALIZE:
+		return 1;
+
+
+	case DEVICEGETNUMSUBSYSTEMS:
+		return 1;
+
+	case DEVICEGETCURRENTSUBSYSTEM:
+		return 0;
+
+	case DEVICESETSUBSYSTEM:
+		return n == 0;
+
+	case DEVICEGETSUBSSYSTEMINFO:
+		if(n != 0)
+			return 0;
+		strncpy(((SubSystemInfo*)arg)->name, "Software rasterizer", sizeof(SubSystemInfo::name));
+		return 1;
+
+
+	case DEVICEGETNUMVIDEOMODES:
+		return 1;
+
+	case DEVICEGETCURRENTVIDEOMODE:
+		return 0;
+
+	case DEVICESETVIDEOMODE:
+		return n == 0;
+
+	case DEVICEGETVIDEOMODEINFO:
+		if(n != 0)
+			return 0;
+		rwmode = (VideoMode*)arg;
+		rwmode->width = softGlobals.width;
+		rwmode->height = softGlobals.height;
+		rwmode->depth = 32;
+		rwmode->flags = 0;
+		return 1;
+
+	case DEVICEGETMAXMULTISAMPLINGLEVELS:
+	case DEVICEGETMULTISAMPLINGLEVELS:
+		return 1;
+	case DEVICESETMULTISAMPLINGLEVELS:
+		return n <= 1;
+	default:
+		assert(0 && "not implemented");
+		return 0;
+	}
+	return 1;
+}
+
+Device renderdevice = {
+	0.0f, 1.0f,
+	soft::beginUpdate,
+	soft::endUpdate,
+	soft::clearCamera,
+	soft::showRaster,
+	soft::rasterRenderFast,
+	soft::setRenderState,
+	soft::getRenderState,
+	soft::im2DRenderLine,
+	soft::im2DRenderTriangle,
+	soft::im2DRenderPrimitive,
+	soft::im2DRenderIndexedPrimitive,
+	soft::im3DTransform,
+	soft::im3DRenderPrimitive,
+	soft::im3DRenderIndexedPrimitive,
+	soft::im3DEnd,
+	soft::deviceSystem
+};
+
+}
+}
+
+#endif
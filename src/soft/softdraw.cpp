@@ -0,0 +1,1135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#ifdef RW_SOFT
+
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
+#define PLUGIN_ID 0
+
+/*
+ * Triangles are clipped in clip space, snapped to 28.4 fixed point and
+ * set up once: integer edge functions with a top-left fill rule and
+ * plane equations for depth and the perspective divided attributes.
+ * They are binned into TILESIZE square tiles of the viewport.
+ * Rasterization is deferred until the queue is flushed, then every tile
+ * is one job that walks its bin in submission order and shades four
+ * pixels at a time with SIMD. Tiles write disjoint pixels, so the image
+ * does not depend on how the jobs are scheduled.
+ */
+
+namespace rw {
+namespace soft {
+
+enum {
+	TILESHIFT = 6,
+	TILESIZE = 1<<TILESHIFT,
+	SUBPIXELBITS = 4,
+	SUBPIXELS = 1<<SUBPIXELBITS,
+	// the queue is flushed when it is full
+	MAXTRIANGLES = 1<<15
+};
+
+enum {
+	PLANE_Z,
+	PLANE_Q,
+	PLANE_R,
+	PLANE_G,
+	PLANE_B,
+	PLANE_A,
+	PLANE_U,
+	PLANE_V,
+	PLANE_FOG,
+	NUMPLANES
+};
+
+enum {
+	TRI_PERSPECTIVE = 1,
+	TRI_TEXTURED = 2,
+	TRI_FOG = 4
+};
+
+struct SetupTriangle
+{
+	int32 minx, miny, maxx, maxy;	// inclusive pixel bounds
+	int32 edgeA[3], edgeB[3];	// per subpixel in x and y
+	int64 edgeC[3];
+	float32 x0, y0;			// origin of the planes
+	float32 plane[NUMPLANES][3];	// value at origin, d/dx, d/dy
+	int32 state;
+	int32 level;
+	uint32 flags;
+};
+
+struct Bin
+{
+	int32 *tris;
+	int32 numTris;
+	int32 space;
+};
+
+struct Rasterizer
+{
+	// viewport of the current camera
+	uint8 *color;
+	int32 colorStride;
+	float32 *depth;		// nil without z-buffer
+	int32 depthStride;	// in floats
+	int32 width, height;
+
+	Bin *bins;
+	int32 numBinsX, numBinsY;
+	int32 numBins;
+	int32 binSpace;
+
+	SetupTriangle *tris;
+	int32 numTris;
+	DrawState *states;
+	int32 numStates;
+	bool32 stateDirty;
+};
+static Rasterizer rast;
+
+// Four lanes of floats, ints and masks
+
+#if defined(RW_SSE2)
+
+typedef __m128 vf4;
+typedef __m128i vi4;
+typedef __m128i vm4;
+
+static inline vf4 vsplat(float32 f) { return _mm_set1_ps(f); }
+static inline vf4 vset(float32 a, float32 b, float32 c, float32 d) { return _mm_setr_ps(a, b, c, d); }
+static inline vf4 vadd(vf4 a, vf4 b) { return _mm_add_ps(a, b); }
+static inline vf4 vsub(vf4 a, vf4 b) { return _mm_sub_ps(a, b); }
+static inline vf4 vmul(vf4 a, vf4 b) { return _mm_mul_ps(a, b); }
+static inline vf4 vdiv(vf4 a, vf4 b) { return _mm_div_ps(a, b); }
+static inline vf4 vmin(vf4 a, vf4 b) { return _mm_min_ps(a, b); }
+static inline vf4 vmax(vf4 a, vf4 b) { return _mm_max_ps(a, b); }
+static inline vm4 vcmple(vf4 a, vf4 b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+static inline vm4 vcmpge(vf4 a, vf4 b) { return _mm_castps_si128(_mm_cmpge_ps(a, b)); }
+static inline vm4 vcmplt(vf4 a, vf4 b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+static inline vi4 vspliti(int32 i) { return _mm_set1_epi32(i); }
+static inline vi4 vseti(int32 a, int32 b, int32 c, int32 d) { return _mm_setr_epi32(a, b, c, d); }
+static inline vi4 vaddi(vi4 a, vi4 b) { return _mm_add_epi32(a, b); }
+static inline vi4 vori(vi4 a, vi4 b) { return _mm_or_si128(a, b); }
+static inline vm4 vcmpgti(vi4 a, vi4 b) { return _mm_cmpgt_epi32(a, b); }
+static inline vm4 vand(vm4 a, vm4 b) { return _mm_and_si128(a, b); }
+static inline int32 vbits(vm4 m) { return _mm_movemask_ps(_mm_castsi128_ps(m)); }
+static inline vf4 vselect(vm4 m, vf4 a, vf4 b) {
+	__m128 mf = _mm_castsi128_ps(m);
+	return _mm_or_ps(_mm_and_ps(mf, a), _mm_andnot_ps(mf, b)); }
+static inline vi4 vselecti(vm4 m, vi4 a, vi4 b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+static inline vf4 vloadf(const float32 *p) { return _mm_loadu_ps(p); }
+static inline void vstoref(float32 *p, vf4 v) { _mm_storeu_ps(p, v); }
+static inline vi4 vloadi(const void *p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void vstorei(void *p, vi4 v) { _mm_storeu_si128((__m128i*)p, v); }
+
+static inline void
+vunpack(vi4 px, vf4 *r, vf4 *g, vf4 *b, vf4 *a)
+{
+	__m128i m = _mm_set1_epi32(0xFF);
+	*r = _mm_cvtepi32_ps(_mm_and_si128(px, m));
+	*g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), m));
+	*b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), m));
+	*a = _mm_cvtepi32_ps(_mm_srli_epi32(px, 24));
+}
+
+// components have to be in [0, 255]
+static inline vi4
+vpack(vf4 r, vf4 g, vf4 b, vf4 a)
+{
+	__m128 h = _mm_set1_ps(0.5f);
+	__m128i ir = _mm_cvttps_epi32(_mm_add_ps(r, h));
+	__m128i ig = _mm_cvttps_epi32(_mm_add_ps(g, h));
+	__m128i ib = _mm_cvttps_epi32(_mm_add_ps(b, h));
+	__m128i ia = _mm_cvttps_epi32(_mm_add_ps(a, h));
+	return _mm_or_si128(_mm_or_si128(ir, _mm_slli_epi32(ig, 8)),
+		_mm_or_si128(_mm_slli_epi32(ib, 16), _mm_slli_epi32(ia, 24)));
+}
+
+#elif defined(RW_NEON)
+
+typedef float32x4_t vf4;
+typedef int32x4_t vi4;
+typedef uint32x4_t vm4;
+
+static inline vf4 vsplat(float32 f) { return vdupq_n_f32(f); }
+static inline vf4 vset(float32 a, float32 b, float32 c, float32 d) {
+	float32 f[4] = { a, b, c, d };
+	return vld1q_f32(f); }
+static inline vf4 vadd(vf4 a, vf4 b) { return vaddq_f32(a, b); }
+static inline vf4 vsub(vf4 a, vf4 b) { return vsubq_f32(a, b); }
+static inline vf4 vmul(vf4 a, vf4 b) { return vmulq_f32(a, b); }
+#ifdef __aarch64__
+static inline vf4 vdiv(vf4 a, vf4 b) { return vdivq_f32(a, b); }
+#else
+static inline vf4 vdiv(vf4 a, vf4 b) {
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	return vmulq_f32(a, r); }
+#endif
+static inline vf4 vmin(vf4 a, vf4 b) { return vminq_f32(a, b); }
+static inline vf4 vmax(vf4 a, vf4 b) { return vmaxq_f32(a, b); }
+static inline vm4 vcmple(vf4 a, vf4 b) { return vcleq_f32(a, b); }
+static inline vm4 vcmpge(vf4 a, vf4 b) { return vcgeq_f32(a, b); }
+static inline vm4 vcmplt(vf4 a, vf4 b) { return vcltq_f32(a, b); }
+static inline vi4 vspliti(int32 i) { return vdupq_n_s32(i); }
+static inline vi4 vseti(int32 a, int32 b, int32 c, int32 d) {
+	int32 i[4] = { a, b, c, d };
+	return vld1q_s32(i); }
+static inline vi4 vaddi(vi4 a, vi4 b) { return vaddq_s32(a, b); }
+static inline vi4 vori(vi4 a, vi4 b) { return vorrq_s32(a, b); }
+static inline vm4 vcmpgti(vi4 a, vi4 b) { return vcgtq_s32(a, b); }
+static inline vm4 vand(vm4 a, vm4 b) { return vandq_u32(a, b); }
+static inline int32 vbits(vm4 m) {
+	uint32x4_t s = vshrq_n_u32(m, 31);
+	return vgetq_lane_u32(s, 0) | vgetq_lane_u32(s, 1)<<1 |
+		vgetq_lane_u32(s, 2)<<2 | vgetq_lane_u32(s, 3)<<3; }
+static inline vf4 vselect(vm4 m, vf4 a, vf4 b) { return vbslq_f32(m, a, b); }
+static inline vi4 vselecti(vm4 m, vi4 a, vi4 b) { return vbslq_s32(m, a, b); }
+static inline vf4 vloadf(const float32 *p) { return vld1q_f32(p); }
+static inline void vstoref(float32 *p, vf4 v) { vst1q_f32(p, v); }
+static inline vi4 vloadi(const void *p) { return vld1q_s32((const int32_t*)p); }
+static inline void vstorei(void *p, vi4 v) { vst1q_s32((int32_t*)p, v); }
+
+static inline void
+vunpack(vi4 px, vf4 *r, vf4 *g, vf4 *b, vf4 *a)
+{
+	uint32x4_t u = vreinterpretq_u32_s32(px);
+	uint32x4_t m = vdupq_n_u32(0xFF);
+	*r = vcvtq_f32_u32(vandq_u32(u, m));
+	*g = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(u, 8), m));
+	*b = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(u, 16), m));
+	*a = vcvtq_f32_u32(vshrq_n_u32(u, 24));
+}
+
+static inline vi4
+vpack(vf4 r, vf4 g, vf4 b, vf4 a)
+{
+	float32x4_t h = vdupq_n_f32(0.5f);
+	uint32x4_t ir = vcvtq_u32_f32(vaddq_f32(r, h));
+	uint32x4_t ig = vcvtq_u32_f32(vaddq_f32(g, h));
+	uint32x4_t ib = vcvtq_u32_f32(vaddq_f32(b, h));
+	uint32x4_t ia = vcvtq_u32_f32(vaddq_f32(a, h));
+	return vreinterpretq_s32_u32(vorrq_u32(vorrq_u32(ir, vshlq_n_u32(ig, 8)),
+		vorrq_u32(vshlq_n_u32(ib, 16), vshlq_n_u32(ia, 24))));
+}
+
+#else
+
+struct vf4 { float32 f[4]; };
+struct vi4 { int32 i[4]; };
+struct vm4 { uint32 m[4]; };
+
+#define LANES(k) for(int32 k = 0; k < 4; k++)
+
+static inline vf4 vsplat(float32 f) { vf4 r; LANES(k) r.f[k] = f; return r; }
+static inline vf4 vset(float32 a, float32 b, float32 c, float32 d) {
+	vf4 r; r.f[0] = a; r.f[1] = b; r.f[2] = c; r.f[3] = d; return r; }
+static inline vf4 vadd(vf4 a, vf4 b) { LANES(k) a.f[k] += b.f[k]; return a; }
+static inline vf4 vsub(vf4 a, vf4 b) { LANES(k) a.f[k] -= b.f[k]; return a; }
+static inline vf4 vmul(vf4 a, vf4 b) { LANES(k) a.f[k] *= b.f[k]; return a; }
+static inline vf4 vdiv(vf4 a, vf4 b) { LANES(k) a.f[k] /= b.f[k]; return a; }
+static inline vf4 vmin(vf4 a, vf4 b) { LANES(k) a.f[k] = b.f[k] < a.f[k] ? b.f[k] : a.f[k]; return a; }
+static inline vf4 vmax(vf4 a, vf4 b) { LANES(k) a.f[k] = b.f[k] > a.f[k] ? b.f[k] : a.f[k]; return a; }
+static inline vm4 vcmple(vf4 a, vf4 b) { vm4 r; LANES(k) r.m[k] = a.f[k] <= b.f[k] ? ~0u : 0; return r; }
+static inline vm4 vcmpge(vf4 a, vf4 b) { vm4 r; LANES(k) r.m[k] = a.f[k] >= b.f[k] ? ~0u : 0; return r; }
+static inline vm4 vcmplt(vf4 a, vf4 b) { vm4 r; LANES(k) r.m[k] = a.f[k] < b.f[k] ? ~0u : 0; return r; }
+static inline vi4 vspliti(int32 i) { vi4 r; LANES(k) r.i[k] = i; return r; }
+static inline vi4 vseti(int32 a, int32 b, int32 c, int32 d) {
+	vi4 r; r.i[0] = a; r.i[1] = b; r.i[2] = c; r.i[3] = d; return r; }
+static inline vi4 vaddi(vi4 a, vi4 b) { LANES(k) a.i[k] += b.i[k]; return a; }
+static inline vi4 vori(vi4 a, vi4 b) { LANES(k) a.i[k] |= b.i[k]; return a; }
+static inline vm4 vcmpgti(vi4 a, vi4 b) { vm4 r; LANES(k) r.m[k] = a.i[k] > b.i[k] ? ~0u : 0; return r; }
+static inline vm4 vand(vm4 a, vm4 b) { LANES(k) a.m[k] &= b.m[k]; return a; }
+static inline int32 vbits(vm4 m) { int32 b = 0; LANES(k) if(m.m[k]) b |= 1<<k; return b; }
+static inline vf4 vselect(vm4 m, vf4 a, vf4 b) { LANES(k) if(!m.m[k]) a.f[k] = b.f[k]; return a; }
+static inline vi4 vselecti(vm4 m, vi4 a, vi4 b) { LANES(k) if(!m.m[k]) a.i[k] = b.i[k]; return a; }
+static inline vf4 vloadf(const float32 *p) { vf4 r; LANES(k) r.f[k] = p[k]; return r; }
+static inline void vstoref(float32 *p, vf4 v) { LANES(k) p[k] = v.f[k]; }
+// pixels are bytes in memory, independent of endianness
+static inline vi4 vloadi(const void *p) {
+	const uint8 *b = (const uint8*)p; vi4 r;
+	LANES(k) r.i[k] = b[4*k] | b[4*k+1]<<8 | b[4*k+2]<<16 | (uint32)b[4*k+3]<<24;
+	return r; }
+static inline void vstorei(void *p, vi4 v) {
+	uint8 *b = (uint8*)p;
+	LANES(k){ b[4*k] = v.i[k]; b[4*k+1] = v.i[k]>>8; b[4*k+2] = v.i[k]>>16; b[4*k+3] = v.i[k]>>24; } }
+
+static inline void
+vunpack(vi4 px, vf4 *r, vf4 *g, vf4 *b, vf4 *a)
+{
+	LANES(k){
+		r->f[k] = (float32)(px.i[k] & 0xFF);
+		g->f[k] = (float32)(px.i[k]>>8 & 0xFF);
+		b->f[k] = (float32)(px.i[k]>>16 & 0xFF);
+		a->f[k] = (float32)((uint32)px.i[k]>>24);
+	}
+}
+
+static inline vi4
+vpack(vf4 r, vf4 g, vf4 b, vf4 a)
+{
+	vi4 px;
+	LANES(k)
+		px.i[k] = (int32)(r.f[k]+0.5f) | (int32)(g.f[k]+0.5f)<<8 |
+			(int32)(b.f[k]+0.5f)<<16 | (uint32)(a.f[k]+0.5f)<<24;
+	return px;
+}
+
+#undef LANES
+
+#endif
+
+// Texture sampling
+
+struct Sampler
+{
+	uint32 *texels;
+	int32 width, height;
+	float32 fwidth, fheight;
+	int32 addressU, addressV;
+	bool32 linear;
+};
+
+static void
+setupSampler(Sampler *smp, DrawState *s, int32 level)
+{
+	Raster *raster = s->texture;
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 w = raster->originalWidth >> level;
+	int32 h = raster->originalHeight >> level;
+	smp->texels = (uint32*)(natras->data + natras->levelOffset[level]);
+	smp->width = w > 0 ? w : 1;
+	smp->height = h > 0 ? h : 1;
+	smp->fwidth = (float32)smp->width;
+	smp->fheight = (float32)smp->height;
+	smp->addressU = s->addressU;
+	smp->addressV = s->addressV;
+	smp->linear = s->filter == Texture::LINEAR ||
+		s->filter == Texture::LINEARMIPNEAREST ||
+		s->filter == Texture::LINEARMIPLINEAR;
+}
+
+static inline int32
+floorInt(float32 f)
+{
+	// keep it in range of int32
+	if(f < -4194304.0f) f = -4194304.0f;
+	if(f > 4194304.0f) f = 4194304.0f;
+	int32 i = (int32)f;
+	return f < (float32)i ? i-1 : i;
+}
+
+static inline int32
+address(int32 i, int32 n, int32 mode)
+{
+	switch(mode){
+	case Texture::MIRROR:
+		i %= 2*n;
+		if(i < 0) i += 2*n;
+		return i >= n ? 2*n-1 - i : i;
+	case Texture::CLAMP:
+	case Texture::BORDER:
+		return i < 0 ? 0 : i >= n ? n-1 : i;
+	default:
+		if((n & (n-1)) == 0)
+			return i & (n-1);
+		i %= n;
+		return i < 0 ? i+n : i;
+	}
+}
+
+// f in [0, 256]
+static inline uint32
+lerpTexel(uint32 a, uint32 b, uint32 f)
+{
+	uint32 rb = (((a & 0xFF00FF)*(256-f) + (b & 0xFF00FF)*f) >> 8) & 0xFF00FF;
+	uint32 ag = ((a>>8 & 0xFF00FF)*(256-f) + (b>>8 & 0xFF00FF)*f) & 0xFF00FF00;
+	return rb | ag;
+}
+
+static uint32
+sample(Sampler *smp, float32 u, float32 v)
+{
+	int32 x0, y0, x1, y1;
+	uint32 fx, fy, *row0, *row1;
+	float32 tu, tv;
+
+	if(!smp->linear){
+		x0 = address(floorInt(u*smp->fwidth), smp->width, smp->addressU);
+		y0 = address(floorInt(v*smp->fheight), smp->height, smp->addressV);
+		return smp->texels[y0*smp->width + x0];
+	}
+	tu = u*smp->fwidth - 0.5f;
+	tv = v*smp->fheight - 0.5f;
+	x0 = floorInt(tu);
+	y0 = floorInt(tv);
+	fx = (uint32)((tu - x0)*256.0f);
+	fy = (uint32)((tv - y0)*256.0f);
+	x1 = address(x0+1, smp->width, smp->addressU);
+	y1 = address(y0+1, smp->height, smp->addressV);
+	x0 = address(x0, smp->width, smp->addressU);
+	y0 = address(y0, smp->height, smp->addressV);
+	row0 = &smp->texels[y0*smp->width];
+	row1 = &smp->texels[y1*smp->width];
+	return lerpTexel(lerpTexel(row0[x0], row0[x1], fx),
+		lerpTexel(row1[x0], row1[x1], fx), fy);
+}
+
+// Pixel shading
+
+static void
+blendFactor(int32 f, vf4 *out, vf4 *src, vf4 *dst)
+{
+	vf4 s = vsplat(1.0f/255.0f);
+	vf4 one = vsplat(1.0f);
+	vf4 t;
+	int32 i;
+	switch(f){
+	case BLENDZERO:
+		out[0] = out[1] = out[2] = out[3] = vsplat(0.0f);
+		break;
+	case BLENDONE:
+	default:
+		out[0] = out[1] = out[2] = out[3] = one;
+		break;
+	case BLENDSRCCOLOR:
+		for(i = 0; i < 4; i++) out[i] = vmul(src[i], s);
+		break;
+	case BLENDINVSRCCOLOR:
+		for(i = 0; i < 4; i++) out[i] = vsub(one, vmul(src[i], s));
+		break;
+	case BLENDSRCALPHA:
+		out[0] = out[1] = out[2] = out[3] = vmul(src[3], s);
+		break;
+	case BLENDINVSRCALPHA:
+		out[0] = out[1] = out[2] = out[3] = vsub(one, vmul(src[3], s));
+		break;
+	case BLENDDESTALPHA:
+		out[0] = out[1] = out[2] = out[3] = vmul(dst[3], s);
+		break;
+	case BLENDINVDESTALPHA:
+		out[0] = out[1] = out[2] = out[3] = vsub(one, vmul(dst[3], s));
+		break;
+	case BLENDDESTCOLOR:
+		for(i = 0; i < 4; i++) out[i] = vmul(dst[i], s);
+		break;
+	case BLENDINVDESTCOLOR:
+		for(i = 0; i < 4; i++) out[i] = vsub(one, vmul(dst[i], s));
+		break;
+	case BLENDSRCALPHASAT:
+		t = vmul(vmin(src[3], vsub(vsplat(255.0f), dst[3])), s);
+		out[0] = out[1] = out[2] = t;
+		out[3] = one;
+		break;
+	}
+}
+
+#define PLANE(p) vadd(vsplat(t->plane[p][0] + t->plane[p][2]*fy), vmul(vsplat(t->plane[p][1]), fx))
+
+// Shade up to four pixels starting at x,y, n of them are inside the viewport
+static void
+shadeQuad(SetupTriangle *t, DrawState *s, Sampler *smp,
+	int32 x, int32 y, vm4 mask, uint8 *cdst, float32 *zdst, int32 n)
+{
+	uint32 texels[4], ctmp[4];
+	float32 ztmp[4], us[4], vs[4];
+	vf4 fx, z, oldz, w, col[4], tex[4], dst[4], sf[4], df[4], lo, hi;
+	vi4 px, oldpx;
+	float32 fy;
+	int32 i, bits;
+
+	fx = vset(x+0.5f - t->x0, x+1.5f - t->x0, x+2.5f - t->x0, x+3.5f - t->x0);
+	fy = y+0.5f - t->y0;
+
+	if(n < 4){
+		mask = vand(mask, vcmpgti(vspliti(n), vseti(0, 1, 2, 3)));
+		memcpy(ctmp, cdst, n*4);
+		if(zdst)
+			memcpy(ztmp, zdst, n*4);
+	}
+	float32 *zp = n < 4 ? ztmp : zdst;
+	uint8 *cp = n < 4 ? (uint8*)ctmp : cdst;
+
+	// depth test first, it doesn't depend on shading
+	z = PLANE(PLANE_Z);
+	if(zdst && (s->zTest || s->zWrite)){
+		oldz = vloadf(zp);
+		if(s->zTest)
+			mask = vand(mask, vcmple(z, oldz));
+	}else
+		oldz = z;
+	if(vbits(mask) == 0)
+		return;
+
+	if(t->flags & TRI_PERSPECTIVE)
+		w = vdiv(vsplat(1.0f), PLANE(PLANE_Q));
+	else
+		w = vsplat(1.0f);
+	col[0] = vmul(PLANE(PLANE_R), w);
+	col[1] = vmul(PLANE(PLANE_G), w);
+	col[2] = vmul(PLANE(PLANE_B), w);
+	col[3] = vmul(PLANE(PLANE_A), w);
+
+	if(t->flags & TRI_TEXTURED){
+		vstoref(us, vmul(PLANE(PLANE_U), w));
+		vstoref(vs, vmul(PLANE(PLANE_V), w));
+		bits = vbits(mask);
+		for(i = 0; i < 4; i++)
+			texels[i] = bits & 1<<i ? sample(smp, us[i], vs[i]) : 0;
+		vunpack(vloadi(texels), &tex[0], &tex[1], &tex[2], &tex[3]);
+		for(i = 0; i < 4; i++)
+			col[i] = vmul(vmul(col[i], tex[i]), vsplat(1.0f/255.0f));
+	}
+
+	lo = vsplat(0.0f);
+	hi = vsplat(255.0f);
+	for(i = 0; i < 4; i++)
+		col[i] = vmin(vmax(col[i], lo), hi);
+
+	if(t->flags & TRI_FOG){
+		vf4 f = vmin(vmax(vmul(PLANE(PLANE_FOG), w), lo), vsplat(1.0f));
+		vf4 fc;
+		fc = vsplat(s->fogColor.red);
+		col[0] = vadd(fc, vmul(vsub(col[0], fc), f));
+		fc = vsplat(s->fogColor.green);
+		col[1] = vadd(fc, vmul(vsub(col[1], fc), f));
+		fc = vsplat(s->fogColor.blue);
+		col[2] = vadd(fc, vmul(vsub(col[2], fc), f));
+	}
+
+	switch(s->alphaFunc){
+	case ALPHAGREATEREQUAL:
+		mask = vand(mask, vcmpge(col[3], vsplat(s->alphaRef)));
+		break;
+	case ALPHALESS:
+		mask = vand(mask, vcmplt(col[3], vsplat(s->alphaRef)));
+		break;
+	}
+	if(vbits(mask) == 0)
+		return;
+
+	if(zdst && s->zWrite)
+		vstoref(zp, vselect(mask, z, oldz));
+
+	oldpx = vloadi(cp);
+	if(s->blend){
+		vunpack(oldpx, &dst[0], &dst[1], &dst[2], &dst[3]);
+		blendFactor(s->srcBlend, sf, col, dst);
+		blendFactor(s->destBlend, df, col, dst);
+		for(i = 0; i < 4; i++)
+			col[i] = vmin(vadd(vmul(col[i], sf[i]), vmul(dst[i], df[i])), hi);
+	}
+	px = vpack(col[0], col[1], col[2], col[3]);
+	vstorei(cp, vselecti(mask, px, oldpx));
+
+	if(n < 4){
+		memcpy(cdst, ctmp, n*4);
+		if(zdst)
+			memcpy(zdst, ztmp, n*4);
+	}
+}
+
+#undef PLANE
+
+static void
+rasterizeTriangle(SetupTriangle *t, DrawState *s, int32 tx0, int32 ty0, int32 tx1, int32 ty1)
+{
+	Sampler smp;
+	vi4 e0, e1, e2, s0, s1, s2, minus1;
+	int32 x, y, xs, xe, ys, ye;
+	int64 px, py;
+	uint8 *crow;
+	float32 *zrow;
+
+	// tiles start on multiples of four, so groups never cross them
+	xs = (t->minx > tx0 ? t->minx : tx0) & ~3;
+	xe = t->maxx < tx1 ? t->maxx : tx1;
+	ys = t->miny > ty0 ? t->miny : ty0;
+	ye = t->maxy < ty1 ? t->maxy : ty1;
+	if(t->flags & TRI_TEXTURED)
+		setupSampler(&smp, s, t->level);
+
+	s0 = vspliti(t->edgeA[0]*4*SUBPIXELS);
+	s1 = vspliti(t->edgeA[1]*4*SUBPIXELS);
+	s2 = vspliti(t->edgeA[2]*4*SUBPIXELS);
+	minus1 = vspliti(-1);
+	for(y = ys; y <= ye; y++){
+		px = (int64)xs*SUBPIXELS + SUBPIXELS/2;
+		py = (int64)y*SUBPIXELS + SUBPIXELS/2;
+		// in range of int32 inside the bounding box
+		int32 r0 = (int32)(t->edgeA[0]*px + t->edgeB[0]*py + t->edgeC[0]);
+		int32 r1 = (int32)(t->edgeA[1]*px + t->edgeB[1]*py + t->edgeC[1]);
+		int32 r2 = (int32)(t->edgeA[2]*px + t->edgeB[2]*py + t->edgeC[2]);
+		int32 a0 = t->edgeA[0]*SUBPIXELS;
+		int32 a1 = t->edgeA[1]*SUBPIXELS;
+		int32 a2 = t->edgeA[2]*SUBPIXELS;
+		e0 = vseti(r0, r0+a0, r0+2*a0, r0+3*a0);
+		e1 = vseti(r1, r1+a1, r1+2*a1, r1+3*a1);
+		e2 = vseti(r2, r2+a2, r2+2*a2, r2+3*a2);
+		crow = rast.color + y*rast.colorStride;
+		zrow = rast.depth ? rast.depth + y*rast.depthStride : nil;
+		for(x = xs; x <= xe; x += 4){
+			// inside if no edge function is negative
+			vm4 in = vcmpgti(vori(vori(e0, e1), e2), minus1);
+			if(vbits(in))
+				shadeQuad(t, s, &smp, x, y, in, crow + x*4,
+					zrow ? zrow + x : nil,
+					rast.width - x < 4 ? rast.width - x : 4);
+			e0 = vaddi(e0, s0);
+			e1 = vaddi(e1, s1);
+			e2 = vaddi(e2, s2);
+		}
+	}
+}
+
+static void
+tileJob(void *data, int32 i)
+{
+	Rasterizer *r = (Rasterizer*)data;
+	Bin *bin = &r->bins[i];
+	SetupTriangle *t;
+	int32 j, x0, y0, x1, y1;
+
+	x0 = (i % r->numBinsX)*TILESIZE;
+	y0 = (i / r->numBinsX)*TILESIZE;
+	x1 = x0+TILESIZE < r->width ? x0+TILESIZE-1 : r->width-1;
+	y1 = y0+TILESIZE < r->height ? y0+TILESIZE-1 : r->height-1;
+	for(j = 0; j < bin->numTris; j++){
+		t = &r->tris[bin->tris[j]];
+		rasterizeTriangle(t, &r->states[t->state], x0, y0, x1, y1);
+	}
+}
+
+void
+flush(void)
+{
+	int32 i;
+	if(rast.numTris == 0)
+		return;
+	Engine::jobfuncs.parallelFor(tileJob, &rast, rast.numBins);
+	for(i = 0; i < rast.numBins; i++)
+		rast.bins[i].numTris = 0;
+	rast.numTris = 0;
+	rast.numStates = 0;
+	rast.stateDirty = 1;
+}
+
+bool32
+isRasterizerBusy(void)
+{
+	return rast.numTris != 0;
+}
+
+void
+invalidateDrawState(void)
+{
+	rast.stateDirty = 1;
+}
+
+static int32
+getStateIndex(void)
+{
+	DrawState s;
+	if(!rast.stateDirty)
+		return rast.numStates-1;
+	rast.stateDirty = 0;
+	memset(&s, 0, sizeof(s));
+	getDrawState(&s);
+	if(rast.numStates > 0 &&
+	   memcmp(&s, &rast.states[rast.numStates-1], sizeof(DrawState)) == 0)
+		return rast.numStates-1;
+	// one state per triangle at most, so this never overflows
+	rast.states[rast.numStates] = s;
+	return rast.numStates++;
+}
+
+// Triangle setup and binning
+
+static void
+binTriangle(int32 idx)
+{
+	SetupTriangle *t = &rast.tris[idx];
+	int32 bx, by, bx0, by0, bx1, by1, i;
+	int64 cx, cy;
+	Bin *bin;
+	bool32 big;
+
+	bx0 = t->minx >> TILESHIFT;
+	by0 = t->miny >> TILESHIFT;
+	bx1 = t->maxx >> TILESHIFT;
+	by1 = t->maxy >> TILESHIFT;
+	big = bx0 != bx1 || by0 != by1;
+	for(by = by0; by <= by1; by++)
+		for(bx = bx0; bx <= bx1; bx++){
+			if(big){
+				// skip tiles that are outside one of the edges
+				// at the corner where that edge is largest
+				for(i = 0; i < 3; i++){
+					cx = t->edgeA[i] > 0 ? (bx+1)*TILESIZE-1 : bx*TILESIZE;
+					cy = t->edgeB[i] > 0 ? (by+1)*TILESIZE-1 : by*TILESIZE;
+					cx = cx*SUBPIXELS + SUBPIXELS/2;
+					cy = cy*SUBPIXELS + SUBPIXELS/2;
+					if(t->edgeA[i]*cx + t->edgeB[i]*cy + t->edgeC[i] < 0)
+						break;
+				}
+				if(i < 3)
+					continue;
+			}
+			bin = &rast.bins[by*rast.numBinsX + bx];
+			if(bin->numTris >= bin->space){
+				bin->space = bin->space ? 2*bin->space : 64;
+				bin->tris = rwResizeT(int32, bin->tris, bin->space, MEMDUR_EVENT | ID_DRIVER);
+			}
+			bin->tris[bin->numTris++] = idx;
+		}
+}
+
+static int32
+selectLevel(DrawState *s, ClipVertex **v, int64 area)
+{
+	Raster *raster = s->texture;
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	float32 texArea, lod;
+	int32 level;
+
+	if(natras->numLevels < 2 || s->filter < Texture::MIPNEAREST)
+		return 0;
+	// ratio of texels to pixels over the whole triangle
+	texArea = (v[1]->u - v[0]->u)*(v[2]->v - v[0]->v) -
+		(v[2]->u - v[0]->u)*(v[1]->v - v[0]->v);
+	texArea = fabsf(texArea)*raster->originalWidth*raster->originalHeight;
+	if(texArea <= 0.0f)
+		return 0;
+	lod = 0.5f*log2f(texArea*SUBPIXELS*SUBPIXELS/(float32)area);
+	level = (int32)floorf(lod + 0.5f);
+	if(level < 0)
+		return 0;
+	return level < natras->numLevels ? level : natras->numLevels-1;
+}
+
+static void
+setupTriangle(ClipVertex *cv0, ClipVertex *cv1, ClipVertex *cv2, int32 state, bool32 cull)
+{
+	DrawState *s = &rast.states[state];
+	ClipVertex *v[3], *tmp;
+	SetupTriangle *t;
+	float32 q[3], attr[3][NUMPLANES];
+	int32 X[3], Y[3], i, j, a, b;
+	int32 minX, minY, maxX, maxY, maxXs, maxYs;
+	float32 fx[3], fy[3], inv, dx1, dy1, dx2, dy2, da1, da2;
+	int64 area;
+	bool32 perspective;
+
+	v[0] = cv0;
+	v[1] = cv1;
+	v[2] = cv2;
+	maxXs = rast.width*SUBPIXELS;
+	maxYs = rast.height*SUBPIXELS;
+	for(i = 0; i < 3; i++){
+		q[i] = 1.0f/v[i]->w;
+		X[i] = floorInt((v[i]->x*q[i]*0.5f + 0.5f)*maxXs + 0.5f);
+		Y[i] = floorInt((0.5f - v[i]->y*q[i]*0.5f)*maxYs + 0.5f);
+		// clipping leaves them at most a rounding error outside
+		X[i] = X[i] < 0 ? 0 : X[i] > maxXs ? maxXs : X[i];
+		Y[i] = Y[i] < 0 ? 0 : Y[i] > maxYs ? maxYs : Y[i];
+	}
+
+	// positive area is clockwise on screen, that is the back face
+	area = (int64)(X[1]-X[0])*(Y[2]-Y[0]) - (int64)(X[2]-X[0])*(Y[1]-Y[0]);
+	if(area == 0)
+		return;
+	if(cull){
+		if(s->cullMode == CULLBACK && area > 0)
+			return;
+		if(s->cullMode == CULLFRONT && area < 0)
+			return;
+	}
+	if(area < 0){
+		tmp = v[1]; v[1] = v[2]; v[2] = tmp;
+		a = X[1]; X[1] = X[2]; X[2] = a;
+		a = Y[1]; Y[1] = Y[2]; Y[2] = a;
+		inv = q[1]; q[1] = q[2]; q[2] = inv;
+		area = -area;
+	}
+
+	// first and last pixel centers inside the bounds
+	minX = X[0] < X[1] ? X[0] : X[1];
+	minX = minX < X[2] ? minX : X[2];
+	maxX = X[0] > X[1] ? X[0] : X[1];
+	maxX = maxX > X[2] ? maxX : X[2];
+	minY = Y[0] < Y[1] ? Y[0] : Y[1];
+	minY = minY < Y[2] ? minY : Y[2];
+	maxY = Y[0] > Y[1] ? Y[0] : Y[1];
+	maxY = maxY > Y[2] ? maxY : Y[2];
+	minX = (minX - SUBPIXELS/2 + SUBPIXELS-1) >> SUBPIXELBITS;
+	minY = (minY - SUBPIXELS/2 + SUBPIXELS-1) >> SUBPIXELBITS;
+	maxX = (maxX - SUBPIXELS/2) >> SUBPIXELBITS;
+	maxY = (maxY - SUBPIXELS/2) >> SUBPIXELBITS;
+	if(maxX >= rast.width) maxX = rast.width-1;
+	if(maxY >= rast.height) maxY = rast.height-1;
+	if(minX > maxX || minY > maxY)
+		return;
+
+	t = &rast.tris[rast.numTris];
+	t->minx = minX;
+	t->miny = minY;
+	t->maxx = maxX;
+	t->maxy = maxY;
+	for(i = 0; i < 3; i++){
+		a = (i+1)%3;
+		b = (i+2)%3;
+		t->edgeA[i] = Y[a] - Y[b];
+		t->edgeB[i] = X[b] - X[a];
+		t->edgeC[i] = -((int64)t->edgeA[i]*X[a] + (int64)t->edgeB[i]*Y[a]);
+		// top-left rule, other edges don't own pixels exactly on them
+		if(!(t->edgeA[i] > 0 || (t->edgeA[i] == 0 && t->edgeB[i] > 0)))
+			t->edgeC[i] -= 1;
+	}
+
+	t->state = state;
+	t->flags = 0;
+	t->level = 0;
+	if(s->texture && GETSOFTRASTEREXT(s->texture)->data){
+		t->flags |= TRI_TEXTURED;
+		t->level = selectLevel(s, v, area);
+	}
+	if(s->fog)
+		t->flags |= TRI_FOG;
+	perspective = v[0]->w != v[1]->w || v[0]->w != v[2]->w;
+	if(perspective)
+		t->flags |= TRI_PERSPECTIVE;
+	else
+		q[0] = q[1] = q[2] = 1.0f;
+
+	for(i = 0; i < 3; i++){
+		fx[i] = X[i]*(1.0f/SUBPIXELS);
+		fy[i] = Y[i]*(1.0f/SUBPIXELS);
+		attr[i][PLANE_Z] = v[i]->z/v[i]->w;
+		attr[i][PLANE_Q] = q[i];
+		attr[i][PLANE_R] = v[i]->r*q[i];
+		attr[i][PLANE_G] = v[i]->g*q[i];
+		attr[i][PLANE_B] = v[i]->b*q[i];
+		attr[i][PLANE_A] = v[i]->a*q[i];
+		attr[i][PLANE_U] = v[i]->u*q[i];
+		attr[i][PLANE_V] = v[i]->v*q[i];
+		attr[i][PLANE_FOG] = v[i]->fog*q[i];
+	}
+	t->x0 = fx[0];
+	t->y0 = fy[0];
+	dx1 = fx[1] - fx[0];
+	dy1 = fy[1] - fy[0];
+	dx2 = fx[2] - fx[0];
+	dy2 = fy[2] - fy[0];
+	inv = (float32)(SUBPIXELS*SUBPIXELS)/(float32)area;
+	for(j = 0; j < NUMPLANES; j++){
+		da1 = attr[1][j] - attr[0][j];
+		da2 = attr[2][j] - attr[0][j];
+		t->plane[j][0] = attr[0][j];
+		t->plane[j][1] = (da1*dy2 - da2*dy1)*inv;
+		t->plane[j][2] = (da2*dx1 - da1*dx2)*inv;
+	}
+
+	binTriangle(rast.numTris++);
+}
+
+// Clipping
+
+static float32
+clipDist(ClipVertex *v, int32 plane)
+{
+	switch(plane){
+	case CLIPLEFT: return v->x + v->w;
+	case CLIPRIGHT: return v->w - v->x;
+	case CLIPBOTTOM: return v->y + v->w;
+	case CLIPTOP: return v->w - v->y;
+	case CLIPNEAR: return v->z;
+	default: return v->w - v->z;
+	}
+}
+
+// from the inside to the outside vertex so shared edges clip the same
+static void
+clipLerp(ClipVertex *out, ClipVertex *in, ClipVertex *outside, float32 t)
+{
+	float32 *o = (float32*)out;
+	float32 *a = (float32*)in;
+	float32 *b = (float32*)outside;
+	for(int32 i = 0; i < 11; i++)
+		o[i] = a[i] + (b[i] - a[i])*t;
+	out->clip = 0;
+}
+
+static int32
+clipPolygon(ClipVertex *in, int32 n, ClipVertex *out, int32 plane)
+{
+	ClipVertex *a, *b;
+	float32 da, db;
+	int32 i, m;
+
+	m = 0;
+	for(i = 0; i < n; i++){
+		a = &in[i];
+		b = &in[i+1 == n ? 0 : i+1];
+		da = clipDist(a, plane);
+		db = clipDist(b, plane);
+		if(da >= 0.0f)
+			out[m++] = *a;
+		if((da >= 0.0f) != (db >= 0.0f)){
+			if(da >= 0.0f)
+				clipLerp(&out[m++], a, b, da/(da - db));
+			else
+				clipLerp(&out[m++], b, a, db/(db - da));
+		}
+	}
+	return m;
+}
+
+static void
+drawClipped(ClipVertex *v0, ClipVertex *v1, ClipVertex *v2, bool32 cull)
+{
+	ClipVertex buf[2][9];
+	uint32 codes;
+	int32 state, i, n, cur, plane;
+
+	if(rast.color == nil)
+		return;
+	if(v0->clip & v1->clip & v2->clip)
+		return;
+	// clipping makes at most 7 triangles
+	if(rast.numTris + 7 > MAXTRIANGLES)
+		flush();
+	state = getStateIndex();
+
+	codes = v0->clip | v1->clip | v2->clip;
+	if(codes == 0){
+		setupTriangle(v0, v1, v2, state, cull);
+		return;
+	}
+	buf[0][0] = *v0;
+	buf[0][1] = *v1;
+	buf[0][2] = *v2;
+	n = 3;
+	cur = 0;
+	for(plane = 1; plane <= CLIPFAR; plane <<= 1){
+		if((codes & plane) == 0)
+			continue;
+		n = clipPolygon(buf[cur], n, buf[cur^1], plane);
+		cur ^= 1;
+		if(n < 3)
+			return;
+	}
+	for(i = 2; i < n; i++)
+		setupTriangle(&buf[cur][0], &buf[cur][i-1], &buf[cur][i], state, cull);
+}
+
+void
+drawTriangle(ClipVertex *v0, ClipVertex *v1, ClipVertex *v2)
+{
+	drawClipped(v0, v1, v2, 1);
+}
+
+// Lines are one pixel wide quads with half a pixel added at the ends,
+// so a line of zero length is a one pixel point.
+void
+drawLine(ClipVertex *v0, ClipVertex *v1)
+{
+	ClipVertex a, b, c[4];
+	float32 t0, t1, d0, d1, t, x0, y0, x1, y1, dx, dy, len;
+	float32 sx, sy;
+	int32 plane, i;
+
+	if(rast.color == nil)
+		return;
+	if(v0->clip & v1->clip)
+		return;
+	a = *v0;
+	b = *v1;
+	// only the part in front of the near plane
+	// and behind the far plane can be projected
+	t0 = 0.0f;
+	t1 = 1.0f;
+	for(plane = CLIPNEAR; plane <= CLIPFAR; plane <<= 1){
+		d0 = clipDist(v0, plane);
+		d1 = clipDist(v1, plane);
+		if(d0 < 0.0f && d1 < 0.0f)
+			return;
+		if(d0 < 0.0f){
+			t = d0/(d0 - d1);
+			if(t > t0) t0 = t;
+		}else if(d1 < 0.0f){
+			t = d0/(d0 - d1);
+			if(t < t1) t1 = t;
+		}
+	}
+	if(t0 > t1)
+		return;
+	if(t0 > 0.0f) clipLerp(&a, v1, v0, 1.0f - t0);
+	if(t1 < 1.0f) clipLerp(&b, v0, v1, t1);
+
+	sx = rast.width*0.5f;
+	sy = rast.height*0.5f;
+	x0 = a.x/a.w*sx;
+	y0 = -a.y/a.w*sy;
+	x1 = b.x/b.w*sx;
+	y1 = -b.y/b.w*sy;
+	dx = x1 - x0;
+	dy = y1 - y0;
+	len = sqrtf(dx*dx + dy*dy);
+	if(len < 0.0001f){
+		dx = 0.5f;
+		dy = 0.0f;
+	}else{
+		dx *= 0.5f/len;
+		dy *= 0.5f/len;
+	}
+	// corners in pixels relative to the endpoints, back to clip space
+	c[0] = a; c[1] = a; c[2] = b; c[3] = b;
+	c[0].x += (-dx - dy)/sx*a.w;  c[0].y -= (-dy + dx)/sy*a.w;
+	c[1].x += (-dx + dy)/sx*a.w;  c[1].y -= (-dy - dx)/sy*a.w;
+	c[2].x += (dx + dy)/sx*b.w;   c[2].y -= (dy - dx)/sy*b.w;
+	c[3].x += (dx - dy)/sx*b.w;   c[3].y -= (dy + dx)/sy*b.w;
+	for(i = 0; i < 4; i++)
+		c[i].clip = getClipCode(c[i].x, c[i].y, c[i].z, c[i].w);
+	drawClipped(&c[0], &c[1], &c[2], 0);
+	drawClipped(&c[0], &c[2], &c[3], 0);
+}
+
+// Render target
+
+static void
+clearJob(void *data, int32 band)
+{
+	uint32 *mode = (uint32*)data;
+	uint32 color = mode[1];
+	float32 depth = 1.0f;
+	int32 x, y, y0, y1;
+	uint32 *crow;
+	float32 *zrow;
+
+	y0 = band*TILESIZE;
+	y1 = y0+TILESIZE < rast.height ? y0+TILESIZE : rast.height;
+	for(y = y0; y < y1; y++){
+		if(mode[0] & Camera::CLEARIMAGE){
+			crow = (uint32*)(rast.color + y*rast.colorStride);
+			for(x = 0; x < rast.width; x++)
+				crow[x] = color;
+		}
+		if(mode[0] & Camera::CLEARZ && rast.depth){
+			zrow = rast.depth + y*rast.depthStride;
+			for(x = 0; x < rast.width; x++)
+				zrow[x] = depth;
+		}
+	}
+}
+
+void
+clearRenderTarget(RGBA *col, uint32 mode)
+{
+	uint32 data[2];
+	if(rast.color == nil)
+		return;
+	flush();
+	data[0] = mode;
+	memcpy(&data[1], col, 4);
+	Engine::jobfuncs.parallelFor(clearJob, data, (rast.height + TILESIZE-1)/TILESIZE);
+}
+
+void
+setRenderTarget(Camera *cam)
+{
+	Raster *fb, *zb;
+	SoftRaster *natras;
+	int32 i, n;
+
+	flush();
+	rast.color = nil;
+	rast.depth = nil;
+	if(cam == nil || cam->frameBuffer == nil)
+		return;
+	fb = cam->frameBuffer;
+	natras = GETSOFTRASTEREXT(fb->parent);
+	if(natras->data == nil)
+		return;
+	rast.colorStride = fb->parent->originalStride;
+	rast.color = natras->data + fb->offsetY*rast.colorStride + fb->offsetX*4;
+	rast.width = fb->width;
+	rast.height = fb->height;
+
+	zb = cam->zBuffer;
+	if(zb && GETSOFTRASTEREXT(zb->parent)->data){
+		natras = GETSOFTRASTEREXT(zb->parent);
+		rast.depthStride = zb->parent->originalWidth;
+		rast.depth = (float32*)natras->data + zb->offsetY*rast.depthStride + zb->offsetX;
+		if(zb->width < rast.width) rast.width = zb->width;
+		if(zb->height < rast.height) rast.height = zb->height;
+	}
+	if(rast.width > MAXTARGETSIZE) rast.width = MAXTARGETSIZE;
+	if(rast.height > MAXTARGETSIZE) rast.height = MAXTARGETSIZE;
+	if(rast.width <= 0 || rast.height <= 0){
+		rast.color = nil;
+		rast.depth = nil;
+		return;
+	}
+
+	rast.numBinsX = (rast.width + TILESIZE-1)/TILESIZE;
+	rast.numBinsY = (rast.height + TILESIZE-1)/TILESIZE;
+	n = rast.numBinsX*rast.numBinsY;
+	if(n > rast.binSpace){
+		rast.bins = rwResizeT(Bin, rast.bins, n, MEMDUR_EVENT | ID_DRIVER);
+		for(i = rast.binSpace; i < n; i++){
+			rast.bins[i].tris = nil;
+			rast.bins[i].numTris = 0;
+			rast.bins[i].space = 0;
+		}
+		rast.binSpace = n;
+	}
+	rast.numBins = n;
+}
+
+void
+openRasterizer(void)
+{
+	memset(&rast, 0, sizeof(rast));
+	rast.tris = rwNewT(SetupTriangle, MAXTRIANGLES, MEMDUR_EVENT | ID_DRIVER);
+	rast.states = rwNewT(DrawState, MAXTRIANGLES, MEMDUR_EVENT | ID_DRIVER);
+	rast.stateDirty = 1;
+}
+
+void
+closeRasterizer(void)
+{
+	int32 i;
+	for(i = 0; i < rast.binSpace; i++)
+		rwFree(rast.bins[i].tris);
+	rwFree(rast.bins);
+	rwFree(rast.tris);
+	rwFree(rast.states);
+	memset(&rast, 0, sizeof(rast));
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+#ifdef RW_SOFT
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID 0
+
+namespace rw {
+namespace soft {
+
+// Vertices of the current 2D primitive, already in clip space
+static ClipVertex *im2dVerts;
+static int32 im2dSize;
+
+static void
+drawPrimitive(PrimitiveType primType, ClipVertex *verts, int32 numVertices,
+	uint16 *indices, int32 numIndices)
+{
+	int32 i, n;
+
+#define V(i) (&verts[indices ? indices[i] : (i)])
+	n = indices ? numIndices : numVertices;
+	switch(primType){
+	case PRIMTYPELINELIST:
+		for(i = 0; i+1 < n; i += 2)
+			drawLine(V(i), V(i+1));
+		break;
+	case PRIMTYPEPOLYLINE:
+		for(i = 0; i+1 < n; i++)
+			drawLine(V(i), V(i+1));
+		break;
+	case PRIMTYPETRILIST:
+		for(i = 0; i+2 < n; i += 3)
+			drawTriangle(V(i), V(i+1), V(i+2));
+		break;
+	case PRIMTYPETRISTRIP:
+		for(i = 2; i < n; i++)
+			if(i & 1)
+				drawTriangle(V(i-1), V(i-2), V(i));
+			else
+				drawTriangle(V(i-2), V(i-1), V(i));
+		break;
+	case PRIMTYPETRIFAN:
+		for(i = 2; i < n; i++)
+			drawTriangle(V(0), V(i-1), V(i));
+		break;
+	case PRIMTYPEPOINTLIST:
+		for(i = 0; i < n; i++)
+			drawLine(V(i), V(i));
+		break;
+	default:
+		break;
+	}
+#undef V
+}
+
+static Im2DVertex tmpprimbuf[3];
+
+void
+im2DRenderLine(void *vertices, int32 numVertices, int32 vert1, int32 vert2)
+{
+	Im2DVertex *verts = (Im2DVertex*)vertices;
+	tmpprimbuf[0] = verts[vert1];
+	tmpprimbuf[1] = verts[vert2];
+	im2DRenderPrimitive(PRIMTYPELINELIST, tmpprimbuf, 2);
+}
+
+void
+im2DRenderTriangle(void *vertices, int32 numVertices, int32 vert1, int32 vert2, int32 vert3)
+{
+	Im2DVertex *verts = (Im2DVertex*)vertices;
+	tmpprimbuf[0] = verts[vert1];
+	tmpprimbuf[1] = verts[vert2];
+	tmpprimbuf[2] = verts[vert3];
+	im2DRenderPrimitive(PRIMTYPETRILIST, tmpprimbuf, 3);
+}
+
+// Screen space back to clip space so 2D goes through the same clipper
+static ClipVertex*
+im2DConvert(Im2DVertex *verts, int32 numVertices)
+{
+	Camera *cam = (Camera*)engine->currentCamera;
+	ClipVertex *out, *v;
+	float32 sx, sy, w, fog;
+	int32 i;
+
+	if(cam == nil || cam->frameBuffer == nil)
+		return nil;
+	sx = 2.0f/cam->frameBuffer->width;
+	sy = 2.0f/cam->frameBuffer->height;
+	if(numVertices > im2dSize){
+		im2dSize = numVertices;
+		im2dVerts = rwResizeT(ClipVertex, im2dVerts, im2dSize, MEMDUR_EVENT | ID_DRIVER);
+	}
+	out = im2dVerts;
+	for(i = 0; i < numVertices; i++){
+		v = &out[i];
+		w = verts[i].w > 0.0f ? verts[i].w : 1.0f;
+		v->x = (verts[i].x*sx - 1.0f)*w;
+		v->y = (1.0f - verts[i].y*sy)*w;
+		v->z = verts[i].z*w;
+		v->w = w;
+		v->r = verts[i].r;
+		v->g = verts[i].g;
+		v->b = verts[i].b;
+		v->a = verts[i].a;
+		v->u = verts[i].u;
+		v->v = verts[i].v;
+		fog = (w - softGlobals.fogEnd)*softGlobals.fogRange;
+		v->fog = fog < 0.0f ? 0.0f : fog > 1.0f ? 1.0f : fog;
+		v->clip = getClipCode(v->x, v->y, v->z, v->w);
+	}
+	return out;
+}
+
+void
+im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices)
+{
+	ClipVertex *verts = im2DConvert((Im2DVertex*)vertices, numVertices);
+	if(verts)
+		drawPrimitive(primType, verts, numVertices, nil, 0);
+}
+
+void
+im2DRenderIndexedPrimitive(PrimitiveType primType,
+	void *vertices, int32 numVertices, void *indices, int32 numIndices)
+{
+	ClipVertex *verts = im2DConvert((Im2DVertex*)vertices, numVertices);
+	if(verts)
+		drawPrimitive(primType, verts, numVertices, (uint16*)indices, numIndices);
+}
+
+// settable by user - TOOD: make this less shit
+RGBA im3dMaterialColor = { 255, 255, 255, 255 };
+SurfaceProperties im3dSurfaceProps = { 1.0f, 1.0f, 1.0f };
+
+static V3d *im3dPositions;
+static V3d *im3dNormals;
+static RGBA *im3dColors;
+static TexCoords *im3dTexCoords;
+static ClipVertex *im3dVerts;
+static int32 im3dSize;
+static int32 num3DVertices;
+
+void
+closeIm3D(void)
+{
+	rwFree(im3dPositions);
+	rwFree(im3dNormals);
+	rwFree(im3dColors);
+	rwFree(im3dTexCoords);
+	im3dPositions = nil;
+	im3dNormals = nil;
+	im3dColors = nil;
+	rwFree(im3dVerts);
+	im3dTexCoords = nil;
+	im3dVerts = nil;
+	im3dSize = 0;
+	rwFree(im2dVerts);
+	im2dVerts = nil;
+	im2dSize = 0;
+}
+
+void
+im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
+{
+	static RGBA white = { 255, 255, 255, 255 };
+	Im3DVertex *verts = (Im3DVertex*)vertices;
+	int32 i;
+
+	if(world == nil){
+		static Matrix ident;
+		ident.setIdentity();
+		world = &ident;
+	}
+	setWorldMatrix(world);
+	if(flags & im3d::LIGHTING){
+		setMaterial(im3dMaterialColor, im3dSurfaceProps);
+		lightingCB();
+	}else{
+		// vertex colors as they are
+		WorldLights noLights;
+		memset(&noLights, 0, sizeof(noLights));
+		setLights(&noLights);
+		setMaterial(white, im3dSurfaceProps);
+	}
+
+	if((flags & im3d::VERTEXUV) == 0)
+		SetRenderStatePtr(TEXTURERASTER, nil);
+
+	if(numVertices > im3dSize){
+		im3dSize = numVertices;
+		im3dPositions = rwResizeT(V3d, im3dPositions, im3dSize, MEMDUR_EVENT | ID_DRIVER);
+		im3dNormals = rwResizeT(V3d, im3dNormals, im3dSize, MEMDUR_EVENT | ID_DRIVER);
+		im3dColors = rwResizeT(RGBA, im3dColors, im3dSize, MEMDUR_EVENT | ID_DRIVER);
+		im3dTexCoords = rwResizeT(TexCoords, im3dTexCoords, im3dSize, MEMDUR_EVENT | ID_DRIVER);
+		im3dVerts = rwResizeT(ClipVertex, im3dVerts, im3dSize, MEMDUR_EVENT | ID_DRIVER);
+	}
+	for(i = 0; i < numVertices; i++){
+		im3dPositions[i] = verts[i].position;
+		im3dNormals[i] = verts[i].normal;
+		im3dColors[i] = makeRGBA(verts[i].r, verts[i].g, verts[i].b, verts[i].a);
+		im3dTexCoords[i].u = verts[i].u;
+		im3dTexCoords[i].v = verts[i].v;
+	}
+	transformVertices(im3dPositions, flags & im3d::LIGHTING ? im3dNormals : nil,
+		numVertices, flags & im3d::LIGHTING);
+	finishVertices(im3dVerts, 0, numVertices, im3dColors, im3dTexCoords);
+	num3DVertices = numVertices;
+}
+
+void
+im3DRenderPrimitive(PrimitiveType primType)
+{
+	drawPrimitive(primType, im3dVerts, num3DVertices, nil, 0);
+}
+
+void
+im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices)
+{
+	drawPrimitive(primType, im3dVerts, num3DVertices, (uint16*)indices, numIndices);
+}
+
+void
+im3DEnd(void)
+{
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
+
+#include "rwsoft.h"
+#include "rwsoftplg.h"
+
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID ID_MATFX
+
+namespace rw {
+namespace soft {
+
+#ifdef RW_SOFT
+
+static void
+matfxDefaultRender(InstanceDataHeader *header, InstanceData *inst, uint32 flags)
+{
+	Material *m;
+	m = inst->material;
+
+	setMaterial(flags, m->color, m->surfaceProps);
+
+	setTexture(0, m->texture);
+
+	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+	drawInst(header, inst);
+}
+
+static RawMatrix normal2texcoord = {
+	{ 0.5f,  0.0f, 0.0f }, 0.0f,
+	{ 0.0f, -0.5f, 0.0f }, 0.0f,
+	{ 0.0f,  0.0f, 1.0f }, 0.0f,
+	{ 0.5f,  0.5f, 0.0f }, 1.0f
+};
+
+static void
+makeEnvMatrix(RawMatrix *envMtx, Frame *frame)
+{
+	Matrix invMat;
+	RawMatrix invMtx;
+
+	if(frame == nil)
+		frame = engine->currentCamera->getFrame();
+	Matrix::invert(&invMat, frame->getLTM());
+	convMatrix(&invMtx, &invMat);
+	invMtx.pos.set(0.0f, 0.0f, 0.0f);
+	float uscale = fabs(normal2texcoord.right.x);
+	normal2texcoord.right.x = MatFX::envMapFlipU ? -uscale : uscale;
+	RawMatrix::mult(envMtx, &invMtx, &normal2texcoord);
+}
+
+// There is no multitexturing, so the environment map is added
+// in a second pass over the mesh. Unlike the gl3 shader it isn't
+// modulated by the base texture's alpha, which is close enough.
+static void
+matfxEnvRender(InstanceDataHeader *header, InstanceData *inst, uint32 flags, MatFX::Env *env)
+{
+	Material *m;
+	m = inst->material;
+
+	if(env->tex == nil || env->coefficient == 0.0f){
+		matfxDefaultRender(header, inst, flags);
+		return;
+	}
+
+	matfxDefaultRender(header, inst, flags);
+
+	RawMatrix envMtx;
+	makeEnvMatrix(&envMtx, env->frame);
+
+	RGBA envcol = MatFX::envMapUseMatColor ? m->color : MatFX::envMapColor;
+	float32 coef = env->coefficient > 1.0f ? 1.0f : env->coefficient;
+	envcol.red = envcol.red*coef;
+	envcol.green = envcol.green*coef;
+	envcol.blue = envcol.blue*coef;
+	envcol.alpha = env->fbAlpha ? m->color.alpha : 255;
+
+	uint32 srcblend = rw::GetRenderState(SRCBLEND);
+	uint32 destblend = rw::GetRenderState(DESTBLEND);
+	uint32 zwrite = rw::GetRenderState(ZWRITEENABLE);
+	uint32 fogcol = rw::GetRenderState(FOGCOLOR);
+
+	setMaterial(envcol, m->surfaceProps);
+	setTexture(0, env->tex);
+	softGlobals.texMatrix = &envMtx;
+	// This clamps the vertex color. With it we can achieve both PC and PS2 style matfx
+	softGlobals.colorClamp = MatFX::envMapApplyLight ? 0.0f : 1.0f;
+
+	rw::SetRenderState(VERTEXALPHA, 1);
+	rw::SetRenderState(SRCBLEND, env->fbAlpha ? BLENDSRCALPHA : BLENDONE);
+	rw::SetRenderState(DESTBLEND, BLENDONE);
+	rw::SetRenderState(ZWRITEENABLE, 0);
+	rw::SetRenderState(FOGCOLOR, 0);
+
+	drawInst(header, inst);
+
+	rw::SetRenderState(SRCBLEND, srcblend);
+	rw::SetRenderState(DESTBLEND, destblend);
+	rw::SetRenderState(ZWRITEENABLE, zwrite);
+	rw::SetRenderState(FOGCOLOR, fogcol);
+	softGlobals.texMatrix = nil;
+	softGlobals.colorClamp = 0.0f;
+}
+
+void
+matfxRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	setWorldMatrix(atomic->getFrame()->getLTM());
+	lightingCB(atomic);
+	processVertices(header);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+
+	while(n--){
+		MatFX *matfx = MatFX::get(inst->material);
+
+		if(matfx == nil)
+			matfxDefaultRender(header, inst, flags);
+		else switch(matfx->type){
+		case MatFX::ENVMAP:
+			matfxEnvRender(header, inst, flags, &matfx->fx[0].env);
+			break;
+		default:
+			matfxDefaultRender(header, inst, flags);
+			break;
+		}
+		inst++;
+	}
+}
+
+ObjPipeline*
+makeMatFXPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = matfxRenderCB;
+	pipe->pluginID = ID_MATFX;
+	pipe->pluginData = 0;
+	return pipe;
+}
+
+static void*
+matfxOpen(void *o, int32, int32)
+{
+	matFXGlobals.pipelines[PLATFORM_SOFT] = makeMatFXPipeline();
+	return o;
+}
+
+static void*
+matfxClose(void *o, int32, int32)
+{
+	((ObjPipeline*)matFXGlobals.pipelines[PLATFORM_SOFT])->destroy();
+	matFXGlobals.pipelines[PLATFORM_SOFT] = nil;
+	return o;
+}
+
+void
+initMatFX(void)
+{
+	Driver::registerPlugin(PLATFORM_SOFT, 0, ID_MATFX,
+	                       matfxOpen, matfxClose);
+}
+
+#else
+
+void initMatFX(void) { }
+
+#endif
+
+}
+}
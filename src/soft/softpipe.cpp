@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID 0
+
+namespace rw {
+namespace soft {
+
+#ifdef RW_SOFT
+
+void
+freeInstanceData(Geometry *geometry)
+{
+	if(geometry->instData == nil ||
+	   geometry->instData->platform != PLATFORM_SOFT)
+		return;
+	InstanceDataHeader *header = (InstanceDataHeader*)geometry->instData;
+	geometry->instData = nil;
+	rwFree(header->indices);
+	rwFree(header->vertexBuffer);
+	rwFree(header->morphVertices);
+	rwFree(header->inst);
+	rwFree(header);
+}
+
+void*
+destroyNativeData(void *object, int32, int32)
+{
+	freeInstanceData((Geometry*)object);
+	return object;
+}
+
+// Strips are unrolled into lists with the winding of every other
+// triangle swapped back, degenerate triangles are dropped.
+static uint32
+unrollStrip(MeshHeader *meshh, Mesh *mesh, uint32 *dst)
+{
+	uint32 i, a, b, c, n;
+	n = 0;
+	for(i = 2; i < mesh->numIndices; i++){
+		a = meshh->getIndex(mesh, i-2);
+		b = meshh->getIndex(mesh, i-1);
+		c = meshh->getIndex(mesh, i);
+		if(a == b || b == c || a == c)
+			continue;
+		if(i & 1){
+			dst[n++] = b;
+			dst[n++] = a;
+		}else{
+			dst[n++] = a;
+			dst[n++] = b;
+		}
+		dst[n++] = c;
+	}
+	return n;
+}
+
+static InstanceDataHeader*
+instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
+{
+	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	MeshHeader *meshh = geo->meshHeader;
+	geo->instData = header;
+	header->platform = PLATFORM_SOFT;
+
+	header->serialNumber = meshh->serialNum;
+	header->numMeshes = meshh->numMeshes;
+	header->numVertices = geo->numVertices;
+	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
+
+	// a strip of n indices never has more than n-2 triangles
+	uint32 maxIndices = 0;
+	Mesh *mesh = meshh->getMeshes();
+	for(uint32 i = 0; i < header->numMeshes; i++)
+		maxIndices += meshh->flags == MeshHeader::TRISTRIP && mesh[i].numIndices > 2 ?
+			(mesh[i].numIndices-2)*3 : mesh[i].numIndices;
+	header->indices = rwNewT(uint32, maxIndices, MEMDUR_EVENT | ID_GEOMETRY);
+
+	InstanceData *inst = header->inst;
+	uint32 offset = 0;
+	for(uint32 i = 0; i < header->numMeshes; i++){
+		findMinVertAndNumVertices(meshh, mesh,
+		                          &inst->minVert, &inst->numVertices);
+		inst->material = mesh->material;
+		inst->vertexAlpha = 0;
+		inst->offset = offset;
+		if(meshh->flags == MeshHeader::TRISTRIP)
+			inst->numIndex = unrollStrip(meshh, mesh, header->indices + offset);
+		else{
+			inst->numIndex = mesh->numIndices;
+			for(uint32 j = 0; j < inst->numIndex; j++)
+				header->indices[offset+j] = meshh->getIndex(mesh, j);
+		}
+		offset += inst->numIndex;
+		mesh++;
+		inst++;
+	}
+	header->totalNumIndex = offset;
+
+	header->vertexBuffer = nil;
+	header->positions = nil;
+	header->normals = nil;
+	header->colors = nil;
+	header->texCoords = nil;
+	header->morphStart = -1;
+	header->morphEnd = -1;
+	header->morphValue = 0.0f;
+	header->morphVertices = nil;
+
+	return header;
+}
+
+static void
+instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	// don't try to (re)instance native data
+	if(geo->flags & Geometry::NATIVE)
+		return;
+
+	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
+	if(geo->instData){
+		// Already have instanced data, so check if we have to reinstance
+		assert(header->platform == PLATFORM_SOFT);
+		if(header->serialNumber != geo->meshHeader->serialNum){
+			// Mesh changed, so reinstance everything
+			freeInstanceData(geo);
+		}
+	}
+
+	// no instance or complete reinstance
+	if(geo->instData == nil){
+		geo->instData = instanceMesh(rwpipe, geo);
+		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 0);
+	}else if(geo->lockedSinceInst)
+		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
+
+	geo->lockedSinceInst = 0;
+}
+
+// Blend the morph targets selected by the atomic's interpolator,
+// processVertices picks the result up instead of the base shape.
+static void
+morphInstance(Atomic *atomic, InstanceDataHeader *header)
+{
+	Geometry *geo = atomic->geometry;
+	Interpolator *ip = &atomic->interpolator;
+	float32 t = ip->getValue();
+	if(header->morphStart == ip->startMorphTarget &&
+	   header->morphEnd == ip->endMorphTarget &&
+	   header->morphValue == t)
+		return;
+	header->morphStart = ip->startMorphTarget;
+	header->morphEnd = ip->endMorphTarget;
+	header->morphValue = t;
+
+	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	int32 n = header->numVertices;
+	if(header->morphVertices == nil)
+		header->morphVertices = rwNewT(V3d, hasNormals ? 2*n : n, MEMDUR_EVENT | ID_GEOMETRY);
+	geo->interpolateMorphTargets(header->morphVertices,
+		hasNormals ? header->morphVertices + n : nil,
+		ip->startMorphTarget, ip->endMorphTarget, t);
+}
+
+static void
+uninstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	assert(0 && "can't uninstance");
+}
+
+static void
+render(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	pipe->instance(atomic);
+	assert(geo->instData != nil);
+	assert(geo->instData->platform == PLATFORM_SOFT);
+	if(geo->numMorphTargets > 1)
+		morphInstance(atomic, (InstanceDataHeader*)geo->instData);
+	if(pipe->renderCB)
+		pipe->renderCB(atomic, (InstanceDataHeader*)geo->instData);
+}
+
+static void
+renderMesh(rw::ObjPipeline *rwpipe, Atomic *atomic, int32 mesh, bool32 sameAtomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	InstanceDataHeader *header;
+	if(!sameAtomic){
+		pipe->instance(atomic);
+		assert(geo->instData != nil);
+		assert(geo->instData->platform == PLATFORM_SOFT);
+		if(geo->numMorphTargets > 1)
+			morphInstance(atomic, (InstanceDataHeader*)geo->instData);
+	}
+	header = (InstanceDataHeader*)geo->instData;
+	assert(mesh >= 0 && (uint32)mesh < header->numMeshes);
+	pipe->renderMeshCB(atomic, header, &header->inst[mesh], sameAtomic);
+}
+
+static bool32
+meshVertexAlpha(rw::ObjPipeline *rwpipe, Atomic *atomic, int32 mesh)
+{
+	InstanceDataHeader *header;
+	rwpipe->instance(atomic);
+	header = (InstanceDataHeader*)atomic->geometry->instData;
+	if(header == nil || header->platform != PLATFORM_SOFT ||
+	   (uint32)mesh >= header->numMeshes)
+		return 0;
+	return header->inst[mesh].vertexAlpha;
+}
+
+void
+ObjPipeline::init(void)
+{
+	this->rw::ObjPipeline::init(PLATFORM_SOFT);
+	this->impl.instance = soft::instance;
+	this->impl.uninstance = soft::uninstance;
+	this->impl.render = soft::render;
+	this->impl.meshVertexAlpha = soft::meshVertexAlpha;
+	// all CPU work, nothing to upload
+	this->impl.prepareInstance = soft::instance;
+	this->instanceCB = nil;
+	this->uninstanceCB = nil;
+	this->renderCB = nil;
+	this->renderMeshCB = nil;
+}
+
+ObjPipeline*
+ObjPipeline::create(void)
+{
+	ObjPipeline *pipe = rwNewT(ObjPipeline, 1, MEMDUR_GLOBAL);
+	pipe->init();
+	return pipe;
+}
+
+void
+defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
+{
+	bool isPrelit = !!(geo->flags & Geometry::PRELIT);
+	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	bool hasTexCoords = geo->numTexCoordSets > 0;
+	int32 n = header->numVertices;
+
+	if(!reinstance){
+		uint32 size = n*sizeof(V3d);
+		if(hasNormals) size += n*sizeof(V3d);
+		if(hasTexCoords) size += n*sizeof(TexCoords);
+		if(isPrelit) size += n*sizeof(RGBA);
+		header->vertexBuffer = rwNewT(uint8, size, MEMDUR_EVENT | ID_GEOMETRY);
+
+		uint8 *p = header->vertexBuffer;
+		header->positions = (V3d*)p;
+		p += n*sizeof(V3d);
+		if(hasNormals){
+			header->normals = (V3d*)p;
+			p += n*sizeof(V3d);
+		}
+		if(hasTexCoords){
+			header->texCoords = (TexCoords*)p;
+			p += n*sizeof(TexCoords);
+		}
+		if(isPrelit)
+			header->colors = (RGBA*)p;
+	}
+
+	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES)
+		memcpy(header->positions, geo->morphTargets[0].vertices, n*sizeof(V3d));
+
+	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS))
+		memcpy(header->normals, geo->morphTargets[0].normals, n*sizeof(V3d));
+
+	if(hasTexCoords && (!reinstance || geo->lockedSinceInst&Geometry::LOCKTEXCOORDS))
+		memcpy(header->texCoords, geo->texCoords[0], n*sizeof(TexCoords));
+
+	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+		InstanceData *inst = header->inst;
+		for(uint32 i = 0; i < header->numMeshes; i++){
+			if(inst->minVert != 0xFFFFFFFF)
+				inst->vertexAlpha = instColor(VERT_RGBA,
+					(uint8*)(header->colors + inst->minVert),
+					geo->colors + inst->minVert,
+					inst->numVertices, sizeof(RGBA));
+			inst++;
+		}
+	}
+
+	// blend again on the next render
+	header->morphStart = -1;
+}
+
+void
+defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header)
+{
+	assert(0 && "can't uninstance");
+}
+
+ObjPipeline*
+makeDefaultPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = defaultRenderCB;
+	pipe->renderMeshCB = defaultRenderMeshCB;
+	pipe->impl.renderMesh = soft::renderMesh;
+	return pipe;
+}
+
+#else
+void *destroyNativeData(void *object, int32, int32) { return object; }
+#endif
+
+}
+}
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID ID_DRIVER
+
+namespace rw {
+namespace soft {
+
+int32 nativeRasterOffset;
+
+static void
+getLevelDims(Raster *raster, int32 level, int32 *w, int32 *h)
+{
+	int32 i;
+	*w = raster->originalWidth;
+	*h = raster->originalHeight;
+	for(i = 0; i < level; i++){
+		if(*w > 1) *w /= 2;
+		if(*h > 1) *h /= 2;
+	}
+}
+
+// All levels in one block, every pixel is four bytes
+static bool32
+allocateLevels(Raster *raster, int32 numLevels)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 i, w, h;
+	uint32 size;
+
+	w = raster->width;
+	h = raster->height;
+	size = 0;
+	for(i = 0; i < numLevels; i++){
+		natras->levelOffset[i] = size;
+		size += w*h*4;
+		if(w > 1) w /= 2;
+		if(h > 1) h /= 2;
+	}
+	natras->data = rwNewT(uint8, size, MEMDUR_EVENT | ID_DRIVER);
+	if(natras->data == nil){
+		RWERROR((ERR_ALLOC, size));
+		return 0;
+	}
+	memset(natras->data, 0, size);
+	natras->numLevels = numLevels;
+	return 1;
+}
+
+static Raster*
+rasterCreateTexture(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 w, h, numLevels;
+
+	if(raster->format & (Raster::PAL4 | Raster::PAL8)){
+		RWERROR((ERR_NOTEXTURE));
+		return nil;
+	}
+
+	switch(raster->format & 0xF00){
+	case Raster::C8888:
+	case Raster::C1555:
+	case Raster::C4444:
+		natras->hasAlpha = 1;
+		break;
+	case Raster::C888:
+	case Raster::C565:
+	case Raster::C555:
+	case Raster::LUM8:
+		natras->hasAlpha = 0;
+		break;
+	default:
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+	// whatever was asked for, the pixels are RGBA8888
+	raster->format = (raster->format & ~0xF00) | Raster::C8888;
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+
+	numLevels = 1;
+	if(raster->format & Raster::MIPMAP){
+		w = raster->width;
+		h = raster->height;
+		while((w != 1 || h != 1) && numLevels < SoftRaster::MAXLEVELS){
+			numLevels++;
+			if(w > 1) w /= 2;
+			if(h > 1) h /= 2;
+		}
+	}
+	natras->autogenMipmap = (raster->format & (Raster::MIPMAP|Raster::AUTOMIPMAP)) == (Raster::MIPMAP|Raster::AUTOMIPMAP);
+
+	if(!allocateLevels(raster, numLevels))
+		return nil;
+	return raster;
+}
+
+static Raster*
+rasterCreateCamera(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	raster->format = Raster::C8888;
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+	natras->hasAlpha = 0;
+	natras->autogenMipmap = 0;
+	if(!allocateLevels(raster, 1))
+		return nil;
+	return raster;
+}
+
+static Raster*
+rasterCreateZbuffer(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	raster->format = Raster::D32;
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+	natras->hasAlpha = 0;
+	natras->autogenMipmap = 0;
+	if(!allocateLevels(raster, 1))
+		return nil;
+	return raster;
+}
+
+Raster*
+rasterCreate(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	natras->data = nil;
+	natras->hasAlpha = 0;
+	natras->autogenMipmap = 0;
+	natras->numLevels = 1;
+
+	Raster *ret = raster;
+
+	if(raster->width == 0 || raster->height == 0){
+		raster->flags |= Raster::DONTALLOCATE;
+		raster->stride = 0;
+		goto ret;
+	}
+	if(raster->flags & Raster::DONTALLOCATE)
+		goto ret;
+
+	switch(raster->type){
+	case Raster::NORMAL:
+	case Raster::TEXTURE:
+		ret = rasterCreateTexture(raster);
+		break;
+	case Raster::CAMERATEXTURE:
+	case Raster::CAMERA:
+		ret = rasterCreateCamera(raster);
+		break;
+	case Raster::ZBUFFER:
+		ret = rasterCreateZbuffer(raster);
+		break;
+
+	default:
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+
+ret:
+	raster->originalWidth = raster->width;
+	raster->originalHeight = raster->height;
+	raster->originalStride = raster->stride;
+	raster->originalPixels = raster->pixels;
+	return ret;
+}
+
+// Pixels are locked in place
+uint8*
+rasterLock(Raster *raster, int32 level, int32 lockMode)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 w, h;
+
+	assert(raster->privateFlags == 0);
+	if(natras->data == nil || level >= natras->numLevels)
+		return nil;
+#ifdef RW_SOFT
+	// queued triangles may still read or write it
+	if(isRasterizerBusy())
+		flush();
+#endif
+
+	getLevelDims(raster, level, &w, &h);
+	raster->width = w;
+	raster->height = h;
+	raster->stride = w*4;
+	raster->pixels = natras->data + natras->levelOffset[level];
+	raster->privateFlags = lockMode;
+	return raster->pixels;
+}
+
+// 2x2 box filter from the level above
+static void
+makeMipLevel(Raster *raster, int32 level)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 sw, sh, dw, dh, x, y, x0, x1, y0, y1, c;
+	uint8 *src, *dst, *p00, *p01, *p10, *p11;
+
+	getLevelDims(raster, level-1, &sw, &sh);
+	getLevelDims(raster, level, &dw, &dh);
+	src = natras->data + natras->levelOffset[level-1];
+	dst = natras->data + natras->levelOffset[level];
+	for(y = 0; y < dh; y++){
+		y0 = 2*y < sh ? 2*y : sh-1;
+		y1 = 2*y+1 < sh ? 2*y+1 : sh-1;
+		for(x = 0; x < dw; x++){
+			x0 = 2*x < sw ? 2*x : sw-1;
+			x1 = 2*x+1 < sw ? 2*x+1 : sw-1;
+			p00 = &src[(y0*sw + x0)*4];
+			p01 = &src[(y0*sw + x1)*4];
+			p10 = &src[(y1*sw + x0)*4];
+			p11 = &src[(y1*sw + x1)*4];
+			for(c = 0; c < 4; c++)
+				*dst++ = (p00[c] + p01[c] + p10[c] + p11[c] + 2)/4;
+		}
+	}
+}
+
+void
+rasterUnlock(Raster *raster, int32 level)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 i;
+
+	if(raster->privateFlags & Raster::LOCKWRITE &&
+	   level == 0 && natras->autogenMipmap)
+		for(i = 1; i < natras->numLevels; i++)
+			makeMipLevel(raster, i);
+
+	raster->width = raster->originalWidth;
+	raster->height = raster->originalHeight;
+	raster->stride = raster->originalStride;
+	raster->pixels = raster->originalPixels;
+	raster->privateFlags = 0;
+}
+
+int32
+rasterNumLevels(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	// generated levels are not for the user
+	return natras->autogenMipmap ? 1 : natras->numLevels;
+}
+
+bool32
+imageFindRasterFormat(Image *img, int32 type,
+	int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat)
+{
+	assert((type&0xF) == Raster::TEXTURE);
+
+	*pWidth = img->width;
+	*pHeight = img->height;
+	*pDepth = 32;
+	*pFormat = (img->hasAlpha() ? Raster::C8888 : Raster::C888) | type;
+	return 1;
+}
+
+bool32
+rasterFromImage(Raster *raster, Image *image)
+{
+	if((raster->type&0xF) != Raster::TEXTURE)
+		return 0;
+
+	void (*conv)(uint8 *out, uint8 *in) = nil;
+
+	// Unpalettize image if necessary but don't change original
+	Image *truecolimg = nil;
+	if(image->depth <= 8){
+		truecolimg = Image::create(image->width, image->height, image->depth);
+		truecolimg->pixels = image->pixels;
+		truecolimg->stride = image->stride;
+		truecolimg->palette = image->palette;
+		truecolimg->unpalettize();
+		image = truecolimg;
+	}
+
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	switch(image->depth){
+	case 32:
+		conv = conv_RGBA8888_from_RGBA8888;
+		break;
+	case 24:
+		conv = conv_RGBA8888_from_RGB888;
+		break;
+	case 16:
+		conv = conv_RGBA8888_from_ARGB1555;
+		break;
+	default:
+		if(truecolimg)
+			truecolimg->destroy();
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	natras->hasAlpha = image->hasAlpha();
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+
+	uint8 *pixels = raster->pixels;
+	assert(pixels);
+	uint8 *imgpixels = image->pixels;
+
+	int x, y;
+	assert(image->width == raster->width);
+	assert(image->height == raster->height);
+	for(y = 0; y < image->height; y++){
+		uint8 *imgrow = imgpixels;
+		uint8 *rasrow = pixels;
+		for(x = 0; x < image->width; x++){
+			conv(rasrow, imgrow);
+			imgrow += image->bpp;
+			rasrow += 4;
+		}
+		imgpixels += image->stride;
+		pixels += raster->stride;
+	}
+	if(unlock)
+		raster->unlock(0);
+
+	if(truecolimg)
+		truecolimg->destroy();
+
+	return 1;
+}
+
+Image*
+rasterToImage(Raster *raster)
+{
+	Image *image;
+
+	if(raster->type == Raster::ZBUFFER){
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		if(raster->lock(0, Raster::LOCKREAD) == nil){
+			RWERROR((ERR_INVRASTER));
+			return nil;
+		}
+		unlock = true;
+	}
+
+	image = Image::create(raster->width, raster->height, 32);
+	image->allocate();
+
+	uint8 *imgpixels = image->pixels;
+	uint8 *pixels = raster->pixels;
+
+	int y;
+	for(y = 0; y < image->height; y++){
+		memcpy(imgpixels, pixels, image->width*4);
+		imgpixels += image->stride;
+		pixels += raster->stride;
+	}
+
+	if(unlock)
+		raster->unlock(0);
+
+	return image;
+}
+
+static void*
+createNativeRaster(void *object, int32 offset, int32)
+{
+	SoftRaster *ras = PLUGINOFFSET(SoftRaster, object, offset);
+	ras->data = nil;
+	ras->numLevels = 0;
+	return object;
+}
+
+static void*
+destroyNativeRaster(void *object, int32 offset, int32)
+{
+	SoftRaster *natras = PLUGINOFFSET(SoftRaster, object, offset);
+#ifdef RW_SOFT
+	if(natras->data)
+		evictRaster((Raster*)object);
+#endif
+	rwFree(natras->data);
+	natras->data = nil;
+	return object;
+}
+
+static void*
+copyNativeRaster(void *dst, void *, int32 offset, int32)
+{
+	SoftRaster *d = PLUGINOFFSET(SoftRaster, dst, offset);
+	d->data = nil;
+	d->numLevels = 0;
+	return dst;
+}
+
+void registerNativeRaster(void)
+{
+	nativeRasterOffset = Raster::registerPlugin(sizeof(SoftRaster),
+	                                            ID_RASTERSOFT,
+	                                            createNativeRaster,
+	                                            destroyNativeRaster,
+	                                            copyNativeRaster);
+}
+
+}
+}
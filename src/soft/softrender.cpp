@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#ifdef RW_SOFT
+
+#define PLUGIN_ID 0
+
+namespace rw {
+namespace soft {
+
+// What is known about a vertex before the material
+struct CachedVertex
+{
+	float32 x, y, z, w;
+	uint32 clip;
+	float32 fog;
+	float32 r, g, b;	// sum of dynamic lights
+	V3d normal;		// world space
+};
+
+enum { CHUNKSIZE = 256 };
+
+static CachedVertex *vertexCache;
+static int32 vertexCacheSize;
+static ClipVertex *clipVerts;
+static int32 clipVertsSize;
+
+struct TransformJob
+{
+	V3d *positions;
+	V3d *normals;
+	int32 numVertices;
+	bool32 lighting;
+};
+
+struct FinishJob
+{
+	ClipVertex *out;
+	int32 first;
+	int32 numVertices;
+	RGBA *colors;
+	TexCoords *texCoords;
+};
+
+static void
+lightVertex(CachedVertex *cv, V3d *V, V3d *N)
+{
+	SoftLight *l;
+	V3d d;
+	float32 r, g, b, dist, atten, lf, pcos, ccos, falloff;
+	int32 i;
+
+	r = g = b = 0.0f;
+	for(i = 0; i < softGlobals.numLights; i++){
+		l = &softGlobals.lights[i];
+		if(l->type == Light::DIRECTIONAL){
+			lf = -dot(*N, l->direction);
+			if(lf <= 0.0f)
+				continue;
+			atten = 1.0f;
+		}else{
+			d = sub(*V, l->position);
+			dist = length(d);
+			atten = 1.0f - dist/l->radius;
+			if(atten <= 0.0f || dist == 0.0f)
+				continue;
+			d = scale(d, 1.0f/dist);
+			lf = -dot(*N, d);
+			if(lf <= 0.0f)
+				continue;
+			if(l->type == Light::SPOT){
+				pcos = dot(d, l->direction);	// cos to point
+				ccos = -l->minusCosAngle;
+				falloff = (pcos-ccos)/(1.0f-ccos);
+				if(falloff < 0.0f)	// outside of cone
+					continue;
+				lf *= falloff > l->hardSpot ? falloff : l->hardSpot;
+			}
+		}
+		lf *= atten;
+		r += lf*l->color.red;
+		g += lf*l->color.green;
+		b += lf*l->color.blue;
+	}
+	cv->r = r;
+	cv->g = g;
+	cv->b = b;
+}
+
+static void
+transformJob(void *data, int32 chunk)
+{
+	TransformJob *job = (TransformJob*)data;
+	RawMatrix *m = &softGlobals.worldViewProj;
+	Matrix *world = &softGlobals.world;
+	CachedVertex *cv;
+	V3d *p, *n, V, N;
+	int32 i, end;
+
+	i = chunk*CHUNKSIZE;
+	end = i+CHUNKSIZE < job->numVertices ? i+CHUNKSIZE : job->numVertices;
+	for(; i < end; i++){
+		cv = &vertexCache[i];
+		p = &job->positions[i];
+		cv->x = p->x*m->right.x + p->y*m->up.x + p->z*m->at.x + m->pos.x;
+		cv->y = p->x*m->right.y + p->y*m->up.y + p->z*m->at.y + m->pos.y;
+		cv->z = p->x*m->right.z + p->y*m->up.z + p->z*m->at.z + m->pos.z;
+		cv->w = p->x*m->rightw + p->y*m->upw + p->z*m->atw + m->posw;
+		cv->clip = getClipCode(cv->x, cv->y, cv->z, cv->w);
+		cv->fog = (cv->w - softGlobals.fogEnd)*softGlobals.fogRange;
+
+		if(job->normals){
+			n = &job->normals[i];
+			N = add(add(scale(world->right, n->x), scale(world->up, n->y)), scale(world->at, n->z));
+		}else
+			N.set(0.0f, 0.0f, 0.0f);
+		cv->normal = N;
+		if(job->lighting){
+			V = add(add(add(scale(world->right, p->x), scale(world->up, p->y)),
+				scale(world->at, p->z)), world->pos);
+			lightVertex(cv, &V, &N);
+		}else
+			cv->r = cv->g = cv->b = 0.0f;
+	}
+}
+
+void
+transformVertices(V3d *positions, V3d *normals, int32 numVertices, bool32 lighting)
+{
+	TransformJob job;
+
+	if(numVertices > vertexCacheSize){
+		vertexCacheSize = numVertices;
+		vertexCache = rwResizeT(CachedVertex, vertexCache, vertexCacheSize, MEMDUR_EVENT | ID_DRIVER);
+	}
+	job.positions = positions;
+	job.normals = normals;
+	job.numVertices = numVertices;
+	job.lighting = lighting;
+	Engine::jobfuncs.parallelFor(transformJob, &job, (numVertices + CHUNKSIZE-1)/CHUNKSIZE);
+}
+
+static inline float32
+clampColor(float32 c)
+{
+	c = c < 0.0f ? 0.0f : c > 1.0f ? 1.0f : c;
+	return c > softGlobals.colorClamp ? c : softGlobals.colorClamp;
+}
+
+static void
+finishJob(void *data, int32 chunk)
+{
+	FinishJob *job = (FinishJob*)data;
+	RGBAf *mat = &softGlobals.matColor;
+	RawMatrix *tm = softGlobals.texMatrix;
+	float32 amb = softGlobals.surfProps.ambient;
+	float32 diff = softGlobals.surfProps.diffuse;
+	float32 ar = softGlobals.ambient.red*amb;
+	float32 ag = softGlobals.ambient.green*amb;
+	float32 ab = softGlobals.ambient.blue*amb;
+	CachedVertex *cv;
+	ClipVertex *v;
+	float32 r, g, b, a;
+	int32 i, end;
+
+	i = chunk*CHUNKSIZE;
+	end = i+CHUNKSIZE < job->numVertices ? i+CHUNKSIZE : job->numVertices;
+	for(; i < end; i++){
+		cv = &vertexCache[job->first + i];
+		v = &job->out[i];
+		v->x = cv->x;
+		v->y = cv->y;
+		v->z = cv->z;
+		v->w = cv->w;
+		v->clip = cv->clip;
+		v->fog = cv->fog < 0.0f ? 0.0f : cv->fog > 1.0f ? 1.0f : cv->fog;
+
+		if(job->colors){
+			RGBA *c = &job->colors[job->first + i];
+			r = c->red/255.0f;
+			g = c->green/255.0f;
+			b = c->blue/255.0f;
+			a = c->alpha/255.0f;
+		}else{
+			r = g = b = 0.0f;
+			a = 1.0f;
+		}
+		v->r = clampColor(r + ar + cv->r*diff)*mat->red*255.0f;
+		v->g = clampColor(g + ag + cv->g*diff)*mat->green*255.0f;
+		v->b = clampColor(b + ab + cv->b*diff)*mat->blue*255.0f;
+		v->a = clampColor(a)*mat->alpha*255.0f;
+
+		if(tm){
+			V3d *n = &cv->normal;
+			v->u = n->x*tm->right.x + n->y*tm->up.x + n->z*tm->at.x + tm->pos.x;
+			v->v = n->x*tm->right.y + n->y*tm->up.y + n->z*tm->at.y + tm->pos.y;
+		}else if(job->texCoords){
+			v->u = job->texCoords[job->first + i].u;
+			v->v = job->texCoords[job->first + i].v;
+		}else
+			v->u = v->v = 0.0f;
+	}
+}
+
+void
+finishVertices(ClipVertex *out, int32 first, int32 numVertices,
+	RGBA *colors, TexCoords *texCoords)
+{
+	FinishJob job;
+	job.out = out;
+	job.first = first;
+	job.numVertices = numVertices;
+	job.colors = colors;
+	job.texCoords = texCoords;
+	Engine::jobfuncs.parallelFor(finishJob, &job, (numVertices + CHUNKSIZE-1)/CHUNKSIZE);
+}
+
+void
+processVertices(InstanceDataHeader *header, V3d *positions, V3d *normals)
+{
+	if(positions == nil){
+		if(header->morphVertices){
+			positions = header->morphVertices;
+			normals = header->normals ? header->morphVertices + header->numVertices : nil;
+		}else{
+			positions = header->positions;
+			normals = header->normals;
+		}
+	}
+	transformVertices(positions, normals, header->numVertices, softGlobals.numLights != 0);
+}
+
+void
+closeRender(void)
+{
+	rwFree(vertexCache);
+	vertexCache = nil;
+	vertexCacheSize = 0;
+	rwFree(clipVerts);
+	clipVerts = nil;
+	clipVertsSize = 0;
+}
+
+static void
+drawInst_simple(InstanceDataHeader *header, InstanceData *inst)
+{
+	uint32 *idx = header->indices + inst->offset;
+	uint32 i;
+	for(i = 0; i+2 < inst->numIndex; i += 3)
+		drawTriangle(&clipVerts[idx[i] - inst->minVert],
+			&clipVerts[idx[i+1] - inst->minVert],
+			&clipVerts[idx[i+2] - inst->minVert]);
+}
+
+// Emulate PS2 GS alpha test FB_ONLY case: pixels failing the test
+// are drawn without z-write.
+static void
+drawInst_GSemu(InstanceDataHeader *header, InstanceData *inst)
+{
+	uint32 hasAlpha;
+	int alphafunc, alpharef, gsalpharef;
+	int zwrite;
+	hasAlpha = getAlphaBlend();
+	if(hasAlpha){
+		zwrite = rw::GetRenderState(rw::ZWRITEENABLE);
+		alphafunc = rw::GetRenderState(rw::ALPHATESTFUNC);
+		if(zwrite){
+			alpharef = rw::GetRenderState(rw::ALPHATESTREF);
+			gsalpharef = rw::GetRenderState(rw::GSALPHATESTREF);
+
+			SetRenderState(rw::ALPHATESTFUNC, rw::ALPHAGREATEREQUAL);
+			SetRenderState(rw::ALPHATESTREF, gsalpharef);
+			drawInst_simple(header, inst);
+			SetRenderState(rw::ALPHATESTFUNC, rw::ALPHALESS);
+			SetRenderState(rw::ZWRITEENABLE, 0);
+			drawInst_simple(header, inst);
+			SetRenderState(rw::ZWRITEENABLE, 1);
+			SetRenderState(rw::ALPHATESTFUNC, alphafunc);
+			SetRenderState(rw::ALPHATESTREF, alpharef);
+		}else{
+			SetRenderState(rw::ALPHATESTFUNC, rw::ALPHAALWAYS);
+			drawInst_simple(header, inst);
+			SetRenderState(rw::ALPHATESTFUNC, alphafunc);
+		}
+	}else
+		drawInst_simple(header, inst);
+}
+
+void
+drawInst(InstanceDataHeader *header, InstanceData *inst)
+{
+	if(inst->numIndex == 0 || inst->minVert == 0xFFFFFFFF)
+		return;
+	if(inst->numVertices > clipVertsSize){
+		clipVertsSize = inst->numVertices;
+		clipVerts = rwResizeT(ClipVertex, clipVerts, clipVertsSize, MEMDUR_EVENT | ID_DRIVER);
+	}
+	finishVertices(clipVerts, inst->minVert, inst->numVertices,
+		header->colors, header->texCoords);
+
+	if(rw::GetRenderState(rw::GSALPHATEST))
+		drawInst_GSemu(header, inst);
+	else
+		drawInst_simple(header, inst);
+}
+
+void
+lightingCB(Atomic *atomic)
+{
+	WorldLights lightData;
+	Light *directionals[8];
+	Light *locals[8];
+	lightData.directionals = directionals;
+	lightData.numDirectionals = 8;
+	lightData.locals = locals;
+	lightData.numLocals = 8;
+
+	if(atomic->geometry->flags & rw::Geometry::LIGHT)
+		((World*)engine->currentWorld)->enumerateLights(atomic, &lightData);
+	else
+		memset(&lightData, 0, sizeof(lightData));
+	setLights(&lightData);
+}
+
+void
+lightingCB(void)
+{
+	WorldLights lightData;
+	Light *directionals[8];
+	Light *locals[8];
+	lightData.directionals = directionals;
+	lightData.numDirectionals = 8;
+	lightData.locals = locals;
+	lightData.numLocals = 8;
+
+	((World*)engine->currentWorld)->enumerateLights(&lightData);
+	setLights(&lightData);
+}
+
+static void
+defaultRenderMesh(InstanceDataHeader *header, InstanceData *inst, uint32 flags)
+{
+	Material *m = inst->material;
+
+	setMaterial(flags, m->color, m->surfaceProps);
+
+	setTexture(0, m->texture);
+
+	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+	drawInst(header, inst);
+}
+
+void
+defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	setWorldMatrix(atomic->getFrame()->getLTM());
+	lightingCB(atomic);
+	processVertices(header);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+
+	while(n--){
+		defaultRenderMesh(header, inst, flags);
+		inst++;
+	}
+}
+
+void
+defaultRenderMeshCB(Atomic *atomic, InstanceDataHeader *header, InstanceData *inst, bool32 sameAtomic)
+{
+	if(!sameAtomic){
+		setWorldMatrix(atomic->getFrame()->getLTM());
+		lightingCB(atomic);
+		processVertices(header);
+	}
+	defaultRenderMesh(header, inst, atomic->geometry->flags);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
+
+#include "rwsoft.h"
+#include "rwsoftplg.h"
+
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID ID_SKIN
+
+namespace rw {
+namespace soft {
+
+#ifdef RW_SOFT
+
+// Skinned vertices of the atomic being rendered
+static V3d *skinnedPositions;
+static V3d *skinnedNormals;
+static int32 skinnedSize;
+
+static void
+skinVertices(Atomic *atomic, InstanceDataHeader *header)
+{
+	Geometry *geo = atomic->geometry;
+	if(geo->numVertices > skinnedSize){
+		skinnedSize = geo->numVertices;
+		skinnedPositions = rwResizeT(V3d, skinnedPositions, skinnedSize, MEMDUR_EVENT | ID_SKIN);
+		skinnedNormals = rwResizeT(V3d, skinnedNormals, skinnedSize, MEMDUR_EVENT | ID_SKIN);
+	}
+	Skin::skinVertices(atomic, skinnedPositions,
+		header->normals ? skinnedNormals : nil);
+	processVertices(header, skinnedPositions,
+		header->normals ? skinnedNormals : nil);
+}
+
+static void
+skinRenderMesh(InstanceDataHeader *header, InstanceData *inst, uint32 flags)
+{
+	Material *m = inst->material;
+
+	setMaterial(flags, m->color, m->surfaceProps);
+
+	setTexture(0, m->texture);
+
+	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+	drawInst(header, inst);
+}
+
+// The whole atomic is skinned on the CPU into its local space,
+// so unlike on GPUs the bone limit of split meshes doesn't matter.
+void
+skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	setWorldMatrix(atomic->getFrame()->getLTM());
+	lightingCB(atomic);
+	skinVertices(atomic, header);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+
+	while(n--){
+		skinRenderMesh(header, inst, flags);
+		inst++;
+	}
+}
+
+static void*
+skinOpen(void *o, int32, int32)
+{
+	skinGlobals.pipelines[PLATFORM_SOFT] = makeSkinPipeline();
+	return o;
+}
+
+static void*
+skinClose(void *o, int32, int32)
+{
+	((ObjPipeline*)skinGlobals.pipelines[PLATFORM_SOFT])->destroy();
+	skinGlobals.pipelines[PLATFORM_SOFT] = nil;
+
+	rwFree(skinnedPositions);
+	rwFree(skinnedNormals);
+	skinnedPositions = nil;
+	skinnedNormals = nil;
+	skinnedSize = 0;
+	return o;
+}
+
+void
+initSkin(void)
+{
+	Driver::registerPlugin(PLATFORM_SOFT, 0, ID_SKIN,
+	                       skinOpen, skinClose);
+}
+
+ObjPipeline*
+makeSkinPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = skinRenderCB;
+	pipe->pluginID = ID_SKIN;
+	pipe->pluginData = 1;
+	return pipe;
+}
+
+#else
+
+void initSkin(void) { }
+
+#endif
+
+}
+}
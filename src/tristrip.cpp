@@ -25,11 +25,8 @@ struct GraphEdge
 
 struct StripNode
 {
-	uint16 v[3];	/* vertex indices */
-	uint8 parent : 2;	/* tunnel parent node (edge index) */
-	uint8 visited : 1;	/* visited in breadth first search */
-	uint8 stripVisited : 1;	/* strip starting at this node was visited during search */
-	uint8 isEnd : 1;	/* is in end list */
+	uint32 v[3];	/* vertex indices */
+	uint8 numFree;	/* connected nodes not in a strip yet */
 	GraphEdge e[3];
 	int32 stripId;	/* index of start node */
 	LLLink inlist;
@@ -41,6 +38,21 @@ struct StripMesh
 	StripNode *nodes;
 	LinkList loneNodes;	/* nodes not connected to any others */
 	LinkList endNodes;	/* strip start/end nodes */
+
+	/* edge hash, chains of half edges (node*3 + edge) */
+	int32 hashSize;
+	int32 *hashHeads;
+	int32 *hashNext;
+
+	/* nodes by number of free neighbours, may contain stale entries */
+	int32 *buckets[4];
+	int32 bucketSize[4];
+	/* free neighbours of the last strip, to keep strips together */
+	int32 *frontier;
+	int32 frontierSize;
+	/* for trial walks */
+	int32 *stamp;
+	int32 curStamp;
 };
 
 //#define trace(...) printf(__VA_ARGS__)
@@ -88,18 +100,18 @@ static void
 collectFaces(Geometry *geo, StripMesh *sm, uint16 m)
 {
 	StripNode *n;
-	Triangle *t;
+	Triangle32 t;
 	sm->numNodes = 0;
 	for(int32 i = 0; i < geo->numTriangles; i++){
-		t = &geo->triangles[i];
-		if(t->matId == m){
+		t = geo->getTriangle(i);
+		if(t.matId == m){
 			n = &sm->nodes[sm->numNodes++];
-			n->v[0] = t->v[0];
-			n->v[1] = t->v[1];
-			n->v[2] = t->v[2];
-			assert(t->v[0] < geo->numVertices);
-			assert(t->v[1] < geo->numVertices);
-			assert(t->v[2] < geo->numVertices);
+			n->v[0] = t.v[0];
+			n->v[1] = t.v[1];
+			n->v[2] = t.v[2];
+			assert(t.v[0] < (uint32)geo->numVertices);
+			assert(t.v[1] < (uint32)geo->numVertices);
+			assert(t.v[2] < (uint32)geo->numVertices);
 			n->e[0].node = 0;
 			n->e[1].node = 0;
 			n->e[2].node = 0;
@@ -109,68 +121,72 @@ collectFaces(Geometry *geo, StripMesh *sm, uint16 m)
 			n->e[0].isStrip = 0;
 			n->e[1].isStrip = 0;
 			n->e[2].isStrip = 0;
-			n->parent = 0;
-			n->visited = 0;
-			n->stripVisited = 0;
-			n->isEnd = 0;
+			n->numFree = 0;
 			n->stripId = -1;
 			n->inlist.init();
 		}
 	}
 }
 
-/* Find Triangle that has edge e that is not connected yet. */
-static GraphEdge
-findEdge(StripMesh *sm, int32 e[2])
+static uint32
+hashEdge(int32 a, int32 b)
 {
-	StripNode *n;
-	GraphEdge ge = { 0, 0, 0, 0 };
-	for(int32 i = 0; i < sm->numNodes; i++){
-		n = &sm->nodes[i];
-		for(int32 j = 0; j < 3; j++){
-			if(n->e[j].isConnected)
-				continue;
-			if(e[0] == n->v[j] &&
-			   e[1] == n->v[(j+1) % 3]){
-				ge.node = i;
-				// signal success
-				ge.isConnected = 1;
-				ge.otherEdge = j;
-				return ge;
-			}
-		}
-	}
-	return ge;
+	return (a*0x9E3779B1u) ^ (b*0x85EBCA77u);
 }
 
-/* Connect nodes sharing an edge, preserving winding */
+/* Connect nodes sharing an edge, preserving winding.
+ * Half edges are hashed by their vertices so finding
+ * the opposite half edge is a short chain walk. */
 static void
 connectNodesPreserve(StripMesh *sm)
 {
 	StripNode *n, *nn;
-	int32 e[2];
-	GraphEdge ge;
-	for(int32 i = 0; i < sm->numNodes; i++){
+	int32 i, j, k, h;
+	uint32 a, b;
+	uint32 mask;
+
+	sm->hashSize = 16;
+	while(sm->hashSize < sm->numNodes*3)
+		sm->hashSize *= 2;
+	mask = sm->hashSize-1;
+	for(i = 0; i < sm->hashSize; i++)
+		sm->hashHeads[i] = -1;
+	for(i = 0; i < sm->numNodes; i++){
 		n = &sm->nodes[i];
-		for(int32 j = 0; j < 3; j++){
+		for(j = 0; j < 3; j++){
+			h = hashEdge(n->v[j], n->v[(j+1) % 3]) & mask;
+			sm->hashNext[i*3+j] = sm->hashHeads[h];
+			sm->hashHeads[h] = i*3+j;
+		}
+	}
+
+	for(i = 0; i < sm->numNodes; i++){
+		n = &sm->nodes[i];
+		for(j = 0; j < 3; j++){
 			if(n->e[j].isConnected)
 				continue;
 
 			/* flip edge and search for node */
-			e[1] = n->v[j];
-			e[0] = n->v[(j+1) % 3];
-			ge = findEdge(sm, e);
-			if(ge.isConnected){
+			a = n->v[(j+1) % 3];
+			b = n->v[j];
+			h = hashEdge(a, b) & mask;
+			for(k = sm->hashHeads[h]; k >= 0; k = sm->hashNext[k]){
+				nn = &sm->nodes[k/3];
+				if(nn == n || nn->e[k%3].isConnected ||
+				   nn->v[k%3] != a || nn->v[(k%3+1) % 3] != b)
+					continue;
 				/* found node, now connect */
-				n->e[j].node = ge.node;
+				n->e[j].node = k/3;
 				n->e[j].isConnected = 1;
-				n->e[j].otherEdge = ge.otherEdge;
+				n->e[j].otherEdge = k%3;
 				n->e[j].isStrip = 0;
-				nn = &sm->nodes[ge.node];
-				nn->e[ge.otherEdge].node = i;
-				nn->e[ge.otherEdge].isConnected = 1;
-				nn->e[ge.otherEdge].otherEdge = j;
-				nn->e[ge.otherEdge].isStrip = 0;
+				nn->e[k%3].node = i;
+				nn->e[k%3].isConnected = 1;
+				nn->e[k%3].otherEdge = j;
+				nn->e[k%3].isStrip = 0;
+				n->numFree++;
+				nn->numFree++;
+				break;
 			}
 		}
 	}
@@ -192,8 +208,6 @@ numStripEdges(StripNode *n)
 		n->e[2].isStrip;
 }
 
-#define IsEnd(n) (numConnections(n) > 0 && numStripEdges(n) < 2)
-
 /* Complement the strip-ness of an edge */
 static void
 complementEdge(StripMesh *sm, GraphEdge *e)
@@ -203,226 +217,176 @@ complementEdge(StripMesh *sm, GraphEdge *e)
 	e->isStrip = !e->isStrip;
 }
 
-/* While possible extend a strip from a starting node until
- * we find a node already in a strip. N.B. this function
- * makes no attempts to connect to an already existing strip.
- * It also doesn't try to alternate between left and right. */
-static void
-extendStrip(StripMesh *sm, StripNode *start)
-{
-	StripNode *n, *nn;
-	n = start;
-	if(numConnections(n) == 0){
-		sm->loneNodes.append(&n->inlist);
-		return;
-	}
-	sm->endNodes.append(&n->inlist);
-	n->isEnd = 1;
-loop:
-	/* Find the next node to connect to on any of the three edges */
-	for(int32 i = 0; i < 3; i++){
-		if(!n->e[i].isConnected)
-			continue;
-		nn = &sm->nodes[n->e[i].node];
-		if(nn->stripId >= 0)
-			continue;
-
-		/* found one */
-		nn->stripId = n->stripId;
-		/* We know it's not a strip edge yet,
-		 * so complementing it will make it one. */
-		complementEdge(sm, &n->e[i]);
-		n = nn;
-		goto loop;
-	}
-	if(n != start){
-		sm->endNodes.append(&n->inlist);
-		n->isEnd = 1;
-	}
-}
+#define NEXT(x) (((x)+1) % 3)
+#define PREV(x) (((x)+2) % 3)
+#define RIGHT(x) NEXT(x)
+#define LEFT(x) PREV(x)
 
-static void
-buildStrips(StripMesh *sm)
+static bool32
+isFree(StripMesh *sm, StripNode *n, int32 e)
 {
-	StripNode *n;
-	for(int32 i = 0; i < sm->numNodes; i++){
-		n = &sm->nodes[i];
-		if(n->stripId >= 0)
-			continue;
-		n->stripId = i;
-		extendStrip(sm, n);
-	}
+	return n->e[e].isConnected &&
+		sm->nodes[n->e[e].node].stripId < 0 &&
+		sm->stamp[n->e[e].node] != sm->curStamp;
 }
 
-static StripNode*
-findTunnel(StripMesh *sm, StripNode *n)
+/* Walk a strip leaving the start node through edge j.
+ * At every node prefer the exit that alternates turns
+ * so makeMesh doesn't have to insert swaps.
+ * Returns the number of triangles, swaps in *numSwaps.
+ * With commit set the strip edges are actually made. */
+static int32
+walkStrip(StripMesh *sm, StripNode *start, int32 j, bool32 commit, int32 *numSwaps)
 {
-	LinkList searchNodes;
-	StripNode *nn;
-	int edgetype;
-	int isEnd;
+	StripNode *n, *nn;
+	int32 i, len;
+	int32 rightturn, lastrightturn;
 
-	searchNodes.init();
-	edgetype = 0;
+	sm->curStamp++;
+	sm->stamp[start - sm->nodes] = sm->curStamp;
+	*numSwaps = 0;
+	len = 1;
+	n = start;
+	lastrightturn = -1;
 	for(;;){
-		for(int32 i = 0; i < 3; i++){
-			/* Find a node connected by the right edgetype */
-			if(!n->e[i].isConnected ||
-			    n->e[i].isStrip != edgetype)
-				continue;
-			nn = &sm->nodes[n->e[i].node];
-
-			/* If the node has been visited already,
-			 * there's a shorter path. */
-			if(nn->visited)
-				continue;
-
-			/* Don't allow non-strip edge between nodes of the same
-			 * strip to prevent loops.
-			 * Actually these edges are allowed under certain
-			 * circumstances, but they require complex checks. */
-			if(edgetype == 0 &&
-			   n->stripId == nn->stripId)
-				continue;
-
-			isEnd = IsEnd(nn);
-
-			/* Can't add end nodes to two lists, so skip. */
-			if(isEnd && edgetype == 1)
-				continue;
-
-			nn->parent = n->e[i].otherEdge;
-			nn->visited = 1;
-			sm->nodes[nn->stripId].stripVisited = 1;
-
-			/* Search complete. */
-			if(isEnd && edgetype == 0)
-				return nn;
+		i = n->e[j].otherEdge;
+		nn = &sm->nodes[n->e[j].node];
+		if(commit){
+			complementEdge(sm, &n->e[j]);
+			nn->stripId = start->stripId;
+		}
+		sm->stamp[nn - sm->nodes] = sm->curStamp;
+		len++;
+		n = nn;
 
-			/* Found a valid node. */
-			searchNodes.append(&nn->inlist);
+		/* the turn that alternates with the last one comes first */
+		rightturn = lastrightturn < 0 ? 1 : !lastrightturn;
+		j = rightturn ? RIGHT(i) : LEFT(i);
+		if(!isFree(sm, n, j)){
+			j = rightturn ? LEFT(i) : RIGHT(i);
+			if(!isFree(sm, n, j))
+				break;
+			if(lastrightturn >= 0)
+				(*numSwaps)++;
+			rightturn = !rightturn;
 		}
-		if(searchNodes.isEmpty())
-			return nil;
-		n = LLLinkGetData(searchNodes.link.next, StripNode, inlist);
-		n->inlist.remove();
-		edgetype = !edgetype;
+		lastrightturn = rightturn;
 	}
+	return len;
 }
 
 static void
-resetGraph(StripMesh *sm)
+pushBucket(StripMesh *sm, int32 i)
 {
-	StripNode *n;
-	for(int32 i = 0; i < sm->numNodes; i++){
-		n = &sm->nodes[i];
-		n->visited = 0;
-		n->stripVisited = 0;
-	}
+	int32 b = sm->nodes[i].numFree;
+	sm->buckets[b][sm->bucketSize[b]++] = i;
 }
 
-static StripNode*
-walkStrip(StripMesh *sm, StripNode *start)
+/* Take a node out of the pool of free nodes */
+static void
+claimNode(StripMesh *sm, StripNode *n)
 {
-	StripNode *n, *nn;
-	int32 last;
-
-//trace("stripend: ");
-//printNode(sm, start);
-
-	n = start;
-	last = -1;
-	for(;;n = nn){
-		n->visited = 0;
-		n->stripVisited = 0;
-		if(n->isEnd)
-			n->inlist.remove();
-		n->isEnd = 0;
-
-		if(IsEnd(n) && n != start)
-			return n;
-
-		/* find next node */
-		nn = nil;
-		for(int32 i = 0; i < 3; i++){
-			if(!n->e[i].isStrip || i == last)
-				continue;
-			nn = &sm->nodes[n->e[i].node];
-			last = n->e[i].otherEdge;
-			nn->stripId = n->stripId;
-			break;
-		}
-//trace("    next: ");
-//printNode(sm, nn);
-		if(nn == nil)
-			return nil;
+	StripNode *nn;
+	for(int32 i = 0; i < 3; i++){
+		if(!n->e[i].isConnected)
+			continue;
+		nn = &sm->nodes[n->e[i].node];
+		if(nn->stripId >= 0)
+			continue;
+		nn->numFree--;
+		pushBucket(sm, nn - sm->nodes);
+		sm->frontier[sm->frontierSize++] = nn - sm->nodes;
 	}
 }
 
-static void
-applyTunnel(StripMesh *sm, StripNode *end, StripNode *start)
+/* Pick the next strip start. Free nodes next to the last strip
+ * come first for locality, otherwise the node with the fewest
+ * free neighbours, the usual greedy heuristic that avoids
+ * leaving isolated triangles behind. */
+static StripNode*
+findStart(StripMesh *sm)
 {
-	LinkList tmplist;
-	StripNode *n, *nn;
-
-	for(n = end; n != start; n = &sm->nodes[n->e[n->parent].node]){
-//trace("	");
-//printNode(sm, n);
-		complementEdge(sm, &n->e[n->parent]);
+	StripNode *n, *best;
+	int32 i, b;
+
+	best = nil;
+	for(i = 0; i < sm->frontierSize; i++){
+		n = &sm->nodes[sm->frontier[i]];
+		if(n->stripId < 0 && (best == nil || n->numFree < best->numFree))
+			best = n;
 	}
-//trace("	");
-//printNode(sm, start);
-
-//printSmesh(sm);
-//trace("-------\n");
-	tmplist.init();
-	while(!sm->endNodes.isEmpty()){
-		n = LLLinkGetData(sm->endNodes.link.next, StripNode, inlist);
-		/* take out of end list */
-		n->inlist.remove();
-		n->isEnd = 0;
-		/* no longer an end node */
-		if(!IsEnd(n))
-			continue;
-		// TODO: only walk strip if it was touched
-		/* set new id, walk strip and find other end */
-		n->stripId = n - sm->nodes;
-		nn = walkStrip(sm, n);
-		tmplist.append(&n->inlist);
-		n->isEnd = 1;
-		if(nn && n != nn){
-			tmplist.append(&nn->inlist);
-			nn->isEnd = 1;
+	sm->frontierSize = 0;
+	if(best)
+		return best;
+
+	for(b = 0; b < 4; b++)
+		while(sm->bucketSize[b] > 0){
+			n = &sm->nodes[sm->buckets[b][--sm->bucketSize[b]]];
+			if(n->stripId < 0 && n->numFree == b)
+				return n;
 		}
-	}
-	/* Move new end nodes to the real list. */
-	sm->endNodes = tmplist;
-	sm->endNodes.link.next->prev = &sm->endNodes.link;
-	sm->endNodes.link.prev->next = &sm->endNodes.link;
+	return nil;
 }
 
 static void
-tunnel(StripMesh *sm)
+buildStrips(StripMesh *sm)
 {
 	StripNode *n, *nn;
+	int32 i, j, len, swaps;
+	int32 bestj, bestlen, bestswaps;
+
+	for(i = 0; i < 4; i++)
+		sm->bucketSize[i] = 0;
+	/* push in reverse so equal nodes come out in mesh order */
+	for(i = sm->numNodes-1; i >= 0; i--)
+		pushBucket(sm, i);
+	sm->frontierSize = 0;
+	sm->curStamp = 0;
+	for(i = 0; i < sm->numNodes; i++)
+		sm->stamp[i] = 0;
+
+	while(n = findStart(sm), n != nil){
+		n->stripId = n - sm->nodes;
+		if(numConnections(n) == 0){
+			sm->loneNodes.append(&n->inlist);
+			continue;
+		}
+		sm->endNodes.append(&n->inlist);
 
-again:
-	FORLIST(lnk, sm->endNodes){
-		n = LLLinkGetData(lnk, StripNode, inlist);
-//		trace("searching %p %d\n", n, numStripEdges(n));
-		nn = findTunnel(sm, n);
-//		trace("          %p %p\n", n, nn);
-
-		if(nn){
-			applyTunnel(sm, nn, n);
-			resetGraph(sm);
-			/* applyTunnel changes sm->endNodes, so we have to
-			 * jump out of the loop. */
-			goto again;
+		/* try all exits, take the longest strip */
+		bestj = -1;
+		bestlen = 0;
+		bestswaps = 0;
+		for(j = 0; j < 3; j++){
+			sm->curStamp++;
+			if(!isFree(sm, n, j))
+				continue;
+			len = walkStrip(sm, n, j, 0, &swaps);
+			if(len > bestlen || (len == bestlen && swaps < bestswaps)){
+				bestj = j;
+				bestlen = len;
+				bestswaps = swaps;
+			}
+		}
+
+		claimNode(sm, n);
+		if(bestj < 0)
+			continue;
+		walkStrip(sm, n, bestj, 1, &swaps);
+		/* claim all nodes of the new strip */
+		nn = n;
+		j = bestj;
+		for(;;){
+			i = nn->e[j].otherEdge;
+			nn = &sm->nodes[nn->e[j].node];
+			claimNode(sm, nn);
+			for(j = 0; j < 3; j++)
+				if(nn->e[j].isStrip && j != i)
+					break;
+			if(j == 3)
+				break;
 		}
-		resetGraph(sm);
 	}
-	trace("tunneling done!\n");
 }
 
 /* Get next edge in strip.
@@ -437,11 +401,6 @@ getNextEdge(StripNode *n, int32 last)
 	return -1;
 }
 
-#define NEXT(x) (((x)+1) % 3)
-#define PREV(x) (((x)+2) % 3)
-#define RIGHT(x) NEXT(x)
-#define LEFT(x) PREV(x)
-
 /* Generate mesh indices for all strips in a StripMesh */
 static void
 makeMesh(StripMesh *sm, Mesh *m)
@@ -452,9 +411,10 @@ makeMesh(StripMesh *sm, Mesh *m)
 	int32 even;
 	StripNode *n;
 
-	/* three indices + two for stitch per triangle must be enough */
-	m->indices = rwNewT(uint16, sm->numNodes*5, MEMDUR_FUNCTION | ID_GEOMETRY);
-	memset(m->indices, 0xFF, sm->numNodes*5*sizeof(uint16));
+	/* three indices + two for stitch per triangle must be enough,
+	 * always 32 bit here, buildTristrips converts when copying */
+	m->indices32 = rwNewT(uint32, sm->numNodes*5, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(m->indices32, 0xFF, sm->numNodes*5*sizeof(uint32));
 
 	even = 1;
 	FORLIST(lnk, sm->endNodes){
@@ -477,13 +437,13 @@ makeMesh(StripMesh *sm, Mesh *m)
 		if(even){
 			/* Start with a right turn */
 			i = LEFT(j);
-			m->indices[m->numIndices++] = n->v[i];
-			m->indices[m->numIndices++] = n->v[NEXT(i)];
+			m->indices32[m->numIndices++] = n->v[i];
+			m->indices32[m->numIndices++] = n->v[NEXT(i)];
 		}else{
 			/* Start with a left turn */
 			i = RIGHT(j);
-			m->indices[m->numIndices++] = n->v[NEXT(i)];
-			m->indices[m->numIndices++] = n->v[i];
+			m->indices32[m->numIndices++] = n->v[NEXT(i)];
+			m->indices32[m->numIndices++] = n->v[i];
 		}
 trace("\nstart %d %d\n", numStripEdges(n), m->numIndices-2);
 		lastrightturn = -1;
@@ -492,7 +452,7 @@ trace("\nstart %d %d\n", numStripEdges(n), m->numIndices-2);
 			rightturn = RIGHT(i) == j;
 			if(rightturn == lastrightturn){
 				// insert a swap if we're not alternating
-				m->indices[m->numIndices] = m->indices[m->numIndices-2];
+				m->indices32[m->numIndices] = m->indices32[m->numIndices-2];
 trace("SWAP\n");
 				m->numIndices++;
 				even = !even;
@@ -500,9 +460,9 @@ trace("SWAP\n");
 trace("%d:%d%c %d %d %d\n", n-sm->nodes, m->numIndices, even ? ' ' : '.', n->v[0], n->v[1], n->v[2]);
 			lastrightturn = rightturn;
 			if(rightturn)
-				m->indices[m->numIndices++] = n->v[NEXT(j)];
+				m->indices32[m->numIndices++] = n->v[NEXT(j)];
 			else
-				m->indices[m->numIndices++] = n->v[j];
+				m->indices32[m->numIndices++] = n->v[j];
 			even = !even;
 
 			/* go to next triangle */
@@ -513,12 +473,12 @@ trace("%d:%d%c %d %d %d\n", n-sm->nodes, m->numIndices, even ? ' ' : '.', n->v[0
 
 		/* finish strip */
 trace("%d:%d%c %d %d %d\nend\n", n-sm->nodes, m->numIndices, even ? ' ' : '.', n->v[0], n->v[1], n->v[2]);
-		m->indices[m->numIndices++] = n->v[LEFT(i)];
+		m->indices32[m->numIndices++] = n->v[LEFT(i)];
 		even = !even;
 		if(seam){
-			m->indices[seam] = m->indices[seam-1];
-			m->indices[seam+1] = m->indices[seam+2];
-trace("STITCH %d: %d %d\n", seam, m->indices[seam], m->indices[seam+1]);
+			m->indices32[seam] = m->indices32[seam-1];
+			m->indices32[seam+1] = m->indices32[seam+2];
+trace("STITCH %d: %d %d\n", seam, m->indices32[seam], m->indices32[seam+1]);
 		}
 	}
 
@@ -528,25 +488,25 @@ trace("STITCH %d: %d %d\n", seam, m->indices[seam], m->indices[seam+1]);
 		if(numStripEdges(n) != 0)
 			continue;
 		if(m->numIndices != 0){
-			m->indices[m->numIndices] = m->indices[m->numIndices-1];
+			m->indices32[m->numIndices] = m->indices32[m->numIndices-1];
 			m->numIndices++;
-			m->indices[m->numIndices++] = n->v[!even];
+			m->indices32[m->numIndices++] = n->v[!even];
 		}
-		m->indices[m->numIndices++] = n->v[!even];
-		m->indices[m->numIndices++] = n->v[even];
-		m->indices[m->numIndices++] = n->v[2];
+		m->indices32[m->numIndices++] = n->v[!even];
+		m->indices32[m->numIndices++] = n->v[even];
+		m->indices32[m->numIndices++] = n->v[2];
 		even = !even;
 	}
 	FORLIST(lnk, sm->loneNodes){
 		n = LLLinkGetData(lnk, StripNode, inlist);
 		if(m->numIndices != 0){
-			m->indices[m->numIndices] = m->indices[m->numIndices-1];
+			m->indices32[m->numIndices] = m->indices32[m->numIndices-1];
 			m->numIndices++;
-			m->indices[m->numIndices++] = n->v[!even];
+			m->indices32[m->numIndices++] = n->v[!even];
 		}
-		m->indices[m->numIndices++] = n->v[!even];
-		m->indices[m->numIndices++] = n->v[even];
-		m->indices[m->numIndices++] = n->v[2];
+		m->indices32[m->numIndices++] = n->v[!even];
+		m->indices32[m->numIndices++] = n->v[even];
+		m->indices32[m->numIndices++] = n->v[2];
 		even = !even;
 	}
 }
@@ -556,14 +516,14 @@ static void verifyMesh(Geometry *geo);
 /*
  * For each material:
  * 1. build dual graph (collectFaces, connectNodes)
- * 2. make some simple strip (buildStrips)
- * 3. apply tunnel operator (tunnel)
+ * 2. greedily grow strips from nodes with few free neighbours,
+ *    starting next to the last strip when possible (buildStrips)
  */
 void
 Geometry::buildTristrips(void)
 {
 	int32 i;
-	uint16 *indices;
+	uint32 j;
 	MeshHeader *header;
 	Mesh *ms, *md;
 	StripMesh smesh;
@@ -573,8 +533,18 @@ Geometry::buildTristrips(void)
 	this->allocateMeshes(matList.numMaterials, 0, 1);
 
 	smesh.nodes = rwNewT(StripNode, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	i = 16;
+	while(i < this->numTriangles*3)
+		i *= 2;
+	smesh.hashHeads = rwNewT(int32, i, MEMDUR_FUNCTION | ID_GEOMETRY);
+	smesh.hashNext = rwNewT(int32, this->numTriangles*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	/* every node can be pushed once initially and once per lost neighbour */
+	for(i = 0; i < 4; i++)
+		smesh.buckets[i] = rwNewT(int32, this->numTriangles*4, MEMDUR_FUNCTION | ID_GEOMETRY);
+	smesh.frontier = rwNewT(int32, this->numTriangles*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	smesh.stamp = rwNewT(int32, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
 	ms = this->meshHeader->getMeshes();
-	for(int32 i = 0; i < this->matList.numMaterials; i++){
+	for(i = 0; i < this->matList.numMaterials; i++){
 		smesh.loneNodes.init();
 		smesh.endNodes.init();
 		collectFaces(this, &smesh, i);
@@ -584,17 +554,18 @@ printSmesh(&smesh);
 //trace("-------\n");
 //printLone(&smesh);
 //trace("-------\n");
-//printEnds(&smesh);
-//trace("-------\n");
-		// TODO: make this work
-//		tunnel(&smesh);
-//trace("-------\n");
 //printEnds(&smesh);
 
 		ms[i].material = this->matList.materials[i];
 		makeMesh(&smesh, &ms[i]);
 		this->meshHeader->totalIndices += ms[i].numIndices;
 	}
+	rwFree(smesh.stamp);
+	rwFree(smesh.frontier);
+	for(i = 0; i < 4; i++)
+		rwFree(smesh.buckets[i]);
+	rwFree(smesh.hashNext);
+	rwFree(smesh.hashHeads);
 	rwFree(smesh.nodes);
 
 	/* Now re-allocate and copy data */
@@ -603,48 +574,85 @@ printSmesh(&smesh);
 	this->allocateMeshes(header->numMeshes, header->totalIndices, 0);
 	this->meshHeader->flags = MeshHeader::TRISTRIP;
 	md = this->meshHeader->getMeshes();
-	indices = md->indices;
 	for(i = 0; i < header->numMeshes; i++){
 		md[i].material = ms[i].material;
 		md[i].numIndices = ms[i].numIndices;
-		md[i].indices = indices;
-		indices += md[i].numIndices;
-		memcpy(md[i].indices, ms[i].indices, md[i].numIndices*sizeof(uint16));
-		rwFree(ms[i].indices);
+	}
+	this->meshHeader->setupIndices();
+	for(i = 0; i < header->numMeshes; i++){
+		for(j = 0; j < md[i].numIndices; j++)
+			this->meshHeader->setIndex(&md[i], j, ms[i].indices32[j]);
+		rwFree(ms[i].indices32);
 	}
 	rwFree(header);
 
 	verifyMesh(this);
 }
 
-/* Check that tristripped mesh and geometry triangles are actually the same. */
+/* Rotate a triangle so the smallest index comes first, keeps the winding */
+static void
+canonTriangle(uint32 *v, uint32 a, uint32 b, uint32 c)
+{
+	if(a < b && a < c){
+		v[0] = a; v[1] = b; v[2] = c;
+	}else if(b < c){
+		v[0] = b; v[1] = c; v[2] = a;
+	}else{
+		v[0] = c; v[1] = a; v[2] = b;
+	}
+}
+
+static uint32
+hashTriangle(uint32 *v, int32 m)
+{
+	return (v[0]*0x9E3779B1u) ^ (v[1]*0x85EBCA77u) ^ (v[2]*0xC2B2AE3Du) ^ m;
+}
+
+/* Check that tristripped mesh and geometry triangles are actually the same.
+ * Geometry triangles are hashed so this stays linear. */
 static void
 verifyMesh(Geometry *geo)
 {
 	int32 i, k;
 	uint32 j;
-	int32 x;
-	int32 a, b, c, m;
+	int32 x, m, hashSize;
+	uint32 a, b, c, h;
+	uint32 v[3], tv[3];
 	Mesh *mesh;
-	Triangle *t;
+	Triangle32 t;
+	int32 *heads, *next;
 	uint8 *seen;
 
+	hashSize = 16;
+	while(hashSize < geo->numTriangles*2)
+		hashSize *= 2;
+	heads = rwNewT(int32, hashSize, MEMDUR_FUNCTION | ID_GEOMETRY);
+	next = rwNewT(int32, geo->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
 	seen = rwNewT(uint8, geo->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
 	memset(seen, 0, geo->numTriangles);
+	for(i = 0; i < hashSize; i++)
+		heads[i] = -1;
+	for(i = 0; i < geo->numTriangles; i++){
+		t = geo->getTriangle(i);
+		canonTriangle(v, t.v[0], t.v[1], t.v[2]);
+		h = hashTriangle(v, t.matId) & (hashSize-1);
+		next[i] = heads[h];
+		heads[h] = i;
+	}
 
 	mesh = geo->meshHeader->getMeshes();
 	for(i = 0; i < geo->meshHeader->numMeshes; i++){
 		m = geo->matList.findIndex(mesh->material);
 		x = 0;
-		for(j = 0; j < mesh->numIndices-2; j++){
-			a = mesh->indices[j+x];
+		for(j = 0; j+2 < mesh->numIndices; j++){
+			a = geo->meshHeader->getIndex(mesh, j+x);
 			x = !x;
-			b = mesh->indices[j+x];
-			c = mesh->indices[j+2];
-			if(a >= geo->numVertices ||
-			   b >= geo->numVertices ||
-			   c >= geo->numVertices){
-				fprintf(stderr, "triangle %d %d %d out of range (%d)\n", a, b, c, geo->numVertices);
+			b = geo->meshHeader->getIndex(mesh, j+x);
+			c = geo->meshHeader->getIndex(mesh, j+2);
+			if(a >= (uint32)geo->numVertices ||
+			   b >= (uint32)geo->numVertices ||
+			   c >= (uint32)geo->numVertices){
+				fprintf(stderr, "triangle %u %u %u out of range (%d)\n", a, b, c, geo->numVertices);
 				goto loss;
 			}
 			if(a == b || a == c || b == c)
@@ -652,12 +660,14 @@ verifyMesh(Geometry *geo)
 trace("%d %d %d\n", a, b, c);
 
 			/* now that we have a triangle, try to find it */
-			for(k = 0; k < geo->numTriangles; k++){
-				t = &geo->triangles[k];
-				if(seen[k] || t->matId != m) continue;
-				if((t->v[0] == a && t->v[1] == b && t->v[2] == c) ||
-				   (t->v[1] == a && t->v[2] == b && t->v[0] == c) ||
-				   (t->v[2] == a && t->v[0] == b && t->v[1] == c)){
+			canonTriangle(v, a, b, c);
+			h = hashTriangle(v, m) & (hashSize-1);
+			for(k = heads[h]; k >= 0; k = next[k]){
+				if(seen[k]) continue;
+				t = geo->getTriangle(k);
+				if(t.matId != m) continue;
+				canonTriangle(tv, t.v[0], t.v[1], t.v[2]);
+				if(tv[0] == v[0] && tv[1] == v[1] && tv[2] == v[2]){
 					seen[k] = 1;
 					goto found;
 				}
@@ -677,6 +687,8 @@ trace("%d %d %d\n", a, b, c);
 		}
 
 	rwFree(seen);
+	rwFree(next);
+	rwFree(heads);
 }
 
 }
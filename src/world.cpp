@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -16,6 +17,117 @@ namespace rw {
 
 int32 World::numAllocated = 0;
 
+static void
+initSector(WorldSector *s, WorldSector *parent)
+{
+	s->parent = parent;
+	for(int32 i = 0; i < 8; i++)
+		s->children[i] = nil;
+	s->numChildren = 0;
+	s->atomics.init();
+	s->lights.init();
+}
+
+void
+WorldSector::getBounds(BBox *box) const
+{
+	float32 r = this->halfSize*2.0f;
+	box->inf.set(this->center.x - r, this->center.y - r, this->center.z - r);
+	box->sup.set(this->center.x + r, this->center.y + r, this->center.z + r);
+}
+
+// Deepest sector that can hold the sphere, sectors are created on the way
+static WorldSector*
+findSector(WorldSector *s, const Sphere *sph)
+{
+	V3d d;
+	float32 half;
+	int32 depth, i;
+
+	for(depth = 0; depth < World::MAXSECTORDEPTH; depth++){
+		half = s->halfSize*0.5f;
+		if(sph->radius > half)
+			break;
+		d = sub(sph->center, s->center);
+		// only possible for the root
+		if(fabs(d.x) > s->halfSize || fabs(d.y) > s->halfSize || fabs(d.z) > s->halfSize)
+			break;
+		i = (d.x >= 0.0f) | (d.y >= 0.0f)<<1 | (d.z >= 0.0f)<<2;
+		if(s->children[i] == nil){
+			WorldSector *c = rwNewT(WorldSector, 1, MEMDUR_EVENT | ID_WORLD);
+			c->center.x = s->center.x + (i & 1 ? half : -half);
+			c->center.y = s->center.y + (i & 2 ? half : -half);
+			c->center.z = s->center.z + (i & 4 ? half : -half);
+			c->halfSize = half;
+			initSector(c, s);
+			s->children[i] = c;
+			s->numChildren++;
+		}
+		s = s->children[i];
+	}
+	return s;
+}
+
+// Free empty leaves up the tree
+static void
+pruneSector(WorldSector *s)
+{
+	WorldSector *parent;
+	int32 i;
+	while(s->parent && s->numChildren == 0 &&
+	      s->atomics.isEmpty() && s->lights.isEmpty()){
+		parent = s->parent;
+		for(i = 0; i < 8; i++)
+			if(parent->children[i] == s){
+				parent->children[i] = nil;
+				parent->numChildren--;
+			}
+		rwFree(s);
+		s = parent;
+	}
+}
+
+static void
+unlinkAtomic(Atomic *atomic)
+{
+	if(atomic->sector == nil)
+		return;
+	atomic->inSector.remove();
+	pruneSector(atomic->sector);
+	atomic->sector = nil;
+}
+
+static void
+unlinkLight(Light *light)
+{
+	if(light->sector == nil)
+		return;
+	light->inSector.remove();
+	pruneSector(light->sector);
+	light->sector = nil;
+}
+
+static void
+getLightSphere(Light *light, Sphere *s)
+{
+	s->center = light->getFrame()->getLTM()->pos;
+	s->radius = light->radius;
+}
+
+static bool32
+spheresIntersect(const Sphere *s1, const Sphere *s2)
+{
+	return length(sub(s1->center, s2->center)) < s1->radius + s2->radius;
+}
+
+static void
+lightChanged(World *world, Light *light)
+{
+	uint32 stamp = ++world->lightStamp;
+	world->lightHistory[stamp % World::LIGHTHISTORY].light = light;
+	world->lightHistory[stamp % World::LIGHTHISTORY].stamp = stamp;
+}
+
 PluginList World::s_plglist(sizeof(World));
 
 World*
@@ -31,14 +143,41 @@ World::create(BBox *bbox)
 	world->localLights.init();
 	world->globalLights.init();
 	world->clumps.init();
+	world->rootSector = rwNewT(WorldSector, 1, MEMDUR_EVENT | ID_WORLD);
+	if(bbox){
+		world->rootSector->center = scale(add(bbox->inf, bbox->sup), 0.5f);
+		V3d size = sub(bbox->sup, bbox->inf);
+		world->rootSector->halfSize = fmaxf(size.x, fmaxf(size.y, size.z))*0.5f;
+	}else{
+		world->rootSector->center.set(0.0f, 0.0f, 0.0f);
+		world->rootSector->halfSize = 8192.0f;
+	}
+	initSector(world->rootSector, nil);
+	world->lightStamp = 1;
+	world->lightResetStamp = 1;
+	memset(world->lightHistory, 0, sizeof(world->lightHistory));
 	s_plglist.construct(world);
 	return world;
 }
 
+static void
+destroySector(WorldSector *s)
+{
+	FORLIST(lnk, s->atomics)
+		Atomic::fromSector(lnk)->sector = nil;
+	FORLIST(lnk, s->lights)
+		Light::fromSector(lnk)->sector = nil;
+	for(int32 i = 0; i < 8; i++)
+		if(s->children[i])
+			destroySector(s->children[i]);
+	rwFree(s);
+}
+
 void
 World::destroy(void)
 {
 	s_plglist.destruct(this);
+	destroySector(this->rootSector);
 	rwFree(this);
 	numAllocated--;
 }
@@ -52,8 +191,10 @@ World::addLight(Light *light)
 		this->globalLights.append(&light->inWorld);
 	}else{
 		this->localLights.append(&light->inWorld);
-		if(light->getFrame())
+		if(light->getFrame()){
+			this->updateLight(light);
 			light->getFrame()->updateObjects();
+		}
 	}
 }
 
@@ -62,9 +203,36 @@ World::removeLight(Light *light)
 {
 	assert(light->world == this);
 	light->inWorld.remove();
+	if(light->getType() >= Light::POINT){
+		unlinkLight(light);
+		// cached lists may point to it
+		this->lightResetStamp = ++this->lightStamp;
+	}
 	light->world = nil;
 }
 
+void
+World::updateLight(Light *light)
+{
+	WorldSector *s, *old;
+	Sphere sph;
+	if(light->getFrame() == nil)
+		return;
+	getLightSphere(light, &sph);
+	s = findSector(this->rootSector, &sph);
+	old = light->sector;
+	if(s != old){
+		// link first, s may be an ancestor of old that pruning would free
+		if(old)
+			light->inSector.remove();
+		light->sector = s;
+		s->lights.append(&light->inSector);
+		if(old)
+			pruneSector(old);
+	}
+	lightChanged(this, light);
+}
+
 void
 World::addCamera(Camera *cam)
 {
@@ -86,17 +254,40 @@ World::addAtomic(Atomic *atomic)
 {
 	assert(atomic->world == nil);
 	atomic->world = this;
-	if(atomic->getFrame())
+	if(atomic->getFrame()){
+		this->updateAtomic(atomic);
 		atomic->getFrame()->updateObjects();
+	}
 }
 
 void
 World::removeAtomic(Atomic *atomic)
 {
 	assert(atomic->world == this);
+	unlinkAtomic(atomic);
+	atomic->lightStamp = 0;
 	atomic->world = nil;
 }
 
+void
+World::updateAtomic(Atomic *atomic)
+{
+	WorldSector *s, *old;
+	if(atomic->getFrame() == nil)
+		return;
+	s = findSector(this->rootSector, atomic->getWorldBoundingSphere());
+	old = atomic->sector;
+	if(s == old)
+		return;
+	// link first, s may be an ancestor of old that pruning would free
+	if(old)
+		atomic->inSector.remove();
+	atomic->sector = s;
+	s->atomics.append(&atomic->inSector);
+	if(old)
+		pruneSector(old);
+}
+
 void
 World::addClump(Clump *clump)
 {
@@ -130,12 +321,244 @@ World::removeClump(Clump *clump)
 	clump->world = nil;
 }
 
+static bool32
+sphereIntersectsBox(const Sphere *s, const BBox *box)
+{
+	float32 d, dist = 0.0f;
+	d = s->center.x < box->inf.x ? box->inf.x - s->center.x :
+	    s->center.x > box->sup.x ? s->center.x - box->sup.x : 0.0f;
+	dist += d*d;
+	d = s->center.y < box->inf.y ? box->inf.y - s->center.y :
+	    s->center.y > box->sup.y ? s->center.y - box->sup.y : 0.0f;
+	dist += d*d;
+	d = s->center.z < box->inf.z ? box->inf.z - s->center.z :
+	    s->center.z > box->sup.z ? s->center.z - box->sup.z : 0.0f;
+	dist += d*d;
+	return dist <= s->radius*s->radius;
+}
+
+static bool32
+boxesIntersect(const BBox *a, const BBox *b)
+{
+	return a->inf.x <= b->sup.x && a->sup.x >= b->inf.x &&
+	       a->inf.y <= b->sup.y && a->sup.y >= b->inf.y &&
+	       a->inf.z <= b->sup.z && a->sup.z >= b->inf.z;
+}
+
+// Region queries visit sectors whose loose bounds touch the region.
+// The root is always visited since it keeps atomics outside the world.
+// Return 0 to stop.
+static bool32
+queryBox(WorldSector *s, const BBox *box, World::AtomicCallback cb, void *data)
+{
+	BBox bounds;
+	Atomic *a;
+	if(s->parent){
+		s->getBounds(&bounds);
+		if(!boxesIntersect(&bounds, box))
+			return 1;
+	}
+	FORLIST(lnk, s->atomics){
+		a = Atomic::fromSector(lnk);
+		if(sphereIntersectsBox(a->getWorldBoundingSphere(), box) &&
+		   cb(a, data) == nil)
+			return 0;
+	}
+	for(int32 i = 0; i < 8; i++)
+		if(s->children[i] && !queryBox(s->children[i], box, cb, data))
+			return 0;
+	return 1;
+}
+
+static bool32
+querySphere(WorldSector *s, const Sphere *sph, World::AtomicCallback cb, void *data)
+{
+	BBox bounds;
+	Atomic *a;
+	Sphere *as;
+	float32 r;
+	if(s->parent){
+		s->getBounds(&bounds);
+		if(!sphereIntersectsBox(sph, &bounds))
+			return 1;
+	}
+	FORLIST(lnk, s->atomics){
+		a = Atomic::fromSector(lnk);
+		as = a->getWorldBoundingSphere();
+		r = as->radius + sph->radius;
+		if(length(sub(as->center, sph->center)) <= r &&
+		   cb(a, data) == nil)
+			return 0;
+	}
+	for(int32 i = 0; i < 8; i++)
+		if(s->children[i] && !querySphere(s->children[i], sph, cb, data))
+			return 0;
+	return 1;
+}
+
+static bool32
+queryFrustumBatched(WorldSector *s, Camera *cam, World::AtomicCallback cb, void *data)
+{
+	enum { CHUNK = 256 };
+	Atomic *atomics[CHUNK];
+	int32 i, n;
+
+	n = 0;
+	FORLIST(lnk, s->atomics){
+		atomics[n++] = Atomic::fromSector(lnk);
+		if(n == CHUNK){
+			n = cam->cullAtomics(atomics, n);
+			for(i = 0; i < n; i++)
+				if(cb(atomics[i], data) == nil)
+					return 0;
+			n = 0;
+		}
+	}
+	n = cam->cullAtomics(atomics, n);
+	for(i = 0; i < n; i++)
+		if(cb(atomics[i], data) == nil)
+			return 0;
+	return 1;
+}
+
+// Sectors completely inside the frustum need no more tests
+static bool32
+queryFrustum(WorldSector *s, Camera *cam, bool32 inside, World::AtomicCallback cb, void *data)
+{
+	BBox bounds;
+	Atomic *a;
+	if(!inside && s->parent){
+		s->getBounds(&bounds);
+		switch(cam->frustumTestBox(&bounds)){
+		case Camera::BOXOUTSIDE:
+			return 1;
+		case Camera::BOXINSIDE:
+			inside = 1;
+			break;
+		}
+	}
+	if(batchFrustumCulling && !inside){
+		if(!queryFrustumBatched(s, cam, cb, data))
+			return 0;
+	}else{
+		FORLIST(lnk, s->atomics){
+			a = Atomic::fromSector(lnk);
+			if(!inside &&
+			   cam->frustumTestSphere(a->getWorldBoundingSphere()) == Camera::SPHEREOUTSIDE)
+				continue;
+			if(cb(a, data) == nil)
+				return 0;
+		}
+	}
+	for(int32 i = 0; i < 8; i++)
+		if(s->children[i] && !queryFrustum(s->children[i], cam, inside, cb, data))
+			return 0;
+	return 1;
+}
+
+void
+World::forAllAtomicsInBox(const BBox *box, AtomicCallback cb, void *data)
+{
+	queryBox(this->rootSector, box, cb, data);
+}
+
+void
+World::forAllAtomicsInSphere(const Sphere *sphere, AtomicCallback cb, void *data)
+{
+	querySphere(this->rootSector, sphere, cb, data);
+}
+
+void
+World::forAllVisibleAtomics(Camera *cam, AtomicCallback cb, void *data)
+{
+	queryFrustum(this->rootSector, cam, 0, cb, data);
+}
+
+static Atomic*
+renderAtomicCB(Atomic *atomic, void*)
+{
+	if(atomic->object.object.flags & Atomic::RENDER)
+		atomic->render();
+	return atomic;
+}
+
 void
 World::render(void)
 {
-	// this is very wrong, we really want world sectors
-	FORLIST(lnk, this->clumps)
-		Clump::fromWorld(lnk)->render();
+	Camera *cam = (Camera*)engine->currentCamera;
+	if(cam == nil){
+		FORLIST(lnk, this->clumps)
+			Clump::fromWorld(lnk)->render();
+		return;
+	}
+	this->forAllVisibleAtomics(cam, renderAtomicCB, nil);
+}
+
+static void
+collectLights(WorldSector *s, const Sphere *sph, Atomic *atomic)
+{
+	BBox bounds;
+	Sphere lsph;
+	Light *l;
+	if(s->parent){
+		s->getBounds(&bounds);
+		if(!sphereIntersectsBox(sph, &bounds))
+			return;
+	}
+	FORLIST(lnk, s->lights){
+		l = Light::fromSector(lnk);
+		if(l->getFrame() == nil)
+			continue;
+		getLightSphere(l, &lsph);
+		if(!spheresIntersect(sph, &lsph))
+			continue;
+		if(atomic->numCachedLights >= atomic->cachedLightSpace){
+			atomic->cachedLightSpace += 8;
+			atomic->cachedLights = rwResizeT(Light*, atomic->cachedLights,
+				atomic->cachedLightSpace, MEMDUR_EVENT | ID_ATOMIC);
+		}
+		atomic->cachedLights[atomic->numCachedLights++] = l;
+	}
+	for(int32 i = 0; i < 8; i++)
+		if(s->children[i])
+			collectLights(s->children[i], sph, atomic);
+}
+
+// Find all local lights touching the atomic, independent of their flags
+static void
+cacheLights(World *world, Atomic *atomic)
+{
+	atomic->numCachedLights = 0;
+	collectLights(world->rootSector, atomic->getWorldBoundingSphere(), atomic);
+	atomic->lightStamp = world->lightStamp;
+}
+
+static bool32
+isLightCacheValid(World *world, Atomic *atomic)
+{
+	Sphere lsph;
+	Light *l;
+	uint32 stamp;
+	int32 i;
+
+	if(atomic->lightStamp == 0 || atomic->lightStamp < world->lightResetStamp)
+		return 0;
+	if(world->lightStamp - atomic->lightStamp > World::LIGHTHISTORY)
+		return 0;
+	// Lights that changed since may have come closer or moved away
+	for(stamp = atomic->lightStamp+1; stamp <= world->lightStamp; stamp++){
+		l = world->lightHistory[stamp % World::LIGHTHISTORY].light;
+		for(i = 0; i < atomic->numCachedLights; i++)
+			if(atomic->cachedLights[i] == l)
+				return 0;
+		if(l->getFrame() == nil)
+			continue;
+		getLightSphere(l, &lsph);
+		if(spheresIntersect(atomic->getWorldBoundingSphere(), &lsph))
+			return 0;
+	}
+	atomic->lightStamp = world->lightStamp;
+	return 1;
 }
 
 // Find lights that illuminate an atomic
@@ -178,19 +601,14 @@ World::enumerateLights(Atomic *atomic, WorldLights *lightData)
 	if(!normals)
 		return;
 
-	// TODO: for this we would use an atomic's world sectors, but we don't have those yet
-	FORLIST(lnk, this->localLights){
+	if(!isLightCacheValid(this, atomic))
+		cacheLights(this, atomic);
+
+	for(int32 i = 0; i < atomic->numCachedLights; i++){
 		if(lightData->numLocals >= maxLocals)
 			return;
-
-		Light *l = Light::fromWorld(lnk);
-		if((l->getFlags() & Light::LIGHTATOMICS) == 0)
-			continue;
-
-		// check if spheres are intersecting
-		Sphere *atomsphere = atomic->getWorldBoundingSphere();
-		V3d dist = sub(l->getFrame()->getLTM()->pos, atomsphere->center);
-		if(length(dist) < atomsphere->radius + l->radius)
+		Light *l = atomic->cachedLights[i];
+		if(l->getFlags() & Light::LIGHTATOMICS)
 			lightData->locals[lightData->numLocals++] = l;
 	}
 }
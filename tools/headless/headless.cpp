@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <rw.h>
+
+// Checks of the parts of librw that don't need a window.
+// Needs the null platform, exits with 1 if any check fails.
+
+using namespace rw;
+
+static int numFailed;
+
+static void
+check(bool ok, const char *what)
+{
+	printf("%-6s %s\n", ok ? "ok" : "FAILED", what);
+	if(!ok)
+		numFailed++;
+}
+
+static bool
+testBox(OcclusionBuffer *ob, float32 x, float32 y, float32 z, float32 size)
+{
+	BBox box;
+	box.inf.set(x-size, y-size, z-size);
+	box.sup.set(x+size, y+size, z+size);
+	return !!ob->testBox(&box);
+}
+
+// A 10x10 wall 10 units in front of the camera
+static void
+checkOcclusion(void)
+{
+	Geometry *geo = Geometry::create(4, 2, 0);
+	V3d *v = geo->morphTargets[0].vertices;
+	v[0].set(-5.0f, -5.0f, 0.0f);
+	v[1].set( 5.0f, -5.0f, 0.0f);
+	v[2].set( 5.0f,  5.0f, 0.0f);
+	v[3].set(-5.0f,  5.0f, 0.0f);
+	Triangle32 t0 = { { 0, 1, 2 }, 0 };
+	Triangle32 t1 = { { 0, 2, 3 }, 0 };
+	geo->setTriangle(0, t0);
+	geo->setTriangle(1, t1);
+	geo->calculateBoundingSphere();
+
+	Atomic *wall = Atomic::create();
+	wall->setGeometry(geo, 0);
+	geo->destroy();
+	Frame *frame = Frame::create();
+	V3d pos = { 0.0f, 0.0f, 10.0f };
+	frame->translate(&pos, COMBINEREPLACE);
+	wall->setFrame(frame);
+
+	Camera *cam = Camera::create();
+	cam->setFrame(Frame::create());
+	cam->setNearPlane(1.0f);
+	cam->setFarPlane(1000.0f);
+	Frame::syncDirty();
+
+	OcclusionBuffer *ob = OcclusionBuffer::create(256, 128);
+	ob->begin(cam);
+	ob->addOccluder(wall);
+	ob->end();
+	check(ob->stats.numTriangles == 2, "occlusion: wall rasterized");
+	check(!testBox(ob, 0.0f, 0.0f, 20.0f, 1.0f), "occlusion: box behind the wall is hidden");
+	check(!testBox(ob, 0.0f, 0.0f, 500.0f, 50.0f), "occlusion: far box behind the wall is hidden");
+	check(testBox(ob, 0.0f, 0.0f, 5.0f, 1.0f), "occlusion: box in front of the wall is visible");
+	check(testBox(ob, 12.0f, 0.0f, 20.0f, 1.0f), "occlusion: box beside the wall is visible");
+	check(testBox(ob, 0.0f, 0.0f, 500.0f, 300.0f), "occlusion: box larger than the wall is visible");
+	check(testBox(ob, 0.0f, 0.0f, 0.5f, 1.0f), "occlusion: box crossing the near plane is visible");
+	ob->destroy();
+
+	frame = wall->getFrame();
+	wall->destroy();
+	frame->destroy();
+	frame = cam->getFrame();
+	cam->destroy();
+	frame->destroy();
+}
+
+static int32 callbackSum;
+
+static void
+addToSum(void *data)
+{
+	callbackSum += *(int32*)data;
+}
+
+static void
+recordFrame(CommandBuffer *cb, Camera *cam, bool withCall)
+{
+	null::Im2DVertex v2[4];
+	null::Im3DVertex v3[4];
+	uint16 indices[6] = { 0, 1, 2, 0, 2, 3 };
+	RGBA col = makeRGBA(64, 128, 255, 255);
+	Matrix world;
+	int32 n = 42;
+
+	memset(v2, 0, sizeof(v2));
+	memset(v3, 0, sizeof(v3));
+	for(int32 i = 0; i < 4; i++){
+		v2[i].x = (float32)(i&1);
+		v2[i].y = (float32)(i>>1);
+		v2[i].r = 255;
+		v3[i].position.set((float32)(i&1), (float32)(i>>1), 1.0f);
+	}
+	world.setIdentity();
+	world.pos.set(1.0f, 2.0f, 3.0f);
+
+	cb->beginUpdate(cam);
+	cb->clearCamera(cam, &col, Camera::CLEARIMAGE|Camera::CLEARZ);
+	cb->setRenderState(ZTESTENABLE, 0);
+	cb->im2DRenderPrimitive(PRIMTYPETRISTRIP, v2, 4);
+	cb->im2DRenderIndexedPrimitive(PRIMTYPETRILIST, v2, 4, indices, 6);
+	cb->im2DRenderTriangle(v2, 4, 0, 1, 2);
+	if(withCall)
+		cb->call(addToSum, &n, sizeof(n));
+	cb->setRenderState(ZTESTENABLE, 1);
+	cb->im3DTransform(v3, 4, &world, im3d::ALLOPAQUE);
+	cb->im3DRenderIndexedPrimitive(PRIMTYPETRILIST, indices, 6);
+	cb->im3DRenderPrimitive(PRIMTYPELINELIST);
+	cb->im3DEnd();
+	cb->endUpdate(cam);
+}
+
+// Replaying a command buffer against the null device gives
+// the same commands back, callbacks run instead.
+static void
+checkCommandBuffer(void)
+{
+	Camera *cam = Camera::create();
+	cam->setFrame(Frame::create());
+
+	CommandBuffer *cb = CommandBuffer::create(64);
+	CommandBuffer *expected = CommandBuffer::create();
+	CommandBuffer *replayed = CommandBuffer::create();
+	recordFrame(cb, cam, true);
+	recordFrame(expected, cam, false);
+	check(cb->numCommands == expected->numCommands+1, "cmdbuf: commands recorded");
+
+	callbackSum = 0;
+	null::recordCommands(replayed);
+	cb->execute();
+	null::recordCommands(nil);
+	check(callbackSum == 42, "cmdbuf: callback ran with its data");
+	check(replayed->numCommands == expected->numCommands &&
+	      replayed->size == expected->size &&
+	      memcmp(replayed->data, expected->data, expected->size) == 0,
+	      "cmdbuf: replay reaches the device unchanged");
+
+	// a second replay doesn't change anything
+	replayed->reset();
+	null::recordCommands(replayed);
+	cb->execute();
+	null::recordCommands(nil);
+	check(callbackSum == 84 && replayed->size == expected->size,
+	      "cmdbuf: buffer can be replayed");
+
+	cb->destroy();
+	expected->destroy();
+	replayed->destroy();
+	Frame *frame = cam->getFrame();
+	cam->destroy();
+	frame->destroy();
+}
+
+int
+main(void)
+{
+	rw::Engine::init();
+	rw::Engine::open(nil);
+	rw::Engine::start();
+
+	checkOcclusion();
+	checkCommandBuffer();
+
+	rw::Engine::stop();
+	rw::Engine::close();
+	rw::Engine::term();
+
+	if(numFailed)
+		printf("%d checks failed\n", numFailed);
+	return numFailed != 0;
+}
@@ -13,14 +13,16 @@ char *argv0;
 void
 usage(void)
 {
-	fprintf(stderr, "usage: %s in.ska [out.anm]\n", argv0);
+	fprintf(stderr, "usage: %s [-c] in.ska [out.anm]\n", argv0);
 	fprintf(stderr, "   or: %s in.anm [out.ska]\n", argv0);
+	fprintf(stderr, "\t-c compress key frames\n");
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
+	bool compress = false;
 	rw::Engine::init();
 	rw::registerHAnimPlugin();
 	rw::Engine::open(nil);
@@ -30,6 +32,9 @@ main(int argc, char *argv[])
 	case 'v':
 		sscanf(EARGF(usage()), "%x", &rw::version);
 		break;
+	case 'c':
+		compress = true;
+		break;
 	default:
 		usage();
 	}ARGEND;
@@ -72,10 +77,20 @@ main(int argc, char *argv[])
 		fprintf(stderr, "Error: couldn't open %s\n", file);
 		return 1;
 	}
-	if(firstword == ID_ANIMANIMATION)
-		anim->streamWriteLegacy(&stream);
-	else
-		anim->streamWrite(&stream);
+	Animation *out = anim;
+	if(firstword == ID_ANIMANIMATION){
+		// ska only knows uncompressed frames
+		if(anim->interpInfo->id == HAnimCompressedKeyFrame::INTERPID)
+			out = decompressHAnimAnimation(anim);
+		out->streamWriteLegacy(&stream);
+	}else{
+		if(compress)
+			out = compressHAnimAnimation(anim);
+		out->streamWrite(&stream);
+	}
+	stream.close();
+	if(out != anim)
+		out->destroy();
 
 	anim->destroy();
 